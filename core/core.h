@@ -19,6 +19,7 @@
 #include "page_allocator.h"
 #include "log.h"
 #include "thread.h"
+#include "trace.h"
 #include "thread_queue.h"
 #include "hash.h"
 #include "small_block_allocator.h"
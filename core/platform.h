@@ -27,6 +27,10 @@ static const char *operating_system_string = "Mac OSX";
 #error "Unsupported operating system."
 #endif
 
+#if defined(TORQUE_SOCKETS_ENABLE_TRACE) && defined(__cplusplus)
+#include <atomic> // for core/trace.h
+#endif
+
 #if defined(_MSC_VER)
 #define COMPILER_VISUALC
 static const char *compiler_string = "VisualC++";
@@ -63,6 +67,16 @@ static const char *compiler_string = "GNU C Compiler";
 	#else
 		#define INLINE_ASM_STYLE_VC_X86
 	#endif
+
+	#if !defined(PLATFORM_NACL)
+		#define CPU_X86_INTRINSICS
+		#if defined(_MSC_VER)
+			#include <intrin.h>
+		#else
+			#include <cpuid.h>
+			#include <immintrin.h>
+		#endif
+	#endif
 #elif defined(__ppc__) || defined(__powerpc__) || defined(PPC)
 	static const char *cpu_string = "PowerPC";
 	#ifndef BIG_ENDIAN
@@ -0,0 +1 @@
+#include <linux/errqueue.h>
@@ -4,6 +4,9 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -16,6 +19,7 @@
 #include <semaphore.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <math.h>
 
 #include <CoreServices/CoreServices.h>
 
@@ -7,6 +7,7 @@
 #include <semaphore.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <math.h>
 #include <stdarg.h>
 
 #define XP_UNIX
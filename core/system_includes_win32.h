@@ -5,5 +5,6 @@
 #include <windows.h>
 
 #include <new>
+#include <math.h>
 
 typedef int socklen_t;
\ No newline at end of file
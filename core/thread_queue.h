@@ -5,17 +5,19 @@
 class thread_queue : public ref_object
 {
 public:
-	/// thread_queue constructor.  threadCount specifies the number of worker threads that will be created.
+	/// thread_queue constructor.  threadCount specifies the number of worker threads that will be created.  The threads are started when the first request is posted, so a queue that is never used costs no threads.
 	thread_queue(uint32 threadCount)
 	{
 		_current_index = 0;
+		_thread_count = threadCount;
+		_inline = false;
 		_storage.set((void *) 1);
-		for(uint32 i = 0; i < threadCount; i++)
-		{
-			thread *theThread = new thread_queue_thread(this);
-			_threads.push_back(theThread);
-			theThread->start();
-		}
+	}
+	
+	/// Sets whether requests are processed immediately on the posting thread rather than by the worker threads.  Inline processing makes the order of results deterministic, for simulation and tests.
+	void set_inline(bool is_inline)
+	{
+		_inline = is_inline;
 	}
 
 	~thread_queue()
@@ -65,6 +67,20 @@ public:
 		record->cancelled = false;
 		record->progress = 0;
 		_process_list.push_back(record);
+		if(_inline)
+		{
+			record->state = process_record::in_process;
+			unlock();
+			process_request(record->request_buffer, record->response_buffer, &(record->cancelled), &(record->progress));
+			record->state = process_record::process_complete;
+			return index;
+		}
+		while(_threads.size() < _thread_count)
+		{
+			thread *theThread = new thread_queue_thread(this);
+			_threads.push_back(theThread);
+			theThread->start();
+		}
 		_semaphore.increment();
 		unlock();
 		return index;
@@ -134,6 +150,8 @@ protected:
 	};
 	
 	uint32 _current_index;
+	uint32 _thread_count; ///< Number of worker threads to start with the first request.
+	bool _inline; ///< True if requests are processed by post_request itself.
 	friend class thread_queue_thread;
 	/// list of worker threads on this thread_queue
 	array<thread *> _threads;
@@ -0,0 +1,238 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+// Scoped tracing spans for finding where time goes inside a tick, exported in the Chrome trace event JSON format (chrome://tracing, ui.perfetto.dev).
+//
+// Spans are only compiled in when TORQUE_SOCKETS_ENABLE_TRACE is defined, and even then record nothing until trace_set_enabled(true) is called, so a traced build can ship and be switched on in production.  Each span stores a static name and two cycle counter timestamps into a fixed-size buffer owned by the recording thread; no locks are taken on the recording path.
+
+#if defined(TORQUE_SOCKETS_ENABLE_TRACE)
+#define _TorqueTraceConcat(a, b) a##b
+#define _TorqueTraceSpanName(line) _TorqueTraceConcat(_trace_span_, line)
+#define TorqueTraceSpan(span_name) trace_span _TorqueTraceSpanName(__LINE__)(span_name)
+
+/// Reads the cpu cycle counter, or if there isn't one a microsecond clock.
+inline uint64 trace_read_timestamp()
+{
+#if defined(INLINE_ASM_STYLE_GCC_X86)
+	uint32 low, high;
+	asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+	return (uint64(high) << 32) | low;
+#elif defined(PLATFORM_WIN32)
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+#else
+	timeval t;
+	gettimeofday(&t, NULL);
+	return uint64(t.tv_sec) * 1000000 + t.tv_usec;
+#endif
+}
+
+/// Returns a microsecond wall clock, used to calibrate trace_read_timestamp.
+inline uint64 trace_read_microseconds()
+{
+#if defined(PLATFORM_WIN32)
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return ((uint64(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / 10;
+#else
+	timeval t;
+	gettimeofday(&t, NULL);
+	return uint64(t.tv_sec) * 1000000 + t.tv_usec;
+#endif
+}
+
+/// Span storage for a single thread.  Buffers are registered with the global trace state on first use and freed when their thread exits, taking the thread's spans with them.
+struct trace_thread_buffer
+{
+	enum {
+		max_span_count = 65536, ///< Spans past this count are dropped (and counted) until the trace is reset.
+	};
+	struct span_record
+	{
+		static_string name;
+		uint64 start;
+		uint64 end;
+	};
+	trace_thread_buffer *next;
+	uint32 thread_index; ///< Small sequential id for this thread, used as the tid in the exported trace.
+	uint32 generation; ///< The trace the spans were recorded in.  The owning thread empties the buffer when it finds a newer trace has started.
+	uint32 span_count;
+	uint32 dropped_count;
+	span_record spans[max_span_count];
+};
+
+struct trace_state
+{
+	std::atomic<bool> enabled; ///< Read on every span without the lock.  Stored with release after generation, so a thread that sees a trace enabled also sees its generation.
+	std::atomic<uint32> generation; ///< Counts the traces started.
+	uint64 start_timestamp;
+	uint64 start_microseconds;
+	uint32 thread_count;
+	trace_thread_buffer *buffers;
+	mutex lock;
+
+	trace_state()
+	{
+		enabled = false;
+		generation = 0;
+		start_timestamp = 0;
+		start_microseconds = 0;
+		thread_count = 0;
+		buffers = 0;
+	}
+};
+
+inline trace_state &_trace_state()
+{
+	static trace_state state;
+	return state;
+}
+
+/// Owns the span buffer of the thread it belongs to, and unregisters and frees it when the thread exits.
+struct trace_thread_owner
+{
+	trace_thread_buffer *buffer;
+
+	trace_thread_owner()
+	{
+		buffer = 0;
+	}
+
+	~trace_thread_owner()
+	{
+		if(!buffer)
+			return;
+		trace_state &state = _trace_state();
+		state.lock.lock();
+		for(trace_thread_buffer **walk = &state.buffers; *walk; walk = &(*walk)->next)
+		{
+			if(*walk == buffer)
+			{
+				*walk = buffer->next;
+				break;
+			}
+		}
+		state.lock.unlock();
+		memory_deallocate(buffer);
+	}
+};
+
+inline trace_thread_buffer *_trace_get_thread_buffer()
+{
+	// the trace state is constructed first, so it outlives every thread's owner.
+	trace_state &state = _trace_state();
+	static thread_local trace_thread_owner owner;
+	trace_thread_buffer *buffer = owner.buffer;
+	if(!buffer)
+	{
+		buffer = (trace_thread_buffer *) memory_allocate(sizeof(trace_thread_buffer));
+		buffer->generation = 0;
+		buffer->span_count = 0;
+		buffer->dropped_count = 0;
+		state.lock.lock();
+		buffer->thread_index = ++state.thread_count;
+		buffer->next = state.buffers;
+		state.buffers = buffer;
+		state.lock.unlock();
+		owner.buffer = buffer;
+	}
+	return buffer;
+}
+
+/// Returns true if spans are currently being recorded.
+inline bool trace_is_enabled()
+{
+	return _trace_state().enabled.load(std::memory_order_acquire);
+}
+
+/// Starts or stops recording spans.  Starting a trace discards any spans recorded by a previous one; each thread empties its own buffer the next time it records a span.
+inline void trace_set_enabled(bool enabled)
+{
+	trace_state &state = _trace_state();
+	if(enabled && !state.enabled.load(std::memory_order_acquire))
+	{
+		state.lock.lock();
+		state.generation.fetch_add(1, std::memory_order_relaxed);
+		state.start_microseconds = trace_read_microseconds();
+		state.start_timestamp = trace_read_timestamp();
+		state.lock.unlock();
+	}
+	state.enabled.store(enabled, std::memory_order_release);
+}
+
+/// A span of time covering the lifetime of the trace_span instance.  Normally declared with the TorqueTraceSpan macro.
+class trace_span
+{
+	static_string _name;
+	uint64 _start;
+public:
+	trace_span(static_string name)
+	{
+		_name = name;
+		_start = trace_is_enabled() ? trace_read_timestamp() : 0;
+	}
+	~trace_span()
+	{
+		if(!_start || !trace_is_enabled())
+			return;
+		trace_thread_buffer *buffer = _trace_get_thread_buffer();
+		uint32 generation = _trace_state().generation.load(std::memory_order_relaxed);
+		if(buffer->generation != generation)
+		{
+			buffer->generation = generation;
+			buffer->span_count = 0;
+			buffer->dropped_count = 0;
+		}
+		if(buffer->span_count == trace_thread_buffer::max_span_count)
+		{
+			buffer->dropped_count++;
+			return;
+		}
+		trace_thread_buffer::span_record &record = buffer->spans[buffer->span_count];
+		record.name = _name;
+		record.start = _start;
+		record.end = trace_read_timestamp();
+		buffer->span_count++;
+	}
+};
+
+/// Writes all spans recorded since the trace was enabled to file_name as Chrome trace event JSON.  Returns false if the file could not be written.  Spans from threads that are still recording may be missed, so stop the trace first for a complete export; spans from threads that have exited are gone.
+inline bool trace_write_chrome_json(const char *file_name)
+{
+	trace_state &state = _trace_state();
+	FILE *f = fopen(file_name, "w");
+	if(!f)
+		return false;
+
+	// calibrate the timestamp counter against the microsecond clock over the span of the trace.
+	uint64 elapsed_timestamp = trace_read_timestamp() - state.start_timestamp;
+	uint64 elapsed_microseconds = trace_read_microseconds() - state.start_microseconds;
+	float64 microseconds_per_tick = elapsed_timestamp ? float64(elapsed_microseconds) / float64(elapsed_timestamp) : 1;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool first = true;
+	state.lock.lock();
+	uint32 generation = state.generation.load(std::memory_order_relaxed);
+	for(trace_thread_buffer *walk = state.buffers; walk; walk = walk->next)
+	{
+		// threads that haven't recorded since the trace started still hold spans from an earlier one.
+		if(walk->generation != generation)
+			continue;
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u (%u spans dropped)\"}}", first ? "" : ",\n", walk->thread_index, walk->thread_index, walk->dropped_count);
+		first = false;
+		for(uint32 i = 0; i < walk->span_count; i++)
+		{
+			trace_thread_buffer::span_record &record = walk->spans[i];
+			float64 start = float64(int64(record.start - state.start_timestamp)) * microseconds_per_tick;
+			float64 duration = float64(record.end - record.start) * microseconds_per_tick;
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", record.name, walk->thread_index, start, duration);
+		}
+	}
+	state.lock.unlock();
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return true;
+}
+#else
+#define TorqueTraceSpan(span_name)
+#endif
@@ -47,10 +47,15 @@ class torque_socket_instance : public scriptable_object
 	NPObjectRef on_socket_packet;
 	NPObjectRef on_packet_delivery_notify;
 	NPObjectRef on_pong;
+	NPObjectRef on_events; ///< If set, receives all the events of a wakeup in one call, as an array of records, in place of the per-event callbacks above.
+	mutex _notify_lock;
+	bool _notify_pending; ///< True while a main thread wakeup is posted and hasn't started pumping yet.
+	array<char> _batch_script; ///< Script text of the records being delivered to on_events, kept between pumps to reuse its storage.
 public:
 	torque_socket_instance()
 	{
 		logprintf("torque_socket_instance constructor");
+		_notify_pending = false;
 		_socket = torque_socket_create(true, background_socket_notify, this);
 	}
 	
@@ -63,18 +68,33 @@ public:
 	{
 		logprintf("back-call %d", net::time::get_current().get_milliseconds() % 1000);
 		torque_socket_instance *inst = (torque_socket_instance *) the_socket_instance;
-		browser->pluginthreadasynccall(inst->get_plugin_instance(), main_thread_socket_notify, the_socket_instance);
+		// the socket notifies for every packet it queues; one pending wakeup is enough, since pump drains the whole queue.
+		inst->_notify_lock.lock();
+		bool post = !inst->_notify_pending;
+		inst->_notify_pending = true;
+		inst->_notify_lock.unlock();
+		if(post)
+			browser->pluginthreadasynccall(inst->get_plugin_instance(), main_thread_socket_notify, the_socket_instance);
 	}
 									
 	static void main_thread_socket_notify(void *the_socket_instance)
 	{
 		torque_socket_instance *inst = (torque_socket_instance *) the_socket_instance;		
+		// clear the flag before pumping, so events queued while script runs post a new wakeup.
+		inst->_notify_lock.lock();
+		inst->_notify_pending = false;
+		inst->_notify_lock.unlock();
 		inst->pump();
 	}
 	
 	void pump()
 	{
 		logprintf("pump %d", net::time::get_current().get_milliseconds() % 1000);
+		if(on_events)
+		{
+			pump_batch();
+			return;
+		}
 
 		// pump the socket's event queue and generate events to post back from the plugin.
 		torque_socket_event *event;
@@ -126,6 +146,136 @@ public:
 		}
 	}
 	
+	/// Delivers every pending event in a single on_events call.  Each record is an object with a type named after the per-event callback it replaces (challenge_response, connect_request, established, close, packet, packet_delivery_notify or socket_packet) and that callback's arguments: connection, sequence, delivered, key, data and address.  Payloads are binary strings, one character per byte, so script reads them with charCodeAt.  The records are built by evaluating one array literal, so a wakeup costs two calls into the browser however many events it delivers.
+	void pump_batch()
+	{
+		torque_socket_event *event;
+		char number[32];
+		uint32 record_count = 0;
+		_batch_script.clear();
+		append_script("[");
+		while((event = torque_socket_get_next_event(_socket)) != NULL)
+		{
+			const char *type;
+			switch(event->event_type)
+			{
+				case torque_connection_challenge_response_event_type:
+					type = "challenge_response";
+					break;
+				case torque_connection_requested_event_type:
+					type = "connect_request";
+					break;
+				case torque_connection_timed_out_event_type:
+				case torque_connection_disconnected_event_type:
+					type = "close";
+					break;
+				case torque_connection_established_event_type:
+					type = "established";
+					break;
+				case torque_connection_packet_event_type:
+					type = "packet";
+					break;
+				case torque_connection_packet_notify_event_type:
+					type = "packet_delivery_notify";
+					break;
+				case torque_socket_packet_event_type:
+					type = "socket_packet";
+					break;
+				default:
+					continue;
+			}
+			append_script(record_count++ ? ",{type:\"" : "{type:\"");
+			append_script(type);
+			formatted_string_buffer::format_buffer(number, sizeof(number), "\",connection:%d", int(event->connection));
+			append_script(number);
+			switch(event->event_type)
+			{
+				case torque_connection_challenge_response_event_type:
+				case torque_connection_requested_event_type:
+					append_script(",key:");
+					append_script_string(event->key, event->key_size);
+					append_script(",data:");
+					append_script_string(event->data, event->data_size);
+					break;
+				case torque_connection_timed_out_event_type:
+					append_script(",data:\"timeout\"");
+					break;
+				case torque_connection_disconnected_event_type:
+					append_script(",data:");
+					append_script_string(event->data, event->data_size);
+					break;
+				case torque_connection_packet_event_type:
+					formatted_string_buffer::format_buffer(number, sizeof(number), ",sequence:%d,data:", int(event->packet_sequence));
+					append_script(number);
+					append_script_string(event->data, event->data_size);
+					break;
+				case torque_connection_packet_notify_event_type:
+					formatted_string_buffer::format_buffer(number, sizeof(number), ",sequence:%d", int(event->packet_sequence));
+					append_script(number);
+					append_script(event->delivered ? ",delivered:true" : ",delivered:false");
+					break;
+				case torque_socket_packet_event_type:
+				{
+					string source_address = net::address(event->source_address).to_string();
+					append_script(",address:");
+					append_script_string((const uint8 *) source_address.c_str(), source_address.len());
+					append_script(",data:");
+					append_script_string(event->data, event->data_size);
+					break;
+				}
+			}
+			append_script("}");
+		}
+		if(!record_count)
+			return;
+		append_script("]");
+
+		NPObject *window;
+		if(browser->getvalue(get_plugin_instance(), NPNVWindowNPObject, &window) != NPERR_NO_ERROR)
+			return;
+		NPString script = { _batch_script.begin(), _batch_script.size() };
+		NPVariant records;
+		if(browser->evaluate(get_plugin_instance(), window, &script, &records))
+		{
+			if(NPVARIANT_IS_OBJECT(records))
+			{
+				empty_type void_return_value;
+				NPObjectRef batch;
+				batch = NPVARIANT_TO_OBJECT(records);
+				call_function(on_events, &void_return_value, batch);
+			}
+			browser->releasevariantvalue(&records);
+		}
+		browser->releaseobject(window);
+	}
+
+	void append_script(const char *text)
+	{
+		while(*text)
+			_batch_script.push_back(*text++);
+	}
+
+	/// Appends data as a script string literal, escaping everything but printable ASCII so the literal is plain ASCII whatever the bytes are.
+	void append_script_string(const uint8 *data, uint32 data_size)
+	{
+		static const char hex_digits[] = "0123456789abcdef";
+		_batch_script.push_back('"');
+		for(uint32 i = 0; i < data_size; i++)
+		{
+			uint8 c = data[i];
+			if(c >= ' ' && c < 0x7f && c != '"' && c != '\\')
+				_batch_script.push_back(char(c));
+			else
+			{
+				_batch_script.push_back('\\');
+				_batch_script.push_back('x');
+				_batch_script.push_back(hex_digits[c >> 4]);
+				_batch_script.push_back(hex_digits[c & 0xF]);
+			}
+		}
+		_batch_script.push_back('"');
+	}
+
 	bool bind(core::string bind_address)
 	{
 		core::net::address the_addr(bind_address.c_str(), false, 0);
@@ -217,6 +367,7 @@ public:
 		tnl_slot(db, torque_socket_instance, on_packet, 0);
 		tnl_slot(db, torque_socket_instance, on_packet_delivery_notify, 0);
 		tnl_slot(db, torque_socket_instance, on_pong, 0);
+		tnl_slot(db, torque_socket_instance, on_events, 0);
 		tnl_method(db, torque_socket_instance, bind);
 		tnl_method(db, torque_socket_instance, set_key_pair);
 		tnl_method(db, torque_socket_instance, set_challenge_response);
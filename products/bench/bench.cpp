@@ -0,0 +1,653 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+// bench - microbenchmarks for the core and torque_sockets primitives, with machine-readable output and a regression check against a stored baseline.
+//
+// usage: bench [--format json|csv] [--filter <substring>] [--time <ms>] [--repeat <count>]
+//              [--baseline <file>] [--threshold <percent>] [--write-baseline <file>]
+//
+// Each benchmark is run in a doubling loop until a single run takes at least --time milliseconds, then that iteration count is repeated --repeat times and the fastest run is reported.  Baselines are CSV files of name,nanoseconds_per_op as written by --write-baseline.  With --baseline, any benchmark slower than its baseline by more than --threshold percent is reported and the exit code is 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tomcrypt.h"
+#include "core/platform.h"
+extern "C"
+{
+#include "torque_sockets/torque_sockets_c_api.h"
+};
+
+namespace core
+{
+	#include "core/core.h"
+	struct net {
+		#include "torque_sockets/torque_sockets.h"
+	};
+};
+
+using namespace core;
+
+static volatile uint32 bench_sink; ///< Results are folded in here so the optimizer can't discard the work.
+
+// bit_stream read/write at various widths
+
+enum {
+	bit_stream_buffer_size = 4096,
+};
+static byte bit_stream_buffer[bit_stream_buffer_size];
+
+static uint64 bench_bit_stream_write(uint32 iterations, uint32 bit_width)
+{
+	bit_stream s(bit_stream_buffer, bit_stream_buffer_size);
+	uint32 writes_per_pass = (bit_stream_buffer_size * 8) / bit_width;
+	uint32 mask = bit_width == 32 ? 0xFFFFFFFF : (1 << bit_width) - 1;
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		s.set_bit_position(0);
+		for(uint32 j = 0; j < writes_per_pass; j++)
+			s.write_integer(j & mask, bit_width);
+	}
+	bench_sink += bit_stream_buffer[17];
+	return uint64(iterations) * writes_per_pass;
+}
+
+static uint64 bench_bit_stream_read(uint32 iterations, uint32 bit_width)
+{
+	bit_stream s(bit_stream_buffer, bit_stream_buffer_size);
+	uint32 reads_per_pass = (bit_stream_buffer_size * 8) / bit_width;
+	uint32 sum = 0;
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		s.set_bit_position(0);
+		for(uint32 j = 0; j < reads_per_pass; j++)
+			sum += s.read_integer(bit_width);
+	}
+	bench_sink += sum;
+	return uint64(iterations) * reads_per_pass;
+}
+
+static uint64 bench_bit_stream_write_1(uint32 iterations) { return bench_bit_stream_write(iterations, 1); }
+static uint64 bench_bit_stream_write_7(uint32 iterations) { return bench_bit_stream_write(iterations, 7); }
+static uint64 bench_bit_stream_write_16(uint32 iterations) { return bench_bit_stream_write(iterations, 16); }
+static uint64 bench_bit_stream_write_32(uint32 iterations) { return bench_bit_stream_write(iterations, 32); }
+static uint64 bench_bit_stream_read_1(uint32 iterations) { return bench_bit_stream_read(iterations, 1); }
+static uint64 bench_bit_stream_read_7(uint32 iterations) { return bench_bit_stream_read(iterations, 7); }
+static uint64 bench_bit_stream_read_16(uint32 iterations) { return bench_bit_stream_read(iterations, 16); }
+static uint64 bench_bit_stream_read_32(uint32 iterations) { return bench_bit_stream_read(iterations, 32); }
+
+// bit_stream::copy_bits of a 64 byte block
+
+static uint64 bench_copy_bits(uint32 iterations, uint32 dest_bit, uint32 source_bit)
+{
+	static byte source[80], dest[80];
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		source[0] = uint8(i);
+		bit_stream::copy_bits(dest, dest_bit, source, source_bit, 64 * 8 - max(dest_bit, source_bit));
+	}
+	bench_sink += dest[3];
+	return iterations;
+}
+
+static uint64 bench_copy_bits_aligned(uint32 iterations) { return bench_copy_bits(iterations, 0, 0); }
+static uint64 bench_copy_bits_unaligned(uint32 iterations) { return bench_copy_bits(iterations, 3, 5); }
+
+// hash_table_flat at scale
+
+enum {
+	hash_table_key_count = 100000,
+};
+
+static uint32 hash_table_key(uint32 index)
+{
+	return index * 2654435761u;
+}
+
+static uint64 bench_hash_table_flat_insert(uint32 iterations)
+{
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		hash_table_flat<uint32, uint32> table;
+		for(uint32 j = 0; j < hash_table_key_count; j++)
+			table.insert(hash_table_key(j), j);
+		bench_sink += table.size();
+	}
+	return uint64(iterations) * hash_table_key_count;
+}
+
+static uint64 bench_hash_table_flat_find(uint32 iterations)
+{
+	static hash_table_flat<uint32, uint32> *table = 0;
+	if(!table)
+	{
+		table = new hash_table_flat<uint32, uint32>;
+		for(uint32 j = 0; j < hash_table_key_count; j++)
+			table->insert(hash_table_key(j), j);
+	}
+	uint32 found = 0;
+	for(uint32 i = 0; i < iterations; i++)
+		for(uint32 j = 0; j < hash_table_key_count; j++)
+			found += bool(table->find(hash_table_key(j)));
+	bench_sink += found;
+	return uint64(iterations) * hash_table_key_count;
+}
+
+static uint64 bench_hash_table_flat_insert_remove(uint32 iterations)
+{
+	hash_table_flat<uint32, uint32> table;
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		for(uint32 j = 0; j < hash_table_key_count; j++)
+			table.insert(hash_table_key(j), j);
+		for(uint32 j = 0; j < hash_table_key_count; j++)
+			table.remove(hash_table_key(j));
+	}
+	bench_sink += table.size();
+	return uint64(iterations) * hash_table_key_count;
+}
+
+// allocators, 1000 32 byte blocks at a time
+
+enum {
+	allocation_count = 1000,
+	allocation_size = 32,
+};
+static void *allocations[allocation_count];
+
+static uint64 bench_page_allocator(uint32 iterations)
+{
+	zone_allocator zone;
+	page_allocator<> allocator(&zone);
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		for(uint32 j = 0; j < allocation_count; j++)
+			allocations[j] = allocator.allocate(allocation_size);
+		allocator.clear();
+	}
+	bench_sink += uint32(size_t(allocations[7]));
+	return uint64(iterations) * allocation_count;
+}
+
+// small_block_allocator finds its page header by masking block addresses, so it needs the page aligned memory zone_allocator only hands out on OS X.
+#if defined(PLATFORM_MAC_OSX)
+static uint64 bench_small_block_allocator(uint32 iterations)
+{
+	zone_allocator zone;
+	small_block_allocator<> allocator(&zone);
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		for(uint32 j = 0; j < allocation_count; j++)
+			allocations[j] = allocator.allocate(allocation_size);
+		for(uint32 j = 0; j < allocation_count; j++)
+			allocator.deallocate(allocations[j]);
+	}
+	bench_sink += uint32(size_t(allocations[7]));
+	return uint64(iterations) * allocation_count;
+}
+#endif
+
+static uint64 bench_malloc(uint32 iterations)
+{
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		for(uint32 j = 0; j < allocation_count; j++)
+			allocations[j] = malloc(allocation_size);
+		for(uint32 j = 0; j < allocation_count; j++)
+			free(allocations[j]);
+	}
+	bench_sink += uint32(size_t(allocations[7]));
+	return uint64(iterations) * allocation_count;
+}
+
+// crypto
+
+enum {
+	crypto_buffer_size = 1024,
+};
+static byte crypto_buffer[crypto_buffer_size + 64];
+
+static uint64 bench_symmetric_cipher_encrypt(uint32 iterations)
+{
+	uint8 key[net::symmetric_cipher::key_size] = { 1, 2, 3, 4 };
+	uint8 init_vector[net::symmetric_cipher::block_size] = { 5, 6, 7, 8 };
+	net::symmetric_cipher cipher(key, init_vector);
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		cipher.setup_counter(i, 0, 0, 0);
+		cipher.encrypt(crypto_buffer, crypto_buffer, crypto_buffer_size);
+	}
+	bench_sink += crypto_buffer[5];
+	return iterations;
+}
+
+static uint64 bench_sha256(uint32 iterations)
+{
+	uint8 hash[32];
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		hash_state state;
+		net::sha256_init(&state);
+		net::sha256_process(&state, crypto_buffer, crypto_buffer_size);
+		net::sha256_done(&state, hash);
+		crypto_buffer[0] = hash[0];
+	}
+	bench_sink += hash[1];
+	return iterations;
+}
+
+static uint64 bench_siphash(uint32 iterations)
+{
+	uint8 key[net::siphash_key_size] = { 1, 2, 3, 4 };
+	uint8 message[14] = { 5, 6, 7, 8 };
+	uint64 hash = 0;
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		message[0] = uint8(i);
+		hash += net::buffer_siphash(key, message, sizeof(message));
+	}
+	bench_sink += uint32(hash);
+	return iterations;
+}
+
+static uint64 bench_sha256_portable(uint32 iterations)
+{
+	bool use_hardware = net::sha256_use_hardware();
+	net::sha256_use_hardware() = false;
+	bench_sha256(iterations);
+	net::sha256_use_hardware() = use_hardware;
+	return iterations;
+}
+
+static uint64 bench_hash_and_encrypt(uint32 iterations)
+{
+	uint8 key[net::symmetric_cipher::key_size] = { 1, 2, 3, 4 };
+	uint8 init_vector[net::symmetric_cipher::block_size] = { 5, 6, 7, 8 };
+	net::symmetric_cipher cipher(key, init_vector);
+	bit_stream s(crypto_buffer, sizeof(crypto_buffer));
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		s.set_byte_position(crypto_buffer_size);
+		cipher.setup_counter(i, 0, 0, 0);
+		net::bit_stream_hash_and_encrypt(s, net::torque_connection::message_signature_bytes, 0, &cipher);
+	}
+	bench_sink += crypto_buffer[9];
+	return iterations;
+}
+
+static net::random_generator &bench_random()
+{
+	static net::random_generator generator;
+	return generator;
+}
+
+static uint64 bench_random_integer(uint32 iterations)
+{
+	for(uint32 i = 0; i < iterations; i++)
+		bench_sink += bench_random().random_integer();
+	return iterations;
+}
+
+static uint64 bench_random_integer_unpooled(uint32 iterations)
+{
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		uint8 buffer[4];
+		yarrow_read(buffer, sizeof(buffer), bench_random().get_state());
+		bench_sink += buffer[0];
+	}
+	return iterations;
+}
+
+static uint64 bench_fast_random_integer(uint32 iterations)
+{
+	static net::fast_random_generator generator(1);
+	for(uint32 i = 0; i < iterations; i++)
+		bench_sink += generator.random_integer();
+	return iterations;
+}
+
+static uint64 bench_key_generate(uint32 iterations, uint32 key_size)
+{
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		ref_ptr<net::asymmetric_key> key = new net::asymmetric_key(key_size, bench_random());
+		bench_sink += key->is_valid();
+	}
+	return iterations;
+}
+
+static uint64 bench_shared_secret(uint32 iterations, uint32 key_size)
+{
+	ref_ptr<net::asymmetric_key> private_key = new net::asymmetric_key(key_size, bench_random());
+	ref_ptr<net::asymmetric_key> remote_key = new net::asymmetric_key(key_size, bench_random());
+	ref_ptr<net::asymmetric_key> public_key = new net::asymmetric_key(*remote_key->get_public_key());
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		byte_buffer_ptr secret = private_key->compute_shared_secret_key(public_key);
+		bench_sink += secret->get_buffer()[0];
+	}
+	return iterations;
+}
+
+static uint64 bench_key_generate_16(uint32 iterations) { return bench_key_generate(iterations, 16); }
+static uint64 bench_key_generate_20(uint32 iterations) { return bench_key_generate(iterations, 20); }
+static uint64 bench_key_generate_32(uint32 iterations) { return bench_key_generate(iterations, 32); }
+static uint64 bench_shared_secret_16(uint32 iterations) { return bench_shared_secret(iterations, 16); }
+static uint64 bench_shared_secret_20(uint32 iterations) { return bench_shared_secret(iterations, 20); }
+static uint64 bench_shared_secret_32(uint32 iterations) { return bench_shared_secret(iterations, 32); }
+
+// socket internals
+
+enum {
+	event_batch_size = 64,
+};
+
+static uint64 bench_socket_event_queue(uint32 iterations)
+{
+	zone_allocator zone;
+	net::socket_event_queue queue(&zone);
+	uint8 data[100] = { 1 };
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		for(uint32 j = 0; j < event_batch_size; j++)
+		{
+			torque_socket_event *event = queue.post_event(torque_connection_packet_event_type, j);
+			queue.set_event_data(event, data, sizeof(data));
+		}
+		while(queue.has_event())
+			bench_sink += queue.dequeue()->connection;
+		queue.clear();
+	}
+	return uint64(iterations) * event_batch_size;
+}
+
+static uint64 bench_flight_recorder(uint32 iterations)
+{
+	static net::packet_flight_recorder recorder;
+	net::time now = net::time::get_current();
+	recorder.start(now);
+	for(uint32 i = 0; i < iterations; i++)
+		recorder.record_event(now, net::packet_flight_recorder::packet_sent, i, i, 0, 100);
+	bench_sink += recorder.get_record_count();
+	return iterations;
+}
+
+static uint64 bench_latency_histogram(uint32 iterations)
+{
+	static net::latency_histogram histogram;
+	for(uint32 i = 0; i < iterations; i++)
+		histogram.record(i & 0xFFFF);
+	bench_sink += histogram.get_count();
+	return iterations;
+}
+
+// udp sends over loopback, copied by the kernel or zero-copy from the socket's pooled buffers.  Nothing reads the receiving socket, so once its buffer fills the kernel drops the datagrams, which completes zero-copy sends as quickly as it can.
+
+enum {
+	udp_send_batch_size = 16,
+};
+
+static uint64 bench_udp_send(uint32 iterations, uint32 size, bool zerocopy)
+{
+	static net::udp_socket receiver, copy_sender, zerocopy_sender;
+	static byte payload[net::udp_socket::max_datagram_size];
+	if(!receiver.is_bound())
+	{
+		receiver.bind(net::address(net::address::localhost, 0));
+		copy_sender.bind(net::address(net::address::localhost, 0));
+		zerocopy_sender.bind(net::address(net::address::localhost, 0));
+		zerocopy_sender.set_zerocopy_threshold(1);
+	}
+	net::udp_socket &sender = zerocopy ? zerocopy_sender : copy_sender;
+	net::udp_socket::outgoing_datagram datagrams[udp_send_batch_size];
+	for(uint32 i = 0; i < udp_send_batch_size; i++)
+	{
+		datagrams[i].destination = receiver.get_bound_address();
+		datagrams[i].header = 0;
+		datagrams[i].header_size = 0;
+		datagrams[i].data = payload;
+		datagrams[i].data_size = size;
+	}
+	for(uint32 i = 0; i < iterations; i++)
+	{
+		if(zerocopy)
+		{
+			for(uint32 j = 0; j < udp_send_batch_size; j++)
+			{
+				byte *buffer;
+				while(!(buffer = sender.get_send_buffer()))
+					sender.process_send_completions();
+				datagrams[j].data = buffer;
+			}
+		}
+		bench_sink += sender.send_to_batch(datagrams, udp_send_batch_size);
+	}
+	return uint64(iterations) * udp_send_batch_size;
+}
+
+static uint64 bench_udp_send_copy_128(uint32 iterations) { return bench_udp_send(iterations, 128, false); }
+static uint64 bench_udp_send_copy_512(uint32 iterations) { return bench_udp_send(iterations, 512, false); }
+static uint64 bench_udp_send_copy_1472(uint32 iterations) { return bench_udp_send(iterations, 1472, false); }
+static uint64 bench_udp_send_zerocopy_128(uint32 iterations) { return bench_udp_send(iterations, 128, true); }
+static uint64 bench_udp_send_zerocopy_512(uint32 iterations) { return bench_udp_send(iterations, 512, true); }
+static uint64 bench_udp_send_zerocopy_1472(uint32 iterations) { return bench_udp_send(iterations, 1472, true); }
+
+struct benchmark
+{
+	const char *name;
+	uint64 (*function)(uint32 iterations); ///< Runs the benchmark the given number of times, returning the number of operations performed.
+	uint32 bytes_per_op; ///< Bytes processed per operation, for throughput reporting, or 0.
+};
+
+static benchmark benchmarks[] = {
+	{ "bit_stream_write_1", bench_bit_stream_write_1, 0 },
+	{ "bit_stream_write_7", bench_bit_stream_write_7, 0 },
+	{ "bit_stream_write_16", bench_bit_stream_write_16, 0 },
+	{ "bit_stream_write_32", bench_bit_stream_write_32, 0 },
+	{ "bit_stream_read_1", bench_bit_stream_read_1, 0 },
+	{ "bit_stream_read_7", bench_bit_stream_read_7, 0 },
+	{ "bit_stream_read_16", bench_bit_stream_read_16, 0 },
+	{ "bit_stream_read_32", bench_bit_stream_read_32, 0 },
+	{ "copy_bits_aligned_64", bench_copy_bits_aligned, 64 },
+	{ "copy_bits_unaligned_64", bench_copy_bits_unaligned, 64 },
+	{ "hash_table_flat_insert_100k", bench_hash_table_flat_insert, 0 },
+	{ "hash_table_flat_find_100k", bench_hash_table_flat_find, 0 },
+	{ "hash_table_flat_insert_remove_100k", bench_hash_table_flat_insert_remove, 0 },
+	{ "page_allocator_32", bench_page_allocator, 0 },
+#if defined(PLATFORM_MAC_OSX)
+	{ "small_block_allocator_32", bench_small_block_allocator, 0 },
+#endif
+	{ "malloc_free_32", bench_malloc, 0 },
+	{ "symmetric_cipher_encrypt_1k", bench_symmetric_cipher_encrypt, crypto_buffer_size },
+	{ "sha256_1k", bench_sha256, crypto_buffer_size },
+	{ "sha256_portable_1k", bench_sha256_portable, crypto_buffer_size },
+	{ "siphash_14", bench_siphash, 14 },
+	{ "hash_and_encrypt_1k", bench_hash_and_encrypt, crypto_buffer_size },
+	{ "random_integer", bench_random_integer, 0 },
+	{ "random_integer_unpooled", bench_random_integer_unpooled, 0 },
+	{ "fast_random_integer", bench_fast_random_integer, 0 },
+	{ "asymmetric_key_generate_16", bench_key_generate_16, 0 },
+	{ "asymmetric_key_generate_20", bench_key_generate_20, 0 },
+	{ "asymmetric_key_generate_32", bench_key_generate_32, 0 },
+	{ "shared_secret_16", bench_shared_secret_16, 0 },
+	{ "shared_secret_20", bench_shared_secret_20, 0 },
+	{ "shared_secret_32", bench_shared_secret_32, 0 },
+	{ "socket_event_queue_post_dequeue", bench_socket_event_queue, 0 },
+	{ "flight_recorder_record_event", bench_flight_recorder, 0 },
+	{ "latency_histogram_record", bench_latency_histogram, 0 },
+	{ "udp_send_copy_128", bench_udp_send_copy_128, 128 },
+	{ "udp_send_copy_512", bench_udp_send_copy_512, 512 },
+	{ "udp_send_copy_1472", bench_udp_send_copy_1472, 1472 },
+#if defined(UDP_SOCKET_ZEROCOPY)
+	{ "udp_send_zerocopy_128", bench_udp_send_zerocopy_128, 128 },
+	{ "udp_send_zerocopy_512", bench_udp_send_zerocopy_512, 512 },
+	{ "udp_send_zerocopy_1472", bench_udp_send_zerocopy_1472, 1472 },
+#endif
+};
+
+struct benchmark_result
+{
+	const char *name;
+	uint64 operations;
+	float64 nanoseconds_per_op;
+	float64 megabytes_per_second;
+	float64 baseline_nanoseconds_per_op; ///< 0 if there is no baseline for this benchmark.
+	bool regressed;
+};
+
+static benchmark_result run_benchmark(benchmark &b, uint32 minimum_microseconds, uint32 repeat_count)
+{
+	benchmark_result result;
+	result.name = b.name;
+	result.baseline_nanoseconds_per_op = 0;
+	result.regressed = false;
+
+	// find an iteration count that runs for at least the minimum time
+	uint32 iterations = 1;
+	for(;;)
+	{
+		int64 start = net::time_source::read_monotonic_microseconds();
+		b.function(iterations);
+		int64 elapsed = net::time_source::read_monotonic_microseconds() - start;
+		if(elapsed >= minimum_microseconds || iterations >= 0x40000000)
+			break;
+		iterations *= 2;
+	}
+
+	float64 best = 0;
+	for(uint32 i = 0; i < repeat_count; i++)
+	{
+		int64 start = net::time_source::read_monotonic_microseconds();
+		uint64 operations = b.function(iterations);
+		int64 elapsed = net::time_source::read_monotonic_microseconds() - start;
+		float64 nanoseconds = float64(elapsed) * 1000.0 / float64(operations);
+		if(!i || nanoseconds < best)
+		{
+			best = nanoseconds;
+			result.operations = operations;
+		}
+	}
+	result.nanoseconds_per_op = best;
+	result.megabytes_per_second = b.bytes_per_op && best > 0 ? float64(b.bytes_per_op) * 1000.0 / best : 0;
+	return result;
+}
+
+/// Reads a baseline file of name,nanoseconds_per_op lines into the results.  Returns false if the file couldn't be read.
+static bool read_baseline(const char *file_name, benchmark_result *results, uint32 result_count)
+{
+	FILE *f = fopen(file_name, "r");
+	if(!f)
+		return false;
+	char line[256];
+	while(fgets(line, sizeof(line), f))
+	{
+		char *comma = strchr(line, ',');
+		if(!comma)
+			continue;
+		*comma = 0;
+		float64 value = atof(comma + 1);
+		for(uint32 i = 0; i < result_count; i++)
+			if(!strcmp(results[i].name, line))
+				results[i].baseline_nanoseconds_per_op = value;
+	}
+	fclose(f);
+	return true;
+}
+
+static bool write_baseline(const char *file_name, benchmark_result *results, uint32 result_count)
+{
+	FILE *f = fopen(file_name, "w");
+	if(!f)
+		return false;
+	for(uint32 i = 0; i < result_count; i++)
+		fprintf(f, "%s,%.3f\n", results[i].name, results[i].nanoseconds_per_op);
+	fclose(f);
+	return true;
+}
+
+int main(int argc, const char **argv)
+{
+	const char *format = "json";
+	const char *filter = 0;
+	const char *baseline_file = 0;
+	const char *write_baseline_file = 0;
+	uint32 minimum_milliseconds = 100;
+	uint32 repeat_count = 5;
+	float64 threshold_percent = 10;
+
+	for(int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if(!strcmp(argv[i], "--format") && has_value)
+			format = argv[++i];
+		else if(!strcmp(argv[i], "--filter") && has_value)
+			filter = argv[++i];
+		else if(!strcmp(argv[i], "--time") && has_value)
+			minimum_milliseconds = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--repeat") && has_value)
+			repeat_count = max(atoi(argv[++i]), 1);
+		else if(!strcmp(argv[i], "--baseline") && has_value)
+			baseline_file = argv[++i];
+		else if(!strcmp(argv[i], "--threshold") && has_value)
+			threshold_percent = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--write-baseline") && has_value)
+			write_baseline_file = argv[++i];
+		else
+		{
+			printf("usage: %s [--format json|csv] [--filter <substring>] [--time <ms>] [--repeat <count>] [--baseline <file>] [--threshold <percent>] [--write-baseline <file>]\n", argv[0]);
+			return 2;
+		}
+	}
+	bool csv = !strcmp(format, "csv");
+
+	ltc_mp = ltm_desc;
+
+	uint32 benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	benchmark_result *results = new benchmark_result[benchmark_count];
+	uint32 result_count = 0;
+	for(uint32 i = 0; i < benchmark_count; i++)
+	{
+		if(filter && !strstr(benchmarks[i].name, filter))
+			continue;
+		results[result_count++] = run_benchmark(benchmarks[i], minimum_milliseconds * 1000, repeat_count);
+	}
+
+	if(baseline_file && !read_baseline(baseline_file, results, result_count))
+	{
+		fprintf(stderr, "could not read baseline %s\n", baseline_file);
+		return 2;
+	}
+	uint32 regression_count = 0;
+	for(uint32 i = 0; i < result_count; i++)
+	{
+		benchmark_result &r = results[i];
+		r.regressed = r.baseline_nanoseconds_per_op > 0 && r.nanoseconds_per_op > r.baseline_nanoseconds_per_op * (1 + threshold_percent / 100);
+		regression_count += r.regressed;
+	}
+
+	if(csv)
+		printf("name,operations,ns_per_op,mb_per_s,baseline_ns_per_op,change_percent,regressed\n");
+	else
+		printf("{\n\t\"threshold_percent\": %.1f,\n\t\"benchmarks\": [\n", threshold_percent);
+	for(uint32 i = 0; i < result_count; i++)
+	{
+		benchmark_result &r = results[i];
+		float64 change = r.baseline_nanoseconds_per_op > 0 ? (r.nanoseconds_per_op / r.baseline_nanoseconds_per_op - 1) * 100 : 0;
+		if(csv)
+			printf("%s,%llu,%.3f,%.2f,%.3f,%.1f,%d\n", r.name, (unsigned long long) r.operations, r.nanoseconds_per_op, r.megabytes_per_second, r.baseline_nanoseconds_per_op, change, r.regressed);
+		else
+			printf("\t\t{ \"name\": \"%s\", \"operations\": %llu, \"ns_per_op\": %.3f, \"mb_per_s\": %.2f, \"baseline_ns_per_op\": %.3f, \"change_percent\": %.1f, \"regressed\": %s }%s\n", r.name, (unsigned long long) r.operations, r.nanoseconds_per_op, r.megabytes_per_second, r.baseline_nanoseconds_per_op, change, r.regressed ? "true" : "false", i + 1 < result_count ? "," : "");
+	}
+	if(!csv)
+		printf("\t],\n\t\"regressions\": %u\n}\n", regression_count);
+
+	if(write_baseline_file && !write_baseline(write_baseline_file, results, result_count))
+	{
+		fprintf(stderr, "could not write baseline %s\n", write_baseline_file);
+		return 2;
+	}
+	for(uint32 i = 0; i < result_count; i++)
+		if(results[i].regressed)
+			fprintf(stderr, "REGRESSION: %s %.3f ns/op, baseline %.3f ns/op\n", results[i].name, results[i].nanoseconds_per_op, results[i].baseline_nanoseconds_per_op);
+	return regression_count ? 1 : 0;
+}
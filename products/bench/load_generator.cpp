@@ -0,0 +1,553 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+// load_generator - end-to-end load test of a single torque_socket server on loopback, to find how many handshakes and packets per second it sustains before latency degrades.
+//
+// usage: load_generator [--clients <count>] [--threads <count>] [--port <port>] [--duration <seconds>]
+//                       [--connect-rate <per second>] [--hold <ms>] [--puzzle-difficulty <bits>]
+//                       [--payload <bytes>] [--send-rate <packets per second per connection>]
+//                       [--ramp send|connect] [--step <seconds>] [--p99-limit <us>] [--max-steps <count>]
+//
+// The server socket is run on the main thread.  --clients client sockets are split across --threads threads, and each client socket holds at most one connection to the server.  Idle clients connect at --connect-rate handshakes per second in total (0 connects them all at once); with --hold, connections are closed that many milliseconds after they're established so the clients keep reconnecting.  Established connections send --payload byte packets at --send-rate, never letting more packets be outstanding than the notify window allows.  Each packet carries its send time, and the server records the time from send to the packet event being returned by get_next_event.
+//
+// Without --ramp one report line is printed for the whole --duration.  With --ramp send (or connect), the send rate (or connect rate) is doubled every --step seconds, printing a line per step, until the server delivers less than 90% of the offered load or the p99 latency exceeds --p99-limit.  Each client holds one connection at a time, so connect rates above --clients divided by (--hold plus the handshake time) need more clients.  CPU per packet is the process's user and system time divided by the packets delivered, so it covers both ends of the connection.  The library logs every packet to stderr; redirect it for meaningful numbers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tomcrypt.h"
+#include "core/platform.h"
+extern "C"
+{
+#include "torque_sockets/torque_sockets_c_api.h"
+};
+
+namespace core
+{
+	#include "core/core.h"
+	struct net {
+		#include "torque_sockets/torque_sockets.h"
+	};
+};
+
+extern "C"
+{
+	#include "torque_sockets/torque_sockets_c_implementation.h"
+}
+
+#if !defined(PLATFORM_WIN32)
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+using namespace core;
+
+static torque_socket_interface &api = g_torque_socket_interface;
+
+enum {
+	stamp_size = sizeof(int64), ///< Each packet starts with its send time.
+	send_window = torque_sockets_packet_window_size - 2, ///< Most packets a connection can have awaiting notification before send_to_connection would overrun the window.
+	max_sends_per_pass = 8, ///< Limits the catch up burst after a client thread falls behind.
+};
+
+static int64 load_now()
+{
+	return net::time_source::read_monotonic_microseconds();
+}
+
+static void load_idle()
+{
+#if defined(PLATFORM_WIN32)
+	Sleep(0);
+#else
+	usleep(100);
+#endif
+}
+
+/// Returns the user plus system time used by the process, in microseconds.
+static int64 load_cpu_microseconds()
+{
+#if defined(PLATFORM_WIN32)
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	return int64((((uint64(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime) + ((uint64(user.dwHighDateTime) << 32) | user.dwLowDateTime)) / 10);
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return int64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+/// Seeds a socket's random generator.  Unseeded sockets all generate the same nonces, and the server rejects the repeats as replayed puzzle solutions.
+static void seed_socket(torque_socket_handle socket, uint32 index)
+{
+	uint8 entropy[32];
+	int64 now = load_now();
+	for(uint32 i = 0; i < sizeof(entropy); i++)
+		entropy[i] = uint8((now >> ((i & 7) * 8)) ^ (index >> ((i & 3) * 8)) ^ (size_t(socket) >> ((i & 7) * 4)));
+	api.write_entropy(socket, entropy);
+}
+
+static sockaddr loopback_address(uint16 port)
+{
+	sockaddr_in a;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_port = htons(port);
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return *((sockaddr *) &a);
+}
+
+struct load_options
+{
+	uint32 clients;
+	uint32 threads;
+	uint32 port;
+	float64 duration;
+	float64 connect_rate;
+	uint32 hold;
+	uint32 puzzle_difficulty;
+	uint32 payload;
+	float64 send_rate;
+	const char *ramp;
+	float64 step;
+	uint32 p99_limit;
+	uint32 max_steps;
+
+	load_options()
+	{
+		clients = 16;
+		threads = 2;
+		port = 28100;
+		duration = 10;
+		connect_rate = 0;
+		hold = 0;
+		puzzle_difficulty = 0;
+		payload = 64;
+		send_rate = 100;
+		ramp = 0;
+		step = 3;
+		p99_limit = 10000;
+		max_steps = 16;
+	}
+};
+
+/// Rates the client threads are currently driving.  Written by the main thread between steps.
+struct load_rates
+{
+	volatile float64 connect_rate; ///< Total new connections per second across all clients, 0 for unlimited.
+	volatile float64 send_rate; ///< Packets per second per established connection.
+};
+
+/// Runs a set of client sockets.  Counters are only written by the client thread; the main thread reads them between steps.
+class client_thread : public thread
+{
+	struct client
+	{
+		torque_socket_handle socket;
+		torque_connection_id connection;
+		int64 connect_time; ///< When the pending connection was started, 0 if the client is idle.
+		int64 established_time; ///< When the connection was established, 0 if it isn't yet.
+		int64 next_send_time;
+		uint32 outstanding; ///< Packets sent and not yet notified.
+	};
+	client *_clients;
+	uint32 _client_count;
+	const load_options &_options;
+	load_rates &_rates;
+	sockaddr _server_address;
+	float64 _connect_tokens;
+	mutex _lock; ///< Guards _handshake_latency.
+	net::latency_histogram _handshake_latency;
+public:
+	volatile bool stop;
+	volatile uint32 handshakes;
+	volatile uint32 connect_failures;
+	volatile uint32 packets_sent;
+	volatile uint32 window_stalls;
+	volatile uint32 established;
+
+	client_thread(uint32 first_port, uint32 client_count, const load_options &options, load_rates &rates) : _options(options), _rates(rates)
+	{
+		_client_count = client_count;
+		_clients = new client[client_count];
+		_server_address = loopback_address(uint16(options.port));
+		_connect_tokens = 0;
+		stop = false;
+		handshakes = connect_failures = packets_sent = window_stalls = established = 0;
+		for(uint32 i = 0; i < client_count; i++)
+		{
+			client &c = _clients[i];
+			c.socket = api.create(false, 0, 0);
+			seed_socket(c.socket, first_port + i);
+			sockaddr bind_address = loopback_address(uint16(first_port + i));
+			if(api.bind(c.socket, &bind_address) != bind_success)
+				fprintf(stderr, "client could not bind port %u\n", first_port + i);
+			c.connection = invalid_torque_connection;
+			c.connect_time = 0;
+			c.established_time = 0;
+			c.outstanding = 0;
+		}
+	}
+
+	~client_thread()
+	{
+		for(uint32 i = 0; i < _client_count; i++)
+			api.destroy(_clients[i].socket);
+		delete[] _clients;
+	}
+
+	/// Adds the handshake times recorded since the last call to histogram.
+	void take_handshake_latency(net::latency_histogram &histogram)
+	{
+		_lock.lock();
+		histogram.merge(_handshake_latency);
+		_handshake_latency.reset();
+		_lock.unlock();
+	}
+
+	uint32 run()
+	{
+		uint8 payload[torque_sockets_max_datagram_size];
+		memset(payload, 0xAA, sizeof(payload));
+		int64 last_time = load_now();
+		while(!stop)
+		{
+			int64 now = load_now();
+			float64 connect_rate = _rates.connect_rate;
+			if(connect_rate > 0)
+			{
+				_connect_tokens += float64(now - last_time) * connect_rate / (_options.threads * 1000000.0);
+				if(_connect_tokens > _client_count)
+					_connect_tokens = _client_count;
+			}
+			else
+				_connect_tokens = _client_count;
+			last_time = now;
+
+			float64 send_rate = _rates.send_rate;
+			int64 send_interval = send_rate > 0 ? int64(1000000.0 / send_rate) : 0;
+			bool busy = false;
+			for(uint32 i = 0; i < _client_count; i++)
+			{
+				client &c = _clients[i];
+				torque_socket_event *event;
+				while((event = api.get_next_event(c.socket)) != NULL)
+				{
+					busy = true;
+					switch(event->event_type)
+					{
+						case torque_connection_challenge_response_event_type:
+							api.accept_challenge(c.socket, event->connection);
+							break;
+						case torque_connection_established_event_type:
+							c.established_time = load_now();
+							c.next_send_time = c.established_time;
+							c.outstanding = 0;
+							_lock.lock();
+							_handshake_latency.record(c.established_time - c.connect_time);
+							_lock.unlock();
+							handshakes++;
+							established++;
+							break;
+						case torque_connection_packet_notify_event_type:
+							if(c.outstanding)
+								c.outstanding--;
+							break;
+						case torque_connection_timed_out_event_type:
+						case torque_connection_disconnected_event_type:
+							if(!c.established_time)
+								connect_failures++;
+							else
+								established--;
+							c.connection = invalid_torque_connection;
+							c.connect_time = 0;
+							c.established_time = 0;
+							break;
+					}
+				}
+				now = load_now();
+				if(!c.connect_time)
+				{
+					if(_connect_tokens >= 1)
+					{
+						_connect_tokens -= 1;
+						c.connect_time = now;
+						c.established_time = 0;
+						c.connection = api.connect(c.socket, &_server_address, 0, NULL);
+						busy = true;
+					}
+				}
+				else if(c.established_time)
+				{
+					if(_options.hold && now - c.established_time >= int64(_options.hold) * 1000)
+					{
+						api.close_connection(c.socket, c.connection, 0, NULL);
+						c.connection = invalid_torque_connection;
+						c.connect_time = 0;
+						c.established_time = 0;
+						established--;
+						continue;
+					}
+					if(!send_interval)
+						continue;
+					if(now - c.next_send_time > send_interval * max_sends_per_pass)
+						c.next_send_time = now - send_interval * max_sends_per_pass;
+					while(c.next_send_time <= now)
+					{
+						if(c.outstanding >= send_window)
+						{
+							window_stalls++;
+							break;
+						}
+						int64 stamp = load_now();
+						memcpy(payload, &stamp, stamp_size);
+						api.send_to_connection(c.socket, c.connection, _options.payload, payload);
+						c.outstanding++;
+						c.next_send_time += send_interval;
+						packets_sent++;
+						busy = true;
+					}
+				}
+			}
+			if(!busy)
+				load_idle();
+		}
+		return 0;
+	}
+};
+
+/// Totals for one measurement step.
+struct step_result
+{
+	float64 seconds;
+	float64 offered_connect_rate;
+	float64 offered_send_rate;
+	uint32 established;
+	uint32 handshakes;
+	uint32 connect_failures;
+	uint32 packets_sent;
+	uint32 packets_received;
+	uint64 bytes_received;
+	uint32 window_stalls;
+	int64 cpu_microseconds;
+	net::latency_histogram packet_latency;
+	net::latency_histogram handshake_latency;
+	torque_socket_latency_summary server_queueing;
+};
+
+static void print_header()
+{
+	printf("%10s %10s %7s %12s %7s %12s %12s %14s %10s %8s %8s %8s %8s %8s %8s %8s\n", "send_rate", "conn_rate", "conns", "handshakes/s", "failed", "sent_pps", "recv_pps", "recv_bytes/s", "stalls", "cpu_us", "p50_us", "p99_us", "p999_us", "max_us", "hs_p50", "hs_p99");
+}
+
+static void print_result(step_result &r)
+{
+	printf("%10.0f %10.0f %7u %12.1f %7u %12.1f %12.1f %14.0f %10u %8.2f %8u %8u %8u %8u %8u %8u\n",
+		r.offered_send_rate, r.offered_connect_rate, r.established, r.handshakes / r.seconds, r.connect_failures,
+		r.packets_sent / r.seconds, r.packets_received / r.seconds, r.bytes_received / r.seconds, r.window_stalls,
+		r.packets_received ? float64(r.cpu_microseconds) / r.packets_received : 0.0,
+		r.packet_latency.get_percentile(0.5), r.packet_latency.get_percentile(0.99), r.packet_latency.get_percentile(0.999), r.packet_latency.get_max(),
+		r.handshake_latency.get_percentile(0.5), r.handshake_latency.get_percentile(0.99));
+	fflush(stdout);
+}
+
+/// Runs the server for one step, driving the clients at the current rates.
+static void run_step(torque_socket_handle server, client_thread **threads, const load_options &options, float64 seconds, load_rates &rates, step_result &r)
+{
+	uint32 sent_start = 0, handshakes_start = 0, failures_start = 0, stalls_start = 0;
+	for(uint32 i = 0; i < options.threads; i++)
+	{
+		sent_start += threads[i]->packets_sent;
+		handshakes_start += threads[i]->handshakes;
+		failures_start += threads[i]->connect_failures;
+		stalls_start += threads[i]->window_stalls;
+		net::latency_histogram discard;
+		threads[i]->take_handshake_latency(discard);
+	}
+	api.reset_latency_stats(server);
+	r.packets_received = 0;
+	r.bytes_received = 0;
+	r.packet_latency.reset();
+	r.handshake_latency.reset();
+	r.offered_connect_rate = rates.connect_rate;
+	r.offered_send_rate = rates.send_rate;
+
+	int64 start = load_now();
+	int64 cpu_start = load_cpu_microseconds();
+	int64 end = start + int64(seconds * 1000000);
+	for(;;)
+	{
+		int64 now = load_now();
+		if(now >= end)
+			break;
+		bool busy = false;
+		torque_socket_event *event;
+		while((event = api.get_next_event(server)) != NULL)
+		{
+			busy = true;
+			if(event->event_type == torque_connection_requested_event_type)
+				api.accept_connection(server, event->connection);
+			else if(event->event_type == torque_connection_packet_event_type && event->data_size >= stamp_size)
+			{
+				int64 stamp;
+				memcpy(&stamp, event->data, stamp_size);
+				r.packet_latency.record(load_now() - stamp);
+				r.packets_received++;
+				r.bytes_received += event->data_size;
+			}
+		}
+		if(!busy)
+			load_idle();
+	}
+	r.cpu_microseconds = load_cpu_microseconds() - cpu_start;
+	r.seconds = float64(load_now() - start) / 1000000.0;
+
+	r.packets_sent = r.handshakes = r.connect_failures = r.window_stalls = r.established = 0;
+	for(uint32 i = 0; i < options.threads; i++)
+	{
+		r.packets_sent += threads[i]->packets_sent;
+		r.handshakes += threads[i]->handshakes;
+		r.connect_failures += threads[i]->connect_failures;
+		r.window_stalls += threads[i]->window_stalls;
+		r.established += threads[i]->established;
+		threads[i]->take_handshake_latency(r.handshake_latency);
+	}
+	r.packets_sent -= sent_start;
+	r.handshakes -= handshakes_start;
+	r.connect_failures -= failures_start;
+	r.window_stalls -= stalls_start;
+	api.get_latency_stats(server, torque_latency_arrival_to_dequeue, &r.server_queueing);
+}
+
+int main(int argc, const char **argv)
+{
+	ltc_mp = ltm_desc;
+	load_options options;
+	for(int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if(!strcmp(argv[i], "--clients") && has_value)
+			options.clients = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--threads") && has_value)
+			options.threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--port") && has_value)
+			options.port = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--duration") && has_value)
+			options.duration = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--connect-rate") && has_value)
+			options.connect_rate = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--hold") && has_value)
+			options.hold = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--puzzle-difficulty") && has_value)
+			options.puzzle_difficulty = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--payload") && has_value)
+			options.payload = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--send-rate") && has_value)
+			options.send_rate = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--ramp") && has_value)
+			options.ramp = argv[++i];
+		else if(!strcmp(argv[i], "--step") && has_value)
+			options.step = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--p99-limit") && has_value)
+			options.p99_limit = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--max-steps") && has_value)
+			options.max_steps = atoi(argv[++i]);
+		else
+		{
+			printf("usage: %s [--clients <count>] [--threads <count>] [--port <port>] [--duration <seconds>] [--connect-rate <per second>] [--hold <ms>] [--puzzle-difficulty <bits>] [--payload <bytes>] [--send-rate <pps per connection>] [--ramp send|connect] [--step <seconds>] [--p99-limit <us>] [--max-steps <count>]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(options.ramp && strcmp(options.ramp, "send") && strcmp(options.ramp, "connect"))
+	{
+		fprintf(stderr, "--ramp must be send or connect\n");
+		return 2;
+	}
+	if(!options.threads || options.clients < options.threads)
+	{
+		fprintf(stderr, "need at least one client per thread\n");
+		return 2;
+	}
+	if(options.payload < stamp_size || options.payload > torque_sockets_max_datagram_size - 32)
+	{
+		fprintf(stderr, "--payload must be between %u and %u bytes\n", uint32(stamp_size), uint32(torque_sockets_max_datagram_size - 32));
+		return 2;
+	}
+
+	torque_socket_handle server = api.create(false, 0, 0);
+	seed_socket(server, options.port);
+	sockaddr server_address = loopback_address(uint16(options.port));
+	if(api.bind(server, &server_address) != bind_success)
+	{
+		fprintf(stderr, "could not bind server port %u\n", options.port);
+		return 2;
+	}
+	api.allow_incoming_connections(server, 1);
+	api.set_puzzle_difficulty(server, options.puzzle_difficulty);
+
+	load_rates rates;
+	rates.connect_rate = options.connect_rate;
+	rates.send_rate = options.send_rate;
+
+	client_thread **threads = new client_thread *[options.threads];
+	uint32 first_port = options.port + 1;
+	for(uint32 i = 0; i < options.threads; i++)
+	{
+		uint32 count = options.clients / options.threads + (i < options.clients % options.threads ? 1 : 0);
+		threads[i] = new client_thread(first_port, count, options, rates);
+		first_port += count;
+	}
+	for(uint32 i = 0; i < options.threads; i++)
+		threads[i]->start();
+
+	printf("%u clients on %u threads, %u byte payload, puzzle difficulty %u, hold %u ms\n", options.clients, options.threads, options.payload, options.puzzle_difficulty, options.hold);
+	print_header();
+	step_result *result = new step_result;
+	if(!options.ramp)
+	{
+		run_step(server, threads, options, options.duration, rates, *result);
+		print_result(*result);
+	}
+	else
+	{
+		bool ramp_send = !strcmp(options.ramp, "send");
+		if(!ramp_send && rates.connect_rate <= 0)
+			rates.connect_rate = 10;
+		float64 best = 0;
+		for(uint32 step = 0; step < options.max_steps; step++)
+		{
+			run_step(server, threads, options, options.step, rates, *result);
+			print_result(*result);
+
+			// saturated when the server falls behind the offered load or the tail latency blows up.
+			float64 offered = ramp_send ? result->packets_sent : result->offered_connect_rate * result->seconds;
+			float64 delivered = ramp_send ? result->packets_received : result->handshakes;
+			uint32 p99 = ramp_send ? result->packet_latency.get_percentile(0.99) : result->handshake_latency.get_percentile(0.99);
+			if(delivered < offered * 0.9 || p99 > options.p99_limit)
+			{
+				printf("saturated: delivered %.0f of %.0f offered, p99 %u us (limit %u us)\n", delivered, offered, p99, options.p99_limit);
+				break;
+			}
+			best = delivered / result->seconds;
+			if(ramp_send)
+				rates.send_rate = rates.send_rate * 2;
+			else
+				rates.connect_rate = rates.connect_rate * 2;
+		}
+		printf("highest sustained %s: %.1f per second\n", ramp_send ? "packet rate" : "handshake rate", best);
+	}
+	printf("server queueing (arrival to dequeue): p50 %u us p99 %u us max %u us over %u events\n", result->server_queueing.p50, result->server_queueing.p99, result->server_queueing.max, result->server_queueing.count);
+
+	for(uint32 i = 0; i < options.threads; i++)
+		threads[i]->stop = true;
+	for(uint32 i = 0; i < options.threads; i++)
+	{
+		while(threads[i]->is_running())
+			load_idle();
+		delete threads[i];
+	}
+	delete[] threads;
+	delete result;
+	api.destroy(server);
+	return 0;
+}
@@ -0,0 +1,343 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+// net_simulation - runs torque_socket scale and timeout scenarios on a simulated_network, in virtual time.
+//
+// usage: net_simulation [--scenario connect|timeout|introduce] [--clients <count>] [--seed <seed>] [--spread <ms>]
+//                       [--duration <seconds>] [--latency <us>] [--jitter <us>] [--loss <fraction>] [--puzzle-difficulty <bits>]
+//
+// One server socket and --clients client sockets run on a simulated_network.  The clients are bound and connect to the server at evenly spaced times over the first --spread milliseconds, and the run ends after --duration seconds of virtual time.
+//
+//   connect    every client connects to the server.
+//   timeout    as connect, but once every client is established the network drops every datagram, so all the connections time out on both ends.
+//   introduce  as connect, then the server introduces the clients to each other in pairs and each pair makes an introduced connection.
+//
+// Every event any socket returns is folded into a digest, printed with the results: runs with the same options and seed print the same digest.  The library logs every handshake step; redirect stdout and stderr for large runs.
+//
+// The exit status is 0 only if the scenario completed: every client established, and every pair introduced or every connection timed out on both ends.  "net_simulation --scenario introduce" is the regression check for introduced connections.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tomcrypt.h"
+#include "core/platform.h"
+extern "C"
+{
+#include "torque_sockets/torque_sockets_c_api.h"
+};
+
+namespace core
+{
+	#include "core/core.h"
+	struct net {
+		#include "torque_sockets/torque_sockets.h"
+	};
+};
+
+using namespace core;
+
+enum {
+	client_host_base = 0x0a000002, ///< Clients are bound to consecutive addresses from 10.0.0.2.
+	server_host = 0x0a000001,
+	simulation_port = 28000,
+};
+
+struct simulation_options
+{
+	const char *scenario;
+	uint32 clients;
+	uint64 seed;
+	uint32 spread;
+	float64 duration;
+	uint32 latency;
+	uint32 jitter;
+	float32 loss;
+	uint32 puzzle_difficulty;
+
+	simulation_options()
+	{
+		scenario = "connect";
+		clients = 1000;
+		seed = 1;
+		spread = 1000;
+		duration = 60;
+		latency = net::simulated_network::default_latency;
+		jitter = 0;
+		loss = 0;
+		puzzle_difficulty = 0;
+	}
+};
+
+struct simulation_client
+{
+	net::torque_socket *socket;
+	torque_connection_id server_connection; ///< This client's connection to the server.
+	torque_connection_id server_side_connection; ///< The server's connection to this client.
+	torque_connection_id peer_connection; ///< Introduced connection to the paired client.
+	int64 connect_time;
+	int64 established_time;
+	int64 closed_time;
+	int64 peer_established_time;
+};
+
+struct simulation
+{
+	simulation_options options;
+	net::simulated_network *network;
+	net::torque_socket *server;
+	simulation_client *clients;
+	bool introduce;
+	uint32 established;
+	uint32 peers_established;
+	uint32 client_timeouts;
+	uint32 server_timeouts;
+	uint32 server_closed;
+	int64 last_event_time;
+	uint32 digest;
+	net::latency_histogram handshake_time;
+	net::latency_histogram peer_handshake_time;
+};
+
+static net::address client_address(uint32 index)
+{
+	net::address a;
+	a.set_host(client_host_base + index);
+	a.set_port(simulation_port);
+	return a;
+}
+
+static void digest_word(simulation *s, uint32 value)
+{
+	// FNV-1a, one byte at a time
+	for(uint32 i = 0; i < 4; i++)
+	{
+		s->digest ^= (value >> (i * 8)) & 0xFF;
+		s->digest *= 16777619;
+	}
+}
+
+static simulation_client *find_client(simulation *s, net::torque_socket *socket)
+{
+	uint32 index = socket->get_network_socket().get_bound_address().get_host() - client_host_base;
+	return index < s->options.clients ? s->clients + index : 0;
+}
+
+static void introduce_pair(simulation *s, uint32 index)
+{
+	// the even client of each pair initiates, once both have their connection to the server.
+	simulation_client &initiator = s->clients[index & ~1];
+	simulation_client &host = s->clients[index | 1];
+	if((index | 1) >= s->options.clients || !initiator.established_time || !host.established_time || !initiator.server_side_connection || !host.server_side_connection)
+		return;
+	uint8 data = 0;
+	s->server->introduce_connection(initiator.server_side_connection, host.server_side_connection);
+	initiator.peer_connection = initiator.socket->connect_introduced(initiator.server_connection, host.server_side_connection, 0, 1, &data);
+	host.peer_connection = host.socket->connect_introduced(host.server_connection, initiator.server_side_connection, 1, 1, &data);
+}
+
+static void process_server(simulation *s)
+{
+	torque_socket_event *event;
+	while((event = s->server->get_next_event()) != 0)
+	{
+		int64 now = s->network->get_time();
+		digest_word(s, uint32(now));
+		digest_word(s, event->event_type);
+		digest_word(s, event->connection);
+		s->last_event_time = now;
+		switch(event->event_type)
+		{
+			case torque_connection_requested_event_type:
+				if(event->data_size == sizeof(uint32))
+				{
+					uint32 index;
+					memcpy(&index, event->data, sizeof(index));
+					if(index < s->options.clients)
+						s->clients[index].server_side_connection = event->connection;
+				}
+				s->server->accept_connection(event->connection);
+				break;
+			case torque_connection_timed_out_event_type:
+				s->server_timeouts++;
+				break;
+			case torque_connection_disconnected_event_type:
+				s->server_closed++;
+				break;
+		}
+	}
+}
+
+static void process_client(simulation *s, simulation_client *client)
+{
+	torque_socket_event *event;
+	while((event = client->socket->get_next_event()) != 0)
+	{
+		int64 now = s->network->get_time();
+		digest_word(s, uint32(now));
+		digest_word(s, uint32(client - s->clients));
+		digest_word(s, event->event_type);
+		digest_word(s, event->connection);
+		s->last_event_time = now;
+		bool to_server = event->connection == client->server_connection;
+		switch(event->event_type)
+		{
+			case torque_connection_challenge_response_event_type:
+				client->socket->accept_connection_challenge(event->connection);
+				break;
+			case torque_connection_requested_event_type:
+				client->socket->accept_connection(event->connection);
+				break;
+			case torque_connection_established_event_type:
+				if(to_server)
+				{
+					client->established_time = now;
+					s->established++;
+					s->handshake_time.record(now - client->connect_time);
+					if(s->introduce)
+						introduce_pair(s, uint32(client - s->clients));
+				}
+				else
+				{
+					client->peer_established_time = now;
+					s->peers_established++;
+					s->peer_handshake_time.record(now - client->established_time);
+				}
+				break;
+			case torque_connection_timed_out_event_type:
+				if(to_server)
+				{
+					client->closed_time = now;
+					s->client_timeouts++;
+				}
+				break;
+		}
+	}
+}
+
+static void process_socket(void *data, net::torque_socket *socket)
+{
+	simulation *s = (simulation *) data;
+	if(socket == s->server)
+		process_server(s);
+	else
+		process_client(s, find_client(s, socket));
+}
+
+int main(int argc, const char **argv)
+{
+	ltc_mp = ltm_desc;
+	simulation_options options;
+	for(int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if(!strcmp(argv[i], "--scenario") && has_value)
+			options.scenario = argv[++i];
+		else if(!strcmp(argv[i], "--clients") && has_value)
+			options.clients = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--seed") && has_value)
+			options.seed = strtoull(argv[++i], 0, 10);
+		else if(!strcmp(argv[i], "--spread") && has_value)
+			options.spread = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--duration") && has_value)
+			options.duration = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--latency") && has_value)
+			options.latency = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--jitter") && has_value)
+			options.jitter = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--loss") && has_value)
+			options.loss = float32(atof(argv[++i]));
+		else if(!strcmp(argv[i], "--puzzle-difficulty") && has_value)
+			options.puzzle_difficulty = atoi(argv[++i]);
+		else
+		{
+			printf("usage: %s [--scenario connect|timeout|introduce] [--clients <count>] [--seed <seed>] [--spread <ms>] [--duration <seconds>] [--latency <us>] [--jitter <us>] [--loss <fraction>] [--puzzle-difficulty <bits>]\n", argv[0]);
+			return 1;
+		}
+	}
+	bool timeout = !strcmp(options.scenario, "timeout");
+	if(!timeout && strcmp(options.scenario, "connect") && strcmp(options.scenario, "introduce"))
+	{
+		fprintf(stderr, "--scenario must be connect, timeout or introduce\n");
+		return 1;
+	}
+
+	net::simulated_network network(options.seed);
+	net::link_profile profile;
+	profile.latency = options.latency;
+	profile.jitter = options.jitter;
+	profile.loss = options.loss;
+	network.get_link_emulator().set_profile(net::link_emulator::outgoing, profile);
+
+	simulation *s = new simulation;
+	s->options = options;
+	s->network = &network;
+	s->introduce = !strcmp(options.scenario, "introduce");
+	s->established = s->peers_established = 0;
+	s->client_timeouts = s->server_timeouts = s->server_closed = 0;
+	s->last_event_time = 0;
+	s->digest = 2166136261U;
+	s->clients = new simulation_client[options.clients];
+	memset(s->clients, 0, sizeof(simulation_client) * options.clients);
+
+	int64 real_start = net::time_source::read_monotonic_microseconds();
+	net::address server_address;
+	server_address.set_host(server_host);
+	server_address.set_port(simulation_port);
+	s->server = new net::torque_socket();
+	s->server->bind_simulated(&network, server_address);
+	s->server->set_puzzle_difficulty(options.puzzle_difficulty);
+
+	int64 start = network.get_time();
+	int64 end = start + int64(options.duration * 1000000);
+	bool partitioned = false;
+	int64 partition_time = 0;
+	for(uint32 i = 0; i < options.clients; i++)
+	{
+		network.run_until(start + int64(options.spread) * 1000 * i / options.clients, process_socket, s);
+		simulation_client &client = s->clients[i];
+		client.socket = new net::torque_socket();
+		client.socket->bind_simulated(&network, client_address(i));
+		// clients solve puzzles for the server, and in introduce mode host each other.
+		client.socket->set_puzzle_difficulty(options.puzzle_difficulty);
+		process_client(s, &client);
+		client.connect_time = network.get_time();
+		client.server_connection = client.socket->connect(server_address, (uint8 *) &i, sizeof(i));
+	}
+	while(network.run_next(process_socket, s, end))
+	{
+		if(timeout && !partitioned && s->established == options.clients)
+		{
+			// cut the network: from here on every connection can only time out.
+			profile.loss = 1;
+			network.get_link_emulator().set_profile(net::link_emulator::outgoing, profile);
+			partitioned = true;
+			partition_time = network.get_time();
+		}
+	}
+	int64 real_time = net::time_source::read_monotonic_microseconds() - real_start;
+	int64 virtual_time = network.get_time() - start;
+
+	const net::simulated_network::statistics &stats = network.get_statistics();
+	printf("%s: %u clients, seed %llu, latency %u us, jitter %u us, loss %.3f, puzzle difficulty %u\n", options.scenario, options.clients, (unsigned long long) options.seed, options.latency, options.jitter, options.loss, options.puzzle_difficulty);
+	printf("established %u of %u, handshake p50 %u us p99 %u us max %u us\n", s->established, options.clients, s->handshake_time.get_percentile(0.5), s->handshake_time.get_percentile(0.99), s->handshake_time.get_max());
+	if(s->introduce)
+		printf("introduced %u of %u, introduction p50 %u us p99 %u us max %u us\n", s->peers_established, options.clients & ~1, s->peer_handshake_time.get_percentile(0.5), s->peer_handshake_time.get_percentile(0.99), s->peer_handshake_time.get_max());
+	if(timeout)
+		printf("partitioned at %.3f s: %u client and %u server timeouts, last at %.3f s\n", float64(partition_time - start) / 1000000, s->client_timeouts, s->server_timeouts, float64(s->last_event_time - start) / 1000000);
+	printf("datagrams: %llu sent, %llu delivered, %llu lost, %llu unroutable; %u steps, %llu socket wakeups\n", (unsigned long long) stats.datagrams_sent, (unsigned long long) stats.datagrams_delivered, (unsigned long long) stats.datagrams_lost, (unsigned long long) stats.datagrams_unroutable, stats.steps, (unsigned long long) stats.socket_wakeups);
+	printf("%.3f s virtual in %.3f s real (%.1fx), digest %08x\n", float64(virtual_time) / 1000000, float64(real_time) / 1000000, real_time ? float64(virtual_time) / float64(real_time) : 0.0, s->digest);
+
+	bool completed = s->established == options.clients;
+	if(s->introduce)
+		completed = completed && s->peers_established == (options.clients & ~1);
+	if(timeout)
+		completed = completed && s->client_timeouts == options.clients && s->server_timeouts == options.clients;
+	if(!completed)
+		printf("%s scenario did not complete\n", options.scenario);
+
+	for(uint32 i = 0; i < options.clients; i++)
+		delete s->clients[i].socket;
+	delete s->server;
+	delete[] s->clients;
+	delete s;
+	return completed ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+// replay - plays a packet capture back into a torque_socket and measures how long each stage of the library takes to process it.
+//
+// usage: replay <capture.pcap> [--keys <key file>] [--local <address>] [--speed original|max] [--repeat <count>] [--output <pcap>]
+//
+// The datagrams the capture shows arriving at the local address are injected, at their recorded times, into a torque_socket bound to that address on a simulated_network, so the socket's clock follows the capture and a run can be repeated exactly.  The local address is the one recorded in --keys, else --local, else the address that appears in the most datagrams.
+//
+// A capture taken with torque_socket_start_capture and a key file replays the local host's side completely: the key file restores the socket's private key, client puzzle state and random generator, so it answers challenges and requests with the same packets it sent when the capture was taken, and the remote side's packets that follow decrypt.  Without keys, handshakes that aren't started by the remote side (and everything encrypted after them) fail; packet handling up to that point is still measured.  Only the local host is reproduced - the remote hosts' packets are played as recorded, whatever the socket sends.
+//
+// Each inbound datagram is attributed to a stage by its first byte - a handshake packet type, info packets or connection packets - and the real time the socket takes to process it, with any timer work due at the same moment, is recorded per stage, over all the passes of --repeat.  --speed original waits out the recorded gaps between datagrams; the default, max, plays them back to back.  --output records what the socket sends during the replay, and the report counts how many of those datagrams match the capture byte for byte.  The digest covers every event the socket returns, for comparing builds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tomcrypt.h"
+#include "core/platform.h"
+extern "C"
+{
+#include "torque_sockets/torque_sockets_c_api.h"
+};
+
+namespace core
+{
+	#include "core/core.h"
+	struct net {
+		#include "torque_sockets/torque_sockets.h"
+	};
+};
+
+#if !defined(PLATFORM_WIN32)
+#include <unistd.h>
+#endif
+
+using namespace core;
+
+enum {
+	handshake_stage_count = net::torque_socket::probe_response_packet + 1,
+	info_stage = handshake_stage_count,
+	connection_stage,
+	stage_count,
+	replay_seed = 1,
+};
+
+static const char *handshake_stage_names[handshake_stage_count] = {
+	"connect_challenge_request",
+	"connect_challenge_response",
+	"connect_reject",
+	"connect_request",
+	"connect_accept",
+	"disconnect",
+	"introduced_connection_request",
+	"connection_introduction",
+	"punch",
+	"probe_request",
+	"probe_response",
+};
+
+/// One datagram of the capture, held in memory so the replay isn't timing file reads.
+struct replay_record
+{
+	int64 time;
+	net::address source;
+	net::address destination;
+	uint32 data_size;
+	uint8 *data;
+};
+
+struct replay_options
+{
+	const char *capture_file;
+	const char *key_file;
+	const char *local;
+	const char *output_file;
+	bool original_speed;
+	uint32 repeat;
+
+	replay_options()
+	{
+		capture_file = 0;
+		key_file = 0;
+		local = 0;
+		output_file = 0;
+		original_speed = false;
+		repeat = 1;
+	}
+};
+
+struct replay
+{
+	net::torque_socket *socket;
+	uint32 events;
+	uint32 digest;
+};
+
+static void digest_word(replay *r, uint32 value)
+{
+	// FNV-1a, one byte at a time
+	for(uint32 i = 0; i < 4; i++)
+	{
+		r->digest ^= (value >> (i * 8)) & 0xFF;
+		r->digest *= 16777619;
+	}
+}
+
+static uint32 digest_data(const uint8 *data, uint32 data_size)
+{
+	uint32 digest = 2166136261U;
+	for(uint32 i = 0; i < data_size; i++)
+	{
+		digest ^= data[i];
+		digest *= 16777619;
+	}
+	return digest;
+}
+
+static void wait_microseconds(int64 microseconds)
+{
+#if defined(PLATFORM_WIN32)
+	Sleep(DWORD(microseconds / 1000));
+#else
+	usleep(useconds_t(microseconds));
+#endif
+}
+
+static void process_socket(void *data, net::torque_socket *socket)
+{
+	replay *r = (replay *) data;
+	torque_socket_event *event;
+	while((event = socket->get_next_event()) != 0)
+	{
+		r->events++;
+		digest_word(r, event->event_type);
+		digest_word(r, event->connection);
+		digest_word(r, event->data_size);
+		switch(event->event_type)
+		{
+			case torque_connection_challenge_response_event_type:
+				socket->accept_connection_challenge(event->connection);
+				break;
+			case torque_connection_requested_event_type:
+				socket->accept_connection(event->connection);
+				break;
+		}
+	}
+}
+
+static uint32 get_stage(const replay_record &record)
+{
+	uint8 packet_type = record.data_size ? record.data[0] : 0;
+	if(packet_type >= 128)
+		return connection_stage;
+	if(packet_type >= net::torque_socket::first_valid_info_packet_id)
+		return info_stage;
+	return packet_type < handshake_stage_count ? packet_type : info_stage;
+}
+
+static const char *get_stage_name(uint32 stage)
+{
+	if(stage < handshake_stage_count)
+		return handshake_stage_names[stage];
+	return stage == info_stage ? "info" : "connection";
+}
+
+/// Counts the datagrams the local address sent during the replay, as recorded in output_file, whose payloads appear among those it sent in the capture.
+static uint32 count_matching_sends(const char *output_file, const net::address &local, replay_record *records, uint32 record_count, uint32 *replayed_sends)
+{
+	hash_table_flat<uint32, uint32> recorded;
+	for(uint32 i = 0; i < record_count; i++)
+	{
+		if(records[i].source != local)
+			continue;
+		uint32 digest = digest_data(records[i].data, records[i].data_size);
+		hash_table_flat<uint32, uint32>::pointer p = recorded.find(digest);
+		if(p)
+			(*p.value())++;
+		else
+			recorded.insert(digest, 1);
+	}
+	uint32 matches = 0;
+	*replayed_sends = 0;
+	net::packet_capture_reader reader;
+	net::packet_capture_record record;
+	if(!reader.open(output_file))
+		return 0;
+	while(reader.read(record))
+	{
+		if(record.source != local)
+			continue;
+		(*replayed_sends)++;
+		hash_table_flat<uint32, uint32>::pointer p = recorded.find(digest_data(record.data, record.data_size));
+		if(p && *p.value())
+		{
+			(*p.value())--;
+			matches++;
+		}
+	}
+	return matches;
+}
+
+static bool choose_local_address(const replay_options &options, replay_record *records, uint32 record_count, net::address &local)
+{
+	if(options.key_file)
+	{
+		// the capture records the socket's bound address as it was given, so a socket bound to any host appears with host 0 both here and in the capture.
+		net::torque_socket keys;
+		if(!keys.load_capture_keys(options.key_file, &local))
+		{
+			fprintf(stderr, "can't read key file %s\n", options.key_file);
+			return false;
+		}
+		return true;
+	}
+	if(options.local)
+	{
+		if(!local.set(options.local))
+		{
+			fprintf(stderr, "bad --local address %s\n", options.local);
+			return false;
+		}
+		return true;
+	}
+	hash_table_flat<net::address, uint32> counts;
+	uint32 best_count = 0;
+	for(uint32 i = 0; i < record_count; i++)
+	{
+		for(uint32 j = 0; j < 2; j++)
+		{
+			const net::address &a = j ? records[i].destination : records[i].source;
+			hash_table_flat<net::address, uint32>::pointer p = counts.find(a);
+			if(!p)
+				p = counts.insert(a, 0);
+			uint32 count = ++(*p.value());
+			if(count > best_count)
+			{
+				best_count = count;
+				local = a;
+			}
+		}
+	}
+	return best_count != 0;
+}
+
+int main(int argc, const char **argv)
+{
+	ltc_mp = ltm_desc;
+	replay_options options;
+	for(int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if(!strcmp(argv[i], "--keys") && has_value)
+			options.key_file = argv[++i];
+		else if(!strcmp(argv[i], "--local") && has_value)
+			options.local = argv[++i];
+		else if(!strcmp(argv[i], "--output") && has_value)
+			options.output_file = argv[++i];
+		else if(!strcmp(argv[i], "--speed") && has_value && (!strcmp(argv[i + 1], "original") || !strcmp(argv[i + 1], "max")))
+			options.original_speed = !strcmp(argv[++i], "original");
+		else if(!strcmp(argv[i], "--repeat") && has_value)
+			options.repeat = atoi(argv[++i]);
+		else if(argv[i][0] != '-' && !options.capture_file)
+			options.capture_file = argv[i];
+		else
+			options.repeat = 0;
+	}
+	if(!options.capture_file || !options.repeat)
+	{
+		printf("usage: %s <capture.pcap> [--keys <key file>] [--local <address>] [--speed original|max] [--repeat <count>] [--output <pcap>]\n", argv[0]);
+		return 1;
+	}
+
+	net::packet_capture_reader reader;
+	if(!reader.open(options.capture_file))
+	{
+		fprintf(stderr, "can't read capture %s\n", options.capture_file);
+		return 1;
+	}
+	array<replay_record> records;
+	net::packet_capture_record record;
+	while(reader.read(record))
+	{
+		replay_record r;
+		r.time = record.time;
+		r.source = record.source;
+		r.destination = record.destination;
+		r.data_size = record.data_size;
+		r.data = (uint8 *) memory_allocate(record.data_size ? record.data_size : 1);
+		memcpy(r.data, record.data, record.data_size);
+		records.push_back(r);
+	}
+	reader.close();
+	if(!records.size())
+	{
+		fprintf(stderr, "no UDP datagrams in %s\n", options.capture_file);
+		return 1;
+	}
+
+	net::address local;
+	if(!choose_local_address(options, records.begin(), records.size(), local))
+		return 1;
+	uint32 inbound = 0, outbound = 0;
+	for(uint32 i = 0; i < records.size(); i++)
+	{
+		if(records[i].destination == local)
+			inbound++;
+		else if(records[i].source == local)
+			outbound++;
+	}
+	printf("%s: %u datagrams, %u to and %u from %s, over %.3f s\n", options.capture_file, records.size(), inbound, outbound, local.to_string().c_str(), float64(records[records.size() - 1].time - records[0].time) / 1000000);
+
+	net::latency_histogram stage_time[stage_count];
+	uint32 first_digest = 0;
+	bool digests_match = true;
+	for(uint32 pass = 0; pass < options.repeat; pass++)
+	{
+		// start the clock just before the first datagram, so timers the socket sets up when it's bound line up with the capture.
+		net::simulated_network network(replay_seed, records[0].time - 1);
+		replay r;
+		r.events = 0;
+		r.digest = 2166136261U;
+		r.socket = new net::torque_socket();
+		if(r.socket->bind_simulated(&network, local) != bind_success)
+		{
+			fprintf(stderr, "can't bind %s\n", local.to_string().c_str());
+			return 1;
+		}
+		if(options.key_file)
+			r.socket->load_capture_keys(options.key_file);
+		if(options.output_file)
+			r.socket->start_capture(options.output_file);
+
+		int64 real_start = net::time_source::read_monotonic_microseconds();
+		int64 processing_time = 0;
+		for(uint32 i = 0; i < records.size(); i++)
+		{
+			replay_record &rec = records[i];
+			if(rec.destination != local)
+				continue;
+			network.run_until(rec.time - 1, process_socket, &r);
+			if(options.original_speed)
+			{
+				int64 wait = (rec.time - records[0].time) - (net::time_source::read_monotonic_microseconds() - real_start);
+				if(wait > 0)
+					wait_microseconds(wait);
+			}
+			network.inject(rec.source, rec.destination, rec.data, rec.data_size, rec.time);
+			int64 start = net::time_source::read_monotonic_microseconds();
+			network.run_until(rec.time, process_socket, &r);
+			int64 elapsed = net::time_source::read_monotonic_microseconds() - start;
+			processing_time += elapsed;
+			stage_time[get_stage(rec)].record(elapsed);
+		}
+		// let the socket's timers run out the rest of the capture.
+		network.run_until(records[records.size() - 1].time, process_socket, &r);
+		int64 real_time = net::time_source::read_monotonic_microseconds() - real_start;
+		int64 virtual_time = network.get_time() - records[0].time;
+		r.socket->stop_capture();
+
+		printf("pass %u: %u events, digest %08x, %.3f s virtual in %.3f s real, %.3f s processing, %.0f datagrams/s\n", pass + 1, r.events, r.digest, float64(virtual_time) / 1000000, float64(real_time) / 1000000, float64(processing_time) / 1000000, processing_time ? float64(inbound) * 1000000 / float64(processing_time) : 0.0);
+		if(!pass)
+			first_digest = r.digest;
+		else if(r.digest != first_digest)
+			digests_match = false;
+		delete r.socket;
+	}
+	if(options.repeat > 1)
+		printf("digests %s across %u passes\n", digests_match ? "match" : "DIFFER", options.repeat);
+	if(options.output_file)
+	{
+		uint32 replayed_sends;
+		uint32 matches = count_matching_sends(options.output_file, local, records.begin(), records.size(), &replayed_sends);
+		printf("sent %u datagrams (capture: %u), %u identical to the capture\n", replayed_sends, outbound, matches);
+	}
+
+	printf("%-30s %8s %10s %10s %10s\n", "stage", "count", "mean us", "p50 us", "p99 us");
+	for(uint32 i = 0; i < stage_count; i++)
+	{
+		if(stage_time[i].get_count())
+			printf("%-30s %8u %10u %10u %10u\n", get_stage_name(i), stage_time[i].get_count(), stage_time[i].get_mean(), stage_time[i].get_percentile(0.5), stage_time[i].get_percentile(0.99));
+	}
+
+	for(uint32 i = 0; i < records.size(); i++)
+		memory_deallocate(records[i].data);
+	return 0;
+}
@@ -0,0 +1,46 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+// flight_recorder_decode - prints packet flight recorder dumps (see torque_socket_get_flight_record) as timelines.
+
+#include <stdio.h>
+
+#include "core/platform.h"
+
+namespace core
+{
+	#include "core/core.h"
+	struct net {
+		#include "torque_sockets/time.h"
+		#include "torque_sockets/packet_flight_recorder.h"
+	};
+};
+
+int main(int argc, const char **argv)
+{
+	if(argc < 2)
+	{
+		printf("usage: %s <dump file> [<dump file> ...]\n", argv[0]);
+		return 1;
+	}
+	int result = 0;
+	for(int i = 1; i < argc; i++)
+	{
+		FILE *f = fopen(argv[i], "rb");
+		if(!f)
+		{
+			printf("%s: could not open file.\n", argv[i]);
+			result = 1;
+			continue;
+		}
+		core::uint8 buffer[core::net::packet_flight_recorder::dump_max_size];
+		core::uint32 size = core::uint32(fread(buffer, 1, sizeof(buffer), f));
+		fclose(f);
+
+		printf("%s:\n", argv[i]);
+		if(!core::net::packet_flight_recorder::print_timeline(buffer, size, stdout))
+		{
+			printf("%s: not a valid flight recorder dump.\n", argv[i]);
+			result = 1;
+		}
+	}
+	return result;
+}
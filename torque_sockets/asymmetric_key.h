@@ -1,9 +1,9 @@
 #define crypto_key            ecc_key
-#define crypto_make_key       ecc_make_key
+#define crypto_make_key       fixed_ecc_make_key
 #define crypto_free           ecc_free
 #define crypto_import         ecc_import
 #define crypto_export         ecc_export
-#define crypto_shared_secret  ecc_shared_secret
+#define crypto_shared_secret  fixed_ecc_shared_secret
 
 class asymmetric_key : public ref_object
 {
@@ -109,6 +109,7 @@ class asymmetric_key : public ref_object
 	/// Generates a new asymmetric key of key_size bytes
 	asymmetric_key(uint32 key_size, random_generator &the_random_generator)
 	{
+		TorqueTraceSpan("asymmetric_key::generate");
 		uint8 static_crypto_buffer[static_crypto_buffer_size];
 		_is_valid = false;
 
@@ -175,6 +176,7 @@ class asymmetric_key : public ref_object
 	/// for a symmetric crypto.
 	byte_buffer_ptr compute_shared_secret_key(asymmetric_key *publicKey)
 	{
+		TorqueTraceSpan("asymmetric_key::compute_shared_secret_key");
 		if(publicKey->get_key_size() != get_key_size() || !_has_private_key)
 			return NULL;
 
@@ -1,6 +1,7 @@
 /// Hashes the bit_stream, writing the hash digest into the end of the buffer, and then encrypts with the given cipher
 static void bit_stream_hash_and_encrypt(bit_stream &the_stream, uint32 hash_digest_size, uint32 encrypt_start_offset, symmetric_cipher *the_cipher)
 {
+	TorqueTraceSpan("bit_stream_hash_and_encrypt");
 	uint32 digest_start = the_stream.get_next_byte_position();
 	the_stream.set_byte_position(digest_start);
 	hash_state hash_state;
@@ -24,6 +25,7 @@ static void bit_stream_hash_and_encrypt(bit_stream &the_stream, uint32 hash_dige
 /// Decrypts the bit_stream, then checks the hash digest at the end of the buffer to validate the contents
 static bool bit_stream_decrypt_and_check_hash(bit_stream &the_stream, uint32 hash_digest_size, uint32 decrypt_start_offset, symmetric_cipher *the_cipher)
 {
+	TorqueTraceSpan("bit_stream_decrypt_and_check_hash");
 	uint32 buffer_size = the_stream.get_stream_byte_size();
 	uint8 *buffer = the_stream.get_buffer();
 	
@@ -177,6 +179,119 @@ static uint32 buffer_calculate_crc(const uint8 *buffer, uint32 len, uint32 crcVa
    return(crcVal);
 }
 
+/// Returns true if the CPU has the SSE4.2 crc32 instruction.
+static bool crc32c_hardware_available()
+{
+#if defined(CPU_X86_INTRINSICS)
+#if defined(COMPILER_VISUALC)
+	int registers[4];
+	__cpuid(registers, 1);
+	return (registers[2] >> 20) & 1;
+#else
+	unsigned eax, ebx, ecx, edx;
+	return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((ecx >> 20) & 1);
+#endif
+#else
+	return false;
+#endif
+}
+
+#if defined(CPU_X86_INTRINSICS)
+#if defined(COMPILER_GCC)
+__attribute__((target("sse4.2")))
+#endif
+static uint32 _crc32c_hardware(const uint8 *buffer, uint32 len, uint32 crc)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64 crc64 = crc;
+	for(; len >= 8; len -= 8, buffer += 8)
+	{
+		uint64 word;
+		memcpy(&word, buffer, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = uint32(crc64);
+#endif
+	for(; len >= 4; len -= 4, buffer += 4)
+	{
+		uint32 word;
+		memcpy(&word, buffer, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+	}
+	for(; len; len--)
+		crc = _mm_crc32_u8(crc, *buffer++);
+	return crc;
+}
+#endif
+
+/// CRC32C with eight lookup tables, consuming eight bytes per step.
+static uint32 _crc32c_portable(const uint8 *buffer, uint32 len, uint32 crc)
+{
+	static uint32 crc_tables[8][256];
+	static bool crc_tables_valid = false;
+
+	if(!crc_tables_valid)
+	{
+		for(uint32 i = 0; i < 256; i++)
+		{
+			uint32 val = i;
+			for(uint32 j = 0; j < 8; j++)
+				val = (val & 1) ? 0x82f63b78 ^ (val >> 1) : val >> 1;
+			crc_tables[0][i] = val;
+		}
+		for(uint32 i = 0; i < 256; i++)
+			for(uint32 k = 1; k < 8; k++)
+				crc_tables[k][i] = (crc_tables[k - 1][i] >> 8) ^ crc_tables[0][crc_tables[k - 1][i] & 0xff];
+		crc_tables_valid = true;
+	}
+
+	for(; len >= 8; len -= 8, buffer += 8)
+	{
+		uint32 low = crc ^ (buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (uint32(buffer[3]) << 24));
+		uint32 high = buffer[4] | (buffer[5] << 8) | (buffer[6] << 16) | (uint32(buffer[7]) << 24);
+		crc = crc_tables[7][low & 0xff] ^ crc_tables[6][(low >> 8) & 0xff] ^ crc_tables[5][(low >> 16) & 0xff] ^ crc_tables[4][low >> 24] ^
+			crc_tables[3][high & 0xff] ^ crc_tables[2][(high >> 8) & 0xff] ^ crc_tables[1][(high >> 16) & 0xff] ^ crc_tables[0][high >> 24];
+	}
+	for(; len; len--)
+		crc = crc_tables[0][(crc ^ *buffer++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+/// Returns a 32 bit CRC32C (Castagnoli) for the buffer, computed with the SSE4.2 crc32 instruction when the CPU has it.  As with buffer_calculate_crc the result isn't inverted, so it can be passed back in to continue the CRC over more data; the standard CRC32C value is its complement.
+static uint32 buffer_calculate_crc32c(const uint8 *buffer, uint32 len, uint32 crc = 0xFFFFFFFF)
+{
+#if defined(CPU_X86_INTRINSICS)
+	static bool hardware = crc32c_hardware_available();
+	if(hardware)
+		return _crc32c_hardware(buffer, len, crc);
+#endif
+	return _crc32c_portable(buffer, len, crc);
+}
+
+static void crc32c_test()
+{
+	printf("---- crc32c unit test: ----\n");
+	const uint8 *check = (const uint8 *) "123456789";
+	printf("check value %08x (e3069283), portable %08x (e3069283)\n", ~buffer_calculate_crc32c(check, 9), ~_crc32c_portable(check, 9, 0xFFFFFFFF));
+
+	// Every length and alignment up to a few words, in one piece and in two.
+	uint8 buffer[80];
+	for(uint32 i = 0; i < sizeof(buffer); i++)
+		buffer[i] = uint8(i * 167 + 13);
+	uint32 mismatches = 0;
+	for(uint32 offset = 0; offset < 8; offset++)
+	{
+		for(uint32 len = 0; len + offset <= sizeof(buffer); len++)
+		{
+			uint32 reference = _crc32c_portable(buffer + offset, len, 0xFFFFFFFF);
+			uint32 split = len / 3;
+			if(buffer_calculate_crc32c(buffer + offset, len) != reference || buffer_calculate_crc32c(buffer + offset + split, len - split, buffer_calculate_crc32c(buffer + offset, split)) != reference)
+				mismatches++;
+		}
+	}
+	printf("%s: %u mismatches with the portable code (0)\n", crc32c_hardware_available() ? "hardware" : "portable", mismatches);
+}
+
 static void write_uint32_to_buffer(uint32 value, uint8 *buffer)
 {
 	buffer[0] = value >> 24;
@@ -221,3 +336,82 @@ static uint16 read_uint16_from_buffer(const uint8 *buffer)
 }
 
 
+
+enum {
+	siphash_key_size = 16,
+};
+
+static uint64 _siphash_read_uint64(const uint8 *buf)
+{
+	uint64 value = 0;
+	for(int32 i = 7; i >= 0; i--)
+		value = (value << 8) | buf[i];
+	return value;
+}
+
+static inline uint64 _siphash_rotate(uint64 value, uint32 bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline void _siphash_round(uint64 &v0, uint64 &v1, uint64 &v2, uint64 &v3)
+{
+	v0 += v1; v1 = _siphash_rotate(v1, 13); v1 ^= v0; v0 = _siphash_rotate(v0, 32);
+	v2 += v3; v3 = _siphash_rotate(v3, 16); v3 ^= v2;
+	v0 += v3; v3 = _siphash_rotate(v3, 21); v3 ^= v0;
+	v2 += v1; v1 = _siphash_rotate(v1, 17); v1 ^= v2; v2 = _siphash_rotate(v2, 32);
+}
+
+/// Returns the SipHash-2-4 of the buffer under a siphash_key_size byte key.  SipHash is a keyed hash built for short inputs: a few tens of nanoseconds for a handful of bytes, and without the key its output can't be predicted or forged.
+static uint64 buffer_siphash(const uint8 key[siphash_key_size], const uint8 *buffer, uint32 len)
+{
+	uint64 k0 = _siphash_read_uint64(key);
+	uint64 k1 = _siphash_read_uint64(key + 8);
+	uint64 v0 = k0 ^ 0x736f6d6570736575ULL;
+	uint64 v1 = k1 ^ 0x646f72616e646f6dULL;
+	uint64 v2 = k0 ^ 0x6c7967656e657261ULL;
+	uint64 v3 = k1 ^ 0x7465646279746573ULL;
+
+	uint32 end = len & ~7;
+	for(uint32 i = 0; i < end; i += 8)
+	{
+		uint64 m = _siphash_read_uint64(buffer + i);
+		v3 ^= m;
+		_siphash_round(v0, v1, v2, v3);
+		_siphash_round(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	uint64 last = uint64(len) << 56;
+	for(uint32 i = 0; i < (len & 7); i++)
+		last |= uint64(buffer[end + i]) << (i * 8);
+	v3 ^= last;
+	_siphash_round(v0, v1, v2, v3);
+	_siphash_round(v0, v1, v2, v3);
+	v0 ^= last;
+
+	v2 ^= 0xff;
+	for(uint32 i = 0; i < 4; i++)
+		_siphash_round(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void siphash_test()
+{
+	printf("---- siphash unit test: ----\n");
+	// Vectors from the SipHash reference implementation: key 00 01 .. 0f, message 00 01 .. (length - 1).
+	static const struct { uint32 length; uint64 hash; } vectors[] = {
+		{ 0, 0x726fdb47dd0e0e31ULL },
+		{ 8, 0x93f5f5799a932462ULL },
+		{ 15, 0xa129ca6149be45e5ULL },
+	};
+	uint8 key[siphash_key_size], message[16];
+	for(uint32 i = 0; i < siphash_key_size; i++)
+		key[i] = uint8(i);
+	for(uint32 i = 0; i < sizeof(message); i++)
+		message[i] = uint8(i);
+	uint32 failures = 0;
+	for(uint32 i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+		if(buffer_siphash(key, message, vectors[i].length) != vectors[i].hash)
+			failures++;
+	printf("%u known answer failures (0)\n", failures);
+}
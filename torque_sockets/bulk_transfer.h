@@ -0,0 +1,281 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// A file mapped into memory, read only for sending or read/write for receiving.  An empty file maps to a NULL pointer with size 0.
+class mapped_file
+{
+public:
+	mapped_file()
+	{
+#if defined(PLATFORM_WIN32)
+		_file = INVALID_HANDLE_VALUE;
+		_mapping = 0;
+#else
+		_file = -1;
+#endif
+		_data = 0;
+		_size = 0;
+	}
+
+	~mapped_file()
+	{
+		close();
+	}
+
+	/// Maps an existing file for reading.  Returns false if it can't be opened or mapped.
+	bool open_for_read(const char *file_name)
+	{
+		close();
+#if defined(PLATFORM_WIN32)
+		_file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+		LARGE_INTEGER size;
+		if(_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size))
+			return _fail();
+		_size = uint64(size.QuadPart);
+#else
+		_file = ::open(file_name, O_RDONLY);
+		struct stat status;
+		if(_file == -1 || fstat(_file, &status))
+			return _fail();
+		_size = uint64(status.st_size);
+#endif
+		return _map(false);
+	}
+
+	/// Creates (or replaces) a file of exactly size bytes and maps it for writing.  Returns false if it can't be created, sized or mapped.
+	bool create(const char *file_name, uint64 size)
+	{
+		close();
+		_size = size;
+#if defined(PLATFORM_WIN32)
+		_file = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+		if(_file == INVALID_HANDLE_VALUE)
+			return _fail();
+		LARGE_INTEGER end;
+		end.QuadPart = LONGLONG(size);
+		if(!SetFilePointerEx(_file, end, 0, FILE_BEGIN) || !SetEndOfFile(_file))
+			return _fail();
+#else
+		_file = ::open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(_file == -1 || ftruncate(_file, off_t(size)))
+			return _fail();
+#endif
+		return _map(true);
+	}
+
+	void close()
+	{
+#if defined(PLATFORM_WIN32)
+		if(_data)
+			UnmapViewOfFile(_data);
+		if(_mapping)
+			CloseHandle(_mapping);
+		if(_file != INVALID_HANDLE_VALUE)
+			CloseHandle(_file);
+		_file = INVALID_HANDLE_VALUE;
+		_mapping = 0;
+#else
+		if(_data)
+			munmap(_data, size_t(_size));
+		if(_file != -1)
+			::close(_file);
+		_file = -1;
+#endif
+		_data = 0;
+		_size = 0;
+	}
+
+	bool is_open()
+	{
+#if defined(PLATFORM_WIN32)
+		return _file != INVALID_HANDLE_VALUE;
+#else
+		return _file != -1;
+#endif
+	}
+
+	uint8 *get_data()
+	{
+		return _data;
+	}
+
+	uint64 get_size()
+	{
+		return _size;
+	}
+private:
+#if defined(PLATFORM_WIN32)
+	HANDLE _file;
+	HANDLE _mapping;
+#else
+	int _file;
+#endif
+	uint8 *_data;
+	uint64 _size;
+
+	bool _fail()
+	{
+		close();
+		return false;
+	}
+
+	bool _map(bool writable)
+	{
+		if(!_size)
+			return true;
+		if(uint64(size_t(_size)) != _size)
+			return _fail();
+#if defined(PLATFORM_WIN32)
+		_mapping = CreateFileMappingA(_file, 0, writable ? PAGE_READWRITE : PAGE_READONLY, DWORD(_size >> 32), DWORD(_size), 0);
+		if(!_mapping)
+			return _fail();
+		_data = (uint8 *) MapViewOfFile(_mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size_t(_size));
+		if(!_data)
+			return _fail();
+#else
+		void *data = mmap(0, size_t(_size), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, _file, 0);
+		if(data == MAP_FAILED)
+			return _fail();
+		_data = (uint8 *) data;
+		madvise(data, size_t(_size), MADV_SEQUENTIAL);
+#endif
+		return true;
+	}
+};
+
+/// Constants and state for streaming a file over a connection in bulk_packet packets.  A transfer starts with an offer carrying the file's name and size.  The receiver's application accepts it by naming a file to write, which is created at full size and mapped, and the sender then streams the file in fixed size chunks read straight from its own mapping.  The notify protocol reports each chunk delivered or lost, and lost chunks are sent again, so every chunk is delivered exactly once without any acks of its own.
+struct bulk_transfer
+{
+	enum {
+		max_name_size = 255,
+		chunk_header_size = 9, ///< Message type, transfer id and chunk index.
+		chunk_size = torque_sockets_max_datagram_size - 8 - chunk_header_size - 4, ///< Payload bytes per chunk: a datagram less the largest packet header (torque_connection::max_packet_header_size), chunk header and CRC trailer.
+		reserved_window_packets = 8, ///< Packets of the connection's window that chunks never take, so game traffic can always be sent.
+		burst_chunks = 8, ///< Chunks that can be sent at once after the rate limit has built up unused budget.
+		minimum_probe_interval = 20000, ///< Microseconds without a notify, with bulk packets in flight, before pinging to draw an ack.
+		process_interval = 1000, ///< Microseconds between passes over a socket's transfers when it is scheduled by get_next_process_time.
+	};
+	/// First byte of each bulk_packet payload.
+	enum message_type {
+		offer_message, ///< Sender to receiver: transfer id, file size, name.
+		accept_message, ///< Receiver to sender: transfer id.
+		refuse_message, ///< Receiver to sender: transfer id.
+		chunk_message, ///< Sender to receiver: transfer id, chunk index, data.
+	};
+	/// What a sequenced packet in the connection's window carried, for the notify protocol: window_none, a chunk index, or one of the messages below.
+	enum window_record {
+		window_none = -1,
+		window_offer = -2,
+		window_reply = -3,
+		window_refused = -4, ///< A chunk the socket refused to send, already queued to go again.
+	};
+
+	/// Returns true if a file of size bytes can be sent.  Chunk indices are 32 bits, which caps a file at 2^32 - 1 chunks.
+	static bool is_valid_size(uint64 size)
+	{
+		return size <= uint64(0xFFFFFFFF) * chunk_size;
+	}
+
+	/// Returns the number of chunks a file of size bytes is sent in.  size must pass is_valid_size.
+	static uint32 get_chunk_count(uint64 size)
+	{
+		return uint32((size + chunk_size - 1) / chunk_size);
+	}
+
+	/// Returns the size of chunk index of a file of size bytes.
+	static uint32 get_chunk_data_size(uint64 size, uint32 index)
+	{
+		uint64 offset = uint64(index) * chunk_size;
+		return size - offset < chunk_size ? uint32(size - offset) : uint32(chunk_size);
+	}
+
+	/// A bitmap of one bit per chunk.
+	struct chunk_set
+	{
+		array<uint32> words;
+		uint32 count; ///< Number of bits set.
+
+		void reset(uint32 chunk_count)
+		{
+			words.clear();
+			words.resize((chunk_count + 31) >> 5);
+			for(uint32 i = 0; i < words.size(); i++)
+				words[i] = 0;
+			count = 0;
+		}
+		bool contains(uint32 index)
+		{
+			return (words[index >> 5] >> (index & 31)) & 1;
+		}
+		/// Sets the bit for index, returning false if it was already set.
+		bool insert(uint32 index)
+		{
+			if(contains(index))
+				return false;
+			words[index >> 5] |= 1 << (index & 31);
+			count++;
+			return true;
+		}
+	};
+
+	/// The sending side of a transfer.
+	struct sender
+	{
+		enum state_type {
+			idle,
+			offering, ///< The offer is in flight, or delivered and waiting for the receiver's answer.
+			sending,
+		};
+		state_type state;
+		uint32 transfer_id;
+		mapped_file file;
+		byte_buffer_ptr name;
+		uint32 chunk_count;
+		uint32 next_chunk; ///< First chunk never sent.
+		array<uint32> resend; ///< Chunks reported lost, to be sent again.
+		chunk_set delivered;
+		bool offer_lost; ///< The offer hasn't been sent yet, or was reported lost and has to be sent again.
+		uint32 max_bytes_per_second; ///< 0 for no limit other than the window.
+		int64 budget; ///< Bytes, times 1000000, that can be sent now under the rate limit.  Kept in byte-microseconds so that frequent small refills don't round away.
+		int64 last_budget_time; ///< Microseconds when the budget was last refilled.
+
+		sender()
+		{
+			state = idle;
+			transfer_id = 0;
+			chunk_count = 0;
+			next_chunk = 0;
+			offer_lost = false;
+			max_bytes_per_second = 0;
+			budget = 0;
+			last_budget_time = 0;
+		}
+	};
+
+	/// The receiving side of a transfer.
+	struct receiver
+	{
+		enum state_type {
+			idle,
+			offered, ///< The offer has been posted to the application, which hasn't answered yet.
+			receiving,
+		};
+		state_type state;
+		uint32 transfer_id;
+		uint64 size;
+		mapped_file file;
+		uint32 chunk_count;
+		chunk_set received;
+		message_type reply; ///< accept_message or refuse_message, for the last offer the application answered.
+		bool reply_pending; ///< The reply has to be sent (again), even after the transfer itself is over.
+
+		receiver()
+		{
+			state = idle;
+			transfer_id = 0;
+			size = 0;
+			chunk_count = 0;
+			reply = refuse_message;
+			reply_pending = false;
+		}
+	};
+};
@@ -4,6 +4,7 @@ public:
 	puzzle_solver() : thread_queue(1) { }
 	void process_request(const byte_buffer_ptr &the_request, byte_buffer_ptr &the_response, bool *cancelled, float *progress)
 	{
+		TorqueTraceSpan("puzzle_solver::process_request");
 		nonce the_nonce;
 		nonce remote_nonce;
 		uint32 puzzle_difficulty;
@@ -14,7 +15,7 @@ public:
 		core::read(s, puzzle_difficulty);
 		core::read(s, client_identity);
 		uint32 solution = 0;
-		time start = time::get_current();
+		int64 start = time_source::read_monotonic_microseconds();
 		for(;;)
 		{
 			if(*cancelled)
@@ -26,11 +27,13 @@ public:
 		}
 		if(!*cancelled)
 		{
-			byte_buffer_ptr response = new byte_buffer(sizeof(solution));
+			uint32 solve_time = uint32(time_source::read_monotonic_microseconds() - start);
+			byte_buffer_ptr response = new byte_buffer(sizeof(solution) + sizeof(solve_time));
 			bit_stream s(response->get_buffer(), response->get_buffer_size());
 			core::write(s, solution);
+			core::write(s, solve_time);
 			the_response = response;
-			TorqueLogMessageFormatted(LogNettorque_socket, ("Client puzzle solved in %lli ms.", (time::get_current() - start).get_milliseconds()));
+			TorqueLogMessageFormatted(LogNettorque_socket, ("Client puzzle solved in %u us.", solve_time));
 		}
 	}
 };
@@ -164,6 +167,7 @@ private:
 	/// Checks a puzzle solution submitted by a client to see if it is a valid solution for the current or previous puzzle nonces
 	result_code check_solution(uint32 solution, nonce &client_nonce, nonce &server_nonce, uint32 puzzle_difficulty, uint32 client_identity)
 	{
+		TorqueTraceSpan("client_puzzle_manager::check_solution");
 		if(puzzle_difficulty != _current_difficulty)
 			return invalid_puzzle_difficulty;
 		nonce_table *the_table = NULL;
@@ -210,6 +214,25 @@ private:
 	/// Returns the current server nonce
 	nonce get_current_nonce() { return _current_nonce; }
 
+	/// Returns the previous server nonce, for which solutions are still accepted.
+	nonce get_last_nonce() { return _last_nonce; }
+
+	/// Returns the time the server nonce was last refreshed.
+	time get_last_update_time() { return _last_update_time; }
+
+	/// Sets the server nonces and the time they were last refreshed, as read from a capture key file.  Solutions already accepted are forgotten.
+	void restore(nonce current_nonce, nonce last_nonce, time last_update_time)
+	{
+		_current_nonce = current_nonce;
+		_last_nonce = last_nonce;
+		_last_update_time = last_update_time;
+		_current_nonce_table->reset();
+		_last_nonce_table->reset();
+	}
+
 	/// Returns the current client puzzle difficulty
 	uint32 get_current_difficulty() { return _current_difficulty; }
+
+	/// Sets the difficulty of the puzzles handed out from now on, clamped to max_puzzle_difficulty.  Solutions to puzzles of any other difficulty are rejected.
+	void set_current_difficulty(uint32 difficulty) { _current_difficulty = difficulty > max_puzzle_difficulty ? max_puzzle_difficulty : difficulty; }
 };
@@ -0,0 +1,591 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+#if defined(__SIZEOF_INT128__)
+typedef uint64 fixed_ecc_limb; ///< Limbs are 64 bits where the compiler has a 128 bit type for their products.
+typedef unsigned __int128 fixed_ecc_double_limb;
+#else
+typedef uint32 fixed_ecc_limb;
+typedef uint64 fixed_ecc_double_limb;
+#endif
+
+/// fixed_ecc_curve does elliptic curve arithmetic for one of the small curves torque_sockets keys use, with every value held on the stack in fixed arrays of limbs.  Field elements are kept in Montgomery form, points are kept in Jacobian coordinates so that only the final conversion to affine needs an inversion, and scalar multiplication uses a width 4 non-adjacent form, costing about one point addition per five scalar bits.  The curves must have a = -3, as the SECG r1 curves do.  Like libtomcrypt's ltc_ecc_mulmod (LTC_ECC_TIMING_RESISTANT isn't defined), the scalar multiply is not constant time.
+template<uint32 byte_size> class fixed_ecc_curve
+{
+public:
+	enum {
+		limb_bits = sizeof(fixed_ecc_limb) * 8,
+		limb_count = (byte_size + sizeof(fixed_ecc_limb) - 1) / sizeof(fixed_ecc_limb),
+		scalar_byte_size = byte_size + 4, ///< Largest scalar multiply accepts.  Private keys can be larger than the field, since the order of SECP160R1 is 161 bits.
+		scalar_limb_count = (scalar_byte_size + sizeof(fixed_ecc_limb)) / sizeof(fixed_ecc_limb), ///< Leaves room for the NAF recoding to carry out of the top of the scalar.
+		window_size = 4,
+		table_size = 1 << (window_size - 2), ///< Odd multiples P, 3P, 5P and 7P.
+	};
+	typedef fixed_ecc_limb limb;
+	typedef fixed_ecc_double_limb double_limb;
+	typedef limb field[limb_count]; ///< Least significant limb first.
+
+	struct point
+	{
+		field x;
+		field y;
+		field z; ///< Zero for the point at infinity.
+	};
+
+	/// Sets up the curve from its libtomcrypt parameter set.
+	fixed_ecc_curve(const ltc_ecc_set_type *parameters)
+	{
+		_read_hex(_p, parameters->prime);
+		_p_inverse = 1;
+		for(uint32 i = 0; i < 6; i++)
+			_p_inverse *= 2 - _p[0] * _p_inverse;
+		_p_inverse = 0 - _p_inverse;
+
+		// 2^(2 * limb_bits * limb_count) mod p, by doubling 1.
+		memset(_r_squared, 0, sizeof(_r_squared));
+		_r_squared[0] = 1;
+		for(uint32 i = 0; i < 2 * limb_bits * limb_count; i++)
+			_add(_r_squared, _r_squared, _r_squared);
+		memset(_one, 0, sizeof(_one));
+		_one[0] = 1;
+		_to_montgomery(_one, _one);
+
+		field raw;
+		_read_hex(raw, parameters->B);
+		_to_montgomery(_b, raw);
+		_read_hex(raw, parameters->Gx);
+		_to_montgomery(_generator.x, raw);
+		_read_hex(raw, parameters->Gy);
+		_to_montgomery(_generator.y, raw);
+		memcpy(_generator.z, _one, sizeof(field));
+	}
+
+	/// Computes scalar * (x, y), where x and y are big endian byte_size coordinates of a point on the curve and scalar is a big endian number of scalar_size bytes.  Writes the affine result to x_out and y_out.  Returns false, writing nothing, if the point is not on the curve, the scalar is too large, or the result is the point at infinity; the caller falls back to libtomcrypt for those.
+	bool multiply(const uint8 *x, const uint8 *y, const uint8 *scalar, uint32 scalar_size, uint8 *x_out, uint8 *y_out)
+	{
+		point p;
+		if(!_read_coordinate(p.x, x) || !_read_coordinate(p.y, y))
+			return false;
+		memcpy(p.z, _one, sizeof(field));
+		if(!_is_on_curve(p))
+			return false;
+		return _multiply(p, scalar, scalar_size, x_out, y_out);
+	}
+
+	/// Computes scalar * G for the curve's base point G.
+	bool multiply_generator(const uint8 *scalar, uint32 scalar_size, uint8 *x_out, uint8 *y_out)
+	{
+		return _multiply(_generator, scalar, scalar_size, x_out, y_out);
+	}
+private:
+	field _p;
+	limb _p_inverse; ///< -p^-1 mod 2^limb_bits, for Montgomery reduction.
+	field _r_squared; ///< R^2 mod p, where R = 2^(limb_bits * limb_count); multiplying by it converts into Montgomery form.
+	field _one; ///< R mod p: one in Montgomery form.
+	field _b; ///< The curve's b coefficient in Montgomery form.
+	point _generator;
+
+	static void _read_hex(field result, const char *hex)
+	{
+		memset(result, 0, sizeof(field));
+		uint32 length = uint32(strlen(hex));
+		for(uint32 i = 0; i < length && i < limb_count * limb_bits / 4; i++)
+		{
+			char c = hex[length - 1 - i];
+			limb digit = c >= 'a' ? c - 'a' + 10 : c >= 'A' ? c - 'A' + 10 : c - '0';
+			result[i / (limb_bits / 4)] |= digit << ((i % (limb_bits / 4)) * 4);
+		}
+	}
+
+	/// Reads a big endian number of size bytes into count limbs.
+	static void _read_bytes(limb *result, uint32 count, const uint8 *bytes, uint32 size)
+	{
+		memset(result, 0, count * sizeof(limb));
+		for(uint32 i = 0; i < size; i++)
+			result[i / sizeof(limb)] |= limb(bytes[size - 1 - i]) << ((i % sizeof(limb)) * 8);
+	}
+
+	/// Reads a big endian coordinate into Montgomery form.  Returns false if it isn't less than p.
+	bool _read_coordinate(field result, const uint8 *bytes)
+	{
+		field raw;
+		_read_bytes(raw, limb_count, bytes, byte_size);
+		if(!_less(raw, _p))
+			return false;
+		_to_montgomery(result, raw);
+		return true;
+	}
+
+	void _write_coordinate(uint8 *bytes, const field value)
+	{
+		field raw;
+		_from_montgomery(raw, value);
+		for(uint32 i = 0; i < byte_size; i++)
+			bytes[byte_size - 1 - i] = uint8(raw[i / sizeof(limb)] >> ((i % sizeof(limb)) * 8));
+	}
+
+	static bool _less(const field a, const field b)
+	{
+		for(uint32 i = limb_count; i--; )
+			if(a[i] != b[i])
+				return a[i] < b[i];
+		return false;
+	}
+
+	static bool _is_zero(const field a)
+	{
+		limb bits = 0;
+		for(uint32 i = 0; i < limb_count; i++)
+			bits |= a[i];
+		return bits == 0;
+	}
+
+	static bool _equal(const field a, const field b)
+	{
+		return !memcmp(a, b, sizeof(field));
+	}
+
+	/// result = a + b, returning the carry out.
+	static limb _add_raw(field result, const field a, const field b)
+	{
+		double_limb carry = 0;
+		for(uint32 i = 0; i < limb_count; i++)
+		{
+			carry += double_limb(a[i]) + b[i];
+			result[i] = limb(carry);
+			carry >>= limb_bits;
+		}
+		return limb(carry);
+	}
+
+	/// result = a - b, returning the borrow out.
+	static limb _sub_raw(field result, const field a, const field b)
+	{
+		limb borrow = 0;
+		for(uint32 i = 0; i < limb_count; i++)
+		{
+			limb difference = a[i] - b[i];
+			limb next_borrow = (a[i] < b[i]) | (difference < borrow);
+			result[i] = difference - borrow;
+			borrow = next_borrow;
+		}
+		return borrow;
+	}
+
+	void _add(field result, const field a, const field b)
+	{
+		if(_add_raw(result, a, b) || !_less(result, _p))
+			_sub_raw(result, result, _p);
+	}
+
+	void _sub(field result, const field a, const field b)
+	{
+		if(_sub_raw(result, a, b))
+			_add_raw(result, result, _p);
+	}
+
+	/// Montgomery multiplication: result = a * b / R mod p.
+	void _mul(field result, const field a, const field b)
+	{
+		limb t[limb_count + 2];
+		memset(t, 0, sizeof(t));
+		for(uint32 i = 0; i < limb_count; i++)
+		{
+			double_limb carry = 0;
+			for(uint32 j = 0; j < limb_count; j++)
+			{
+				carry += double_limb(a[j]) * b[i] + t[j];
+				t[j] = limb(carry);
+				carry >>= limb_bits;
+			}
+			carry += t[limb_count];
+			t[limb_count] = limb(carry);
+			t[limb_count + 1] = limb(carry >> limb_bits);
+
+			limb m = t[0] * _p_inverse;
+			carry = (double_limb(m) * _p[0] + t[0]) >> limb_bits;
+			for(uint32 j = 1; j < limb_count; j++)
+			{
+				carry += double_limb(m) * _p[j] + t[j];
+				t[j - 1] = limb(carry);
+				carry >>= limb_bits;
+			}
+			carry += t[limb_count];
+			t[limb_count - 1] = limb(carry);
+			t[limb_count] = t[limb_count + 1] + limb(carry >> limb_bits);
+		}
+		if(t[limb_count] || !_less(t, _p))
+			_sub_raw(t, t, _p);
+		memcpy(result, t, sizeof(field));
+	}
+
+	void _to_montgomery(field result, const field a)
+	{
+		_mul(result, a, _r_squared);
+	}
+
+	void _from_montgomery(field result, const field a)
+	{
+		field one;
+		memset(one, 0, sizeof(one));
+		one[0] = 1;
+		_mul(result, a, one);
+	}
+
+	/// result = a^(p - 2) = a^-1 mod p.
+	void _invert(field result, const field a)
+	{
+		field exponent;
+		field two;
+		memset(two, 0, sizeof(two));
+		two[0] = 2;
+		_sub_raw(exponent, _p, two);
+		field x;
+		memcpy(x, _one, sizeof(field));
+		for(uint32 i = limb_count * limb_bits; i--; )
+		{
+			_mul(x, x, x);
+			if((exponent[i / limb_bits] >> (i % limb_bits)) & 1)
+				_mul(x, x, a);
+		}
+		memcpy(result, x, sizeof(field));
+	}
+
+	/// Checks y^2 = x^3 - 3x + b for an affine point.
+	bool _is_on_curve(const point &p)
+	{
+		field left, right, t;
+		_mul(left, p.y, p.y);
+		_mul(right, p.x, p.x);
+		_mul(right, right, p.x);
+		_add(t, p.x, p.x);
+		_add(t, t, p.x);
+		_sub(right, right, t);
+		_add(right, right, _b);
+		return _equal(left, right);
+	}
+
+	/// Jacobian doubling for a = -3 (dbl-2001-b).  Doubling the point at infinity, or a point with y = 0, gives z = 0.
+	void _double(point &result, const point &p)
+	{
+		field delta, gamma, beta, alpha, t, u;
+		_mul(delta, p.z, p.z);
+		_mul(gamma, p.y, p.y);
+		_mul(beta, p.x, gamma);
+		_sub(t, p.x, delta);
+		_add(u, p.x, delta);
+		_mul(alpha, t, u);
+		_add(t, alpha, alpha);
+		_add(alpha, alpha, t);
+
+		_add(t, p.y, p.z);
+		_mul(t, t, t);
+		_sub(t, t, gamma);
+		_sub(result.z, t, delta);
+
+		_add(beta, beta, beta);
+		_add(beta, beta, beta); // 4 beta
+		_mul(t, alpha, alpha);
+		_add(u, beta, beta);
+		_sub(result.x, t, u);
+
+		_sub(t, beta, result.x);
+		_mul(t, alpha, t);
+		_mul(gamma, gamma, gamma);
+		_add(gamma, gamma, gamma);
+		_add(gamma, gamma, gamma);
+		_add(gamma, gamma, gamma); // 8 gamma^2
+		_sub(result.y, t, gamma);
+	}
+
+	/// Jacobian addition (add-1998-cmo-2), handling the point at infinity and p == q.
+	void _add_points(point &result, const point &p, const point &q)
+	{
+		if(_is_zero(p.z))
+		{
+			result = q;
+			return;
+		}
+		if(_is_zero(q.z))
+		{
+			result = p;
+			return;
+		}
+		field z1z1, z2z2, u1, u2, s1, s2, h, r, t;
+		_mul(z1z1, p.z, p.z);
+		_mul(z2z2, q.z, q.z);
+		_mul(u1, p.x, z2z2);
+		_mul(u2, q.x, z1z1);
+		_mul(s1, p.y, q.z);
+		_mul(s1, s1, z2z2);
+		_mul(s2, q.y, p.z);
+		_mul(s2, s2, z1z1);
+		_sub(h, u2, u1);
+		_sub(r, s2, s1);
+		if(_is_zero(h))
+		{
+			if(_is_zero(r))
+				_double(result, p);
+			else
+				memset(result.z, 0, sizeof(field));
+			return;
+		}
+		field hh, hhh, v;
+		_mul(hh, h, h);
+		_mul(hhh, h, hh);
+		_mul(v, u1, hh);
+		_mul(t, p.z, q.z);
+		_mul(result.z, t, h);
+
+		_mul(t, r, r);
+		_sub(t, t, hhh);
+		_sub(t, t, v);
+		_sub(result.x, t, v);
+
+		_sub(t, v, result.x);
+		_mul(t, r, t);
+		_mul(s1, s1, hhh);
+		_sub(result.y, t, s1);
+	}
+
+	/// Recodes scalar into width 4 NAF digits, least significant first.  Returns the digit count.
+	static uint32 _recode(const limb *scalar_limbs, int8 *digits)
+	{
+		limb k[scalar_limb_count];
+		memcpy(k, scalar_limbs, sizeof(k));
+		uint32 count = 0;
+		for(;;)
+		{
+			limb bits = 0;
+			for(uint32 i = 0; i < scalar_limb_count; i++)
+				bits |= k[i];
+			if(!bits)
+				break;
+			int32 digit = 0;
+			if(k[0] & 1)
+			{
+				digit = int32(k[0] & ((1 << window_size) - 1));
+				if(digit >= (1 << (window_size - 1)))
+				{
+					// k += 2^window_size - digit
+					digit -= 1 << window_size;
+					limb carry = limb(-digit);
+					for(uint32 i = 0; i < scalar_limb_count && carry; i++)
+					{
+						k[i] += carry;
+						carry = k[i] < carry;
+					}
+				}
+				else
+					k[0] -= limb(digit);
+			}
+			digits[count++] = int8(digit);
+			for(uint32 i = 0; i < scalar_limb_count - 1; i++)
+				k[i] = (k[i] >> 1) | (k[i + 1] << (limb_bits - 1));
+			k[scalar_limb_count - 1] >>= 1;
+		}
+		return count;
+	}
+
+	bool _multiply(const point &p, const uint8 *scalar, uint32 scalar_size, uint8 *x_out, uint8 *y_out)
+	{
+		while(scalar_size && !*scalar)
+		{
+			scalar++;
+			scalar_size--;
+		}
+		if(scalar_size > scalar_byte_size)
+			return false;
+		limb k[scalar_limb_count];
+		_read_bytes(k, scalar_limb_count, scalar, scalar_size);
+
+		int8 digits[scalar_limb_count * limb_bits + 1];
+		uint32 digit_count = _recode(k, digits);
+		point table[table_size];
+		point twice;
+		table[0] = p;
+		_double(twice, p);
+		for(uint32 i = 1; i < table_size; i++)
+			_add_points(table[i], table[i - 1], twice);
+
+		point result;
+		memset(&result, 0, sizeof(result));
+		for(uint32 i = digit_count; i--; )
+		{
+			_double(result, result);
+			int32 digit = digits[i];
+			if(digit > 0)
+				_add_points(result, result, table[digit >> 1]);
+			else if(digit < 0)
+			{
+				point negated = table[(-digit) >> 1];
+				field zero;
+				memset(zero, 0, sizeof(zero));
+				_sub(negated.y, zero, negated.y);
+				_add_points(result, result, negated);
+			}
+		}
+		if(_is_zero(result.z))
+			return false;
+
+		field z_inverse, z_inverse_squared, x, y;
+		_invert(z_inverse, result.z);
+		_mul(z_inverse_squared, z_inverse, z_inverse);
+		_mul(x, result.x, z_inverse_squared);
+		_mul(y, result.y, z_inverse_squared);
+		_mul(y, y, z_inverse);
+		_write_coordinate(x_out, x);
+		_write_coordinate(y_out, y);
+		return true;
+	}
+};
+
+/// Returns the fixed_ecc_curve for the libtomcrypt parameter set index, which must be the byte_size curve fixed_ecc_key_size accepts.  Each curve is set up the first time it's used.
+template<uint32 byte_size> static fixed_ecc_curve<byte_size> *fixed_ecc_get_curve(int index)
+{
+	static fixed_ecc_curve<byte_size> curve(&ltc_ecc_sets[index]);
+	return &curve;
+}
+
+/// Returns the key size of the curve if fixed_ecc_curve implements it, or 0 if it doesn't.
+static uint32 fixed_ecc_key_size(const ltc_ecc_set_type *parameters)
+{
+	if(!strcmp(parameters->name, "SECP128R1") || !strcmp(parameters->name, "SECP160R1"))
+		return parameters->size;
+	return 0;
+}
+
+/// Multiplies the point (x, y) (or the base point, if x is NULL) of the curve with parameter set index by scalar.  Coordinates are big endian, key_size bytes.
+static bool fixed_ecc_multiply(int index, uint32 key_size, const uint8 *x, const uint8 *y, const uint8 *scalar, uint32 scalar_size, uint8 *x_out, uint8 *y_out)
+{
+	switch(key_size)
+	{
+		case 16:
+			return x ? fixed_ecc_get_curve<16>(index)->multiply(x, y, scalar, scalar_size, x_out, y_out) : fixed_ecc_get_curve<16>(index)->multiply_generator(scalar, scalar_size, x_out, y_out);
+		case 20:
+			return x ? fixed_ecc_get_curve<20>(index)->multiply(x, y, scalar, scalar_size, x_out, y_out) : fixed_ecc_get_curve<20>(index)->multiply_generator(scalar, scalar_size, x_out, y_out);
+	}
+	return false;
+}
+
+/// Writes a libtomcrypt big integer into size big endian bytes.  Returns false if it doesn't fit.
+static bool fixed_ecc_read_mp(void *value, uint8 *bytes, uint32 size)
+{
+	uint32 value_size = ltc_mp.unsigned_size(value);
+	if(value_size > size)
+		return false;
+	memset(bytes, 0, size);
+	return ltc_mp.unsigned_write(value, bytes + size - value_size) == CRYPT_OK;
+}
+
+/// Drop-in replacement for libtomcrypt's ecc_shared_secret that computes the shared point with fixed_ecc_curve for the curves it implements.  Keys on any other curve, or a public point that isn't in affine form, go to ecc_shared_secret instead.  Output is identical either way.
+static int fixed_ecc_shared_secret(ecc_key *private_key, ecc_key *public_key, unsigned char *out, unsigned long *outlen)
+{
+	TorqueTraceSpan("fixed_ecc_shared_secret");
+	if(private_key->type != PK_PRIVATE || ltc_ecc_is_valid_idx(private_key->idx) == 0 || ltc_ecc_is_valid_idx(public_key->idx) == 0 || strcmp(private_key->dp->name, public_key->dp->name))
+		return ecc_shared_secret(private_key, public_key, out, outlen);
+
+	uint32 size = fixed_ecc_key_size(private_key->dp);
+	uint8 x[20], y[20], scalar[24], x_out[20], y_out[20];
+	if(!size || ltc_mp.compare_d(public_key->pubkey.z, 1) != LTC_MP_EQ
+		|| !fixed_ecc_read_mp(public_key->pubkey.x, x, size) || !fixed_ecc_read_mp(public_key->pubkey.y, y, size)
+		|| !fixed_ecc_read_mp(private_key->k, scalar, size + 4)
+		|| !fixed_ecc_multiply(private_key->idx, size, x, y, scalar, size + 4, x_out, y_out))
+		return ecc_shared_secret(private_key, public_key, out, outlen);
+
+	if(*outlen < size)
+		return CRYPT_BUFFER_OVERFLOW;
+	memcpy(out, x_out, size);
+	*outlen = size;
+	return CRYPT_OK;
+}
+
+/// Drop-in replacement for libtomcrypt's ecc_make_key.  It draws the same random bytes and makes the same key as ecc_make_key, computing the public point with fixed_ecc_curve for the curves it implements.
+static int fixed_ecc_make_key(prng_state *prng, int wprng, int keysize, ecc_key *key)
+{
+	TorqueTraceSpan("fixed_ecc_make_key");
+	int index;
+	for(index = 0; (keysize > ltc_ecc_sets[index].size) && (ltc_ecc_sets[index].size != 0); index++)
+		;
+	uint32 size = ltc_ecc_sets[index].size ? fixed_ecc_key_size(&ltc_ecc_sets[index]) : 0;
+	if(!size)
+		return ecc_make_key(prng, wprng, keysize, key);
+
+	int err;
+	if((err = prng_is_valid(wprng)) != CRYPT_OK)
+		return err;
+	const ltc_ecc_set_type *parameters = &ltc_ecc_sets[index];
+	uint8 random[20];
+	if(prng_descriptor[wprng].read(random, size, prng) != size)
+		return CRYPT_ERROR_READPRNG;
+
+	void *order;
+	if((err = ltc_init_multi(&key->pubkey.x, &key->pubkey.y, &key->pubkey.z, &key->k, &order, NULL)) != CRYPT_OK)
+		return err;
+	uint8 scalar[24], x[20], y[20];
+	if((err = ltc_mp.read_radix(order, (char *) parameters->order, 16)) != CRYPT_OK
+		|| (err = ltc_mp.unsigned_read(key->k, random, size)) != CRYPT_OK
+		|| (ltc_mp.compare(key->k, order) != LTC_MP_LT && (err = ltc_mp.mpdiv(key->k, order, NULL, key->k)) != CRYPT_OK))
+		goto error;
+	if(!fixed_ecc_read_mp(key->k, scalar, size + 4) || !fixed_ecc_multiply(index, size, 0, 0, scalar, size + 4, x, y))
+	{
+		// k was zero; let libtomcrypt make what it makes of that.
+		ltc_deinit_multi(key->pubkey.x, key->pubkey.y, key->pubkey.z, key->k, order, NULL);
+		return ecc_make_key(prng, wprng, keysize, key);
+	}
+	if((err = ltc_mp.unsigned_read(key->pubkey.x, x, size)) != CRYPT_OK
+		|| (err = ltc_mp.unsigned_read(key->pubkey.y, y, size)) != CRYPT_OK
+		|| (err = ltc_mp.set_int(key->pubkey.z, 1)) != CRYPT_OK)
+		goto error;
+	ltc_mp.deinit(order);
+	key->type = PK_PRIVATE;
+	key->idx = index;
+	key->dp = parameters;
+	zeromem(random, sizeof(random));
+	zeromem(scalar, sizeof(scalar));
+	return CRYPT_OK;
+error:
+	ltc_deinit_multi(key->pubkey.x, key->pubkey.y, key->pubkey.z, key->k, order, NULL);
+	return err;
+}
+
+/// Checks fixed_ecc against libtomcrypt: key generation from the same random state, and shared secrets both ways.
+static void fixed_ecc_test()
+{
+	printf("---- fixed_ecc unit test: ----\n");
+	int descriptor_index = register_prng(&yarrow_desc);
+	static const int key_sizes[] = { 16, 20 };
+	for(uint32 size = 0; size < sizeof(key_sizes) / sizeof(key_sizes[0]); size++)
+	{
+		uint32 key_mismatches = 0, secret_mismatches = 0, trials = 50;
+		for(uint32 i = 0; i < trials; i++)
+		{
+			uint8 seed[8];
+			write_uint32_to_buffer(i, seed);
+			write_uint32_to_buffer(key_sizes[size], seed + 4);
+			prng_state fixed_state, reference_state;
+			yarrow_start(&fixed_state);
+			yarrow_add_entropy(seed, sizeof(seed), &fixed_state);
+			yarrow_ready(&fixed_state);
+			reference_state = fixed_state;
+
+			ecc_key fixed_key, reference_key, other_key;
+			fixed_ecc_make_key(&fixed_state, descriptor_index, key_sizes[size], &fixed_key);
+			ecc_make_key(&reference_state, descriptor_index, key_sizes[size], &reference_key);
+			ecc_make_key(&reference_state, descriptor_index, key_sizes[size], &other_key);
+			if(ltc_mp.compare(fixed_key.k, reference_key.k) != LTC_MP_EQ || ltc_mp.compare(fixed_key.pubkey.x, reference_key.pubkey.x) != LTC_MP_EQ || ltc_mp.compare(fixed_key.pubkey.y, reference_key.pubkey.y) != LTC_MP_EQ)
+				key_mismatches++;
+
+			uint8 fixed_secret[64], reference_secret[64];
+			unsigned long fixed_size = sizeof(fixed_secret), reference_size = sizeof(reference_secret);
+			fixed_ecc_shared_secret(&fixed_key, &other_key, fixed_secret, &fixed_size);
+			ecc_shared_secret(&other_key, &reference_key, reference_secret, &reference_size);
+			if(fixed_size != reference_size || memcmp(fixed_secret, reference_secret, fixed_size))
+				secret_mismatches++;
+
+			ecc_free(&fixed_key);
+			ecc_free(&reference_key);
+			ecc_free(&other_key);
+		}
+		printf("%d byte keys: %u trials, %u key mismatches (0), %u shared secret mismatches (0)\n", key_sizes[size], trials, key_mismatches, secret_mismatches);
+	}
+}
@@ -0,0 +1,130 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// latency_histogram accumulates latency samples (normally in microseconds) into log-linear buckets: each power of two range is split into sub_bucket_count linear buckets, so any recorded value is reported with at most 1/sub_bucket_count relative error.  Recording is a bit scan and an increment, and the histogram is a fixed size, so it is cheap enough to keep on every socket.
+class latency_histogram
+{
+public:
+	enum {
+		sub_bucket_bits = 3,
+		sub_bucket_count = 1 << sub_bucket_bits, ///< Linear buckets per power of two.
+		bucket_count = (32 - sub_bucket_bits + 1) * sub_bucket_count, ///< Enough buckets to hold any uint32 value.
+	};
+
+	latency_histogram()
+	{
+		reset();
+	}
+
+	/// Clears all recorded samples.
+	void reset()
+	{
+		for(uint32 i = 0; i < bucket_count; i++)
+			_buckets[i] = 0;
+		_count = 0;
+		_sum = 0;
+		_min = 0;
+		_max = 0;
+	}
+
+	/// Records a single sample.  Negative samples (from clocks stepping backwards) are recorded as zero, and samples larger than a uint32 are clamped.
+	void record(int64 value)
+	{
+		uint32 v = value < 0 ? 0 : value > int64(0xFFFFFFFF) ? 0xFFFFFFFF : uint32(value);
+		_buckets[_bucket_index(v)]++;
+		if(!_count || v < _min)
+			_min = v;
+		if(v > _max)
+			_max = v;
+		_count++;
+		_sum += v;
+	}
+
+	/// Adds all the samples recorded in another histogram to this one.
+	void merge(const latency_histogram &other)
+	{
+		if(!other._count)
+			return;
+		for(uint32 i = 0; i < bucket_count; i++)
+			_buckets[i] += other._buckets[i];
+		if(!_count || other._min < _min)
+			_min = other._min;
+		if(other._max > _max)
+			_max = other._max;
+		_count += other._count;
+		_sum += other._sum;
+	}
+
+	uint32 get_count() const { return _count; }
+	uint32 get_min() const { return _min; }
+	uint32 get_max() const { return _max; }
+	uint32 get_mean() const { return _count ? uint32(_sum / _count) : 0; }
+
+	/// Returns the value below which the given fraction (0 to 1) of the samples fall, to within the bucket resolution.  Returns 0 if no samples have been recorded.
+	uint32 get_percentile(float64 fraction) const
+	{
+		if(!_count)
+			return 0;
+		uint64 target = uint64(fraction * _count + 0.5);
+		if(target < 1)
+			target = 1;
+		if(target > _count)
+			target = _count;
+		uint64 seen = 0;
+		for(uint32 i = 0; i < bucket_count; i++)
+		{
+			seen += _buckets[i];
+			if(seen >= target)
+			{
+				uint32 high = _bucket_high(i);
+				return high > _max ? _max : high < _min ? _min : high;
+			}
+		}
+		return _max;
+	}
+private:
+	static uint32 _highest_bit(uint32 value)
+	{
+		uint32 bit_index = 0;
+		while(value >>= 1)
+			bit_index++;
+		return bit_index;
+	}
+
+	static uint32 _bucket_index(uint32 value)
+	{
+		if(value < sub_bucket_count)
+			return value;
+		uint32 shift = _highest_bit(value) - sub_bucket_bits;
+		return (shift + 1) * sub_bucket_count + ((value >> shift) & (sub_bucket_count - 1));
+	}
+
+	/// Returns the largest value that falls in the bucket.
+	static uint32 _bucket_high(uint32 index)
+	{
+		if(index < sub_bucket_count)
+			return index;
+		uint32 shift = index / sub_bucket_count - 1;
+		uint64 low = uint64(sub_bucket_count + (index & (sub_bucket_count - 1))) << shift;
+		uint64 high = low + (uint64(1) << shift) - 1;
+		return high > 0xFFFFFFFF ? 0xFFFFFFFF : uint32(high);
+	}
+
+	uint32 _buckets[bucket_count];
+	uint32 _count;
+	uint64 _sum;
+	uint32 _min;
+	uint32 _max;
+};
+
+static void latency_histogram_test()
+{
+	printf("---- latency_histogram unit test: ----\n");
+	latency_histogram h;
+	for(uint32 i = 1; i <= 10000; i++)
+		h.record(i);
+	printf("count %u min %u mean %u max %u\n", h.get_count(), h.get_min(), h.get_mean(), h.get_max());
+	printf("p50 %u (5000) p99 %u (9900) p99.9 %u (9990)\n", h.get_percentile(0.5), h.get_percentile(0.99), h.get_percentile(0.999));
+	h.record(-5);
+	h.record(int64(1) << 40);
+	printf("min %u max %u p100 %u\n", h.get_min(), h.get_max(), h.get_percentile(1));
+}
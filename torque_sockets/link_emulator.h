@@ -0,0 +1,444 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// link_profile describes the emulated network conditions for one direction of a link.  All times are in microseconds.  A default constructed profile is a perfect link.
+struct link_profile
+{
+	enum jitter_distribution {
+		jitter_uniform, ///< Delay varies evenly between latency - jitter and latency + jitter.
+		jitter_normal, ///< Delay is normally distributed around latency, with jitter as the standard deviation.
+		jitter_pareto, ///< Delay is latency plus a heavy tailed (Pareto, shape 3) extra delay averaging jitter, like a queue that occasionally backs up.
+		jitter_distribution_count,
+	};
+
+	uint32 latency; ///< One way delay added to every packet.
+	uint32 jitter; ///< Amount of random variation in the delay; packets may be reordered by it.
+	uint32 distribution; ///< jitter_distribution of the variation.
+	float32 reorder; ///< Probability that a packet skips the latency and jitter, so it overtakes the packets already in flight.
+	float32 duplicate; ///< Probability that a packet is delivered twice.
+	float32 loss; ///< Probability of losing a packet while the link is in the good state.  With burst_enter 0 this is plain uniform random loss.
+	float32 burst_loss; ///< Probability of losing a packet while the link is in the bad (burst) state.
+	float32 burst_enter; ///< Per packet probability of the link moving from the good state to the bad state (Gilbert-Elliott model).
+	float32 burst_exit; ///< Per packet probability of the link moving from the bad state back to the good state.
+	uint32 bandwidth; ///< Link rate in bytes per second; packets queue behind each other at this rate.  0 for unlimited.
+	uint32 queue_limit; ///< Bytes that can be waiting for the link before further packets are tail dropped.  0 for unlimited.
+
+	link_profile()
+	{
+		latency = 0;
+		jitter = 0;
+		distribution = jitter_uniform;
+		reorder = 0;
+		duplicate = 0;
+		loss = 0;
+		burst_loss = 0;
+		burst_enter = 0;
+		burst_exit = 0;
+		bandwidth = 0;
+		queue_limit = 0;
+	}
+
+	/// Returns true if the profile changes anything about the packets passing through it.
+	bool is_active() const
+	{
+		return latency || jitter || reorder > 0 || duplicate > 0 || loss > 0 || (burst_enter > 0 && burst_loss > 0) || bandwidth;
+	}
+};
+
+/// Counters of what a link_emulator has done to the packets in one direction.
+struct link_stats
+{
+	uint32 packets; ///< Packets offered to the link.
+	uint32 lost; ///< Packets dropped by random or burst loss.
+	uint32 queue_dropped; ///< Packets tail dropped because the bandwidth queue was full.
+	uint32 duplicated; ///< Extra copies delivered.
+	uint32 reordered; ///< Packets that skipped the delay.
+	uint32 burst_count; ///< Times the link entered the bad state.
+
+	link_stats()
+	{
+		packets = lost = queue_dropped = duplicated = reordered = burst_count = 0;
+	}
+};
+
+/// link_emulator decides the fate of each packet crossing an emulated link: whether it is lost, and when each copy of it should be released.  It has separate profiles for the outgoing (upload) and incoming (download) directions.  The caller holds the packets until their release times; torque_socket keeps them in a release_queue.
+class link_emulator
+{
+public:
+	enum direction {
+		outgoing,
+		incoming,
+		direction_count,
+	};
+	enum {
+		max_copies = 2, ///< Most copies of a packet shape() can release (the packet and a duplicate).
+	};
+
+	link_emulator()
+	{
+		for(uint32 i = 0; i < direction_count; i++)
+			_reset_state(_directions[i]);
+	}
+
+	/// Sets the profile for one direction and resets that direction's link state and counters.
+	void set_profile(direction dir, const link_profile &profile)
+	{
+		_directions[dir].profile = profile;
+		_reset_state(_directions[dir]);
+	}
+
+	const link_profile &get_profile(direction dir) const
+	{
+		return _directions[dir].profile;
+	}
+
+	const link_stats &get_stats(direction dir) const
+	{
+		return _directions[dir].stats;
+	}
+
+	/// Returns true if packets in this direction need to go through shape().
+	bool is_active(direction dir) const
+	{
+		return _directions[dir].profile.is_active();
+	}
+
+	/// Runs a packet of packet_size bytes, offered to the link at time now, through the direction's profile.  Returns the number of copies to deliver (0 if the packet was lost or dropped) and fills in the release time of each.
+	uint32 shape(direction dir, int64 now, uint32 packet_size, fast_random_generator &random, int64 release_times[max_copies])
+	{
+		direction_state &d = _directions[dir];
+		const link_profile &p = d.profile;
+		d.stats.packets++;
+
+		// Gilbert-Elliott loss: step the two state Markov chain, then lose the packet with the current state's loss probability.
+		if(d.bad_state)
+		{
+			if(random.random_chance(p.burst_exit))
+				d.bad_state = false;
+		}
+		else if(random.random_chance(p.burst_enter))
+		{
+			d.bad_state = true;
+			d.stats.burst_count++;
+		}
+		if(random.random_chance(d.bad_state ? p.burst_loss : p.loss))
+		{
+			d.stats.lost++;
+			return 0;
+		}
+
+		// bandwidth: the packet waits for the ones ahead of it to be serialized, unless the queue is full.
+		int64 departure = now;
+		if(p.bandwidth)
+		{
+			int64 start = d.link_free_time > now ? d.link_free_time : now;
+			uint64 queued_bytes = uint64(start - now) * p.bandwidth / 1000000;
+			if(p.queue_limit && queued_bytes + packet_size > p.queue_limit)
+			{
+				d.stats.queue_dropped++;
+				return 0;
+			}
+			departure = start + int64(packet_size) * 1000000 / p.bandwidth;
+			d.link_free_time = departure;
+		}
+
+		uint32 copies = random.random_chance(p.duplicate) ? 2 : 1;
+		if(copies == 2)
+			d.stats.duplicated++;
+		bool reordered = random.random_chance(p.reorder);
+		if(reordered)
+			d.stats.reordered++;
+		for(uint32 i = 0; i < copies; i++)
+			release_times[i] = reordered ? departure : departure + _sample_delay(p, random);
+		return copies;
+	}
+private:
+	struct direction_state
+	{
+		link_profile profile;
+		link_stats stats;
+		bool bad_state; ///< True while the Gilbert-Elliott model is in the bad state.
+		int64 link_free_time; ///< Time the emulated link finishes serializing the packets queued on it.
+	};
+	direction_state _directions[direction_count];
+
+	static void _reset_state(direction_state &d)
+	{
+		d.stats = link_stats();
+		d.bad_state = false;
+		d.link_free_time = 0;
+	}
+
+	static int64 _sample_delay(const link_profile &p, fast_random_generator &random)
+	{
+		float64 delay = p.latency;
+		if(p.jitter)
+		{
+			switch(p.distribution)
+			{
+				case link_profile::jitter_normal:
+					delay += random.random_normal() * p.jitter;
+					break;
+				case link_profile::jitter_pareto:
+					// Pareto with shape 3 has mean 1.5, so this averages jitter.
+					delay += (pow(1 - random.random_unit(), -1.0 / 3) - 1) * 2 * p.jitter;
+					break;
+				default:
+					delay += (random.random_unit() * 2 - 1) * p.jitter;
+					break;
+			}
+		}
+		return delay > 0 ? int64(delay) : 0;
+	}
+};
+
+/// release_queue holds records until their release time in a hashed timer wheel, so inserting and releasing are constant time however many records are waiting.  record_type must have a "record_type *next_packet" link and an "int64 release_time" in microseconds.  Records are released in slot order; records within one slot_time come out in the order they were inserted.
+template <class record_type> class release_queue
+{
+public:
+	enum {
+		slot_shift = 10, ///< Each slot covers 1024 microseconds.
+		slot_count = 1024, ///< The wheel covers about a second; records further out wait in an overflow list.
+		slot_mask = slot_count - 1,
+	};
+
+	release_queue()
+	{
+		for(uint32 i = 0; i < slot_count; i++)
+			_slots[i].head = _slots[i].tail = 0;
+		_overflow = 0;
+		_current_slot = 0;
+		_wheel_count = 0;
+		_overflow_count = 0;
+	}
+
+	/// Returns the number of records waiting.
+	uint32 size() const
+	{
+		return _wheel_count + _overflow_count;
+	}
+
+	/// Adds a record, to be released once the time reaches its release_time.  Release times should not be earlier than the last time passed to release().
+	void insert(record_type *record)
+	{
+		int64 slot = record->release_time >> slot_shift;
+		if(slot < _current_slot)
+			slot = _current_slot;
+		if(slot - _current_slot >= slot_count)
+		{
+			record->next_packet = _overflow;
+			_overflow = record;
+			_overflow_count++;
+			return;
+		}
+		_append(_slots[slot & slot_mask], record);
+		_wheel_count++;
+	}
+
+	/// Removes and returns, as a list linked by next_packet, all the records whose release time is at or before now.
+	record_type *release(int64 now)
+	{
+		slot_list released;
+		released.head = released.tail = 0;
+		int64 now_slot = now >> slot_shift;
+		while(size() && _current_slot <= now_slot)
+		{
+			if(!_wheel_count)
+			{
+				// nothing in the wheel; skip ahead to the earliest overflow record rather than stepping through empty slots.
+				int64 earliest = now_slot;
+				for(record_type *walk = _overflow; walk; walk = walk->next_packet)
+					if((walk->release_time >> slot_shift) < earliest)
+						earliest = walk->release_time >> slot_shift;
+				if(earliest > _current_slot)
+					_current_slot = earliest;
+				_refill_from_overflow();
+			}
+			slot_list &slot = _slots[_current_slot & slot_mask];
+			if(_current_slot == now_slot)
+			{
+				// the current slot may hold records due later in the slot.
+				slot_list later;
+				later.head = later.tail = 0;
+				while(slot.head)
+				{
+					record_type *record = slot.head;
+					slot.head = record->next_packet;
+					if(record->release_time <= now)
+					{
+						_append(released, record);
+						_wheel_count--;
+					}
+					else
+						_append(later, record);
+				}
+				slot = later;
+				break;
+			}
+			while(slot.head)
+			{
+				record_type *record = slot.head;
+				slot.head = record->next_packet;
+				_append(released, record);
+				_wheel_count--;
+			}
+			slot.tail = 0;
+			_current_slot++;
+			if(!(_current_slot & slot_mask))
+				_refill_from_overflow();
+		}
+		// keep the wheel following the clock while it's empty, so records inserted later land in their own slots.
+		if(!size() && _current_slot < now_slot)
+			_current_slot = now_slot;
+		return released.head;
+	}
+
+	/// Returns the earliest release time of the records waiting, or -1 if there are none.
+	int64 get_next_release_time()
+	{
+		if(_wheel_count)
+		{
+			for(int64 slot = _current_slot; ; slot++)
+			{
+				record_type *walk = _slots[slot & slot_mask].head;
+				if(!walk)
+					continue;
+				int64 earliest = walk->release_time;
+				for(; walk; walk = walk->next_packet)
+					if(walk->release_time < earliest)
+						earliest = walk->release_time;
+				return earliest;
+			}
+		}
+		int64 earliest = -1;
+		for(record_type *walk = _overflow; walk; walk = walk->next_packet)
+			if(earliest == -1 || walk->release_time < earliest)
+				earliest = walk->release_time;
+		return earliest;
+	}
+
+	/// Removes and returns all the records, as a list linked by next_packet, regardless of release time.
+	record_type *remove_all()
+	{
+		slot_list all;
+		all.head = all.tail = 0;
+		for(uint32 i = 0; i < slot_count; i++)
+		{
+			while(_slots[i].head)
+			{
+				record_type *record = _slots[i].head;
+				_slots[i].head = record->next_packet;
+				_append(all, record);
+			}
+			_slots[i].tail = 0;
+		}
+		while(_overflow)
+		{
+			record_type *record = _overflow;
+			_overflow = record->next_packet;
+			_append(all, record);
+		}
+		_wheel_count = 0;
+		_overflow_count = 0;
+		return all.head;
+	}
+private:
+	struct slot_list
+	{
+		record_type *head;
+		record_type *tail;
+	};
+	slot_list _slots[slot_count];
+	record_type *_overflow; ///< Records more than slot_count slots in the future, unordered.
+	int64 _current_slot; ///< Absolute index (time >> slot_shift) of the slot at the front of the wheel; follows the times passed to release().
+	uint32 _wheel_count;
+	uint32 _overflow_count;
+
+	static void _append(slot_list &list, record_type *record)
+	{
+		record->next_packet = 0;
+		if(list.tail)
+			list.tail->next_packet = record;
+		else
+			list.head = record;
+		list.tail = record;
+	}
+
+	/// Moves overflow records that now fall within the wheel into their slots.
+	void _refill_from_overflow()
+	{
+		record_type **walk = &_overflow;
+		while(*walk)
+		{
+			record_type *record = *walk;
+			int64 slot = record->release_time >> slot_shift;
+			if(slot - _current_slot < slot_count)
+			{
+				*walk = record->next_packet;
+				_overflow_count--;
+				if(slot < _current_slot)
+					slot = _current_slot;
+				_append(_slots[slot & slot_mask], record);
+				_wheel_count++;
+			}
+			else
+				walk = &record->next_packet;
+		}
+	}
+};
+
+static void link_emulator_test()
+{
+	printf("---- link_emulator unit test: ----\n");
+	fast_random_generator random(1);
+	link_emulator link;
+	link_profile p;
+	p.latency = 50000;
+	p.jitter = 10000;
+	p.distribution = link_profile::jitter_normal;
+	p.loss = 0.01f;
+	p.burst_enter = 0.01f;
+	p.burst_exit = 0.25f;
+	p.burst_loss = 0.5f;
+	p.duplicate = 0.01f;
+	p.bandwidth = 125000;
+	p.queue_limit = 16000;
+	link.set_profile(link_emulator::outgoing, p);
+
+	struct test_record
+	{
+		test_record *next_packet;
+		int64 release_time;
+	};
+	release_queue<test_record> queue;
+	latency_histogram delay;
+	uint32 released = 0;
+	int64 now = 0;
+	for(uint32 i = 0; i < 10000; i++, now += 5000)
+	{
+		int64 release_times[link_emulator::max_copies];
+		uint32 copies = link.shape(link_emulator::outgoing, now, 500, random, release_times);
+		for(uint32 j = 0; j < copies; j++)
+		{
+			test_record *r = new test_record;
+			r->release_time = release_times[j];
+			queue.insert(r);
+		}
+		for(test_record *r = queue.release(now); r; )
+		{
+			test_record *next = r->next_packet;
+			delay.record(now - r->release_time);
+			released++;
+			delete r;
+			r = next;
+		}
+	}
+	for(test_record *r = queue.remove_all(); r; )
+	{
+		test_record *next = r->next_packet;
+		delete r;
+		r = next;
+	}
+	const link_stats &s = link.get_stats(link_emulator::outgoing);
+	printf("packets %u lost %u (%.1f%%) queue dropped %u duplicated %u bursts %u released %u\n", s.packets, s.lost, 100.0 * s.lost / s.packets, s.queue_dropped, s.duplicated, s.burst_count, released);
+	printf("release lateness: p50 %u us max %u us (slot is %u us)\n", delay.get_percentile(0.5), delay.get_max(), uint32(1 << release_queue<test_record>::slot_shift));
+}
@@ -0,0 +1,268 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// One datagram read from a packet capture.
+struct packet_capture_record
+{
+	int64 time; ///< Time the datagram was sent or received, in microseconds since January 1, 1970.
+	address source;
+	address destination;
+	uint32 data_size;
+	const uint8 *data; ///< UDP payload; valid until the next read.
+};
+
+/// packet_capture writes datagrams to a pcap file as IPv4/UDP packets, so captures can be read by tcpdump and Wireshark as well as by packet_capture_reader.  A udp_socket with a capture set records every datagram it sends and receives.  Writes are serialized, so a capture can be shared by a socket's background reader thread and the thread sending on it.
+class packet_capture
+{
+public:
+	enum {
+		pcap_magic = 0xa1b2c3d4, ///< Microsecond timestamps.  Written big endian, which pcap readers detect from the magic.
+		pcap_nanosecond_magic = 0xa1b23c4d,
+		pcap_header_size = 24,
+		pcap_record_header_size = 16,
+		ipv4_header_size = 20,
+		udp_header_size = 8,
+		link_type_ethernet = 1,
+		link_type_raw = 101,
+		link_type_linux_cooked = 113,
+		link_type_ipv4 = 228,
+		snapshot_length = 65535,
+	};
+
+	packet_capture()
+	{
+		_file = 0;
+		_record_count = 0;
+	}
+
+	~packet_capture()
+	{
+		close();
+	}
+
+	/// Creates the capture file, replacing any existing file.  Returns false if it can't be written.
+	bool open(const char *file_name)
+	{
+		close();
+		_lock.lock();
+		_file = fopen(file_name, "wb");
+		_record_count = 0;
+		if(_file)
+		{
+			uint8 header[pcap_header_size];
+			write_uint32_to_buffer(pcap_magic, header);
+			write_uint16_to_buffer(2, header + 4); // version 2.4
+			write_uint16_to_buffer(4, header + 6);
+			write_uint32_to_buffer(0, header + 8); // timezone offset
+			write_uint32_to_buffer(0, header + 12); // timestamp accuracy
+			write_uint32_to_buffer(snapshot_length, header + 16);
+			write_uint32_to_buffer(link_type_ipv4, header + 20);
+			fwrite(header, 1, sizeof(header), _file);
+		}
+		_lock.unlock();
+		return _file != 0;
+	}
+
+	void close()
+	{
+		_lock.lock();
+		if(_file)
+		{
+			fclose(_file);
+			_file = 0;
+		}
+		_lock.unlock();
+	}
+
+	bool is_open()
+	{
+		return _file != 0;
+	}
+
+	/// Returns the number of datagrams written since the capture was opened.
+	uint32 get_record_count()
+	{
+		return _record_count;
+	}
+
+	/// Appends a datagram.  time is in microseconds since January 1, 1970.
+	void write(int64 time, const address &source, const address &destination, const uint8 *data, uint32 data_size)
+	{
+		write(time, source, destination, 0, 0, data, data_size);
+	}
+
+	/// Appends a datagram sent as a separate header and data.
+	void write(int64 time, const address &source, const address &destination, const uint8 *payload_header, uint32 payload_header_size, const uint8 *data, uint32 data_size)
+	{
+		uint8 header[pcap_record_header_size + ipv4_header_size + udp_header_size];
+		uint32 payload_size = payload_header_size + data_size;
+		uint32 packet_size = ipv4_header_size + udp_header_size + payload_size;
+		write_uint32_to_buffer(uint32(time / 1000000), header);
+		write_uint32_to_buffer(uint32(time % 1000000), header + 4);
+		write_uint32_to_buffer(packet_size, header + 8);
+		write_uint32_to_buffer(packet_size, header + 12);
+
+		uint8 *ip = header + pcap_record_header_size;
+		ip[0] = 0x45; // version 4, 5 word header
+		ip[1] = 0;
+		write_uint16_to_buffer(uint16(packet_size), ip + 2);
+		write_uint16_to_buffer(0, ip + 4);
+		write_uint16_to_buffer(0x4000, ip + 6); // don't fragment
+		ip[8] = 64;
+		ip[9] = 17; // UDP
+		write_uint16_to_buffer(0, ip + 10);
+		write_uint32_to_buffer(source.get_host(), ip + 12);
+		write_uint32_to_buffer(destination.get_host(), ip + 16);
+		uint32 sum = 0;
+		for(uint32 i = 0; i < ipv4_header_size; i += 2)
+			sum += read_uint16_from_buffer(ip + i);
+		sum = (sum & 0xFFFF) + (sum >> 16);
+		sum += sum >> 16;
+		write_uint16_to_buffer(uint16(~sum), ip + 10);
+
+		uint8 *udp = ip + ipv4_header_size;
+		write_uint16_to_buffer(source.get_port(), udp);
+		write_uint16_to_buffer(destination.get_port(), udp + 2);
+		write_uint16_to_buffer(uint16(udp_header_size + payload_size), udp + 4);
+		write_uint16_to_buffer(0, udp + 6); // no checksum
+
+		_lock.lock();
+		if(_file)
+		{
+			fwrite(header, 1, sizeof(header), _file);
+			if(payload_header_size)
+				fwrite(payload_header, 1, payload_header_size, _file);
+			fwrite(data, 1, data_size, _file);
+			_record_count++;
+		}
+		_lock.unlock();
+	}
+private:
+	mutex _lock;
+	FILE *_file;
+	uint32 _record_count;
+};
+
+/// Reads the UDP datagrams from a pcap file, either one written by packet_capture or one captured by tcpdump on an Ethernet, "any" (Linux cooked) or raw IP interface.  Non-IPv4, non-UDP and fragmented packets are skipped.
+class packet_capture_reader
+{
+public:
+	packet_capture_reader()
+	{
+		_file = 0;
+		_big_endian = true;
+		_nanoseconds = false;
+		_link_type = 0;
+	}
+
+	~packet_capture_reader()
+	{
+		close();
+	}
+
+	/// Opens a capture file.  Returns false if it can't be read or isn't a pcap file with a supported link type.
+	bool open(const char *file_name)
+	{
+		close();
+		_file = fopen(file_name, "rb");
+		if(!_file)
+			return false;
+		uint8 header[packet_capture::pcap_header_size];
+		if(fread(header, 1, sizeof(header), _file) == sizeof(header))
+		{
+			uint32 magic = read_uint32_from_buffer(header);
+			_big_endian = magic == packet_capture::pcap_magic || magic == packet_capture::pcap_nanosecond_magic;
+			if(!_big_endian)
+				magic = _swap(magic);
+			_nanoseconds = magic == packet_capture::pcap_nanosecond_magic;
+			_link_type = _read_uint32(header + 20);
+			if((magic == packet_capture::pcap_magic || _nanoseconds) && _link_header_size() != -1)
+				return true;
+		}
+		close();
+		return false;
+	}
+
+	void close()
+	{
+		if(_file)
+		{
+			fclose(_file);
+			_file = 0;
+		}
+	}
+
+	/// Reads the next UDP datagram.  Returns false at the end of the file.
+	bool read(packet_capture_record &record)
+	{
+		while(_file)
+		{
+			uint8 header[packet_capture::pcap_record_header_size];
+			if(fread(header, 1, sizeof(header), _file) != sizeof(header))
+				return false;
+			uint32 captured_size = _read_uint32(header + 8);
+			if(captured_size > sizeof(_buffer) || fread(_buffer, 1, captured_size, _file) != captured_size)
+				return false;
+			int64 fraction = _read_uint32(header + 4);
+			record.time = int64(_read_uint32(header)) * 1000000 + (_nanoseconds ? fraction / 1000 : fraction);
+
+			int32 link_size = _link_header_size();
+			if(_link_type == packet_capture::link_type_ethernet && (captured_size < 14 || read_uint16_from_buffer(_buffer + 12) != 0x0800))
+				continue;
+			if(_link_type == packet_capture::link_type_linux_cooked && (captured_size < 16 || read_uint16_from_buffer(_buffer + 14) != 0x0800))
+				continue;
+			if(captured_size < uint32(link_size) + packet_capture::ipv4_header_size)
+				continue;
+			const uint8 *ip = _buffer + link_size;
+			uint32 ip_header_size = (ip[0] & 0x0F) * 4;
+			if((ip[0] >> 4) != 4 || ip[9] != 17 || (read_uint16_from_buffer(ip + 6) & 0x3FFF))
+				continue;
+			const uint8 *udp = ip + ip_header_size;
+			if(udp + packet_capture::udp_header_size > _buffer + captured_size)
+				continue;
+			uint32 udp_size = read_uint16_from_buffer(udp + 4);
+			if(udp_size < packet_capture::udp_header_size || udp + udp_size > _buffer + captured_size)
+				continue;
+			record.source.set_host(read_uint32_from_buffer(ip + 12));
+			record.source.set_port(read_uint16_from_buffer(udp));
+			record.destination.set_host(read_uint32_from_buffer(ip + 16));
+			record.destination.set_port(read_uint16_from_buffer(udp + 2));
+			record.data = udp + packet_capture::udp_header_size;
+			record.data_size = udp_size - packet_capture::udp_header_size;
+			return true;
+		}
+		return false;
+	}
+private:
+	FILE *_file;
+	bool _big_endian; ///< Byte order of the file's headers.
+	bool _nanoseconds; ///< True if record timestamps have nanosecond fractions.
+	uint32 _link_type;
+	uint8 _buffer[packet_capture::snapshot_length];
+
+	static uint32 _swap(uint32 value)
+	{
+		return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+	}
+
+	uint32 _read_uint32(const uint8 *buffer)
+	{
+		uint32 value = read_uint32_from_buffer(buffer);
+		return _big_endian ? value : _swap(value);
+	}
+
+	/// Returns the size of the link layer header in front of each IP packet, or -1 if the link type isn't supported.
+	int32 _link_header_size()
+	{
+		switch(_link_type)
+		{
+			case packet_capture::link_type_ethernet:
+				return 14;
+			case packet_capture::link_type_linux_cooked:
+				return 16;
+			case packet_capture::link_type_raw:
+			case packet_capture::link_type_ipv4:
+				return 0;
+		}
+		return -1;
+	}
+};
@@ -0,0 +1,188 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// packet_flight_recorder keeps a fixed-size ring of compact records for the most recent packet headers sent and received on a torque_connection, along with the notify results and send queueing for those packets.  Recording a packet is a handful of stores into the ring, so every connection carries one and it is always on.  When a player reports lag, the recording can be dumped with dump() and the timeline reconstructed with print_timeline() (see products/flight_recorder_decode).
+class packet_flight_recorder
+{
+public:
+	enum {
+		record_count_shift = 8,
+		record_count = 1 << record_count_shift, ///< Number of records kept in the ring; older records are overwritten.
+		record_index_mask = record_count - 1,
+
+		dump_magic = 0x52465354, ///< "TSFR" - first four bytes of a dumped recording.
+		dump_version = 1,
+		dump_header_size = 4 + 4 + 4 + 4 + 8, ///< magic, version, connection id, record count, start time
+		dump_record_size = 4 + 4 + 4 + 2 + 1 + 1,
+		dump_max_size = dump_header_size + dump_record_size * record_count,
+	};
+
+	/// What happened to the packet described by a record.
+	enum record_type {
+		packet_sent, ///< The packet was handed to the socket for sending.
+		packet_send_delayed, ///< The packet was held in the socket's release queue by the link emulator.
+		packet_received, ///< A valid packet header was received and processed.
+		packet_received_out_of_window, ///< A packet was received, but its sequence or ack was outside the packet window and it was discarded.
+		packet_receive_simulated_drop, ///< A received packet was discarded by the link emulator.
+		packet_delivered, ///< Notify: the remote host acknowledged the packet.
+		packet_lost, ///< Notify: the remote host did not receive the packet.
+		packet_send_simulated_drop, ///< The packet was discarded by the link emulator instead of being sent.
+		packet_received_corrupt, ///< A received packet failed its CRC check and was discarded.
+		packet_send_failed, ///< The socket refused the packet.
+		record_type_count,
+	};
+
+	/// A single compact flight record.
+	struct record
+	{
+		uint32 time_offset; ///< Milliseconds since the recorder's start time.
+		uint32 sequence; ///< Send sequence of the packet (for received packets, the remote host's send sequence).
+		uint32 ack_sequence; ///< Highest ack sequence carried in the packet header.
+		uint16 packet_size; ///< Size of the datagram, in bytes.
+		uint8 packet_type; ///< torque_connection::net_packet_type of the packet.
+		uint8 type; ///< record_type of this record.
+	};
+
+	packet_flight_recorder()
+	{
+		_start_time = time(0);
+		_next_record = 0;
+	}
+
+	/// Sets the time all record timestamps are relative to.
+	void start(time start_time)
+	{
+		_start_time = start_time;
+		_next_record = 0;
+	}
+
+	/// Records a single event into the ring.
+	inline void record_event(time the_time, record_type type, uint32 sequence, uint32 ack_sequence, uint32 packet_type, uint32 packet_size)
+	{
+		record &r = _records[_next_record & record_index_mask];
+		_next_record++;
+		r.time_offset = uint32((the_time - _start_time).get_milliseconds());
+		r.sequence = sequence;
+		r.ack_sequence = ack_sequence;
+		r.packet_size = uint16(packet_size);
+		r.packet_type = uint8(packet_type);
+		r.type = uint8(type);
+	}
+
+	/// Returns the number of valid records currently in the ring.
+	uint32 get_record_count()
+	{
+		return _next_record < uint32(record_count) ? _next_record : uint32(record_count);
+	}
+
+	/// Returns the number of bytes dump() will write.
+	uint32 get_dump_size()
+	{
+		return dump_header_size + dump_record_size * get_record_count();
+	}
+
+	/// Writes the recording, oldest record first, into buffer in the compact binary dump format.  All values are little endian.  Returns the number of bytes written, or 0 if buffer_size is smaller than get_dump_size().
+	uint32 dump(uint32 connection_id, uint8 *buffer, uint32 buffer_size)
+	{
+		uint32 dump_size = get_dump_size();
+		if(buffer_size < dump_size)
+			return 0;
+		uint32 count = get_record_count();
+
+		bit_stream s(buffer, buffer_size);
+		core::write(s, uint32(dump_magic));
+		core::write(s, uint32(dump_version));
+		core::write(s, connection_id);
+		core::write(s, count);
+		core::write(s, _start_time.get_milliseconds());
+
+		for(uint32 i = _next_record - count; i != _next_record; i++)
+		{
+			record &r = _records[i & record_index_mask];
+			core::write(s, r.time_offset);
+			core::write(s, r.sequence);
+			core::write(s, r.ack_sequence);
+			core::write(s, r.packet_size);
+			core::write(s, r.packet_type);
+			core::write(s, r.type);
+		}
+		return s.get_next_byte_position();
+	}
+
+	/// Decodes a dump written by dump() and prints it to the output file as a timeline, one line per record.  Returns false if the buffer is not a valid dump.
+	static bool print_timeline(const uint8 *buffer, uint32 buffer_size, FILE *output)
+	{
+		static const char *record_type_names[] = {
+			"SEND",
+			"SEND_DELAYED",
+			"RECV",
+			"RECV_OUT_OF_WINDOW",
+			"RECV_SIM_DROP",
+			"DELIVERED",
+			"LOST",
+			"SEND_SIM_DROP",
+			"RECV_CORRUPT",
+			"SEND_FAILED",
+		};
+		static const char *packet_type_names[] = {
+			"data",
+			"ping",
+			"ack",
+			"bulk",
+			"invalid",
+		};
+
+		if(buffer_size < dump_header_size)
+			return false;
+
+		bit_stream s((uint8 *) buffer, buffer_size);
+		uint32 magic, version, connection_id, count;
+		int64 start_time;
+		core::read(s, magic);
+		core::read(s, version);
+		core::read(s, connection_id);
+		core::read(s, count);
+		core::read(s, start_time);
+		if(magic != dump_magic || version != dump_version || count > uint32(record_count) || buffer_size < dump_header_size + count * dump_record_size)
+			return false;
+
+		fprintf(output, "connection %u: %u records, start time %lld ms\n", connection_id, count, start_time);
+		fprintf(output, "%10s %8s %-18s %-5s %10s %10s %5s\n", "time(ms)", "delta", "event", "type", "sequence", "ack", "size");
+
+		uint32 last_offset = 0;
+		for(uint32 i = 0; i < count; i++)
+		{
+			record r;
+			core::read(s, r.time_offset);
+			core::read(s, r.sequence);
+			core::read(s, r.ack_sequence);
+			core::read(s, r.packet_size);
+			core::read(s, r.packet_type);
+			core::read(s, r.type);
+
+			fprintf(output, "%10u %+8d %-18s %-5s %10u %10u %5u\n", r.time_offset, i ? int32(r.time_offset - last_offset) : 0, r.type < record_type_count ? record_type_names[r.type] : "?", packet_type_names[r.packet_type < 4 ? r.packet_type : 4], r.sequence, r.ack_sequence, uint32(r.packet_size));
+			last_offset = r.time_offset;
+		}
+		return true;
+	}
+private:
+	record _records[record_count]; ///< The record ring.
+	uint32 _next_record; ///< Total number of records written; the next record goes in _records[_next_record & record_index_mask].
+	time _start_time; ///< Time the recording started, all record times are relative to this.
+};
+
+static void packet_flight_recorder_test()
+{
+	printf("---- packet_flight_recorder unit test: ----\n");
+
+	packet_flight_recorder recorder;
+	time start = time::get_current();
+	recorder.start(start);
+	for(uint32 i = 0; i < packet_flight_recorder::record_count + 10; i++)
+		recorder.record_event(start + time(i), packet_flight_recorder::record_type(i % packet_flight_recorder::record_type_count), i, i / 2, 0, 100);
+
+	uint8 buffer[packet_flight_recorder::dump_max_size];
+	uint32 size = recorder.dump(1, buffer, sizeof(buffer));
+	printf("dumped %u records in %u bytes\n", recorder.get_record_count(), size);
+	if(!packet_flight_recorder::print_timeline(buffer, size, stdout))
+		printf("dump failed to decode!\n");
+}
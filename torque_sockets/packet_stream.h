@@ -37,12 +37,12 @@ public:
 		return outgoing_socket.send_to(the_address, buffer, get_next_byte_position());
 	}
 
-   /// Reads a packet into the stream from the specified socket.
-   udp_socket::recv_from_result recv_from(udp_socket &incoming_socket, address *recv_address)
+   /// Reads a packet into the stream from the specified socket, optionally returning its arrival time in microseconds.
+   udp_socket::recv_from_result recv_from(udp_socket &incoming_socket, address *recv_address, int64 *arrival_time = 0)
 	{
 	   udp_socket::recv_from_result the_result;
 	   uint32 data_size;
-	   the_result = incoming_socket.recv_from(recv_address, buffer, sizeof(buffer), &data_size);
+	   the_result = incoming_socket.recv_from(recv_address, buffer, sizeof(buffer), &data_size, arrival_time);
 	   set_buffer(buffer, 0, data_size * 8);
 	   return the_result;
 	}
@@ -69,6 +69,8 @@ public:
 		_introducer = 0;
 		_remote_client_id = 0;
 		_next = 0;
+		_stage_start_time = 0;
+		_integrity_mode = torque_integrity_cipher;
 	}
 	
 	nonce &get_initiator_nonce()
@@ -130,6 +132,7 @@ public:
 	bool _puzzle_retried; ///< True if a puzzle solution was already rejected by the host once.	
 	uint8 _symmetric_key[symmetric_cipher::key_size]; ///< The symmetric key for the connection, generated by the initiator
 	uint8 _init_vector[symmetric_cipher::key_size]; ///< The init vector, generated by the host
+	uint32 _integrity_mode; ///< The torque_socket_integrity_mode requested by the initiator, or on the host, the mode agreed to.
 	
 	uint32 _puzzle_difficulty; ///< Difficulty of the client puzzle solved by this client.
 	uint32 _puzzle_solution; ///< Solution to the client puzzle the host sends to the initiator.
@@ -146,6 +149,7 @@ public:
 	uint32 _state_send_retry_interval;
 	
 	time _state_last_send_time; ///< The send time of the last challenge or connect request.
+	int64 _stage_start_time; ///< Time, in time_source microseconds, the current handshake stage began.
 	byte_buffer_ptr _packet_data; ///< data sent along with this connection request, connection accept, 
 };
 
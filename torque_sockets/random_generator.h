@@ -1,23 +1,63 @@
 /// The random_generator class encapsulates a cryptographically secure
 /// pseudo random number generator (PRNG).  Internally the random_generator class
-/// uses the Yarrow PRNG algorithm.
+/// uses the Yarrow PRNG algorithm.  Small requests (integers, nonces, keys) are served
+/// from a pool that is filled from Yarrow a block at a time, since each yarrow_read
+/// carries a fixed cost that dwarfs the few bytes most callers want.  The generator is
+/// rekeyed from its own output every random_rekey_interval bytes, so that the state
+/// captured at one moment can't be used to recover output from before the last rekey.
 class random_generator
 {
+public:
+	enum {
+		random_pool_size = 512, ///< Bytes read from Yarrow per refill.  Requests this large or larger bypass the pool.
+		random_rekey_interval = 65536, ///< Bytes of output between rekeys.
+		random_rekey_size = 32,
+	};
+private:
 	prng_state _random_state;
 	uint32 _entropy_added;
+	uint8 _pool[random_pool_size];
+	uint32 _pool_position; ///< Offset of the next unused byte of _pool; random_pool_size when it's empty.
+	uint32 _bytes_since_rekey;
+
+	void _discard_pool()
+	{
+		memset(_pool, 0, sizeof(_pool));
+		_pool_position = random_pool_size;
+	}
+
+	/// Reads directly from Yarrow, rekeying first if the interval has passed.
+	void _read_generator(uint8 *out_buffer, uint32 buffer_size)
+	{
+		if(_bytes_since_rekey >= random_rekey_interval)
+		{
+			uint8 key[random_rekey_size];
+			yarrow_read(key, sizeof(key), &_random_state);
+			yarrow_add_entropy(key, sizeof(key), &_random_state);
+			yarrow_ready(&_random_state);
+			memset(key, 0, sizeof(key));
+			_bytes_since_rekey = 0;
+		}
+		yarrow_read(out_buffer, buffer_size, &_random_state);
+		_bytes_since_rekey += buffer_size;
+	}
 public:
 	random_generator()
 	{
 		yarrow_start(&_random_state);
 		yarrow_ready(&_random_state);
 		_entropy_added = 0;
+		_bytes_since_rekey = 0;
+		_discard_pool();
 	}
+
+	/// Returns the underlying Yarrow state, for libtomcrypt routines that draw from it directly.  Those draws bypass the pool.
 	prng_state *get_state()
 	{
 		return &_random_state;
 	}
 	
-	/// Adds random "seed" data to the random number generator
+	/// Adds random "seed" data to the random number generator.  Anything left in the pool is discarded, so later output reflects the new entropy at once.
 	void add_entropy(const uint8 *random_data, uint32 data_len)
 	{
 		yarrow_add_entropy(random_data, data_len, &_random_state);
@@ -26,12 +66,45 @@ public:
 		{
 			yarrow_ready(&_random_state);
 			_entropy_added = 0;
+			_discard_pool();
 		}
 	}
 	
+	/// Restarts the generator from seed alone, discarding all the entropy added so far, so that two generators reseeded with the same data produce the same output.  Used to make a socket's random draws reproducible when replaying a capture.
+	void reseed(const uint8 *seed, uint32 seed_size)
+	{
+		yarrow_start(&_random_state);
+		yarrow_add_entropy(seed, seed_size, &_random_state);
+		yarrow_ready(&_random_state);
+		_entropy_added = 0;
+		_bytes_since_rekey = 0;
+		_discard_pool();
+	}
+	
 	void random_buffer(uint8 *out_buffer, uint32 buffer_size)
 	{
-		yarrow_read(out_buffer, buffer_size, &_random_state);
+		if(buffer_size >= random_pool_size)
+		{
+			_read_generator(out_buffer, buffer_size);
+			return;
+		}
+		while(buffer_size)
+		{
+			if(_pool_position == random_pool_size)
+			{
+				_read_generator(_pool, random_pool_size);
+				_pool_position = 0;
+			}
+			uint32 count = random_pool_size - _pool_position;
+			if(count > buffer_size)
+				count = buffer_size;
+			// bytes are wiped from the pool as they're handed out, so the pool never holds a copy of a key or nonce already in use.
+			memcpy(out_buffer, _pool + _pool_position, count);
+			memset(_pool + _pool_position, 0, count);
+			_pool_position += count;
+			out_buffer += count;
+			buffer_size -= count;
+		}
 	}
 	
 	uint32 random_integer()
@@ -68,3 +141,108 @@ public:
 	}
 };
 
+
+/// fast_random_generator is a small, fast, non-cryptographic PRNG (xoshiro128**) for simulation and other uses where the output doesn't need to be unpredictable.  A generator seeded with the same value always produces the same sequence.  Never use it for nonces, keys or anything else an attacker could benefit from predicting; use random_generator for those.
+class fast_random_generator
+{
+	uint32 _state[4];
+
+	static uint32 _rotate_left(uint32 value, uint32 shift)
+	{
+		return (value << shift) | (value >> (32 - shift));
+	}
+public:
+	fast_random_generator(uint64 seed_value = 0)
+	{
+		seed(seed_value);
+	}
+
+	/// Resets the generator to the start of the sequence for seed_value.
+	void seed(uint64 seed_value)
+	{
+		// expand the seed with splitmix64 so that similar seeds give unrelated sequences, and the state is never all zero.
+		for(uint32 i = 0; i < 4; i += 2)
+		{
+			seed_value += 0x9E3779B97F4A7C15ull;
+			uint64 z = seed_value;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			z ^= z >> 31;
+			_state[i] = uint32(z);
+			_state[i + 1] = uint32(z >> 32);
+		}
+	}
+
+	uint32 random_integer()
+	{
+		uint32 result = _rotate_left(_state[1] * 5, 7) * 9;
+		uint32 t = _state[1] << 9;
+		_state[2] ^= _state[0];
+		_state[3] ^= _state[1];
+		_state[1] ^= _state[2];
+		_state[0] ^= _state[3];
+		_state[2] ^= t;
+		_state[3] = _rotate_left(_state[3], 11);
+		return result;
+	}
+
+	/// Returns a float64 in [0, 1).
+	float64 random_unit()
+	{
+		return float64(random_integer()) * (1.0 / 4294967296.0);
+	}
+
+	/// Returns true with the given probability.
+	bool random_chance(float64 probability)
+	{
+		return probability > 0 && random_unit() < probability;
+	}
+
+	/// Returns a sample from the normal distribution with mean 0 and standard deviation 1.
+	float64 random_normal()
+	{
+		float64 u = 1 - random_unit();
+		return sqrt(-2 * log(u)) * cos(6.283185307179586 * random_unit());
+	}
+};
+
+static void random_generator_test()
+{
+	printf("---- random_generator unit test: ----\n");
+	enum {
+		test_size = random_generator::random_rekey_interval * 2,
+	};
+	static uint8 pooled[test_size];
+	static uint8 direct[test_size];
+	uint8 seed[32];
+	for(uint32 i = 0; i < sizeof(seed); i++)
+		seed[i] = uint8(i * 7);
+
+	// The pool only changes how Yarrow's output is sliced up, so until the first rekey, pieces of odd sizes must match one straight read.
+	random_generator a, b;
+	a.reseed(seed, sizeof(seed));
+	b.reseed(seed, sizeof(seed));
+	for(uint32 offset = 0; offset < test_size; )
+	{
+		uint32 size = 1 + (offset * 13) % 37;
+		if(size > test_size - offset)
+			size = test_size - offset;
+		a.random_buffer(pooled + offset, size);
+		offset += size;
+	}
+	yarrow_read(direct, test_size, b.get_state());
+	uint32 interval = random_generator::random_rekey_interval;
+	printf("output before rekey matches Yarrow stream: %d (1)\n", memcmp(pooled, direct, interval) == 0);
+	printf("output after rekey differs from Yarrow stream: %d (1)\n", memcmp(pooled + interval, direct + interval, interval) != 0);
+
+	// Reseeding with the same data must reproduce the same draws, whatever was left in the pool.
+	random_generator c;
+	c.reseed(seed, sizeof(seed));
+	c.random_integer();
+	a.reseed(seed, sizeof(seed));
+	c.reseed(seed, sizeof(seed));
+	uint32 mismatches = 0;
+	for(uint32 i = 0; i < 1000; i++)
+		mismatches += a.random_integer() != c.random_integer();
+	printf("reseeded generators disagree %u times (0)\n", mismatches);
+}
@@ -0,0 +1,163 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// server_probe tracks one round of latency probes sent by a torque_socket to a list of servers, for filling in a server browser.  Probes are paced at a fixed rate, so that a refresh of hundreds of servers doesn't overflow the client's own uplink or socket buffers and lose the replies it's waiting for.  Each probe carries the index of its target and a token drawn for the round, which the server echoes, so a reply is matched to its target with an array lookup and a check of the sender's address, and replies from earlier rounds or other hosts are ignored.
+class server_probe
+{
+public:
+	enum {
+		no_reply = -1, ///< Round trip time of a target that hasn't replied.
+		refused_retry_interval = 1000, ///< Microseconds before a probe the socket refused is sent again.
+	};
+
+	/// One server being probed.
+	struct target
+	{
+		address remote_address;
+		int64 send_time; ///< Time the probe was sent, 0 if it hasn't been sent yet.
+		int32 round_trip_time; ///< Microseconds from send to reply, or no_reply.
+	};
+
+	server_probe()
+	{
+		_active = false;
+	}
+
+	bool is_active()
+	{
+		return _active;
+	}
+
+	/// Starts a round of probes to count addresses.  packets_per_second paces the sends, 0 sends them all at once.  Targets that haven't replied timeout microseconds after the last probe is sent are reported as no_reply.
+	void start(const address *addresses, uint32 count, uint32 packets_per_second, int64 timeout, int64 now, uint32 token)
+	{
+		_targets.resize(count);
+		for(uint32 i = 0; i < count; i++)
+		{
+			_targets[i].remote_address = addresses[i];
+			_targets[i].send_time = 0;
+			_targets[i].round_trip_time = no_reply;
+		}
+		_packets_per_second = packets_per_second;
+		_timeout = timeout;
+		_start_time = now;
+		_last_send_time = now;
+		_next_send = 0;
+		_refused_time = 0;
+		_retry_time = 0;
+		_replies = 0;
+		_token = token;
+		_active = true;
+	}
+
+	uint32 get_token()
+	{
+		return _token;
+	}
+
+	uint32 get_target_count()
+	{
+		return _targets.size();
+	}
+
+	target &get_target(uint32 index)
+	{
+		return _targets[index];
+	}
+
+	/// Returns the number of probes the pacing allows to be sent at now, starting at get_next_send().  The first probe goes out immediately.
+	uint32 get_due_count(int64 now)
+	{
+		uint32 count = _targets.size();
+		if(!_active || _next_send == count || now < _retry_time)
+			return 0;
+		if(!_packets_per_second)
+			return count - _next_send;
+		int64 allowed = 1 + (now - _start_time) * _packets_per_second / 1000000;
+		return allowed >= count ? count - _next_send : allowed > _next_send ? uint32(allowed) - _next_send : 0;
+	}
+
+	uint32 get_next_send()
+	{
+		return _next_send;
+	}
+
+	/// Marks the next count probes as sent at now.
+	void mark_sent(uint32 count, int64 now)
+	{
+		for(uint32 i = 0; i < count; i++)
+			_targets[_next_send + i].send_time = now;
+		_next_send += count;
+		_last_send_time = now;
+		if(count)
+			_refused_time = 0;
+	}
+
+	/// Records that the socket refused the probe to get_next_send() at now, normally because its send buffer is full.  The probe stays due and is retried refused_retry_interval later.  A probe the socket has gone on refusing for the round's timeout is given up on and reported as no_reply, so that an address the socket can't send to doesn't hold up the round.
+	void refuse(int64 now)
+	{
+		if(!_refused_time)
+			_refused_time = now;
+		else if(now - _refused_time >= _timeout)
+		{
+			_next_send++;
+			_refused_time = 0;
+		}
+		_retry_time = now + refused_retry_interval;
+	}
+
+	/// Records a reply from source to the probe sent to index.  Returns false if the reply doesn't match this round's probe to source, or is a duplicate.
+	bool record_reply(uint32 token, uint32 index, const address &source, int64 round_trip_time)
+	{
+		if(!_active || token != _token || index >= _next_send)
+			return false;
+		target &t = _targets[index];
+		if(t.remote_address != source || t.round_trip_time != no_reply)
+			return false;
+		t.round_trip_time = round_trip_time < 0 ? 0 : round_trip_time > 0x7FFFFFFF ? 0x7FFFFFFF : int32(round_trip_time);
+		_replies++;
+		return true;
+	}
+
+	/// Returns true once every target has replied, or every probe is sent and the timeout since the last send has passed.
+	bool is_complete(int64 now)
+	{
+		if(!_active)
+			return false;
+		if(_replies == _targets.size())
+			return true;
+		return _next_send == _targets.size() && now >= _last_send_time + _timeout;
+	}
+
+	/// Returns the time the probe next needs attention: its next paced send or its timeout.
+	int64 get_next_time()
+	{
+		if(!_active)
+			return -1;
+		if(_next_send < _targets.size())
+		{
+			int64 next = _start_time;
+			if(_packets_per_second)
+				next += (int64(_next_send) * 1000000 + _packets_per_second - 1) / _packets_per_second;
+			return next > _retry_time ? next : _retry_time;
+		}
+		return _last_send_time + _timeout;
+	}
+
+	/// Ends the round.
+	void finish()
+	{
+		_active = false;
+	}
+private:
+	array<target> _targets;
+	uint32 _packets_per_second;
+	int64 _timeout;
+	int64 _start_time;
+	int64 _last_send_time;
+	uint32 _next_send; ///< Index of the next target to send a probe to.
+	int64 _refused_time; ///< Time the socket first refused the probe to _next_send, 0 if it hasn't.
+	int64 _retry_time; ///< No probes are sent before this time, after the socket refused one.
+	uint32 _replies;
+	uint32 _token;
+	bool _active;
+};
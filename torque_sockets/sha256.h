@@ -0,0 +1,265 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+// SHA-256 for the handshake: client identity tokens, packet hashes, signatures and client puzzle checks.  These take the place of libtomcrypt's sha256_init, sha256_process and sha256_done for all of the code in net, which calls them unqualified, and work on libtomcrypt's hash_state, so the results are the same.  When the CPU has the x86 SHA extensions the blocks are compressed with them, several times faster than libtomcrypt's portable code, which is used everywhere else.
+
+enum {
+	sha256_block_size = 64,
+	sha256_length_offset = sha256_block_size - 8, ///< Where the message length goes in the last block.
+};
+
+/// Returns true if the CPU supports the SHA extensions and the SSE4.1 and SSSE3 instructions used with them.
+static bool sha256_hardware_available()
+{
+#if defined(CPU_X86_INTRINSICS)
+	uint32 ecx1, ebx7;
+#if defined(COMPILER_VISUALC)
+	int registers[4];
+	__cpuid(registers, 0);
+	if(registers[0] < 7)
+		return false;
+	__cpuid(registers, 1);
+	ecx1 = registers[2];
+	__cpuidex(registers, 7, 0);
+	ebx7 = registers[1];
+#else
+	unsigned eax, ebx, ecx, edx;
+	if(__get_cpuid_max(0, 0) < 7)
+		return false;
+	__cpuid(1, eax, ebx, ecx, edx);
+	ecx1 = ecx;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	ebx7 = ebx;
+#endif
+	bool ssse3 = (ecx1 >> 9) & 1, sse41 = (ecx1 >> 19) & 1, sha = (ebx7 >> 29) & 1;
+	return ssse3 && sse41 && sha;
+#else
+	return false;
+#endif
+}
+
+/// Returns the switch selecting the hardware compression function.  It starts out on if the CPU supports it; tests and benchmarks can turn it off to run the portable code.
+static bool &sha256_use_hardware()
+{
+	static bool use_hardware = sha256_hardware_available();
+	return use_hardware;
+}
+
+#if defined(CPU_X86_INTRINSICS)
+/// Compresses block_count consecutive blocks into state with the SHA extensions.
+#if defined(COMPILER_GCC)
+__attribute__((target("sha,sse4.1,ssse3")))
+#endif
+static void _sha256_compress_hardware(uint32 state[8], const uint8 *data, uint32 block_count)
+{
+	static const uint32 round_constants[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+	const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	// The round instructions keep the working variables as ABEF and CDGH.
+	__m128i dcba = _mm_loadu_si128((const __m128i *) state);
+	__m128i hgfe = _mm_loadu_si128((const __m128i *) (state + 4));
+	__m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+	__m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+	__m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+	__m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+	for(; block_count; block_count--, data += sha256_block_size)
+	{
+		__m128i abef_start = abef, cdgh_start = cdgh;
+		__m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) data), byte_swap);
+		__m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), byte_swap);
+		__m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), byte_swap);
+		__m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), byte_swap);
+
+		// Each pass does sixteen rounds, then extends the message schedule by sixteen words.
+		for(uint32 round = 0; round < 64; round += 16)
+		{
+			__m128i words[4] = { w0, w1, w2, w3 };
+			for(uint32 i = 0; i < 4; i++)
+			{
+				__m128i k = _mm_add_epi32(words[i], _mm_loadu_si128((const __m128i *) (round_constants + round + i * 4)));
+				cdgh = _mm_sha256rnds2_epu32(cdgh, abef, k);
+				abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(k, 0x0E));
+			}
+			if(round == 48)
+				break;
+			w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3);
+			w1 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w1, w2), _mm_alignr_epi8(w0, w3, 4)), w0);
+			w2 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w2, w3), _mm_alignr_epi8(w1, w0, 4)), w1);
+			w3 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w3, w0), _mm_alignr_epi8(w2, w1, 4)), w2);
+		}
+		abef = _mm_add_epi32(abef, abef_start);
+		cdgh = _mm_add_epi32(cdgh, cdgh_start);
+	}
+
+	__m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+	__m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *) state, _mm_blend_epi16(feba, dchg, 0xF0));
+	_mm_storeu_si128((__m128i *) (state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif
+
+/// Compresses block_count blocks into the hash state, leaving the message length to the caller.  Only called when sha256_use_hardware() is on.
+static void _sha256_compress(hash_state *md, const uint8 *data, uint32 block_count)
+{
+#if defined(CPU_X86_INTRINSICS)
+	uint32 state[8];
+	for(uint32 i = 0; i < 8; i++)
+		state[i] = uint32(md->sha256.state[i]);
+	_sha256_compress_hardware(state, data, block_count);
+	for(uint32 i = 0; i < 8; i++)
+		md->sha256.state[i] = state[i];
+#endif
+}
+
+static int sha256_init(hash_state *md)
+{
+	return ::sha256_init(md);
+}
+
+/// Adds in_size bytes to the hash, buffering a partial block as libtomcrypt does.
+static int sha256_process(hash_state *md, const unsigned char *in, unsigned long in_size)
+{
+	if(!sha256_use_hardware())
+		return ::sha256_process(md, in, in_size);
+	if(md->sha256.curlen >= sha256_block_size)
+		return CRYPT_INVALID_ARG;
+	if(md->sha256.curlen)
+	{
+		uint32 copy_size = sha256_block_size - md->sha256.curlen;
+		if(copy_size > in_size)
+			copy_size = uint32(in_size);
+		memcpy(md->sha256.buf + md->sha256.curlen, in, copy_size);
+		md->sha256.curlen += copy_size;
+		in += copy_size;
+		in_size -= copy_size;
+		if(md->sha256.curlen < sha256_block_size)
+			return CRYPT_OK;
+		_sha256_compress(md, md->sha256.buf, 1);
+		md->sha256.length += sha256_block_size * 8;
+		md->sha256.curlen = 0;
+	}
+	uint32 block_count = uint32(in_size / sha256_block_size);
+	if(block_count)
+	{
+		_sha256_compress(md, in, block_count);
+		md->sha256.length += ulong64(block_count) * sha256_block_size * 8;
+		in += block_count * sha256_block_size;
+		in_size -= block_count * sha256_block_size;
+	}
+	memcpy(md->sha256.buf, in, in_size);
+	md->sha256.curlen = uint32(in_size);
+	return CRYPT_OK;
+}
+
+/// Pads the message and writes the 32 byte digest to out.
+static int sha256_done(hash_state *md, unsigned char *out)
+{
+	if(!sha256_use_hardware())
+		return ::sha256_done(md, out);
+	if(md->sha256.curlen >= sha256_block_size)
+		return CRYPT_INVALID_ARG;
+	md->sha256.length += md->sha256.curlen * 8;
+	md->sha256.buf[md->sha256.curlen++] = 0x80;
+	if(md->sha256.curlen > sha256_length_offset)
+	{
+		memset(md->sha256.buf + md->sha256.curlen, 0, sha256_block_size - md->sha256.curlen);
+		_sha256_compress(md, md->sha256.buf, 1);
+		md->sha256.curlen = 0;
+	}
+	memset(md->sha256.buf + md->sha256.curlen, 0, sha256_length_offset - md->sha256.curlen);
+	ulong64 length = md->sha256.length;
+	for(uint32 i = 0; i < 8; i++)
+		md->sha256.buf[sha256_block_size - 1 - i] = uint8(length >> (i * 8));
+	_sha256_compress(md, md->sha256.buf, 1);
+	for(uint32 i = 0; i < 8; i++)
+		write_uint32_to_buffer(uint32(md->sha256.state[i]), out + i * 4);
+	return CRYPT_OK;
+}
+
+static void sha256_test()
+{
+	printf("---- sha256 unit test: ----\n");
+	static const char *vectors[][2] = {
+		{ "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+	};
+	static const char *million_a_digest = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+	bool hardware_available = sha256_hardware_available();
+	bool saved_use_hardware = sha256_use_hardware();
+	printf("hardware SHA-256 %s\n", hardware_available ? "available" : "not available");
+
+	for(uint32 pass = 0; pass < (hardware_available ? 2u : 1u); pass++)
+	{
+		sha256_use_hardware() = pass == 1;
+		uint32 failures = 0;
+		char hex[65];
+		uint8 digest[32];
+		hash_state state;
+		for(uint32 i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+		{
+			sha256_init(&state);
+			sha256_process(&state, (const uint8 *) vectors[i][0], strlen(vectors[i][0]));
+			sha256_done(&state, digest);
+			for(uint32 j = 0; j < 32; j++)
+				sprintf(hex + j * 2, "%02x", digest[j]);
+			if(strcmp(hex, vectors[i][1]))
+				failures++;
+		}
+		// A million a's, fed in pieces that don't line up with the blocks.
+		uint8 a_buffer[1000];
+		memset(a_buffer, 'a', sizeof(a_buffer));
+		sha256_init(&state);
+		for(uint32 total = 0; total < 1000000; )
+		{
+			uint32 size = 1 + (total * 7) % sizeof(a_buffer);
+			if(size > 1000000 - total)
+				size = 1000000 - total;
+			sha256_process(&state, a_buffer, size);
+			total += size;
+		}
+		sha256_done(&state, digest);
+		for(uint32 j = 0; j < 32; j++)
+			sprintf(hex + j * 2, "%02x", digest[j]);
+		if(strcmp(hex, million_a_digest))
+			failures++;
+		printf("%s: %u known answer failures (0)\n", pass ? "hardware" : "portable", failures);
+	}
+
+	if(hardware_available)
+	{
+		// Every message size over a few blocks, split in two at varying points, against libtomcrypt.
+		uint8 message[300];
+		for(uint32 i = 0; i < sizeof(message); i++)
+			message[i] = uint8(i * 131 + 7);
+		sha256_use_hardware() = true;
+		uint32 mismatches = 0;
+		for(uint32 size = 0; size <= sizeof(message); size++)
+		{
+			uint32 split = (size * 37) % (size + 1);
+			hash_state state, reference_state;
+			uint8 digest[32], reference_digest[32];
+			sha256_init(&state);
+			sha256_process(&state, message, split);
+			sha256_process(&state, message + split, size - split);
+			sha256_done(&state, digest);
+			::sha256_init(&reference_state);
+			::sha256_process(&reference_state, message, size);
+			::sha256_done(&reference_state, reference_digest);
+			if(memcmp(digest, reference_digest, sizeof(digest)))
+				mismatches++;
+		}
+		printf("%u message sizes, %u mismatches with libtomcrypt (0)\n", uint32(sizeof(message) + 1), mismatches);
+	}
+	sha256_use_hardware() = saved_use_hardware;
+}
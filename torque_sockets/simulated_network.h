@@ -0,0 +1,492 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// simulated_network is an in-process transport for running thousands of torque_sockets in one process on a virtual clock.  Sockets join it with torque_socket::bind_simulated; the datagrams they send are queued on the network and delivered in time order, after the delay and loss of the network's link_emulator.  run_next() jumps the clock straight to the next datagram delivery or socket timer and hands each socket that has work to a callback, which processes the socket's events with get_next_event.
+///
+/// Nothing in a simulation depends on the wall clock or on thread scheduling, so a run with the same seed and the same callback behavior reproduces exactly, and handshake retries and connection timeouts take no real time.  Sockets must be destroyed before the network they're bound to.
+class simulated_network
+{
+public:
+	enum {
+		default_start_time = 1000000, ///< Virtual time, in microseconds, a network starts at.  Not 0, since a 0 arrival time means "unknown".
+		default_latency = 10000, ///< One way delay, in microseconds, of a new network's link profile.
+	};
+
+	/// Called by run_next for each socket that has received datagrams or has timer work due.  It should call get_next_event on the socket until it returns NULL.
+	typedef void (*process_function)(void *data, torque_socket *socket);
+
+	/// Counters of the datagrams that have passed through a simulated_network.
+	struct statistics
+	{
+		uint64 datagrams_sent; ///< Datagrams sent by sockets on the network.
+		uint64 datagrams_delivered; ///< Datagrams placed in a socket's receive queue, including duplicates.
+		uint64 datagrams_lost; ///< Datagrams dropped by the network's link_emulator.
+		uint64 datagrams_unroutable; ///< Datagrams sent to an address no socket is bound to.
+		uint64 socket_wakeups; ///< Number of times a socket was handed to the process callback.
+		uint32 steps; ///< Number of times the clock was moved by run_next.
+	};
+
+	/// Constructs a network whose clock starts at start_time, which a replay sets to the time of the capture it plays back.
+	simulated_network(uint64 seed, int64 start_time = default_start_time)
+	{
+		_time = start_time;
+		_next_sequence = 0;
+		_running = false;
+		_random.seed(seed);
+		memset(&_stats, 0, sizeof(_stats));
+
+		link_profile profile;
+		profile.latency = default_latency;
+		_link_emulator.set_profile(link_emulator::outgoing, profile);
+	}
+
+	~simulated_network()
+	{
+		while(_deliveries.size())
+			memory_deallocate(_deliveries.pop());
+		for(hash_table_flat<address, endpoint *>::pointer p = _endpoints.first(); p; ++p)
+			_free_endpoint(*p.value());
+		_free_detached();
+	}
+
+	/// Returns the current virtual time in microseconds.
+	int64 get_time()
+	{
+		return _time;
+	}
+
+	/// Returns the clock that the time_sources of the sockets on this network follow.
+	const int64 *get_clock()
+	{
+		return &_time;
+	}
+
+	/// Returns the link_emulator whose outgoing profile is applied to every datagram sent on the network.  Its bandwidth limit is shared by all the traffic; use each socket's own link emulator for per host conditions.
+	link_emulator &get_link_emulator()
+	{
+		return _link_emulator;
+	}
+
+	/// Fills buffer with bytes from the network's seeded random generator.  Sockets seed themselves from this as they're bound, so their keys and nonces are reproducible too.
+	void random_buffer(uint8 *buffer, uint32 buffer_size)
+	{
+		for(uint32 i = 0; i < buffer_size; i++)
+			buffer[i] = uint8(_random.random_integer());
+	}
+
+	/// Returns the number of addresses sockets are bound to.
+	uint32 get_socket_count()
+	{
+		return _endpoints.size();
+	}
+
+	/// Returns the number of datagrams in flight.
+	uint32 get_datagrams_in_flight()
+	{
+		return _deliveries.size();
+	}
+
+	const statistics &get_statistics()
+	{
+		return _stats;
+	}
+
+	/// Moves the clock to the next time a datagram is delivered or a socket has timer work, delivers the datagrams due and calls process for every socket with work to do at that time.  Returns false, without moving the clock, if nothing is scheduled at or before end_time.
+	bool run_next(process_function process, void *data, int64 end_time)
+	{
+		datagram *next_delivery = _deliveries.top();
+		endpoint *next_socket = _sockets.top();
+		if(!next_delivery && !next_socket)
+			return false;
+		int64 next_time = next_delivery ? next_delivery->time : next_socket->time;
+		if(next_socket && next_socket->time < next_time)
+			next_time = next_socket->time;
+		if(next_time > end_time)
+			return false;
+		if(next_time > _time)
+			_time = next_time;
+		_stats.steps++;
+
+		while((next_delivery = _deliveries.top()) != 0 && next_delivery->time <= _time)
+			_deliver(_deliveries.pop());
+		while((next_socket = _sockets.top()) != 0 && next_socket->time <= _time)
+			_set_ready(_sockets.pop());
+
+		_running = true;
+		for(uint32 i = 0; i < _ready.size(); i++)
+		{
+			endpoint *e = _ready[i];
+			e->ready = false;
+			if(!e->socket)
+				continue;
+			_stats.socket_wakeups++;
+			process(data, e->socket);
+			if(e->socket)
+				_schedule(e);
+		}
+		_ready.clear();
+		_running = false;
+		_free_detached();
+		return true;
+	}
+
+	/// Runs the network until there is nothing left to do before end_time, then moves the clock to end_time.
+	void run_until(int64 end_time, process_function process, void *data)
+	{
+		while(run_next(process, data, end_time))
+			;
+		if(end_time > _time)
+			_time = end_time;
+	}
+
+	/// Queues a datagram for delivery to destination at delivery_time, bypassing the link emulator.  It needn't come from a socket on the network, so a replay can play recorded traffic into a socket.
+	void inject(const address &source, const address &destination, const uint8 *buffer, uint32 buffer_size, int64 delivery_time)
+	{
+		_stats.datagrams_sent++;
+		_queue(source, destination, buffer, buffer_size, delivery_time > _time ? delivery_time : _time);
+	}
+
+	/// Called by udp_socket::bind_simulated to claim an address.  Returns false if the address is in use.
+	bool _attach_socket(const address &bind_address)
+	{
+		if(_endpoints.find(bind_address))
+			return false;
+		endpoint *e = new endpoint;
+		e->bind_address = bind_address;
+		e->socket = 0;
+		e->inbox_head = e->inbox_tail = 0;
+		e->time = 0;
+		e->sequence = 0;
+		e->heap_index = event_heap<endpoint>::not_queued;
+		e->ready = false;
+		_endpoints.insert(bind_address, e);
+		return true;
+	}
+
+	/// Called by torque_socket::bind_simulated so the scheduler can hand the socket to the process callback.
+	void _set_socket_owner(const address &bind_address, torque_socket *socket)
+	{
+		hash_table_flat<address, endpoint *>::pointer p = _endpoints.find(bind_address);
+		assert(p);
+		endpoint *e = *p.value();
+		e->socket = socket;
+		_schedule(e);
+	}
+
+	/// Called when a udp_socket on this network is unbound.  Datagrams waiting for it are dropped.
+	void _detach_socket(const address &bind_address)
+	{
+		hash_table_flat<address, endpoint *>::pointer p = _endpoints.find(bind_address);
+		if(!p)
+			return;
+		endpoint *e = *p.value();
+		p.remove();
+		if(e->heap_index != event_heap<endpoint>::not_queued)
+			_sockets.remove(e);
+		e->socket = 0;
+		// a socket can be destroyed by the process callback while run_next is walking the ready list, so endpoints are only freed once it's done.
+		_detached.push_back(e);
+		if(!_running)
+			_free_detached();
+	}
+
+	/// Called by udp_socket::send_to to queue a datagram for delivery.
+	void _send(const address &source, const address &destination, const uint8 *buffer, uint32 buffer_size)
+	{
+		_stats.datagrams_sent++;
+		int64 release_times[link_emulator::max_copies];
+		uint32 copies = _link_emulator.shape(link_emulator::outgoing, _time, buffer_size, _random, release_times);
+		if(!copies)
+			_stats.datagrams_lost++;
+		for(uint32 i = 0; i < copies; i++)
+			_queue(source, destination, buffer, buffer_size, release_times[i]);
+	}
+
+	/// Called by udp_socket::recv_from to read the next datagram delivered to bind_address.  arrival_time is set to the virtual time of delivery.
+	bool _receive(const address &bind_address, address *sender_address, uint8 *buffer, uint32 buffer_size, uint32 *incoming_packet_size, int64 *arrival_time)
+	{
+		hash_table_flat<address, endpoint *>::pointer p = _endpoints.find(bind_address);
+		if(!p)
+			return false;
+		endpoint *e = *p.value();
+		datagram *d = e->inbox_head;
+		if(!d)
+			return false;
+		e->inbox_head = d->next;
+		if(!e->inbox_head)
+			e->inbox_tail = 0;
+		uint32 size = d->size < buffer_size ? d->size : buffer_size;
+		memcpy(buffer, d->data, size);
+		*incoming_packet_size = size;
+		if(sender_address)
+			*sender_address = d->source;
+		if(arrival_time)
+			*arrival_time = d->time;
+		memory_deallocate(d);
+		return true;
+	}
+private:
+	/// Binary min-heap of records ordered by time, then by the order they were queued, which keeps runs deterministic.  record_type needs int64 time, uint64 sequence and uint32 heap_index members.
+	template <class record_type> class event_heap
+	{
+	public:
+		enum {
+			not_queued = 0xFFFFFFFF,
+		};
+
+		uint32 size()
+		{
+			return _heap.size();
+		}
+
+		record_type *top()
+		{
+			return _heap.size() ? _heap[0] : 0;
+		}
+
+		void push(record_type *record)
+		{
+			record->heap_index = _heap.size();
+			_heap.push_back(record);
+			_sift_up(record->heap_index);
+		}
+
+		record_type *pop()
+		{
+			record_type *record = _heap[0];
+			remove(record);
+			return record;
+		}
+
+		void remove(record_type *record)
+		{
+			uint32 index = record->heap_index;
+			record_type *last = _heap.last();
+			_heap.pop_back();
+			record->heap_index = not_queued;
+			if(last != record)
+			{
+				_heap[index] = last;
+				last->heap_index = index;
+				_sift_up(index);
+				_sift_down(last->heap_index);
+			}
+		}
+	private:
+		array<record_type *> _heap;
+
+		static bool _before(record_type *a, record_type *b)
+		{
+			return a->time < b->time || (a->time == b->time && a->sequence < b->sequence);
+		}
+
+		void _place(uint32 index, record_type *record)
+		{
+			_heap[index] = record;
+			record->heap_index = index;
+		}
+
+		void _sift_up(uint32 index)
+		{
+			record_type *record = _heap[index];
+			while(index)
+			{
+				uint32 parent = (index - 1) / 2;
+				if(!_before(record, _heap[parent]))
+					break;
+				_place(index, _heap[parent]);
+				index = parent;
+			}
+			_place(index, record);
+		}
+
+		void _sift_down(uint32 index)
+		{
+			record_type *record = _heap[index];
+			uint32 count = _heap.size();
+			for(;;)
+			{
+				uint32 child = index * 2 + 1;
+				if(child >= count)
+					break;
+				if(child + 1 < count && _before(_heap[child + 1], _heap[child]))
+					child++;
+				if(!_before(_heap[child], record))
+					break;
+				_place(index, _heap[child]);
+				index = child;
+			}
+			_place(index, record);
+		}
+	};
+
+	struct datagram
+	{
+		datagram *next; ///< Next datagram in the destination's receive queue.
+		int64 time; ///< Virtual time the datagram is delivered.
+		uint64 sequence;
+		uint32 heap_index;
+		address source;
+		address destination;
+		uint32 size;
+		uint8 data[1];
+	};
+
+	struct endpoint
+	{
+		address bind_address;
+		torque_socket *socket; ///< The torque_socket bound to this address, or NULL if there's none.
+		datagram *inbox_head; ///< Datagrams delivered and waiting to be read.
+		datagram *inbox_tail;
+		int64 time; ///< Virtual time the socket next has timer work.
+		uint64 sequence;
+		uint32 heap_index;
+		bool ready; ///< True while the socket is on the list to be processed this step.
+	};
+
+	void _queue(const address &source, const address &destination, const uint8 *buffer, uint32 buffer_size, int64 delivery_time)
+	{
+		datagram *d = (datagram *) memory_allocate(sizeof(datagram) + buffer_size);
+		d->next = 0;
+		d->time = delivery_time;
+		d->sequence = _next_sequence++;
+		d->heap_index = event_heap<datagram>::not_queued;
+		d->source = source;
+		d->destination = destination;
+		d->size = buffer_size;
+		memcpy(d->data, buffer, buffer_size);
+		_deliveries.push(d);
+	}
+
+	void _deliver(datagram *d)
+	{
+		hash_table_flat<address, endpoint *>::pointer p = _endpoints.find(d->destination);
+		if(!p)
+		{
+			_stats.datagrams_unroutable++;
+			memory_deallocate(d);
+			return;
+		}
+		_stats.datagrams_delivered++;
+		endpoint *e = *p.value();
+		d->next = 0;
+		if(e->inbox_tail)
+			e->inbox_tail->next = d;
+		else
+			e->inbox_head = d;
+		e->inbox_tail = d;
+		if(e->socket && !e->ready)
+		{
+			if(e->heap_index != event_heap<endpoint>::not_queued)
+				_sockets.remove(e);
+			_set_ready(e);
+		}
+	}
+
+	void _set_ready(endpoint *e)
+	{
+		e->ready = true;
+		_ready.push_back(e);
+	}
+
+	/// Queues a socket to be woken at the time it next has timer work.
+	void _schedule(endpoint *e)
+	{
+		int64 next_time = e->socket->get_next_process_time();
+		// a socket left with work still to do now is woken on the next step rather than repeatedly on this one.
+		if(next_time <= _time)
+			next_time = _time + 1;
+		e->time = next_time;
+		e->sequence = _next_sequence++;
+		_sockets.push(e);
+	}
+
+	void _free_endpoint(endpoint *e)
+	{
+		while(e->inbox_head)
+		{
+			datagram *next = e->inbox_head->next;
+			memory_deallocate(e->inbox_head);
+			e->inbox_head = next;
+		}
+		delete e;
+	}
+
+	void _free_detached()
+	{
+		for(uint32 i = 0; i < _detached.size(); i++)
+			_free_endpoint(_detached[i]);
+		_detached.clear();
+	}
+
+	int64 _time; ///< The virtual clock, in microseconds.
+	uint64 _next_sequence; ///< Orders events scheduled for the same time.
+	bool _running; ///< True while run_next is calling the process callback.
+	fast_random_generator _random; ///< Seeded source of link emulation and socket entropy.
+	link_emulator _link_emulator; ///< Conditions applied to every datagram.
+	statistics _stats;
+	hash_table_flat<address, endpoint *> _endpoints; ///< Bound addresses.
+	event_heap<datagram> _deliveries; ///< Datagrams in flight, by delivery time.
+	event_heap<endpoint> _sockets; ///< Sockets waiting for their next timer work, by time.
+	array<endpoint *> _ready; ///< Sockets to process on the current step.
+	array<endpoint *> _detached; ///< Endpoints of sockets unbound during the current step, freed when it's done.
+};
+
+static void torque_connection_packet_size_test()
+{
+	printf("---- torque_connection packet size unit test: ----\n");
+	struct test_state
+	{
+		torque_socket *server;
+		bool established;
+		uint32 largest_packet;
+
+		static void process(void *data, torque_socket *socket)
+		{
+			test_state *s = (test_state *) data;
+			torque_socket_event *event;
+			while((event = socket->get_next_event()) != 0)
+			{
+				if(event->event_type == torque_connection_requested_event_type)
+					socket->accept_connection(event->connection);
+				else if(event->event_type == torque_connection_challenge_response_event_type)
+					socket->accept_connection_challenge(event->connection);
+				else if(event->event_type == torque_connection_established_event_type && socket != s->server)
+					s->established = true;
+				else if(event->event_type == torque_connection_packet_event_type && event->data_size > s->largest_packet)
+					s->largest_packet = event->data_size;
+			}
+		}
+	};
+	simulated_network network(1);
+	address server_address, client_address;
+	server_address.set_host(0x0A000001);
+	server_address.set_port(28000);
+	client_address.set_host(0x0A000002);
+	client_address.set_port(28000);
+
+	test_state s;
+	s.server = new torque_socket();
+	s.server->bind_simulated(&network, server_address);
+	s.server->set_puzzle_difficulty(0);
+	s.server->set_integrity_mode(torque_integrity_crc32c);
+	s.established = false;
+	s.largest_packet = 0;
+	torque_socket *client = new torque_socket();
+	client->bind_simulated(&network, client_address);
+	client->set_integrity_mode(torque_integrity_crc32c);
+	torque_connection_id connection = client->connect(server_address, 0, 0);
+	while(!s.established && network.run_next(test_state::process, &s, network.get_time() + 10000000))
+		;
+
+	// the largest payload that fits with the largest header and the CRC goes through; one more byte is refused.
+	uint8 data[udp_socket::max_datagram_size];
+	memset(data, 0, sizeof(data));
+	uint32 largest = udp_socket::max_datagram_size - torque_connection::max_packet_header_size - torque_connection::crc_trailer_bytes;
+	bool sent = client->send_to_connection(connection, data, largest);
+	bool sent_over = client->send_to_connection(connection, data, largest + 1);
+	network.run_until(network.get_time() + 1000000, test_state::process, &s);
+	printf("established %d (1), largest sent %d (1), one byte over sent %d (0), largest received %u (%u)\n", s.established, sent, sent_over, s.largest_packet, largest);
+
+	delete client;
+	delete s.server;
+}
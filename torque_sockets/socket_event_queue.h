@@ -1,37 +1,213 @@
 // socket_event_queue.h - A queue for torque_socket_event records.
 // Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
 
+/// payload_pool holds the buffers behind event data.  Each buffer is a reference counted slot: the event queue holds one reference until it's cleared, and the application can add its own with retain to keep a payload past the next get_next_event call without copying it.  Slots are returned to the pool's free list on their final release, which may happen on any thread, and even after the socket that owns the pool has been destroyed; the pool deletes itself once it is closed and its last slot comes back.
+class payload_pool
+{
+public:
+	enum {
+		slot_data_size = udp_socket::max_datagram_size, ///< Capacity of a pooled slot.  Larger payloads get a slot of their own that is freed rather than pooled.
+		max_free_slots = 256, ///< Free slots kept for reuse; slots released beyond this are freed.
+	};
+	
+	struct slot
+	{
+		payload_pool *pool;
+		slot *next; ///< Next slot in the pool's free list, or in the event queue's list of slots it holds.
+		uint32 ref_count;
+		uint32 capacity;
+		
+		uint8 *get_data()
+		{
+			return (uint8 *) (this + 1);
+		}
+	};
+	
+	payload_pool()
+	{
+		_free_list = 0;
+		_free_count = 0;
+		_owner_free_list = 0;
+		_allocated_count = 0;
+		_released_count = 0;
+		_closed = false;
+	}
+	
+	/// Returns a slot with one reference and room for data_size bytes.  Only the thread that owns the pool may allocate; it takes the free list in one batch when its own runs out, so most allocations don't lock.
+	slot *allocate(uint32 data_size)
+	{
+		slot *the_slot = 0;
+		if(data_size <= slot_data_size)
+		{
+			if(!_owner_free_list && _free_list)
+			{
+				_lock.lock();
+				_owner_free_list = _free_list;
+				_free_list = 0;
+				_free_count = 0;
+				_lock.unlock();
+			}
+			the_slot = _owner_free_list;
+			if(the_slot)
+				_owner_free_list = the_slot->next;
+		}
+		if(!the_slot)
+		{
+			uint32 capacity = data_size > slot_data_size ? data_size : uint32(slot_data_size);
+			the_slot = (slot *) memory_allocate(sizeof(slot) + capacity);
+			the_slot->pool = this;
+			the_slot->capacity = capacity;
+		}
+		_allocated_count++;
+		the_slot->next = 0;
+		the_slot->ref_count = 1;
+		return the_slot;
+	}
+	
+	/// Returns the slot holding data, which must have come from a payload_pool.
+	static slot *get_slot(uint8 *data)
+	{
+		return ((slot *) data) - 1;
+	}
+	
+	/// Adds a reference to the slot holding data.
+	static void retain(uint8 *data)
+	{
+		slot *the_slot = get_slot(data);
+		payload_pool *pool = the_slot->pool;
+		pool->_lock.lock();
+		the_slot->ref_count++;
+		pool->_lock.unlock();
+	}
+	
+	/// Drops a reference to the slot holding data, returning it to its pool on the final release.  Safe to call from any thread.
+	static void release(uint8 *data)
+	{
+		slot *the_slot = get_slot(data);
+		the_slot->pool->release_list(the_slot, false);
+	}
+	
+	/// Drops a reference to every slot in a list linked through next, under a single lock.  If linked is false only the_slot itself is released.
+	void release_list(slot *the_slot, bool linked = true)
+	{
+		_lock.lock();
+		while(the_slot)
+		{
+			slot *next = linked ? the_slot->next : 0;
+			assert(the_slot->ref_count);
+			if(!--the_slot->ref_count)
+			{
+				_released_count++;
+				if(!_closed && the_slot->capacity == slot_data_size && _free_count < max_free_slots)
+				{
+					the_slot->next = _free_list;
+					_free_list = the_slot;
+					_free_count++;
+				}
+				else
+					memory_deallocate(the_slot);
+			}
+			the_slot = next;
+		}
+		bool finished = _closed && _released_count == _allocated_count;
+		_lock.unlock();
+		if(finished)
+			delete this;
+	}
+	
+	/// Called by the owner in place of deleting the pool.  Frees the free slots, and deletes the pool now if no slots are outstanding, or else when the last one is released.
+	void close()
+	{
+		_lock.lock();
+		_closed = true;
+		for(uint32 i = 0; i < 2; i++)
+		{
+			slot *&list = i ? _owner_free_list : _free_list;
+			while(list)
+			{
+				slot *next = list->next;
+				memory_deallocate(list);
+				list = next;
+			}
+		}
+		_free_count = 0;
+		bool finished = _released_count == _allocated_count;
+		_lock.unlock();
+		if(finished)
+			delete this;
+	}
+private:
+	mutex _lock;
+	slot *_free_list; ///< Slots released since the owner last took the free list.
+	uint32 _free_count;
+	slot *_owner_free_list; ///< Free slots taken by the owning thread, which it allocates from without locking.
+	uint32 _allocated_count; ///< Slots handed out, changed only by the owning thread.
+	uint32 _released_count; ///< Slots released for the last time.
+	bool _closed;
+};
+
 class socket_event_queue
 {
 public:
 	struct queue_entry {
 		torque_socket_event *event;
 		queue_entry *next_event;
+		int64 process_time; ///< Time processing started on the packet that posted this event, or 0.
 	};
 	
 	queue_entry *_event_queue_tail;
 	queue_entry *_event_queue_head;
 	page_allocator<16> _allocator;
+	int64 _arrival_time; ///< Arrival time of the packet currently being processed, stamped into each posted event.
+	int64 _process_time; ///< Time processing started on the packet currently being processed.
+	payload_pool *_payloads; ///< Slots for event data.
+	payload_pool::slot *_held_payloads; ///< Slots holding the data of the events posted since the last clear.
 	
 	socket_event_queue(zone_allocator *allocator) : _allocator(allocator)
 	{
 		_event_queue_head = 0;
 		_event_queue_tail = 0;
+		_arrival_time = 0;
+		_process_time = 0;
+		_payloads = new payload_pool;
+		_held_payloads = 0;
+	}
+	
+	~socket_event_queue()
+	{
+		clear();
+		_payloads->close();
+	}
+	
+	/// Sets the arrival and processing start times (in microseconds) of the packet whose events are about to be posted, or 0 for events not caused by a received packet.
+	void set_packet_times(int64 arrival_time, int64 process_time)
+	{
+		_arrival_time = arrival_time;
+		_process_time = process_time;
 	}
 	
 	bool has_event()
 	{
 		return _event_queue_head != 0;
 	}
+	/// Releases the memory of every event posted so far.  Event data the application has retained stays valid until it's released.
 	void clear()
 	{
+		if(_held_payloads)
+		{
+			_payloads->release_list(_held_payloads);
+			_held_payloads = 0;
+		}
 		_allocator.clear();
 	}
 	
-	torque_socket_event *dequeue()
+	/// Removes the event at the head of the queue.  If process_time is not NULL it is set to the processing start time of the packet that posted the event.
+	torque_socket_event *dequeue(int64 *process_time = 0)
 	{
 		assert(_event_queue_head);
 		torque_socket_event *ret = _event_queue_head->event;
+		if(process_time)
+			*process_time = _event_queue_head->process_time;
 		_event_queue_head = _event_queue_head->next_event;
 		if(!_event_queue_head)
 			_event_queue_tail = 0;
@@ -43,12 +219,25 @@ public:
 		return (uint8 *) _allocator.allocate(data_size);
 	}
 	
+	/// Sets event's data to a payload slot of data_size bytes and returns it for the caller to fill in.
+	uint8 *allocate_event_data(torque_socket_event *event, uint32 data_size)
+	{
+		payload_pool::slot *the_slot = _payloads->allocate(data_size);
+		the_slot->next = _held_payloads;
+		_held_payloads = the_slot;
+		event->data_size = data_size;
+		event->data = the_slot->get_data();
+		return event->data;
+	}
+	
 	torque_socket_event *post_event(uint32 event_type, torque_connection_id connection_id = 0)
 	{
+		TorqueTraceSpan("socket_event_queue::post_event");
 		torque_socket_event *ret = (torque_socket_event *) _allocator.allocate(sizeof(torque_socket_event));
 		queue_entry *entry = (queue_entry *) _allocator.allocate(sizeof(queue_entry));
 		
 		entry->event = ret;
+		entry->process_time = _process_time;
 		
 		ret->event_type = event_type;
 		ret->data = 0;
@@ -56,6 +245,10 @@ public:
 		ret->data_size = 0;
 		ret->key_size = 0;
 		ret->connection = connection_id;
+		ret->arrival_time = _arrival_time;
+		ret->reason = torque_reason_none;
+		ret->retry_after = 0;
+		ret->transfer_size = 0;
 
 		entry->next_event = 0;
 		if(_event_queue_tail)
@@ -70,9 +263,7 @@ public:
 	
 	void set_event_data(torque_socket_event *event, uint8 *data, uint32 data_size)
 	{
-		event->data_size = data_size;
-		event->data = allocate_queue_data(data_size);
-		memcpy(event->data, data, data_size);
+		memcpy(allocate_event_data(event, data_size), data, data_size);
 	}
 	
 	void set_event_key(torque_socket_event *event, uint8 *key, uint32 key_size)
@@ -289,6 +289,17 @@ public:
 
 		return current_time;
 	}
+
+	/// Returns the current wall clock time in microseconds since January 1, 1970.  This is the clock kernel packet receive timestamps are taken from, so the two can be compared directly.
+	static int64 get_current_microseconds()
+	{
+		FILETIME ft;
+		GetSystemTimeAsFileTime(&ft);
+		ULARGE_INTEGER lt;
+		lt.LowPart = ft.dwLowDateTime;
+		lt.HighPart = ft.dwHighDateTime;
+		return int64(lt.QuadPart - 116444736000000000ULL) / 10;
+	}
 #else
 	static time get_current()
 	{
@@ -297,6 +308,14 @@ public:
 		uint64 ms = uint64(t.tv_sec) * 1000 + t.tv_usec / 1000;
 		return time(ms);
 	}
+
+	/// Returns the current wall clock time in microseconds since January 1, 1970.  This is the clock kernel packet receive timestamps are taken from, so the two can be compared directly.
+	static int64 get_current_microseconds()
+	{
+		timeval t;
+		gettimeofday(&t, NULL);
+		return int64(t.tv_sec) * 1000000 + t.tv_usec;
+	}
 #endif
 };
 
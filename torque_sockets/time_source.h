@@ -0,0 +1,157 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// time_source is the clock a torque_socket runs on.  It counts microseconds on a monotonic clock, offset so that it starts out equal to the wall clock (microseconds since January 1, 1970), so its values can be used alongside time::get_current() values and never step backwards when the system clock is adjusted.
+///
+/// Hot path code doesn't read the clock directly: tick() samples it once per processing pass and get_tick_time() / get_tick_microseconds() return the cached sample.  update_fast() refreshes the cached sample from the coarse kernel clock, which is cheap enough to call per packet.  read_microseconds() reads the precise clock for callers that need microsecond resolution outside a tick (RTT send stamps).
+///
+/// A time_source can also be switched to a virtual clock, which only moves when set_virtual_microseconds() or advance_virtual() is called, for deterministic simulation and tests.  attach_virtual_clock() makes it follow a clock shared with other time sources instead, such as a simulated_network's.
+class time_source
+{
+public:
+	time_source()
+	{
+		_virtual = false;
+		_virtual_clock = 0;
+		_monotonic_offset = time::get_current_microseconds() - read_monotonic_microseconds();
+		_tick_microseconds = 0;
+		_wall_offset = 0;
+		tick();
+	}
+
+	/// Reads the precise monotonic clock, in microseconds from an arbitrary start point.
+	static int64 read_monotonic_microseconds()
+	{
+#if defined(PLATFORM_WIN32)
+		static LARGE_INTEGER frequency;
+		if(!frequency.QuadPart)
+			QueryPerformanceFrequency(&frequency);
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return int64(counter.QuadPart / frequency.QuadPart) * 1000000 + int64(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return int64(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+#else
+		return time::get_current_microseconds();
+#endif
+	}
+
+	/// Reads the coarse monotonic clock, which has the same start point as read_monotonic_microseconds() but only advances once per kernel tick (1-4 ms).  Where there is no coarse clock this is the precise clock.
+	static int64 read_coarse_monotonic_microseconds()
+	{
+#if defined(CLOCK_MONOTONIC_COARSE)
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+		return int64(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+#else
+		return read_monotonic_microseconds();
+#endif
+	}
+
+	/// Samples the precise clock as the time for this processing pass, and updates the wall clock offset used by from_wall_microseconds.
+	void tick()
+	{
+		if(_virtual)
+		{
+			if(_virtual_clock)
+				_tick_microseconds = *_virtual_clock;
+			return;
+		}
+		int64 wall = time::get_current_microseconds();
+		_set_tick(read_monotonic_microseconds() + _monotonic_offset);
+		_wall_offset = _tick_microseconds - wall;
+	}
+
+	/// Moves the cached time forward from the coarse clock.  Cheaper than tick(), but only accurate to a kernel tick.
+	void update_fast()
+	{
+		if(_virtual)
+		{
+			if(_virtual_clock)
+				_tick_microseconds = *_virtual_clock;
+			return;
+		}
+		_set_tick(read_coarse_monotonic_microseconds() + _monotonic_offset);
+	}
+
+	/// Returns the time sampled by the last tick() or update_fast(), in microseconds.
+	int64 get_tick_microseconds()
+	{
+		return _tick_microseconds;
+	}
+
+	/// Returns the time sampled by the last tick() or update_fast().
+	time get_tick_time()
+	{
+		return time(_tick_microseconds / 1000);
+	}
+
+	/// Reads the current time in microseconds, bypassing the tick cache.
+	int64 read_microseconds()
+	{
+		if(_virtual)
+			return _virtual_clock ? *_virtual_clock : _tick_microseconds;
+		return read_monotonic_microseconds() + _monotonic_offset;
+	}
+
+	/// Converts a wall clock time in microseconds (such as a kernel receive timestamp) to this time source's clock, using the offset between the two measured at the last tick().
+	int64 from_wall_microseconds(int64 wall_microseconds)
+	{
+		return wall_microseconds ? wall_microseconds + _wall_offset : 0;
+	}
+
+	/// Switches between the system clock and a virtual clock.  The virtual clock starts at the current cached time.
+	void set_virtual(bool is_virtual)
+	{
+		_virtual = is_virtual;
+		_virtual_clock = 0;
+		_wall_offset = 0;
+		if(!is_virtual)
+		{
+			_monotonic_offset = _tick_microseconds - read_monotonic_microseconds();
+			tick();
+		}
+	}
+
+	bool is_virtual()
+	{
+		return _virtual;
+	}
+
+	/// Switches to a virtual clock that reads the time from clock, which the owner moves forward.  Any number of time sources can share one clock.
+	void attach_virtual_clock(const int64 *clock)
+	{
+		_virtual = true;
+		_virtual_clock = clock;
+		_wall_offset = 0;
+		_tick_microseconds = *clock;
+	}
+
+	/// Sets the time of the virtual clock.
+	void set_virtual_microseconds(int64 microseconds)
+	{
+		assert(_virtual && !_virtual_clock);
+		_tick_microseconds = microseconds;
+	}
+
+	/// Moves the virtual clock forward.
+	void advance_virtual(int64 microseconds)
+	{
+		assert(_virtual && !_virtual_clock);
+		_tick_microseconds += microseconds;
+	}
+private:
+	void _set_tick(int64 microseconds)
+	{
+		// the coarse and precise clocks can disagree by a kernel tick, so never let the cached time run backwards.
+		if(microseconds > _tick_microseconds)
+			_tick_microseconds = microseconds;
+	}
+
+	bool _virtual; ///< True if the time only moves when set explicitly.
+	const int64 *_virtual_clock; ///< Shared clock a virtual time source follows, or NULL if it's set directly.
+	int64 _monotonic_offset; ///< Added to the monotonic clock to get this time source's time.
+	int64 _wall_offset; ///< Difference between this time source and the wall clock at the last tick.
+	int64 _tick_microseconds; ///< Cached time for the current processing pass.
+};
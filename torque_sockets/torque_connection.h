@@ -35,6 +35,8 @@ public:
 		packet_header_pad_bits = (packet_header_byte_size << 3) - packet_header_bit_size, ///< Padding bits to get header bytes to align on a byte boundary, for encryption purposes.
 		
 		message_signature_bytes = 5, ///< Special data bytes written into the end of the packet to guarantee data consistency
+		max_packet_header_size = packet_header_byte_size + 1 + max_ack_byte_count, ///< Largest header write_packet_header writes: sequence numbers, ack byte count and ack mask.
+		crc_trailer_bytes = 4, ///< Size of the CRC32C at the end of each packet of a torque_integrity_crc32c connection.
 	};
 	enum net_packet_type
 	{
@@ -42,6 +44,7 @@ public:
 		ping_packet, ///< Ping packet, sent if this instance hasn't heard from the remote host for a while.  Sending a
 		///  ping packet does not increment the packet sequence number.
 		ack_packet,  ///< Packet sent in response to a ping packet.  Sending an ack packet does not increment the sequence number.
+		bulk_packet, ///< Piece of a bulk transfer (see bulk_transfer).  Sequenced like a data packet, but handled by the connection itself rather than posted to the application.
 		invalid_packet_type,
 	};
 	/// Constants controlling the behavior of pings and timeouts
@@ -53,70 +56,140 @@ protected:
 	/// Reads a raw packet from a bit_stream, as dispatched from torque_socket.
 	bool read_raw_packet(bit_stream &bstream)
 	{
-		if(_simulated_packet_loss && _torque_socket->random().random_unit_float() < _simulated_packet_loss)
+		TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: RECV bytes", _connection_index));
+		
+		if(_integrity_mode == torque_integrity_crc32c && !_check_packet_crc(bstream))
 		{
-			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: RECVDROP - %d", _connection_index, get_last_send_sequence()));
+			TorqueLogMessage(LogNetConnection, ("Packet failed CRC check"));
+			_flight_recorder.record_event(_torque_socket->get_process_start_time(), packet_flight_recorder::packet_received_corrupt, 0, 0, invalid_packet_type, bstream.get_stream_byte_size());
 			return false;
 		}
-		TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: RECV bytes", _connection_index));
-		
-		if(read_packet_header(bstream))
+		uint32 packet_type;
+		bool sequenced = read_packet_header(bstream, &packet_type);
+		_update_bulk_active();
+		if(sequenced && packet_type == bulk_packet)
+		{
+			_handle_bulk_packet(bstream);
+			return true;
+		}
+		if(sequenced)
 		{
 			torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_packet_event_type);
 			event->packet_sequence = get_last_received_sequence();
 			event->connection = get_connection_index();
-			event->data_size = bstream.get_stream_byte_size() - bstream.get_byte_position();
-			event->data = _torque_socket->_event_queue.allocate_queue_data(event->data_size);
-			memcpy(event->data, bstream.get_buffer() + bstream.get_byte_position(), event->data_size);
+			uint32 data_size = bstream.get_stream_byte_size() - bstream.get_byte_position();
+			memcpy(_torque_socket->_event_queue.allocate_event_data(event, data_size), bstream.get_buffer() + bstream.get_byte_position(), data_size);
 			return true;
 		}
 		return false;
 	}
 	
-	/// Sends a packet that was written into a bit_stream to the remote host, or the _remote_connection on this host.
-	void send_packet(net_packet_type packet_type, uint8 *data, uint32 data_size, uint32 *sequence = 0)
+	/// Sends a packet that was written into a bit_stream to the remote host, or the _remote_connection on this host.  Returns false, and sends nothing, if the data with the largest packet header and the connection's CRC doesn't fit in a datagram.
+	bool send_packet(net_packet_type packet_type, uint8 *data, uint32 data_size, uint32 *sequence = 0)
 	{
+		TorqueTraceSpan("torque_connection::send_packet");
+		if(data_size + get_packet_trailer_size() > udp_socket::max_datagram_size - max_packet_header_size)
+			return false;
 		packet_stream ps;
-		write_packet_header(ps, packet_type);
-		if(packet_type == data_packet)
+		if(is_sequenced(packet_type))
 		{
+			write_data_packet_header(ps, packet_type);
 			int32 start = ps.get_bit_position();
 			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: START", _connection_index) );
 			ps.write_bytes(data, data_size);
 			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: END - %llu bits", _connection_index, ps.get_bit_position() - start) );			
 		}
-		if(!_symmetric_cipher.is_null())
+		else
+			write_packet_header(ps, packet_type);
+		_send_finished_packet(packet_type, ps.get_buffer(), ps.get_next_byte_position(), sequence);
+		return true;
+	}
+
+	/// Sends a data packet whose payload the caller has already written into buffer, starting max_packet_header_size bytes in.  The header is written into the reserved space directly in front of the payload, so the payload isn't copied.
+	void send_packet_in_place(uint8 *buffer, uint32 data_size, uint32 *sequence = 0)
+	{
+		TorqueTraceSpan("torque_connection::send_packet_in_place");
+		uint8 header[max_packet_header_size];
+		bit_stream header_stream(header, sizeof(header));
+		write_data_packet_header(header_stream);
+		uint32 header_size = header_stream.get_next_byte_position();
+		uint8 *packet = buffer + max_packet_header_size - header_size;
+		memcpy(packet, header, header_size);
+		_send_finished_packet(data_packet, packet, header_size + data_size, sequence);
+	}
+
+	/// Encrypts a packet whose header and payload are written, or appends its CRC32C on a torque_integrity_crc32c connection, and hands it to the socket.  The packet buffer must have room for the CRC after packet_size.
+	void _send_finished_packet(net_packet_type packet_type, uint8 *packet, uint32 packet_size, uint32 *sequence)
+	{
+		if(_integrity_mode == torque_integrity_crc32c)
 		{
-			_symmetric_cipher->setup_counter(_last_send_seq, _last_seq_recvd, packet_type, 0);
-			// bit_stream_hash_and_encrypt(ps, message_signature_bytes, packet_header_byte_size, _symmetric_cipher);
+			write_uint32_to_buffer(~buffer_calculate_crc32c(packet, packet_size), packet + packet_size);
+			packet_size += crc_trailer_bytes;
 		}
-		if(_simulated_packet_loss && _torque_socket->random().random_unit_float() < _simulated_packet_loss)
+		else if(!_symmetric_cipher.is_null())
 		{
-			TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: SENDDROP - %d", _connection_index, get_last_send_sequence()));
+			_symmetric_cipher->setup_counter(_last_send_seq, _last_seq_recvd, packet_type, 0);
+			// bit_stream_hash_and_encrypt(ps, message_signature_bytes, packet_header_byte_size, _symmetric_cipher);
 		}
+		TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: SEND - %d bytes", _connection_index, packet_size));
 		
-		TorqueLogMessageFormatted(LogNetConnection, ("torque_connection %d: SEND - %d bytes", _connection_index, ps.get_next_byte_position()));
-		
-		if(_simulated_latency)
-		{
-			_torque_socket->send_to_delayed(get_address(), ps, _simulated_latency);
-		}
-		else
-			_torque_socket->send_to(get_address(), ps.get_next_byte_position(),  ps.get_buffer());
+		packet_flight_recorder::record_type sent = _torque_socket->_send_packet(get_address(), packet, packet_size, &_link_emulator);
+		_flight_recorder.record_event(_torque_socket->get_process_start_time(), sent, _last_send_seq, _last_seq_recvd, packet_type, packet_size);
 		if(sequence)
 			*sequence = _last_send_seq;
 	}
 
+	/// Checks the CRC32C at the end of a received packet and trims it off the stream.  Returns false if the packet is too short or the CRC doesn't match.
+	bool _check_packet_crc(bit_stream &stream)
+	{
+		uint32 size = stream.get_stream_byte_size();
+		if(size < packet_header_byte_size + crc_trailer_bytes)
+			return false;
+		size -= crc_trailer_bytes;
+		if(read_uint32_from_buffer(stream.get_buffer() + size) != ~buffer_calculate_crc32c(stream.get_buffer(), size))
+			return false;
+		stream.set_stream_byte_size(size);
+		return true;
+	}
+
+	/// Returns the number of bytes _send_finished_packet adds to the end of each packet.
+	uint32 get_packet_trailer_size()
+	{
+		return _integrity_mode == torque_integrity_crc32c ? crc_trailer_bytes : 0;
+	}
+
+	/// Returns true if this connection's data packets can be sent as a header followed by a payload kept elsewhere, which is how torque_socket::send_to_connections sends one payload to many connections.  Packets that are encrypted, end in a CRC or are held by the link emulator have to be built whole by send_packet.
+	bool can_send_shared_payload()
+	{
+		return _symmetric_cipher.is_null() && _integrity_mode != torque_integrity_crc32c && !_link_emulator.is_active(link_emulator::outgoing) && !_torque_socket->_link_emulator.is_active(link_emulator::outgoing);
+	}
+
+	/// Returns true for the packet types that take a sequence number and are reported delivered or lost by the notify protocol.
+	static bool is_sequenced(uint32 packet_type)
+	{
+		return packet_type == data_packet || packet_type == bulk_packet;
+	}
+
+	/// Writes the header of the next data (or bulk) packet into stream and records the packet's send time.
+	void write_data_packet_header(bit_stream &stream, net_packet_type packet_type = data_packet)
+	{
+		write_packet_header(stream, packet_type);
+		_packet_send_times[_last_send_seq & packet_window_mask] = _torque_socket->get_time_source().read_microseconds();
+	}
+
 	/// Writes the notify protocol's packet header into the bit_stream.
 	void write_packet_header(bit_stream &stream, net_packet_type packet_type)
 	{
-		assert(!window_full() || packet_type != data_packet);
+		assert(!window_full() || !is_sequenced(packet_type));
 		
 		int32 ack_byte_count = ((_last_seq_recvd - _last_recv_ack_ack + 7) >> 3);
 		assert(ack_byte_count <= max_ack_byte_count);
 		
-		if(packet_type == data_packet)
+		if(is_sequenced(packet_type))
+		{
 			_last_send_seq++;
+			_bulk_window[_last_send_seq & packet_window_mask] = bulk_transfer::window_none;
+		}
 		
 		stream.write_integer(packet_type, 2);
 		stream.write_integer(_last_send_seq, 5); // write the first 5 bits of the send sequence
@@ -139,7 +212,7 @@ protected:
 		// sequence recieved (in case this packet drops and the prev one
 		// goes through) 
 		
-		if(packet_type == data_packet)
+		if(is_sequenced(packet_type))
 			_last_seq_recvd_at_send[_last_send_seq & packet_window_mask] = _last_seq_recvd;
 		
 		//if(is_network_connection())
@@ -151,8 +224,8 @@ protected:
 		TorqueLogMessageFormatted(LogConnectionProtocol, ("build hdr %d %d", _last_send_seq, packet_type));
 	}
 	
-	/// Reads a notify protocol packet header from the bit_stream and returns true if it was a data packet that needs more processing.
-	bool read_packet_header(bit_stream &pstream)
+	/// Reads a notify protocol packet header from the bit_stream and returns true if it was a data or bulk packet that needs more processing.  If packet_type is not NULL it receives the packet's net_packet_type.
+	bool read_packet_header(bit_stream &pstream, uint32 *packet_type = 0)
 	{
 		// read in the packet header:
 		//
@@ -170,11 +243,13 @@ protected:
 		//    00 data packet
 		//    01 ping packet
 		//    02 ack packet
+		//    03 bulk packet
 		
 		// next 0...ack_byte_count bytes are ack flags
 		//
 		// return value is true if this is a valid data packet or false if there is nothing more that should be read
 		
+		TorqueTraceSpan("torque_connection::read_packet_header");
 		uint32 pk_packet_type = pstream.read_integer(2);
 		uint32 pk_sequence_number = pstream.read_integer(5);
 		bool pk_data_packet_flag = pstream.read_bool();
@@ -199,6 +274,7 @@ protected:
 		if(pk_sequence_number - _last_seq_recvd > (max_packet_window_size - 1))
 		{
 			// the sequence number is outside the window... must be out of order discard.
+			_flight_recorder.record_event(_torque_socket->get_process_start_time(), packet_flight_recorder::packet_received_out_of_window, pk_sequence_number, pk_highest_ack, pk_packet_type, pstream.get_stream_byte_size());
 			return false;
 		}
 		
@@ -211,10 +287,11 @@ protected:
 		if(pk_highest_ack > _last_send_seq)
 		{
 			// the ack number is outside the window... must be an out of order packet, discard.
+			_flight_recorder.record_event(_torque_socket->get_process_start_time(), packet_flight_recorder::packet_received_out_of_window, pk_sequence_number, pk_highest_ack, pk_packet_type, pstream.get_stream_byte_size());
 			return false;
 		}
 		
-		if(!_symmetric_cipher.is_null())
+		if(_integrity_mode == torque_integrity_cipher && !_symmetric_cipher.is_null())
 		{
 			_symmetric_cipher->setup_counter(pk_sequence_number, pk_highest_ack, pk_packet_type, 0);
 			/*if(!bit_stream_decrypt_and_check_hash(pstream, message_signature_bytes, packet_header_byte_size, _symmetric_cipher))
@@ -235,6 +312,7 @@ protected:
 			pk_ack_mask[i] = pstream.read_integer(i == pk_ack_word_count - 1 ? (pk_ack_byte_count - (i * 4)) * 8 : 32);
 		pstream.advance_to_next_byte();
 		logprintf("header read %d bits.", pstream.get_bit_position());
+		_flight_recorder.record_event(_torque_socket->get_process_start_time(), packet_flight_recorder::packet_received, pk_sequence_number, pk_highest_ack, pk_packet_type, pstream.get_stream_byte_size());
 		//if(is_network_connection())
 		//{
 		//   TorqueLogMessageFormatted(LogBlah, ("RCV: mHA: %08x  pkHA: %08x  mLSQ: %08x  pkSN: %08x  pkLS: %08x  pkAM: %08x",
@@ -246,6 +324,7 @@ protected:
 			"data_packet",
 			"ping_packet",
 			"ack_packet",
+			"bulk_packet",
 		};
 		
 		TorqueLogBlock(LogConnectionProtocol,
@@ -268,7 +347,7 @@ protected:
 		}
 		
 		// the first word upshifts all NACKs, except for the low bit, which is a 1 if this is a data packet (i.e. not a ping packet or an ack packet)
-		uint32 up_shifted = (pk_packet_type == data_packet) ? 1 : 0; 
+		uint32 up_shifted = is_sequenced(pk_packet_type) ? 1 : 0; 
 		
 		for(uint32 i = 0; i < max_ack_mask_size; i++)
 		{
@@ -289,9 +368,21 @@ protected:
 			bool packet_transmit_success = (pk_ack_mask[ack_mask_word] & (1 << ack_mask_bit)) != 0;
 			TorqueLogMessageFormatted(LogConnectionProtocol, ("Ack %d %d", notify_index, packet_transmit_success));
 			
-			torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_packet_notify_event_type, _connection_index);
-			event->delivered = packet_transmit_success;
-			event->packet_sequence = notify_index;
+			int32 &bulk_record = _bulk_window[notify_index & packet_window_mask];
+			_flight_recorder.record_event(_torque_socket->get_process_start_time(), packet_transmit_success ? packet_flight_recorder::packet_delivered : packet_flight_recorder::packet_lost, notify_index, pk_highest_ack, bulk_record != bulk_transfer::window_none ? bulk_packet : data_packet, 0);
+			if(bulk_record != bulk_transfer::window_none)
+			{
+				// bulk packets are the connection's own business, so their notifies aren't posted.
+				int32 record = bulk_record;
+				bulk_record = bulk_transfer::window_none;
+				_notify_bulk_packet(record, packet_transmit_success);
+			}
+			else
+			{
+				torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_packet_notify_event_type, _connection_index);
+				event->delivered = packet_transmit_success;
+				event->packet_sequence = notify_index;
+			}
 						
 			if(packet_transmit_success)
 				_last_recv_ack_ack = _last_seq_recvd_at_send[notify_index & packet_window_mask];
@@ -300,6 +391,15 @@ protected:
 		if(pk_sequence_number - _last_recv_ack_ack > max_packet_window_size)
 			_last_recv_ack_ack = pk_sequence_number - max_packet_window_size;
 		
+		// take a round trip time sample from the newly acked packet, using the packet's arrival time so that time it sat in our own queues isn't counted.
+		int64 arrival_time = _torque_socket->get_packet_arrival_time();
+		if(notify_count && arrival_time && pk_ack_word_count && (pk_ack_mask[0] & 1))
+		{
+			int64 sample = arrival_time - _packet_send_times[pk_highest_ack & packet_window_mask];
+			if(sample >= 0)
+				_round_trip_time = _round_trip_time ? uint32(_round_trip_time + (sample - int64(_round_trip_time)) / 8) : uint32(sample);
+		}
+		
 		_highest_acked_seq = pk_highest_ack;
 		
 		// first things first... ackback any pings or half-full windows
@@ -314,7 +414,9 @@ protected:
 			// send an ack to the other side the ack will have the same packet sequence as our last sent packet if the last packet we sent was the connection accepted packet we must resend that packet
 			send_ack_packet();
 		}
-		return prev_last_sequence != pk_sequence_number && pk_packet_type == data_packet;
+		if(packet_type)
+			*packet_type = pk_packet_type;
+		return prev_last_sequence != pk_sequence_number && is_sequenced(pk_packet_type);
 	}
 	
 	/// Sends a ping packet to the remote host, to determine if it is still alive and what its packet window status is.
@@ -337,6 +439,267 @@ protected:
 		_last_ping_send_time = time(0);
 		_ping_send_count = 0;
 	}
+
+	/// Returns true if a bulk packet can be sent without taking one of the window slots reserved for the application's data packets.
+	bool _can_send_bulk_packet()
+	{
+		return _last_send_seq - _highest_acked_seq < max_packet_window_size - 2 - bulk_transfer::reserved_window_packets;
+	}
+
+	/// Records the window slot of the bulk packet just sent, so its notify comes back to _notify_bulk_packet.
+	void _record_bulk_packet(int32 record, int64 now)
+	{
+		_bulk_window[_last_send_seq & packet_window_mask] = record;
+		if(!_bulk_in_flight++)
+			_bulk_progress_time = now;
+	}
+
+	/// Sends a bulk message other than a chunk: the message type and transfer id, followed by payload.
+	void _send_bulk_message(bulk_transfer::message_type message, uint32 transfer_id, int32 record, const uint8 *payload, uint32 payload_size, int64 now)
+	{
+		packet_stream ps;
+		write_data_packet_header(ps, bulk_packet);
+		core::write(ps, uint8(message));
+		core::write(ps, transfer_id);
+		ps.write_bytes(payload, payload_size);
+		_send_finished_packet(bulk_packet, ps.get_buffer(), ps.get_next_byte_position(), 0);
+		_record_bulk_packet(record, now);
+	}
+
+	/// Sends as many chunks of the outgoing transfer as the window and rate limit allow, lost chunks first.  Chunks are sent as a header followed by the file data, straight out of the mapping, when the connection can_send_shared_payload.
+	void _send_bulk_chunks(int64 now)
+	{
+		bulk_transfer::sender &sender = _bulk_send;
+		if(sender.max_bytes_per_second)
+		{
+			int64 budget_limit = int64(bulk_transfer::burst_chunks) * bulk_transfer::chunk_size * 1000000;
+			sender.budget += (now - sender.last_budget_time) * sender.max_bytes_per_second;
+			if(sender.budget > budget_limit)
+				sender.budget = budget_limit;
+		}
+		sender.last_budget_time = now;
+		
+		bool shared = can_send_shared_payload();
+		udp_socket::outgoing_datagram datagrams[udp_socket::max_send_batch];
+		uint8 headers[udp_socket::max_send_batch][max_packet_header_size + bulk_transfer::chunk_header_size];
+		uint32 chunks[udp_socket::max_send_batch];
+		uint32 sequences[udp_socket::max_send_batch];
+		uint32 batch_count = 0;
+		while(_can_send_bulk_packet())
+		{
+			bool resend = sender.resend.size() != 0;
+			if(!resend && sender.next_chunk == sender.chunk_count)
+				break;
+			uint32 index = resend ? sender.resend.last() : sender.next_chunk;
+			uint32 size = bulk_transfer::get_chunk_data_size(sender.file.get_size(), index);
+			if(sender.max_bytes_per_second)
+			{
+				if(sender.budget < int64(size) * 1000000)
+					break;
+				sender.budget -= int64(size) * 1000000;
+			}
+			if(resend)
+				sender.resend.pop_back();
+			else
+				sender.next_chunk++;
+			const uint8 *data = sender.file.get_data() + uint64(index) * bulk_transfer::chunk_size;
+			
+			if(shared)
+			{
+				bit_stream header(headers[batch_count], sizeof(headers[batch_count]));
+				write_data_packet_header(header, bulk_packet);
+				core::write(header, uint8(bulk_transfer::chunk_message));
+				core::write(header, sender.transfer_id);
+				core::write(header, index);
+				udp_socket::outgoing_datagram &d = datagrams[batch_count];
+				d.destination = get_address();
+				d.header = headers[batch_count];
+				d.header_size = header.get_next_byte_position();
+				d.data = data;
+				d.data_size = size;
+				chunks[batch_count] = index;
+				sequences[batch_count++] = _last_send_seq;
+			}
+			else
+			{
+				packet_stream ps;
+				write_data_packet_header(ps, bulk_packet);
+				core::write(ps, uint8(bulk_transfer::chunk_message));
+				core::write(ps, sender.transfer_id);
+				core::write(ps, index);
+				ps.write_bytes(data, size);
+				_send_finished_packet(bulk_packet, ps.get_buffer(), ps.get_next_byte_position(), 0);
+			}
+			_record_bulk_packet(int32(index), now);
+			if(batch_count == udp_socket::max_send_batch)
+			{
+				bool all_sent = _send_bulk_chunk_batch(datagrams, chunks, sequences, batch_count);
+				batch_count = 0;
+				// the socket's send buffer is full, so the rest waits for the next pass.
+				if(!all_sent)
+					return;
+			}
+		}
+		if(batch_count)
+			_send_bulk_chunk_batch(datagrams, chunks, sequences, batch_count);
+	}
+
+	/// Hands a batch of chunk datagrams to the socket.  Chunks the socket refused are queued to be sent again right away, and their rate budget is given back, rather than waiting on their notifies.  Returns false if any chunk was refused.
+	bool _send_bulk_chunk_batch(const udp_socket::outgoing_datagram *datagrams, const uint32 *chunks, const uint32 *sequences, uint32 count)
+	{
+		bulk_transfer::sender &sender = _bulk_send;
+		uint32 sent = _torque_socket->_socket.send_to_batch(datagrams, count);
+		for(uint32 i = 0; i < count; i++)
+			_flight_recorder.record_event(_torque_socket->get_process_start_time(), i < sent ? packet_flight_recorder::packet_sent : packet_flight_recorder::packet_send_failed, sequences[i], _last_seq_recvd, bulk_packet, datagrams[i].header_size + datagrams[i].data_size);
+		// resends go out from the back of the list, so the refused chunks are pushed last first to keep them in order.
+		for(uint32 i = count; i-- > sent; )
+		{
+			_bulk_window[sequences[i] & packet_window_mask] = bulk_transfer::window_refused;
+			sender.resend.push_back(chunks[i]);
+			if(sender.max_bytes_per_second)
+				sender.budget += int64(datagrams[i].data_size) * 1000000;
+		}
+		return sent == count;
+	}
+
+	/// Handles the notify of a bulk packet: a lost message or chunk is sent again, and the outgoing transfer is complete once every chunk is delivered.
+	void _notify_bulk_packet(int32 record, bool delivered)
+	{
+		bulk_transfer::sender &sender = _bulk_send;
+		_bulk_in_flight--;
+		_bulk_progress_time = _torque_socket->get_time_source().get_tick_microseconds();
+		if(record == bulk_transfer::window_reply)
+		{
+			if(!delivered)
+				_bulk_receive.reply_pending = true;
+		}
+		else if(record == bulk_transfer::window_refused)
+			return; // already queued to be sent again.
+		else if(record == bulk_transfer::window_offer)
+		{
+			if(!delivered && sender.state == bulk_transfer::sender::offering)
+				sender.offer_lost = true;
+		}
+		else if(sender.state == bulk_transfer::sender::sending)
+		{
+			if(!delivered)
+				sender.resend.push_back(uint32(record));
+			else if(sender.delivered.insert(uint32(record)) && sender.delivered.count == sender.chunk_count)
+				_finish_bulk_send(true);
+		}
+	}
+
+	/// Reads a bulk packet from the remote host.
+	void _handle_bulk_packet(bit_stream &stream)
+	{
+		bulk_transfer::sender &sender = _bulk_send;
+		bulk_transfer::receiver &receiver = _bulk_receive;
+		uint8 message;
+		uint32 transfer_id;
+		core::read(stream, message);
+		core::read(stream, transfer_id);
+		if(stream.was_error_detected())
+			return;
+		switch(message)
+		{
+			case bulk_transfer::offer_message:
+			{
+				uint64 size;
+				uint8 name_size;
+				uint8 name[bulk_transfer::max_name_size];
+				core::read(stream, size);
+				core::read(stream, name_size);
+				stream.read_bytes(name, name_size);
+				if(stream.was_error_detected())
+					return;
+				// the sender only offers a new file once it's done with the last one, so anything still going on here is over.
+				if(receiver.state != bulk_transfer::receiver::idle)
+					_finish_bulk_receive(false);
+				receiver.transfer_id = transfer_id;
+				if(!bulk_transfer::is_valid_size(size))
+				{
+					// no honest sender offers a file this size, so it's refused without asking the application.
+					receiver.reply = bulk_transfer::refuse_message;
+					receiver.reply_pending = true;
+					break;
+				}
+				receiver.state = bulk_transfer::receiver::offered;
+				receiver.size = size;
+				receiver.chunk_count = bulk_transfer::get_chunk_count(size);
+				receiver.reply_pending = false;
+				torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_bulk_offer_event_type, _connection_index);
+				event->transfer_size = size;
+				_torque_socket->_event_queue.set_event_data(event, name, name_size);
+				break;
+			}
+			case bulk_transfer::accept_message:
+				if(sender.state != bulk_transfer::sender::offering || transfer_id != sender.transfer_id)
+					break;
+				sender.state = bulk_transfer::sender::sending;
+				sender.offer_lost = false;
+				sender.last_budget_time = _torque_socket->get_time_source().get_tick_microseconds();
+				if(!sender.chunk_count)
+					_finish_bulk_send(true);
+				break;
+			case bulk_transfer::refuse_message:
+				if(sender.state == bulk_transfer::sender::offering && transfer_id == sender.transfer_id)
+					_finish_bulk_send(false);
+				break;
+			case bulk_transfer::chunk_message:
+			{
+				uint32 index;
+				core::read(stream, index);
+				if(stream.was_error_detected() || receiver.state != bulk_transfer::receiver::receiving || transfer_id != receiver.transfer_id || index >= receiver.chunk_count)
+					break;
+				uint32 size = bulk_transfer::get_chunk_data_size(receiver.size, index);
+				if(stream.get_stream_byte_size() - stream.get_byte_position() != size)
+					break;
+				if(receiver.received.insert(index))
+					memcpy(receiver.file.get_data() + uint64(index) * bulk_transfer::chunk_size, stream.get_buffer() + stream.get_byte_position(), size);
+				if(receiver.received.count == receiver.chunk_count)
+					_finish_bulk_receive(true);
+				break;
+			}
+		}
+		_update_bulk_active();
+	}
+
+	/// Ends the outgoing transfer and posts its completion event.
+	void _finish_bulk_send(bool delivered)
+	{
+		bulk_transfer::sender &sender = _bulk_send;
+		torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_bulk_complete_event_type, _connection_index);
+		event->delivered = delivered;
+		event->transfer_size = sender.file.get_size();
+		sender.state = bulk_transfer::sender::idle;
+		sender.file.close();
+		sender.name = 0;
+		sender.resend.clear();
+	}
+
+	/// Ends the incoming transfer, unmapping the file, and posts its completion event.
+	void _finish_bulk_receive(bool delivered)
+	{
+		bulk_transfer::receiver &receiver = _bulk_receive;
+		torque_socket_event *event = _torque_socket->_event_queue.post_event(torque_connection_bulk_complete_event_type, _connection_index);
+		event->delivered = delivered;
+		event->transfer_size = receiver.size;
+		receiver.state = bulk_transfer::receiver::idle;
+		receiver.file.close();
+	}
+
+	/// Keeps the socket's count of connections with bulk transfer work up to date, so that process_connections only visits those.
+	void _update_bulk_active()
+	{
+		bool active = _bulk_send.state != bulk_transfer::sender::idle || _bulk_receive.reply_pending || _bulk_in_flight;
+		if(active == _bulk_active)
+			return;
+		_bulk_active = active;
+		if(active)
+			_torque_socket->_bulk_connection_count++;
+		else
+			_torque_socket->_bulk_connection_count--;
+	}
 	
 public:
 	/// Sets the initial sequence number of packets read from the remote host.
@@ -400,6 +763,7 @@ public:
 	void set_torque_socket(torque_socket *the_torque_socket)
 	{
 		_torque_socket = the_torque_socket;
+		_flight_recorder.start(the_torque_socket->get_process_start_time());
 	}
 	
 	/// Returns the torque_socket this torque_connection communicates through.
@@ -419,6 +783,12 @@ public:
 		return _symmetric_cipher;
 	}
 
+	/// Returns the torque_socket_integrity_mode agreed for this connection in its handshake.
+	uint32 get_integrity_mode()
+	{
+		return _integrity_mode;
+	}
+
 	byte_buffer_ptr &get_shared_secret()
 	{
 		return _shared_secret;
@@ -434,11 +804,32 @@ public:
 		_ping_timeout = time_per_ping;
 	}
 	
-	/// Simulates a network situation with a percentage random packet loss and a connection one way latency as specified.
+	/// Simulates a network situation with a percentage random packet loss in both directions and a one way send latency in milliseconds.  This is shorthand for setting simple profiles on get_link_emulator().
 	void set_simulated_net_params(float32 packet_loss, uint32 latency)
 	{
-		_simulated_packet_loss = packet_loss;
-		_simulated_latency = latency;
+		link_profile profile;
+		profile.loss = packet_loss;
+		_link_emulator.set_profile(link_emulator::incoming, profile);
+		profile.latency = latency * 1000;
+		_link_emulator.set_profile(link_emulator::outgoing, profile);
+	}
+	
+	/// Returns the link emulator for this connection's traffic.  A direction with a profile set here overrides the socket's link emulator for this connection.
+	link_emulator &get_link_emulator()
+	{
+		return _link_emulator;
+	}
+	
+	/// Returns the smoothed network round trip time in microseconds, or 0 if no sample has been taken yet.  Since the remote host acks on its next outgoing packet, this includes the time it held the ack.
+	uint32 get_round_trip_time()
+	{
+		return _round_trip_time;
+	}
+	
+	/// Returns the flight recorder that tracks the recent packet history of this connection.
+	packet_flight_recorder &get_flight_recorder()
+	{
+		return _flight_recorder;
 	}
 	
 	/// Returns the remote address of the host we're connected or trying to connect to.
@@ -497,6 +888,88 @@ public:
 		return false;
 	}
 
+	/// Starts sending the file at file_path to the remote host, offering it as name.  Returns false if a transfer is already being sent, the name is too long or the file can't be mapped.
+	bool send_bulk_transfer(const char *file_path, const char *name, uint32 max_bytes_per_second)
+	{
+		bulk_transfer::sender &sender = _bulk_send;
+		uint32 name_size = uint32(strlen(name));
+		if(sender.state != bulk_transfer::sender::idle || name_size > bulk_transfer::max_name_size || !sender.file.open_for_read(file_path))
+			return false;
+		if(!bulk_transfer::is_valid_size(sender.file.get_size()))
+		{
+			sender.file.close();
+			return false;
+		}
+		sender.state = bulk_transfer::sender::offering;
+		sender.transfer_id++;
+		sender.name = new byte_buffer((const uint8 *) name, name_size);
+		sender.chunk_count = bulk_transfer::get_chunk_count(sender.file.get_size());
+		sender.next_chunk = 0;
+		sender.resend.clear();
+		sender.delivered.reset(sender.chunk_count);
+		sender.offer_lost = true;
+		sender.max_bytes_per_second = max_bytes_per_second;
+		sender.budget = int64(bulk_transfer::burst_chunks) * bulk_transfer::chunk_size * 1000000;
+		process_bulk_transfer();
+		return true;
+	}
+
+	/// Answers the remote host's offer, receiving the file into file_path, or refusing it if file_path is NULL.  Returns false if no offer is waiting or the file can't be created, in which case the offer is refused.
+	bool accept_bulk_transfer(const char *file_path)
+	{
+		bulk_transfer::receiver &receiver = _bulk_receive;
+		if(receiver.state != bulk_transfer::receiver::offered)
+			return false;
+		bool accepted = file_path && receiver.file.create(file_path, receiver.size);
+		receiver.reply = accepted ? bulk_transfer::accept_message : bulk_transfer::refuse_message;
+		receiver.reply_pending = true;
+		receiver.state = accepted ? bulk_transfer::receiver::receiving : bulk_transfer::receiver::idle;
+		if(accepted)
+		{
+			receiver.received.reset(receiver.chunk_count);
+			if(!receiver.chunk_count)
+				_finish_bulk_receive(true);
+		}
+		process_bulk_transfer();
+		return accepted || !file_path;
+	}
+
+	/// Sends whatever the bulk transfers on this connection have ready: the receiver's reply, the offer, and as many chunks as the window and rate limit allow.  If bulk packets are in flight and nothing has been notified for a while, since the remote host acks only when it has something to send or half its window is unacked, a ping draws the ack out.
+	void process_bulk_transfer()
+	{
+		TorqueTraceSpan("torque_connection::process_bulk_transfer");
+		bulk_transfer::sender &sender = _bulk_send;
+		bulk_transfer::receiver &receiver = _bulk_receive;
+		int64 now = _torque_socket->get_time_source().get_tick_microseconds();
+		if(receiver.reply_pending && _can_send_bulk_packet())
+		{
+			receiver.reply_pending = false;
+			_send_bulk_message(receiver.reply, receiver.transfer_id, bulk_transfer::window_reply, 0, 0, now);
+		}
+		if(sender.state == bulk_transfer::sender::offering && sender.offer_lost && _can_send_bulk_packet())
+		{
+			uint8 offer[sizeof(uint64) + 1 + bulk_transfer::max_name_size];
+			bit_stream offer_stream(offer, sizeof(offer));
+			core::write(offer_stream, sender.file.get_size());
+			core::write(offer_stream, uint8(sender.name->get_buffer_size()));
+			offer_stream.write_bytes(sender.name->get_buffer(), sender.name->get_buffer_size());
+			sender.offer_lost = false;
+			_send_bulk_message(bulk_transfer::offer_message, sender.transfer_id, bulk_transfer::window_offer, offer, offer_stream.get_next_byte_position(), now);
+		}
+		else if(sender.state == bulk_transfer::sender::sending)
+			_send_bulk_chunks(now);
+		
+		int64 probe_interval = int64(_round_trip_time) * 2;
+		if(probe_interval < bulk_transfer::minimum_probe_interval)
+			probe_interval = bulk_transfer::minimum_probe_interval;
+		if(_bulk_in_flight && now - _bulk_progress_time > probe_interval)
+		{
+			send_ping_packet();
+			_bulk_progress_time = now;
+		}
+		_update_bulk_active();
+	}
+
 	torque_connection(nonce initiator_nonce, uint32 initial_send_sequence, uint32 connection_index, bool is_initiator)
 	{
 		_is_initiator = is_initiator;
@@ -504,9 +977,6 @@ public:
 		_initial_send_seq = initial_send_sequence;
 		_initiator_nonce = initiator_nonce;
 		
-		_simulated_latency = 0;
-		_simulated_packet_loss = 0;
-		
 		_last_ping_send_time = time(0);
 		_ping_send_count = 0;
 		
@@ -515,9 +985,19 @@ public:
 		_last_send_seq = _initial_send_seq; // start sending at _initial_send_seq + 1
 		_ack_mask[0] = 0;
 		_last_recv_ack_ack = 0;
+		_round_trip_time = 0;
+		for(uint32 i = 0; i < max_packet_window_size; i++)
+		{
+			_packet_send_times[i] = 0;
+			_bulk_window[i] = bulk_transfer::window_none;
+		}
+		_bulk_in_flight = 0;
+		_bulk_progress_time = 0;
+		_bulk_active = false;
 		
 		_ping_timeout = time(default_ping_timeout);
 		_ping_retry_count = default_ping_retry_count;
+		_integrity_mode = torque_integrity_cipher;
 	}
 protected:
 	safe_ptr<torque_socket> _torque_socket; ///< The torque_socket of which this torque_connection is a member.
@@ -528,6 +1008,7 @@ protected:
 	nonce _host_nonce; ///< Unique nonce generated by the server for the connection.	
 	byte_buffer_ptr _shared_secret; ///< The shared secret key 
 	ref_ptr<symmetric_cipher> _symmetric_cipher; ///< The helper object that performs symmetric encryption on packets
+	uint32 _integrity_mode; ///< torque_socket_integrity_mode of the data packets.  The cipher isn't used on torque_integrity_crc32c connections.
 
 	uint32 _last_seq_recvd_at_send[max_packet_window_size]; ///< The sequence number of the last packet received from the remote host when we sent the packet with sequence X & packet_window_mask.
 	uint32 _last_seq_recvd; ///< The sequence number of the most recently received packet from the remote host.
@@ -539,6 +1020,8 @@ protected:
 	uint32 _initial_send_seq; ///< The first _last_send_seq for this side of the torque_connection.
 	uint32 _initial_recv_seq; ///< The first _last_seq_recvd (the first _last_send_seq for the remote host).
 	time _highest_acked_send_time; ///< The send time of the highest packet sequence acked by the remote host.  Used in the computation of round trip time.
+	int64 _packet_send_times[max_packet_window_size]; ///< Time, in microseconds, the data packet with sequence X & packet_window_mask was sent.
+	uint32 _round_trip_time; ///< Smoothed round trip time in microseconds.
 	time _last_update_time; ///< The last time a packet was sent from this instance.
 	
 	time _ping_timeout; ///< time to wait before sending a ping packet.
@@ -546,6 +1029,13 @@ protected:
 	// timeout management stuff:
 	uint32 _ping_send_count; ///< Number of unacknowledged ping packets sent to the remote host
 	time _last_ping_send_time; ///< Last time a ping packet was sent from this connection
-	uint32 _simulated_latency; ///< Amount of additional time this connection delays its packet sends to simulate latency in the connection
-	float32 _simulated_packet_loss; ///< Function to simulate packet loss on a network
+	link_emulator _link_emulator; ///< Emulated network conditions for this connection's packets.
+	packet_flight_recorder _flight_recorder; ///< Ring of recent packet header records for latency and loss forensics.
+
+	int32 _bulk_window[max_packet_window_size]; ///< bulk_transfer::window_record of the sequenced packet X & packet_window_mask.
+	uint32 _bulk_in_flight; ///< Bulk packets sent and not yet notified.
+	int64 _bulk_progress_time; ///< Microseconds when a bulk packet was last notified, or first sent with none in flight.
+	bool _bulk_active; ///< Counted in the socket's _bulk_connection_count.
+	bulk_transfer::sender _bulk_send; ///< The file being sent to the remote host, if any.
+	bulk_transfer::receiver _bulk_receive; ///< The file being received from the remote host, if any.
 };
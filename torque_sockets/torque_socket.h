@@ -25,6 +25,8 @@ public:
 		introduced_connection_request_packet, ///< sent from the initiator and host to the introducer.  An introducer will ignore introduced_connection_request packets until a call to torque_socket_introduce is made.  Once introduced_connection_request packets are received from both initiator and host, and upon subsequent receipt of introduced_connection_request packets, the introducer will send connection_introduction packets to introducer and host.
 		connection_introduction_packet, ///< Packet sent by introducer to properly connect initiator and host.
 		punch_packet, ///< Packets sent by initiator or host of an introduced connection to "punch" a connection hole through NATs and firewalls.
+		probe_request_packet, ///< Latency probe sent by probe(); any torque_socket echoes it back as a probe_response_packet.
+		probe_response_packet, ///< Echo of a probe_request_packet.
 
 		first_valid_info_packet_id = 32, ///< The first valid first byte of an info packet sent from a torque_socekt
 		last_valid_info_packet_id = 127, ///< The last valid first byte of an info packet sent from a torque_socekt 
@@ -45,33 +47,28 @@ protected:
 		timeout_check_interval = 1500, ///< Interval in milliseconds between checking for connection timeouts.
 		puzzle_solution_timeout = 30000, ///< If the server gives us a puzzle that takes more than 30 seconds, time out.
 		introduction_timeout = 30000, ///< Amount of time the introducer tracks a connection introduction request.
+		probe_packet_size = 17, ///< Packet type, round token, target index and send time of a latency probe.
 	};
 	
 	enum disconnect_reason
 	{
-		reason_failed_puzzle,
-		reason_self_disconnect,
-		reason_shutdown,
-		reason_reconnecting,
-		reason_disconnect_call,
+		reason_failed_puzzle = torque_reason_failed_puzzle,
+		reason_self_disconnect = torque_reason_self_disconnect,
+		reason_shutdown = torque_reason_shutdown,
+		reason_reconnecting = torque_reason_reconnecting,
+		reason_disconnect_call = torque_reason_disconnect_call,
+		reason_server_full = torque_reason_server_full,
+		reason_too_many_pending = torque_reason_too_many_pending,
 	};
 	
-	/// Computes an identity token for the connecting client based on the address of the client and the client's unique nonce value.
+	/// Computes an identity token for the connecting client based on the address of the client and the client's unique nonce value.  The token is a SipHash keyed with this socket's random hash data, so it can't be forged, and is cheap enough to compute for every challenge request a flood can send.
 	uint32 compute_client_identity_token(const address &the_address, const nonce &the_nonce)
 	{
-		hash_state state;
-		uint32 hash[8];
-		uint32 host = htonl(the_address.get_host());
-		uint32 port = htonl(the_address.get_port());
-		
-		sha256_init(&state);
-		sha256_process(&state, (uint8 *) &host, sizeof(host));
-		sha256_process(&state, (uint8 *) &port, sizeof(port));
-		sha256_process(&state, (uint8 *) &the_nonce, sizeof(the_nonce));
-		sha256_process(&state, _random_hash_data, sizeof(_random_hash_data));
-		sha256_done(&state, (uint8 *) hash);
-		
-		return hash[0];
+		uint8 message[4 + 2 + sizeof(nonce)];
+		write_uint32_to_buffer(the_address.get_host(), message);
+		write_uint16_to_buffer(the_address.get_port(), message + 4);
+		write_uint64_to_buffer(the_nonce, message + 6);
+		return uint32(buffer_siphash(_random_hash_data, message, sizeof(message)));
 	}
 
 	/// Returns the address of the first network torque_socket in the list that the socket on this torque_socket is bound to.
@@ -110,7 +107,7 @@ protected:
 		core::write(out, introducing_connection->get_initiator_nonce());
 		core::write(out, uint32(the_connection->_remote_client_id));
 		core::write(out, uint8(the_connection->get_type() == pending_connection::introduced_connection_initiator));
-		out.send_to(_socket, introducing_connection->get_address());		
+		_send_packet(introducing_connection->get_address(), out.get_buffer(), out.get_next_byte_position());		
 	}
 	
 	void _handle_introduction_request(const address &addr, bit_stream &stream)
@@ -189,7 +186,7 @@ protected:
 		core::write(out, initiator_nonce);
 		core::write(out, host_nonce);
 		
-		out.send_to(_socket, connection->get_address());
+		_send_packet(connection->get_address(), out.get_buffer(), out.get_next_byte_position());
 	}
 
 	void _handle_introduction(const address &the_address, bit_stream &packet_stream)
@@ -235,7 +232,7 @@ protected:
 			core::write(out, uint8(punch_packet));
 			core::write(out, the_connection->get_initiator_nonce());
 			core::write(out, the_connection->get_host_nonce());
-			out.send_to(_socket, the_connection->_possible_addresses[i]);			
+			_send_packet(the_connection->_possible_addresses[i], out.get_buffer(), out.get_next_byte_position());			
 		}
 	}
 	
@@ -259,7 +256,82 @@ protected:
 			}
 		}
 	}
-		
+	
+	/// Echoes a latency probe back to its sender.  The reply is the same size as the request, so probes can't be used to amplify traffic.
+	void _handle_probe_request(const address &the_address, bit_stream &packet_stream)
+	{
+		if(packet_stream.get_stream_byte_size() != probe_packet_size)
+			return;
+		uint8 reply[probe_packet_size];
+		memcpy(reply, packet_stream.get_buffer(), probe_packet_size);
+		reply[0] = probe_response_packet;
+		_send_packet(the_address, reply, probe_packet_size);
+	}
+	
+	void _handle_probe_response(const address &the_address, bit_stream &packet_stream)
+	{
+		uint32 token, index;
+		int64 send_time;
+		core::read(packet_stream, token);
+		core::read(packet_stream, index);
+		core::read(packet_stream, send_time);
+		if(packet_stream.was_error_detected())
+			return;
+		int64 now = _packet_arrival_time ? _packet_arrival_time : _time_source.read_microseconds();
+		_probe.record_reply(token, index, the_address, now - send_time);
+	}
+	
+	/// Sends the probes the pacing of the current round allows, and posts the round's results once it's complete.
+	void _process_probe()
+	{
+		if(!_probe.is_active())
+			return;
+		int64 now = _time_source.read_microseconds();
+		uint32 due = _probe.get_due_count(now);
+		while(due)
+		{
+			uint8 packets[udp_socket::max_send_batch][probe_packet_size];
+			udp_socket::outgoing_datagram datagrams[udp_socket::max_send_batch];
+			uint32 count = due < udp_socket::max_send_batch ? due : udp_socket::max_send_batch;
+			uint32 first = _probe.get_next_send();
+			for(uint32 i = 0; i < count; i++)
+			{
+				bit_stream out(packets[i], probe_packet_size);
+				core::write(out, uint8(probe_request_packet));
+				core::write(out, _probe.get_token());
+				core::write(out, first + i);
+				core::write(out, now);
+				datagrams[i].destination = _probe.get_target(first + i).remote_address;
+				datagrams[i].header = 0;
+				datagrams[i].header_size = 0;
+				datagrams[i].data = packets[i];
+				datagrams[i].data_size = probe_packet_size;
+			}
+			uint32 sent = _send_packets(datagrams, count);
+			_probe.mark_sent(sent, now);
+			if(sent < count)
+			{
+				// the rest stay due, and go out on a later tick.
+				_probe.refuse(now);
+				break;
+			}
+			due -= count;
+		}
+		if(_probe.is_complete(now))
+		{
+			uint32 target_count = _probe.get_target_count();
+			torque_socket_event *event = _event_queue.post_event(torque_socket_probe_results_event_type);
+			torque_socket_probe_result *results = (torque_socket_probe_result *) _event_queue.allocate_event_data(event, target_count * sizeof(torque_socket_probe_result));
+			for(uint32 i = 0; i < target_count; i++)
+			{
+				server_probe::target &t = _probe.get_target(i);
+				t.remote_address.to_sockaddr(&results[i].address);
+				results[i].round_trip_time = t.round_trip_time;
+			}
+			_probe.finish();
+		}
+	}
+	
 	/// Sends a connect challenge request on behalf of the connection to the remote host.
 	void _send_challenge_request(pending_connection *the_connection)
 	{
@@ -268,9 +340,31 @@ protected:
 		core::write(out, uint8(connect_challenge_request_packet));
 		core::write(out, the_connection->get_initiator_nonce());
 		core::write(out, the_connection->get_host_nonce());
-		out.send_to(_socket, the_connection->get_address());
+		_send_packet(the_connection->get_address(), out.get_buffer(), out.get_next_byte_position());
 	}
 	
+	/// Checks the admission policy for a new incoming connection.  Returns false, with the disconnect_reason to reject it with, if the socket is at one of its limits.  Pending connections are counted by walking the list rather than kept in a count: with either limit set, admission keeps the incoming ones under it, and both callers have already walked the same list looking for the requester's own entry.
+	bool _admits_connection(uint32 &reason)
+	{
+		if(!_max_connections && !_max_pending_connections)
+			return true;
+		uint32 pending_count = 0;
+		for(pending_connection *walk = _pending_connections; walk; walk = walk->_next)
+			if(walk->get_type() == pending_connection::connection_host)
+				pending_count++;
+		if(_max_connections && _connection_id_lookup_table.size() + pending_count >= _max_connections)
+		{
+			reason = reason_server_full;
+			return false;
+		}
+		if(_max_pending_connections && pending_count >= _max_pending_connections)
+		{
+			reason = reason_too_many_pending;
+			return false;
+		}
+		return true;
+	}
+
 	/// Handles a connect challenge request by replying to the requestor of a connection with a unique token for that connection, as well as (possibly) a client puzzle (for DoS prevention), or this torque_socket's public key.
 	void _handle_connect_challenge_request(const address &addr, bit_stream &stream)
 	{
@@ -281,6 +375,7 @@ protected:
 		
 		nonce initiator_nonce, host_nonce;
 		core::read(stream, initiator_nonce);
+		core::read(stream, host_nonce);
 
 		// In the case of an introduced connection we will already have a pending connenection for this address.  If so, validate that the nonce is correct.
 		pending_connection *conn;
@@ -296,34 +391,58 @@ protected:
 				break;
 			}
 		}
+		// Turn away clients the host has no room for now, before they solve a puzzle or the host does any key exchange.
+		uint32 reason;
+		if(!conn && !_admits_connection(reason))
+		{
+			_send_connect_reject(initiator_nonce, host_nonce, addr, reason, _admission_retry_after);
+			return;
+		}
 		_send_connect_challenge_response(addr, initiator_nonce);
 	}
 	
-	/// Sends a connect challenge request to the specified address.  This can happen as a result of receiving a connect challenge request, or during an "arranged" connection for the non-initiator of the connection.
+	/// Sends a connect challenge request to the specified address.  This can happen as a result of receiving a connect challenge request, or during an "arranged" connection for the non-initiator of the connection.  The packet is the challenge response template with the initiator's nonce and identity token patched in.
 	void _send_connect_challenge_response(const address &addr, nonce &initiator_nonce)
 	{
-		packet_stream out;
-		core::write(out, uint8(connect_challenge_response_packet));
-		core::write(out, initiator_nonce);
-		
+		_update_challenge_response_template();
 		uint32 identity_token = compute_client_identity_token(addr, initiator_nonce);
-		core::write(out, identity_token);
-		
-		// write out a client puzzle
+		bit_stream patch(_challenge_template + challenge_template_nonce_offset, sizeof(nonce) + sizeof(identity_token));
+		core::write(patch, initiator_nonce);
+		core::write(patch, identity_token);
+
+		TorqueLogMessageFormatted(LogNettorque_socket, ("Sending Challenge Response: %8x", identity_token));
+		_send_packet(addr, _challenge_template, _challenge_template_size);
+	}
+
+	/// Rebuilds the challenge response template if the public key, challenge response data or client puzzle has changed since it was last built.  The template holds the whole connect challenge response packet; only the initiator nonce and identity token, at the front, differ between requests.
+	void _update_challenge_response_template()
+	{
+		nonce puzzle_nonce = _puzzle_manager.get_current_nonce();
 		uint32 difficulty = _puzzle_manager.get_current_difficulty();
-		core::write(out, _puzzle_manager.get_current_nonce());
+		if(_challenge_template_size && puzzle_nonce == _challenge_template_puzzle_nonce && difficulty == _challenge_template_difficulty)
+			return;
+
+		packet_stream out;
+		core::write(out, uint8(connect_challenge_response_packet));
+		assert(out.get_next_byte_position() == challenge_template_nonce_offset);
+		core::write(out, nonce(0));
+		core::write(out, uint32(0));
+		core::write(out, puzzle_nonce);
 		core::write(out, difficulty);
 		core::write(out, _private_key->get_public_key());
 		core::write(out, _challenge_response);
 
-		TorqueLogMessageFormatted(LogNettorque_socket, ("Sending Challenge Response: %8x", identity_token));
-		out.send_to(_socket, addr);
+		_challenge_template_size = out.get_next_byte_position();
+		memcpy(_challenge_template, out.get_buffer(), _challenge_template_size);
+		_challenge_template_puzzle_nonce = puzzle_nonce;
+		_challenge_template_difficulty = difficulty;
 	}
 	
 	/// Processes a connect_challenge_response; if it's correctly formed and for a pending connection that is requesting_challenge_response, post a challenge_response event and awayt a local_challenge_accept.
 	
 	void _handle_connect_challenge_response(const address &the_address, bit_stream &stream)
 	{
+		TorqueTraceSpan("torque_socket::_handle_connect_challenge_response");
 		pending_connection *conn = _find_pending_connection(the_address);
 		if(!conn || conn->get_state() != pending_connection::requesting_challenge_response)
 			return;
@@ -354,9 +473,12 @@ protected:
 		}
 		else
 			conn->_private_key = _private_key;
+		int64 ecdh_start = _time_source.read_microseconds();
 		conn->set_shared_secret(conn->_private_key->compute_shared_secret_key(conn->_public_key));
+		_record_latency(torque_latency_ecdh, _time_source.read_microseconds() - ecdh_start);
 		//logprintf("shared secret (client) %s", conn->get_shared_secret()->encodeBase64()->get_buffer());
 		_random_generator.random_buffer(conn->_symmetric_key, symmetric_cipher::key_size);
+		conn->_integrity_mode = _integrity_mode;
 
 		TorqueLogMessageFormatted(LogNettorque_socket, ("Received Challenge Response: %8x", conn->_client_identity ));
 
@@ -371,6 +493,7 @@ protected:
 		conn->_state_send_retry_count = 0;
 		conn->_state_send_retry_interval = introduction_timeout;
 		conn->_state_last_send_time = get_process_start_time();
+		_end_handshake_stage(conn, torque_latency_handshake_challenge);
 	}
 	
 	/// Sends a connect request on behalf of a pending connection.
@@ -394,12 +517,13 @@ protected:
 		out.write_bytes(conn->_symmetric_key, symmetric_cipher::key_size);
 
 		core::write(out, conn->get_initial_send_sequence());
+		core::write(out, uint8(conn->_integrity_mode));
 		core::write(out, conn->_packet_data);
 		
 		// Write a hash of everything written into the packet, then  symmetrically encrypt the packet from the end of the public key to the end of the signature.
 		symmetric_cipher the_cipher(conn->get_shared_secret());
 		bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &the_cipher);
-		out.send_to(_socket, conn->get_address());
+		_send_packet(conn->get_address(), out.get_buffer(), out.get_next_byte_position());
 	}
 	
 	/// Handles a connection request from a remote host.
@@ -407,6 +531,7 @@ protected:
 	/// This will verify the validity of the connection token, as well as any solution to a client puzzle this torque_socket sent to the remote host.  If those tests pass, and there is not an existing pending connection in awaiting_connect_request state it will construct a pending connection instance to track the rest of the connection negotiation.
 	void _handle_connect_request(const address &the_address, bit_stream &stream)
 	{
+		TorqueTraceSpan("torque_socket::_handle_connect_request");
 		nonce initiator_nonce;
 		nonce host_nonce;
 		
@@ -416,7 +541,10 @@ protected:
 		// check if this connection has already been accepted:
 		torque_connection *existing = _find_connection(the_address);
 		if(existing && existing->get_initiator_nonce() == initiator_nonce && existing->get_host_nonce() == host_nonce)
+		{
 			_send_connect_accept(existing);
+			return;
+		}
 		
 		// see if there's a pending connection from that address
 		pending_connection *pending = _find_pending_connection(the_address);
@@ -437,6 +565,10 @@ protected:
 			return;
 		}
 
+		// The initiator of an introduced connection replaced the introduction's host nonce with the puzzle nonce from the challenge response, so only its initiator nonce can be matched here.  Match before checking the puzzle, which spends the initiator nonce.
+		if(pending && (pending->get_initiator_nonce() != initiator_nonce || (pending->get_state() != pending_connection::awaiting_connect_request && pending->get_host_nonce() != host_nonce)))
+			return;
+
 		uint32 puzzle_difficulty;
 		uint32 puzzle_solution;
 		core::read(stream, puzzle_difficulty);
@@ -450,8 +582,14 @@ protected:
 			_send_connect_reject(initiator_nonce, host_nonce, the_address, reason_failed_puzzle);
 			return;
 		}
-		if(pending && (pending->get_initiator_nonce() != initiator_nonce || pending->get_host_nonce() != host_nonce))
+
+		// The host may have filled up since the challenge was answered.
+		uint32 reason;
+		if(!pending && !_admits_connection(reason))
+		{
+			_send_connect_reject(initiator_nonce, host_nonce, the_address, reason, _admission_retry_after);
 			return;
+		}
 		
 		if(_private_key.is_null())
 			return;
@@ -460,7 +598,9 @@ protected:
 		uint32 decrypt_pos = stream.get_next_byte_position();
 		
 		stream.set_byte_position(decrypt_pos);
+		int64 ecdh_start = _time_source.read_microseconds();
 		byte_buffer_ptr shared_secret = _private_key->compute_shared_secret_key(public_key);
+		_record_latency(torque_latency_ecdh, _time_source.read_microseconds() - ecdh_start);
 		//logprintf("shared secret (server) %s", shared_secret->encodeBase64()->get_buffer());
 		
 		symmetric_cipher the_cipher(shared_secret);
@@ -477,6 +617,8 @@ protected:
 		
 		uint32 connect_sequence;
 		core::read(stream, connect_sequence);
+		uint8 requested_integrity_mode;
+		core::read(stream, requested_integrity_mode);
 		TorqueLogMessageFormatted(LogNettorque_socket, ("Received Connect Request %8x", client_identity));
 		
 		if(existing)
@@ -486,13 +628,18 @@ protected:
 		pending->set_shared_secret(shared_secret);
 		pending->set_address(the_address);
 		pending->set_initial_recv_sequence(connect_sequence);
+		pending->_integrity_mode = requested_integrity_mode == torque_integrity_crc32c && _integrity_mode == torque_integrity_crc32c && !_requires_key_exchange ? torque_integrity_crc32c : torque_integrity_cipher;
 		
 		pending->set_symmetric_cipher(new symmetric_cipher(pending->_symmetric_key, pending->_init_vector));
 		
 		byte_buffer_ptr connect_request_data;
 		core::read(stream, connect_request_data);
 
-		_add_pending_connection(pending);
+		pending->_stage_start_time = _packet_arrival_time ? _packet_arrival_time : _time_source.read_microseconds();
+		if(pending->get_state() == pending_connection::awaiting_connect_request)
+			pending->set_state(pending_connection::awaiting_local_accept);
+		else
+			_add_pending_connection(pending);
 
 		torque_socket_event *event = _event_queue.post_event(torque_connection_requested_event_type, pending->_connection_index);
 		_event_queue.set_event_key(event, public_key->get_public_key()->get_buffer(), public_key->get_public_key()->get_buffer_size());
@@ -516,11 +663,12 @@ protected:
 		uint8 init_vector[symmetric_cipher::block_size];
 		conn->get_symmetric_cipher()->get_init_vector(init_vector);
 		out.write_bytes(init_vector, symmetric_cipher::key_size);
+		core::write(out, uint8(conn->_integrity_mode));
 		
 		symmetric_cipher the_cipher(conn->get_shared_secret());
 		bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &the_cipher);
 
-		out.send_to(_socket, conn->get_address());
+		_send_packet(conn->get_address(), out.get_buffer(), out.get_next_byte_position());
 	}
 	
 	/// Handles a connect accept packet, putting the connection associated with the remote host (if there is one) into an active state.
@@ -548,13 +696,20 @@ protected:
 		uint8 init_vector[symmetric_cipher::block_size];
 		
 		stream.read_bytes(init_vector, symmetric_cipher::block_size);
+		uint8 integrity_mode;
+		core::read(stream, integrity_mode);
+		// The host can only agree to the mode asked for, or fall back to the cipher.
+		if(integrity_mode != torque_integrity_cipher && integrity_mode != pending->_integrity_mode)
+			return;
 		symmetric_cipher *cipher = new symmetric_cipher(pending->_symmetric_key, init_vector);
+		_end_handshake_stage(pending, torque_latency_handshake_connect);
 		
 		torque_connection *the_connection = new torque_connection(pending->get_initiator_nonce(), pending->get_initial_send_sequence(), pending->_connection_index, true);
 		the_connection->set_initial_recv_sequence(recv_sequence);
 		the_connection->set_address(pending->get_address());
 		the_connection->set_shared_secret(pending->get_shared_secret());
 		the_connection->_host_nonce = pending->_host_nonce;
+		the_connection->_integrity_mode = integrity_mode;
 		the_connection->set_torque_socket(this);
 		_remove_pending_connection(pending); // remove the pending connection
 
@@ -564,15 +719,16 @@ protected:
 		_event_queue.post_event(torque_connection_established_event_type, the_connection->get_connection_index());
 	}
 	
-	/// Sends a connect rejection to a valid connect request in response to possible error conditions (server full, wrong password, etc).
-	void _send_connect_reject(nonce &initiator_nonce, nonce &host_nonce, const address &the_address, uint32 reason)
+	/// Sends a connect rejection to a valid connect request in response to possible error conditions (server full, wrong password, etc).  retry_after is a hint, in milliseconds, of how long the client should wait before trying again.
+	void _send_connect_reject(nonce &initiator_nonce, nonce &host_nonce, const address &the_address, uint32 reason, uint32 retry_after = 0)
 	{
 		packet_stream out;
 		core::write(out, uint8(connect_reject_packet));
 		core::write(out, initiator_nonce);
 		core::write(out, host_nonce);
 		core::write(out, reason);
-		out.send_to(_socket, the_address);
+		core::write(out, retry_after);
+		_send_packet(the_address, out.get_buffer(), out.get_next_byte_position());
 	}
 	
 	
@@ -592,8 +748,11 @@ protected:
 		if(pending->get_initiator_nonce() != initiator_nonce || pending->get_host_nonce() != host_nonce)
 			return;
 		
-		uint32 reason;
+		uint32 reason, retry_after;
 		core::read(stream, reason);
+		core::read(stream, retry_after);
+		if(stream.was_error_detected())
+			retry_after = 0;
 		
 		TorqueLogMessageFormatted(LogNettorque_socket, ("Received Connect Reject - reason %d", reason));
 
@@ -606,13 +765,14 @@ protected:
 			pending->_state_send_retry_interval = challenge_retry_time;
 			pending->_state_last_send_time = get_process_start_time();
 			pending->_initiator_nonce = _random_generator.random_nonce();
+			pending->_stage_start_time = _time_source.read_microseconds();
 			
 			_send_challenge_request(pending);
 			return;
 		}
-		byte_buffer_ptr null;
-
-		_event_queue.post_event(torque_connection_disconnected_event_type, pending->_connection_index);
+		torque_socket_event *event = _event_queue.post_event(torque_connection_disconnected_event_type, pending->_connection_index);
+		event->reason = reason;
+		event->retry_after = retry_after;
 		_remove_pending_connection(pending);
 	}
 	
@@ -645,6 +805,7 @@ protected:
 			stream.read_bytes(disconnect_data, disconnect_data_size);
 			torque_socket_event *event = _event_queue.post_event(torque_connection_disconnected_event_type, conn->get_connection_index());
 			_event_queue.set_event_data(event, disconnect_data, disconnect_data_size);
+			event->reason = reason_code;
 
 			_remove_connection(conn);
 		}
@@ -660,19 +821,48 @@ protected:
 		}
 	}
 	
-	/// Handles all packets that don't fall into the category of torque_connection handshake or game data.
+	/// Handles all packets that don't fall into the category of torque_connection handshake or game data.  Queries with a response set by set_info_response are answered here, without posting an event.
 	void _handle_info_packet(const address &address, uint8 packet_type, bit_stream &stream)
 	{
+		info_response &cached = _info_responses[packet_type - first_valid_info_packet_id];
+		if(cached.response)
+		{
+			if(_check_info_rate(address, cached.max_per_second))
+			{
+				cached.hits++;
+				_send_packet(address, cached.response->get_buffer(), cached.response->get_buffer_size());
+			}
+			else
+				cached.rate_limited++;
+			return;
+		}
 		torque_socket_event *event = _event_queue.post_event(torque_socket_packet_event_type);
-		event->data_size = stream.get_stream_byte_size();
-		event->data = (uint8 *) _event_queue.allocate_queue_data(event->data_size);
-		memcpy(event->data, stream.get_buffer(), event->data_size);
+		memcpy(_event_queue.allocate_event_data(event, stream.get_stream_byte_size()), stream.get_buffer(), stream.get_stream_byte_size());
 		address.to_sockaddr(&event->source_address);
 	}
 	
+	/// Counts a cached info response to source against its per second limit.  Returns false if source has already been sent max_per_second responses in the current second.  Addresses that hash to the same slot share a count, so collisions (or a spoofed flood) only ever make the limit stricter.
+	bool _check_info_rate(const address &source, uint32 max_per_second)
+	{
+		if(!max_per_second)
+			return true;
+		int64 now = _process_start_time.get_milliseconds();
+		info_rate_slot &slot = _info_rate_table[source.hash() & (info_rate_table_size - 1)];
+		if(now - slot.window_start >= 1000)
+		{
+			slot.window_start = now;
+			slot.count = 0;
+		}
+		if(slot.count >= max_per_second)
+			return false;
+		slot.count++;
+		return true;
+	}
+	
 	/// Processes a single packet, and dispatches either to handle_info_packet or to the connection associated with the remote address.
 	void _process_packet(const address &the_address, bit_stream &packet_stream)
 	{
+		TorqueTraceSpan("torque_socket::_process_packet");
 		
 		// Determine what to do with this packet:
 		
@@ -725,17 +915,25 @@ protected:
 					case punch_packet:
 						_handle_punch(the_address, packet_stream);
 						break;
+					case probe_request_packet:
+						_handle_probe_request(the_address, packet_stream);
+						break;
+					case probe_response_packet:
+						_handle_probe_response(the_address, packet_stream);
+						break;
 				}
 			}
 		}
 	}
 protected:
-	/// Structure used to track packets that read by the background packet reader or are delayed in sending for simulating a high-latency connection.  The packet_record is allocated as sizeof(packet_record) + packet_size;
+	/// Structure used to track packets that read by the background packet reader or are held by the link emulator.  The packet_record is allocated as sizeof(packet_record) + packet_size;
 	struct packet_record
 	{
 		packet_record *next_packet; ///< The next packet in the list of delayed packets.
-		address remote_address; ///< The address to send this packet to.
-		time send_time; ///< time when we should send the packet.
+		address remote_address; ///< The address to send this packet to, or for incoming packets the address it came from.
+		int64 release_time; ///< For packets held by the link emulator, the time in microseconds the packet should be sent or received.
+		bool incoming; ///< True if this is a received packet held by the link emulator, false if it is waiting to be sent.
+		int64 arrival_time; ///< For packets read by the background packet reader, the time the packet arrived in microseconds.
 		uint32 packet_size; ///< Size, in bytes, of the packet data.
 		uint8 packet_data[1]; ///< Packet data.
 	};
@@ -743,17 +941,38 @@ protected:
 	/// Checks all connections on this torque_socket for packet sends, and for timeouts and all valid and pending connections.
 	void process_connections()
 	{
-		_process_start_time = time::get_current();
+		TorqueTraceSpan("torque_socket::process_connections");
+		_time_source.tick();
+		_process_start_time = _time_source.get_tick_time();
 		_puzzle_manager.tick(_process_start_time, _random_generator);
 		
-		// first see if there are any delayed packets that need to be sent...
-		while(_send_packet_list && _send_packet_list->send_time < get_process_start_time())
+		// first see if the link emulator is done holding any packets: send the outgoing ones and queue the incoming ones for processing.
+		for(packet_record *walk = _release_queue.release(_time_source.get_tick_microseconds()); walk; )
+		{
+			packet_record *next = walk->next_packet;
+			if(walk->incoming)
+			{
+				walk->arrival_time = walk->release_time;
+				walk->next_packet = 0;
+				if(_released_packet_tail)
+					_released_packet_tail->next_packet = walk;
+				else
+					_released_packet_list = walk;
+				_released_packet_tail = walk;
+			}
+			else
+			{
+				_socket.send_to(walk->remote_address, walk->packet_data, walk->packet_size);
+				memory_deallocate(walk);
+			}
+			walk = next;
+		}
+		_process_probe();
+		if(_bulk_connection_count)
 		{
-			packet_record *next = _send_packet_list->next_packet;
-			_socket.send_to(_send_packet_list->remote_address,
-							_send_packet_list->packet_data, _send_packet_list->packet_size);
-			memory_deallocate(_send_packet_list);
-			_send_packet_list = next;
+			for(torque_connection *walk = _connection_list; walk; walk = walk->_next)
+				if(walk->_bulk_active)
+					walk->process_bulk_transfer();
 		}
 		
 		if(get_process_start_time() > _last_timeout_check_time + time(timeout_check_interval))
@@ -774,6 +993,7 @@ protected:
 					else
 					{
 						pending->_state_send_retry_count--;
+						pending->_state_last_send_time = get_process_start_time();
 						switch(pending->get_state())
 						{
 							case pending_connection::requesting_introduction:
@@ -785,6 +1005,9 @@ protected:
 						case pending_connection::requesting_challenge_response:
 								_send_challenge_request(pending);
 								break;
+						case pending_connection::requesting_connection:
+								_send_connect_request(pending);
+								break;
 						default:
 								break;
 						}
@@ -813,9 +1036,11 @@ protected:
 		uint32 request_index;
 		while(_puzzle_solver.get_next_result(result, request_index))
 		{
-			uint32 solution;
+			uint32 solution, solve_time;
 			bit_stream s(result->get_buffer(), result->get_buffer_size());
 			core::read(s, solution);
+			core::read(s, solve_time);
+			_record_latency(torque_latency_puzzle_solve, solve_time);
 			
 			for(pending_connection *walk = _pending_connections; walk; walk = walk->_next)
 			{
@@ -827,6 +1052,10 @@ protected:
 					walk->_puzzle_solution = solution;
 					
 					walk->set_state(pending_connection::requesting_connection);
+					walk->_state_send_retry_count = connect_retry_count;
+					walk->_state_send_retry_interval = connect_retry_time;
+					walk->_state_last_send_time = get_process_start_time();
+					_end_handshake_stage(walk, torque_latency_handshake_puzzle);
 					_send_connect_request(walk);
 					break;
 				}
@@ -913,6 +1142,8 @@ protected:
 		
 		_connection_id_lookup_table.remove(the_connection->get_connection_index());
 		_connection_address_lookup_table.remove(the_connection->get_address());
+		if(the_connection->_bulk_active)
+			_bulk_connection_count--;
 		delete the_connection;
 	}
 	
@@ -931,16 +1162,17 @@ protected:
 		}
 	};
 	
-	packet_record *allocate_packet_record(const address &the_address, bit_stream &stream)
+	packet_record *allocate_packet_record(const address &the_address, const uint8 *data, uint32 data_size)
 	{
-		uint32 data_size = stream.get_next_byte_position();
-		
 		// allocate the send packet, with the data size added on
 		packet_record *the_packet = (packet_record *) memory_allocate(sizeof(packet_record) + data_size);
 		the_packet->remote_address = the_address;
 		the_packet->packet_size = data_size;
-		memcpy(the_packet->packet_data, stream.get_buffer(), data_size);
+		memcpy(the_packet->packet_data, data, data_size);
 		the_packet->next_packet = 0;
+		the_packet->release_time = 0;
+		the_packet->incoming = false;
+		the_packet->arrival_time = 0;
 		return the_packet;
 	}
 
@@ -948,16 +1180,18 @@ protected:
 	{
 		packet_stream stream;
 		address addr;
+		int64 arrival_time;
 		for(;;)
 		{
-			udp_socket::recv_from_result result = stream.recv_from(_socket, &addr);
+			udp_socket::recv_from_result result = stream.recv_from(_socket, &addr, &arrival_time);
 			if(result == udp_socket::invalid_socket)
 				return;
 			
 			if(result == udp_socket::packet_received)
 			{
 				stream.set_bit_position(stream.get_stream_bit_size());
-				packet_record *new_packet = allocate_packet_record(addr, stream);
+				packet_record *new_packet = allocate_packet_record(addr, stream.get_buffer(), stream.get_next_byte_position());
+				new_packet->arrival_time = arrival_time;
 				_packet_queue_mutex.lock();
 				packet_record **walk = &_received_packet_list;
 				while(*walk)
@@ -970,7 +1204,55 @@ protected:
 		}
 	}
 	
-	bool _get_next_packet(packet_stream &stream, address &addr)
+	/// Gets the next packet to process, either one the link emulator has finished delaying or one read from the socket and passed through the link emulator.  arrival_time is returned on the time_source clock.
+	bool _get_next_packet(packet_stream &stream, address &addr, int64 &arrival_time)
+	{
+		for(;;)
+		{
+			if(_released_packet_list)
+			{
+				packet_record *packet = _released_packet_list;
+				_released_packet_list = packet->next_packet;
+				if(!_released_packet_list)
+					_released_packet_tail = 0;
+				stream.set_from_buffer(packet->packet_data, packet->packet_size);
+				addr = packet->remote_address;
+				arrival_time = packet->arrival_time;
+				memory_deallocate(packet);
+				return true;
+			}
+			if(!_read_packet(stream, addr, arrival_time))
+				return false;
+			arrival_time = _time_source.from_wall_microseconds(arrival_time);
+			if(_receive_through_link(stream, addr, arrival_time))
+				return true;
+		}
+	}
+	
+	/// Passes a received packet through the link emulator of the connection it came from (if that has an incoming profile set) or of this socket.  Returns true if the packet should be processed now; otherwise the packet was dropped or is being held in the release queue.
+	bool _receive_through_link(packet_stream &stream, const address &addr, int64 arrival_time)
+	{
+		torque_connection *conn = _find_connection(addr);
+		link_emulator *link = conn && conn->get_link_emulator().is_active(link_emulator::incoming) ? &conn->get_link_emulator() : &_link_emulator;
+		if(!link->is_active(link_emulator::incoming))
+			return true;
+		int64 release_times[link_emulator::max_copies];
+		uint32 size = stream.get_stream_byte_size();
+		uint32 copies = link->shape(link_emulator::incoming, arrival_time ? arrival_time : _time_source.read_microseconds(), size, _link_random, release_times);
+		if(!copies && conn)
+			conn->get_flight_recorder().record_event(get_process_start_time(), packet_flight_recorder::packet_receive_simulated_drop, 0, 0, torque_connection::invalid_packet_type, size);
+		for(uint32 i = 0; i < copies; i++)
+		{
+			packet_record *record = allocate_packet_record(addr, stream.get_buffer(), size);
+			record->incoming = true;
+			record->release_time = release_times[i];
+			_release_queue.insert(record);
+		}
+		return false;
+	}
+	
+	/// Reads the next packet from the socket, or from the background reader's queue.  arrival_time is returned on the wall clock.
+	bool _read_packet(packet_stream &stream, address &addr, int64 &arrival_time)
 	{
 		if(_thread_socket)
 		{
@@ -983,13 +1265,14 @@ protected:
 				return false;
 			stream.set_from_buffer(packet->packet_data, packet->packet_size);
 			addr = packet->remote_address;
+			arrival_time = packet->arrival_time;
 			memory_deallocate(packet);
 			return true;
 		}
 		else
 		{
 			udp_socket::recv_from_result result;
-			return stream.recv_from(_socket, &addr) == udp_socket::packet_received;
+			return stream.recv_from(_socket, &addr, &arrival_time) == udp_socket::packet_received;
 		}
 	}
 public:
@@ -997,6 +1280,7 @@ public:
 	void set_private_key(asymmetric_key *the_key)
 	{
 		_private_key = the_key;
+		_challenge_template_size = 0;
 	}
 	
 	/// Returns the udp_socket associated with this torque_socket
@@ -1008,6 +1292,7 @@ public:
 	void set_challenge_response(byte_buffer_ptr data)
 	{
 		_challenge_response = data;
+		_challenge_template_size = 0;
 	}
 	
 	random_generator &random()
@@ -1027,6 +1312,37 @@ public:
 		_allow_connections = conn;
 	}
 	
+	/// Limits the incoming connections this socket takes on.  max_connections caps the open connections plus the requests awaiting accept_connection, max_pending caps just the requests; 0 is no limit.  Clients over a limit are rejected as soon as their challenge request arrives, with retry_after milliseconds as a hint of when to try again.
+	void set_admission_policy(uint32 max_connections, uint32 max_pending, uint32 retry_after)
+	{
+		_max_connections = max_connections;
+		_max_pending_connections = max_pending;
+		_admission_retry_after = retry_after;
+	}
+
+	/// Sets the torque_socket_integrity_mode this socket asks for on connections it initiates and allows on connections it accepts.  A connection uses torque_integrity_crc32c only if both ends set it.  Returns false if the mode isn't valid, or is torque_integrity_crc32c on a socket that requires key exchange.
+	bool set_integrity_mode(uint32 mode)
+	{
+		if(mode >= torque_integrity_mode_count || (mode == torque_integrity_crc32c && _requires_key_exchange))
+			return false;
+		_integrity_mode = mode;
+		return true;
+	}
+
+	/// Sets whether every connection on this socket must be protected with the keys exchanged in its handshake.  Requiring key exchange sets the integrity mode back to torque_integrity_cipher.
+	void set_requires_key_exchange(bool required)
+	{
+		_requires_key_exchange = required;
+		if(required)
+			_integrity_mode = torque_integrity_cipher;
+	}
+
+	/// Sets the difficulty, in bits, of the client puzzle connecting hosts must solve.
+	void set_puzzle_difficulty(uint32 difficulty)
+	{
+		_puzzle_manager.set_current_difficulty(difficulty);
+	}
+	
 	void _disconnect_existing_connection(const address &remote_host)
 	{
 		
@@ -1047,6 +1363,7 @@ public:
 		new_connection->_state_send_retry_count = challenge_retry_count;
 		new_connection->_state_send_retry_interval = challenge_retry_time;
 		new_connection->_state_last_send_time = get_process_start_time();
+		new_connection->_stage_start_time = _time_source.read_microseconds();
 		
 		_add_pending_connection(new_connection);
 		_send_challenge_request(new_connection);
@@ -1081,7 +1398,7 @@ public:
 			r.initiator_request_received = false;
 			r.host_request_received = false;
 			r.initial_intro_sent = false;
-			r.introduction_time = time::get_current();
+			r.introduction_time = get_process_start_time();
 			_introductions.push_back(r);
 		}
 	}
@@ -1120,6 +1437,7 @@ public:
 		conn->_state_send_retry_count = 0;
 		conn->_state_send_retry_interval = puzzle_solution_timeout;
 		conn->_state_last_send_time = get_process_start_time();
+		_end_handshake_stage(conn, torque_latency_handshake_challenge_accept);
 		
 		packet_stream s;
 		core::write(s, conn->get_initiator_nonce());
@@ -1140,12 +1458,14 @@ public:
 			TorqueLogMessageFormatted(LogNettorque_socket, ("Trying to accept a non-pending connection."));
 			return;
 		}
+		_end_handshake_stage(pending, torque_latency_handshake_local_accept);
 		torque_connection *new_connection = new torque_connection(pending->_initiator_nonce, pending->_initial_send_sequence, pending->_connection_index, false);
 		new_connection->set_torque_socket(this);
 		new_connection->set_symmetric_cipher(pending->get_symmetric_cipher());
 		new_connection->set_shared_secret(pending->get_shared_secret());
 		new_connection->set_initial_recv_sequence(pending->_initial_recv_sequence);
 		new_connection->_host_nonce = pending->_host_nonce;
+		new_connection->_integrity_mode = pending->_integrity_mode;
 		new_connection->set_address(pending->get_address());
 		
 		_remove_pending_connection(pending);
@@ -1183,7 +1503,7 @@ public:
 			symmetric_cipher the_cipher(connection->get_shared_secret());
 			bit_stream_hash_and_encrypt(out, torque_connection::message_signature_bytes, encrypt_pos, &the_cipher);
 			
-			out.send_to(_socket, connection->get_address());
+			_send_packet(connection->get_address(), out.get_buffer(), out.get_next_byte_position());
 			
 			_remove_connection(connection);
 			return;
@@ -1194,40 +1514,370 @@ public:
 			_remove_pending_connection(pending);
 		}
 	}
-	/// Send a datagram packet to the remote host on the other side of the connection.  Returns the sequence number of the packet sent.
-	void send_to_connection(torque_connection_id connection_id, uint8 *data, uint32 data_size, uint32 *sequence = 0)
+	/// Send a datagram packet to the remote host on the other side of the connection, and sets sequence to the sequence number of the packet sent.  Returns false if the connection isn't valid or the data doesn't fit in a datagram with the packet header and the connection's CRC.
+	bool send_to_connection(torque_connection_id connection_id, uint8 *data, uint32 data_size, uint32 *sequence = 0)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		return conn && conn->send_packet(torque_connection::data_packet, data, data_size, sequence);
+	}
+
+	/// Starts a data packet to connection_id that is written directly into the socket's outgoing buffer, rather than built by the caller and copied by send_to_connection.  With zero-copy sends on (set_zerocopy_threshold), the buffer is one of the socket's pinned send buffers, and a large enough packet isn't copied by the kernel either.  The returned stream is positioned at the start of the payload, after space reserved for the packet header, and holds up to max_datagram_size - torque_connection::max_packet_header_size bytes, less the CRC on a torque_integrity_crc32c connection.  Only one packet can be in progress on a socket; beginning another discards it.  Returns NULL if the connection isn't valid or its packet window is full.
+	bit_stream *begin_packet(torque_connection_id connection_id)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		_socket.release_send_buffer(_outgoing_buffer);
+		_outgoing_buffer = _outgoing_packet;
+		_outgoing_connection = invalid_torque_connection;
+		if(!conn || conn->window_full())
+			return 0;
+		_outgoing_connection = connection_id;
+		uint8 *send_buffer = _socket.get_send_buffer();
+		if(send_buffer)
+			_outgoing_buffer = send_buffer;
+		_outgoing_stream.set_buffer(_outgoing_buffer + torque_connection::max_packet_header_size, 0, (udp_socket::max_datagram_size - torque_connection::max_packet_header_size - conn->get_packet_trailer_size()) << 3);
+		return &_outgoing_stream;
+	}
+
+	/// Returns the stream of the packet started by begin_packet, or NULL if no packet is in progress.
+	bit_stream *get_packet_in_progress()
+	{
+		return _outgoing_connection != invalid_torque_connection ? &_outgoing_stream : 0;
+	}
+
+	/// Sends the packet started by begin_packet, whose payload is everything written to the stream.  The header is written in front of the payload in place.  Returns false, and sends nothing, if no packet is in progress, the connection has closed or filled its window since begin_packet, or the payload overflowed the stream.
+	bool commit_packet(uint32 *sequence = 0)
+	{
+		torque_connection_id connection_id = _outgoing_connection;
+		_outgoing_connection = invalid_torque_connection;
+		torque_connection *conn = connection_id != invalid_torque_connection ? _find_connection(connection_id) : 0;
+		bool sent = conn && !conn->window_full() && !_outgoing_stream.was_error_detected();
+		if(sent)
+			conn->send_packet_in_place(_outgoing_buffer, _outgoing_stream.get_next_byte_position(), sequence);
+		// a pooled buffer the socket didn't take (the packet wasn't sent, or the link emulator copied it) goes back to the pool.
+		_socket.release_send_buffer(_outgoing_buffer);
+		_outgoing_buffer = _outgoing_packet;
+		return sent;
+	}
+
+	/// Sends the same datagram to a list of connections, for traffic like world state or chat that every player receives.  The payload isn't copied per connection: each packet is sent as its connection's header followed by the shared data, and the packets go to the socket in batches of udp_socket::max_send_batch.  Connections whose packets are encrypted, carry a CRC or pass through the link emulator are sent to one at a time with send_to_connection.  If sequences is not NULL it receives each packet's sequence number, or -1 where the connection isn't valid, its packet window is full or the data doesn't fit with its CRC.  A packet the socket refuses keeps its sequence number, and is reported lost like any other.  Returns the number of packets sent.
+	uint32 send_to_connections(const torque_connection_id *connection_ids, uint32 count, const uint8 *data, uint32 data_size, int32 *sequences = 0)
+	{
+		TorqueTraceSpan("torque_socket::send_to_connections");
+		if(data_size > udp_socket::max_datagram_size - torque_connection::max_packet_header_size)
+			return 0;
+		udp_socket::outgoing_datagram datagrams[udp_socket::max_send_batch];
+		uint8 headers[udp_socket::max_send_batch][torque_connection::max_packet_header_size];
+		torque_connection *batch_connections[udp_socket::max_send_batch];
+		uint32 batch_count = 0;
+		uint32 sent = 0;
+		for(uint32 i = 0; i < count; i++)
+		{
+			torque_connection *conn = _find_connection(connection_ids[i]);
+			if(sequences)
+				sequences[i] = -1;
+			if(!conn || conn->window_full())
+				continue;
+			if(!conn->can_send_shared_payload())
+			{
+				uint32 sequence;
+				if(!conn->send_packet(torque_connection::data_packet, (uint8 *) data, data_size, &sequence))
+					continue;
+				if(sequences)
+					sequences[i] = int32(sequence);
+				sent++;
+				continue;
+			}
+			bit_stream header(headers[batch_count], torque_connection::max_packet_header_size);
+			conn->write_data_packet_header(header);
+			if(sequences)
+				sequences[i] = int32(conn->get_last_send_sequence());
+			udp_socket::outgoing_datagram &d = datagrams[batch_count];
+			d.destination = conn->get_address();
+			d.header = headers[batch_count];
+			d.header_size = header.get_next_byte_position();
+			d.data = data;
+			d.data_size = data_size;
+			batch_connections[batch_count++] = conn;
+			if(batch_count == udp_socket::max_send_batch)
+			{
+				sent += _send_shared_payload_batch(datagrams, batch_connections, batch_count);
+				batch_count = 0;
+			}
+		}
+		if(batch_count)
+			sent += _send_shared_payload_batch(datagrams, batch_connections, batch_count);
+		return sent;
+	}
+	
+	/// Turns on zero-copy sends of packets of at least threshold bytes built with begin_packet, or turns them off if threshold is 0.  See udp_socket::set_zerocopy_threshold.  Returns false if the platform can't send zero-copy or the socket isn't bound.
+	bool set_zerocopy_threshold(uint32 threshold)
+	{
+		return _socket.set_zerocopy_threshold(threshold);
+	}
+
+	/// Starts sending the file at file_path to connection_id, offered as name.  See torque_socket_interface::send_bulk_transfer.
+	bool send_bulk_transfer(torque_connection_id connection_id, const char *file_path, const char *name, uint32 max_bytes_per_second)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		return conn && conn->send_bulk_transfer(file_path, name, max_bytes_per_second);
+	}
+
+	/// Accepts, into file_path, or refuses, if file_path is NULL, the file connection_id has offered.  See torque_socket_interface::accept_bulk_transfer.
+	bool accept_bulk_transfer(torque_connection_id connection_id, const char *file_path)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		return conn && conn->accept_bulk_transfer(file_path);
+	}
+	
+	/// Writes the flight recorder dump for the specified connection into buffer.  Returns the number of bytes written, or if buffer is too small (or NULL), the number of bytes required.  Returns 0 if there is no such connection.
+	uint32 get_flight_record(torque_connection_id connection_id, uint8 *buffer, uint32 buffer_size)
+	{
+		torque_connection *conn = _find_connection(connection_id);
+		if(!conn)
+			return 0;
+		packet_flight_recorder &recorder = conn->get_flight_recorder();
+		uint32 dump_size = recorder.get_dump_size();
+		if(!buffer || buffer_size < dump_size)
+			return dump_size;
+		return recorder.dump(connection_id, buffer, buffer_size);
+	}
+	
+	/// Returns the clock this socket runs on.
+	time_source &get_time_source()
+	{
+		return _time_source;
+	}
+	
+	/// Returns the arrival time, in microseconds on the time_source clock, of the packet currently being processed, or 0 if no packet is being processed.
+	int64 get_packet_arrival_time()
+	{
+		return _packet_arrival_time;
+	}
+	
+	/// Returns the histogram for one of the torque_socket_latency_stat measurements.
+	latency_histogram &get_latency_histogram(uint32 stat)
+	{
+		assert(stat < torque_latency_stat_count);
+		return _latency_histograms[stat];
+	}
+	
+	/// Fills in the round trip time of the specified connection and this socket's queueing delay figures.
+	void get_latency(torque_connection_id connection_id, torque_socket_latency *latency)
 	{
 		torque_connection *conn = _find_connection(connection_id);
-		conn->send_packet(torque_connection::data_packet, data, data_size, sequence);
+		latency_histogram &queueing_delay = _latency_histograms[torque_latency_arrival_to_dequeue];
+		latency->round_trip_time = conn ? conn->get_round_trip_time() : 0;
+		latency->queueing_delay_count = queueing_delay.get_count();
+		latency->queueing_delay_p50 = queueing_delay.get_percentile(0.5);
+		latency->queueing_delay_p99 = queueing_delay.get_percentile(0.99);
+		latency->queueing_delay_max = queueing_delay.get_max();
+		latency->kernel_timestamps = _socket.has_kernel_timestamps();
+	}
+	
+	/// Summarizes one of the torque_socket_latency_stat measurements.  Returns false if stat isn't valid.
+	bool get_latency_stats(uint32 stat, torque_socket_latency_summary *summary)
+	{
+		if(stat >= torque_latency_stat_count)
+			return false;
+		latency_histogram &h = _latency_histograms[stat];
+		summary->count = h.get_count();
+		summary->min = h.get_min();
+		summary->mean = h.get_mean();
+		summary->p50 = h.get_percentile(0.5);
+		summary->p99 = h.get_percentile(0.99);
+		summary->p999 = h.get_percentile(0.999);
+		summary->max = h.get_max();
+		return true;
+	}
+	
+	/// Clears all the latency histograms on this socket.
+	void reset_latency_stats()
+	{
+		for(uint32 i = 0; i < torque_latency_stat_count; i++)
+			_latency_histograms[i].reset();
+	}
+	
+	void _record_latency(uint32 stat, int64 microseconds)
+	{
+		_latency_histograms[stat].record(microseconds);
+	}
+	
+	/// Records the duration of the handshake stage the pending connection just finished, and starts timing the next stage.
+	void _end_handshake_stage(pending_connection *conn, uint32 stat)
+	{
+		int64 now = _time_source.read_microseconds();
+		if(conn->_stage_start_time)
+			_record_latency(stat, now - conn->_stage_start_time);
+		conn->_stage_start_time = now;
 	}
 	
-	/// Sends a packet to the remote address over this torque_socket's socket.
+	/// Sends a packet to the remote address over this torque_socket's socket.  Succeeds if the socket took the packet or the link emulator queued it; fails if the socket refused it or the link emulator dropped it.
 	udp_socket::send_to_result send_to(const address &the_address, uint32 data_size, uint8 *data)
 	{
 		string addr_string = the_address.to_string();
 		
 		logprintf("send: %s %s", addr_string.c_str(), buffer_encode_base_16(data, data_size)->get_buffer());
 		
-		return _socket.send_to(the_address, data, data_size);
+		packet_flight_recorder::record_type sent = _send_packet(the_address, data, data_size);
+		return sent == packet_flight_recorder::packet_sent || sent == packet_flight_recorder::packet_send_delayed ? udp_socket::send_to_success : udp_socket::send_to_failure;
+	}
+	
+	/// Sends a packet through the link emulator of the sending connection (if it has an outgoing profile set) or of this socket.  Returns how the packet was handled, as a flight recorder record type: sent immediately, refused by the socket, held in the release queue, or dropped.
+	packet_flight_recorder::record_type _send_packet(const address &the_address, const uint8 *data, uint32 data_size, link_emulator *connection_link = 0)
+	{
+		link_emulator *link = connection_link && connection_link->is_active(link_emulator::outgoing) ? connection_link : &_link_emulator;
+		if(!link->is_active(link_emulator::outgoing))
+		{
+			if(_socket.send_to(the_address, data, data_size) != udp_socket::send_to_success)
+				return packet_flight_recorder::packet_send_failed;
+			return packet_flight_recorder::packet_sent;
+		}
+		int64 release_times[link_emulator::max_copies];
+		uint32 copies = link->shape(link_emulator::outgoing, _time_source.read_microseconds(), data_size, _link_random, release_times);
+		if(!copies)
+			return packet_flight_recorder::packet_send_simulated_drop;
+		for(uint32 i = 0; i < copies; i++)
+		{
+			packet_record *record = allocate_packet_record(the_address, data, data_size);
+			record->release_time = release_times[i];
+			_release_queue.insert(record);
+		}
+		return packet_flight_recorder::packet_send_delayed;
 	}
 	
-	/// Sends a packet to the remote address after millisecond_delay time has elapsed.  This is used to simulate network latency on a LAN or single computer.
-	void send_to_delayed(const address &the_address, bit_stream &stream, uint32 millisecond_delay)
+	/// Sends a batch of data packets built by send_to_connections and records them in their connections' flight recorders.  Returns the number of packets the socket took.  Packets the socket refuses are recorded as packet_send_failed and left to the notify protocol to report as lost, as a failed send_to is.
+	uint32 _send_shared_payload_batch(const udp_socket::outgoing_datagram *datagrams, torque_connection **connections, uint32 count)
 	{
-		packet_record *the_packet = allocate_packet_record(the_address, stream);
-		the_packet->send_time = get_process_start_time() + time(millisecond_delay);
+		uint32 sent = _socket.send_to_batch(datagrams, count);
+		for(uint32 i = 0; i < count; i++)
+		{
+			torque_connection *conn = connections[i];
+			conn->get_flight_recorder().record_event(get_process_start_time(), i < sent ? packet_flight_recorder::packet_sent : packet_flight_recorder::packet_send_failed, conn->get_last_send_sequence(), conn->get_last_received_sequence(), torque_connection::data_packet, datagrams[i].header_size + datagrams[i].data_size);
+		}
+		return sent;
+	}
 
-		// insert it into the packet_record list, sorted by time
-		packet_record **list;
-		for(list = &_send_packet_list; *list && ((*list)->send_time <= the_packet->send_time); list = &((*list)->next_packet))
-			;
-		the_packet->next_packet = *list;
-		*list = the_packet;
+	/// Sends a list of datagrams with as few system calls as the platform allows.  Datagrams made of a header and data must be sent through here only if the link emulator isn't active, since it holds single buffers.  Returns the number of datagrams sent, or queued by the link emulator; the rest were refused by the socket.
+	uint32 _send_packets(const udp_socket::outgoing_datagram *datagrams, uint32 count)
+	{
+		if(_link_emulator.is_active(link_emulator::outgoing))
+		{
+			for(uint32 i = 0; i < count; i++)
+			{
+				assert(!datagrams[i].header_size);
+				_send_packet(datagrams[i].destination, datagrams[i].data, datagrams[i].data_size);
+			}
+			return count;
+		}
+		return _socket.send_to_batch(datagrams, count);
+	}
+	
+	/// Starts measuring the round trip time to each of count addresses, normally the servers in a server browser list.  Probes are sent at packets_per_second (0 for all at once), several to a system call, and any torque_socket answers them without involving its application.  When every server has replied, or timeout milliseconds after the last probe is sent, a single torque_socket_probe_results_event_type event reports the round trip time to each address.  Returns false if a round of probes is already in progress.
+	bool probe(const address *addresses, uint32 count, uint32 packets_per_second, uint32 timeout)
+	{
+		if(_probe.is_active() || !count)
+			return false;
+		_probe.start(addresses, count, packets_per_second, int64(timeout) * 1000, _time_source.read_microseconds(), _random_generator.random_integer());
+		_process_probe();
+		return true;
+	}
+	
+	/// Returns the link emulator applied to all the traffic on this socket, except for connections that have their own profile set for a direction.
+	link_emulator &get_link_emulator()
+	{
+		return _link_emulator;
+	}
+	
+	/// Returns the link emulator of a connection, or of the socket if connection_id is invalid_torque_connection.  Returns NULL if there is no such connection.
+	link_emulator *find_link_emulator(torque_connection_id connection_id)
+	{
+		if(connection_id == invalid_torque_connection)
+			return &_link_emulator;
+		torque_connection *conn = _find_connection(connection_id);
+		return conn ? &conn->get_link_emulator() : 0;
+	}
+	
+	/// Sets or, with a NULL profile, clears the emulated link conditions for one direction of a connection or the whole socket.  Returns false if the connection or direction isn't valid.
+	bool set_link_profile(torque_connection_id connection_id, uint32 direction, torque_socket_link_profile *profile)
+	{
+		link_emulator *link = find_link_emulator(connection_id);
+		if(!link || direction >= link_emulator::direction_count)
+			return false;
+		link_profile p;
+		if(profile)
+		{
+			p.latency = profile->latency;
+			p.jitter = profile->jitter;
+			p.distribution = profile->distribution < link_profile::jitter_distribution_count ? profile->distribution : uint32(link_profile::jitter_uniform);
+			p.reorder = profile->reorder;
+			p.duplicate = profile->duplicate;
+			p.loss = profile->loss;
+			p.burst_loss = profile->burst_loss;
+			p.burst_enter = profile->burst_enter;
+			p.burst_exit = profile->burst_exit;
+			p.bandwidth = profile->bandwidth;
+			p.queue_limit = profile->queue_limit;
+		}
+		link->set_profile(link_emulator::direction(direction), p);
+		return true;
+	}
+	
+	/// Fills in the link emulator counters for one direction of a connection or the whole socket.  Returns false if the connection or direction isn't valid.
+	bool get_link_stats(torque_connection_id connection_id, uint32 direction, torque_socket_link_stats *stats)
+	{
+		link_emulator *link = find_link_emulator(connection_id);
+		if(!link || direction >= link_emulator::direction_count)
+			return false;
+		const link_stats &s = link->get_stats(link_emulator::direction(direction));
+		stats->packets = s.packets;
+		stats->lost = s.lost;
+		stats->queue_dropped = s.queue_dropped;
+		stats->duplicated = s.duplicated;
+		stats->reordered = s.reordered;
+		stats->burst_count = s.burst_count;
+		return true;
+	}
+	
+	/// Sets a response this socket sends to every info packet whose first byte is query_type, straight from the receive path, without posting a torque_socket_packet_event_type event or waking the application.  Each source address is sent at most max_per_second responses a second (0 for no limit); queries over the limit are dropped.  A NULL response clears the entry, and queries of that type are posted as events again.  Returns false if query_type isn't an info packet type or the response won't fit in a datagram.
+	bool set_info_response(uint32 query_type, const uint8 *response, uint32 response_size, uint32 max_per_second)
+	{
+		if(query_type < first_valid_info_packet_id || query_type > last_valid_info_packet_id || (response && response_size > udp_socket::max_datagram_size))
+			return false;
+		info_response &cached = _info_responses[query_type - first_valid_info_packet_id];
+		cached.hits = cached.rate_limited = 0;
+		cached.max_per_second = max_per_second;
+		if(!response)
+		{
+			cached.response = 0;
+			return true;
+		}
+		cached.response = new byte_buffer(response, response_size);
+		if(!_info_rate_table.size())
+			_info_rate_table.resize(info_rate_table_size);
+		return true;
+	}
+	
+	/// Fills in the number of queries of query_type answered from the response set by set_info_response, and the number dropped by its rate limit, since the response was set.  Returns false if query_type isn't an info packet type.
+	bool get_info_response_stats(uint32 query_type, torque_socket_info_response_stats *stats)
+	{
+		if(query_type < first_valid_info_packet_id || query_type > last_valid_info_packet_id)
+			return false;
+		info_response &cached = _info_responses[query_type - first_valid_info_packet_id];
+		stats->hits = cached.hits;
+		stats->rate_limited = cached.rate_limited;
+		return true;
+	}
+	
+	/// Seeds the generator the link emulators draw their random loss, jitter and duplication from, so that a run can be repeated.
+	void seed_link_emulator(uint64 seed)
+	{
+		_link_random.seed(seed);
 	}
 	
 	/// Gets the next event on this socket; returns NULL if there are no events to be read.
 	torque_socket_event *get_next_event()
 	{
+		TorqueTraceSpan("torque_socket::get_next_event");
 		process_connections();
 		if(!_event_queue.has_event())
 		{
@@ -1235,22 +1885,54 @@ public:
 			// if there's nothing in the event queue, see if a new packet's come in.
 			packet_stream stream;
 			address source_address;
+			int64 arrival_time;
 			
-			while(_get_next_packet(stream, source_address))
+			while(_get_next_packet(stream, source_address, arrival_time))
 			{
 				//logprintf("Got a packet: %s.", stream.to_string().c_str());
-				_process_start_time = time::get_current();
+				_time_source.update_fast();
+				_process_start_time = _time_source.get_tick_time();
+				int64 process_time = _time_source.read_microseconds();
+				if(arrival_time)
+					_record_latency(torque_latency_arrival_to_process, process_time - arrival_time);
+				_packet_arrival_time = arrival_time;
+				_event_queue.set_packet_times(arrival_time, process_time);
 				_process_packet(source_address, stream);
+				_event_queue.set_packet_times(0, 0);
+				_packet_arrival_time = 0;
 				if(_event_queue.has_event())
 					break;
 			}
 		}
-		if(_event_queue.has_event())
-			return _event_queue.dequeue();
-		else
+		if(!_event_queue.has_event())
 			return 0;
+		int64 process_time;
+		torque_socket_event *event = _event_queue.dequeue(&process_time);
+		if(process_time)
+		{
+			int64 dequeue_time = _time_source.read_microseconds();
+			_record_latency(torque_latency_process_to_dequeue, dequeue_time - process_time);
+			if(event->arrival_time)
+				_record_latency(torque_latency_arrival_to_dequeue, dequeue_time - event->arrival_time);
+		}
+		return event;
 	}	
 	
+	/// Adds a reference to the data of an event returned by get_next_event, so that it stays valid past the next get_next_event call, without being copied, until it is passed to release_event_data.  The event's key is not retained.  Returns the data, or NULL if the event has none.
+	uint8 *retain_event_data(torque_socket_event *event)
+	{
+		if(!event->data)
+			return 0;
+		payload_pool::retain(event->data);
+		return event->data;
+	}
+	
+	/// Drops a reference added by retain_event_data.  Can be called from any thread, and after the socket has been destroyed.
+	static void release_event_data(uint8 *data)
+	{
+		payload_pool::release(data);
+	}
+	
 	bind_result bind(const address &bind_address)
 	{
 		time block_timeout = 0;
@@ -1265,6 +1947,146 @@ public:
 		return the_result;
 	}
 	
+	/// Binds this torque_socket to an address on a simulated_network rather than a real socket.  The socket then runs on the network's virtual clock, solves client puzzles inline and seeds its random generators from the network, so a simulation run can be reproduced exactly.  Simulated sockets can't use a background thread.
+	bind_result bind_simulated(simulated_network *network, const address &bind_address)
+	{
+		assert(!_thread_socket);
+		bind_result the_result = _socket.bind_simulated(network, bind_address);
+		if(the_result != bind_success)
+			return the_result;
+		
+		_time_source.attach_virtual_clock(network->get_clock());
+		_process_start_time = _time_source.get_tick_time();
+		_puzzle_solver.set_inline(true);
+		uint8 entropy[32];
+		network->random_buffer(entropy, sizeof(entropy));
+		_random_generator.add_entropy(entropy, sizeof(entropy));
+		_random_generator.random_buffer(_random_hash_data, sizeof(_random_hash_data));
+		_link_random.seed(_random_generator.random_integer());
+		network->_set_socket_owner(bind_address, this);
+		return the_result;
+	}
+	
+	enum {
+		capture_key_file_version = 3,
+		capture_seed_size = 32,
+	};
+	
+	/// Starts recording every datagram this socket sends and receives to a pcap file.  If key_file_name is set, the socket also writes the state a replay needs to reproduce its side of encrypted handshakes (its private key, puzzle nonces, challenge hashing data and integrity settings), and restarts its random generator from a seed recorded there.  The key file is enough to decrypt every session in the capture, so guard it accordingly.  Returns false if either file can't be written.
+	bool start_capture(const char *capture_file_name, const char *key_file_name = 0)
+	{
+		stop_capture();
+		if(key_file_name)
+		{
+			uint8 seed[capture_seed_size];
+			_random_generator.random_buffer(seed, sizeof(seed));
+			
+			packet_stream s;
+			core::write(s, uint32(capture_key_file_version));
+			address bound_address = _socket.get_bound_address();
+			core::write(s, bound_address.get_host());
+			core::write(s, bound_address.get_port());
+			core::write(s, _private_key->get_private_key());
+			s.write_bytes(_random_hash_data, sizeof(_random_hash_data));
+			core::write(s, _puzzle_manager.get_current_nonce());
+			core::write(s, _puzzle_manager.get_last_nonce());
+			core::write(s, _puzzle_manager.get_last_update_time().get_milliseconds());
+			core::write(s, _puzzle_manager.get_current_difficulty());
+			core::write(s, uint8(_integrity_mode));
+			core::write(s, uint8(_requires_key_exchange));
+			s.write_bytes(seed, sizeof(seed));
+			
+			FILE *key_file = fopen(key_file_name, "wb");
+			if(!key_file)
+				return false;
+			bool written = fwrite(s.get_buffer(), 1, s.get_next_byte_position(), key_file) == s.get_next_byte_position();
+			fclose(key_file);
+			if(!written)
+				return false;
+			_random_generator.reseed(seed, sizeof(seed));
+			_link_random.seed(_random_generator.random_integer());
+		}
+		if(!_capture.open(capture_file_name))
+			return false;
+		_socket.set_capture(&_capture);
+		return true;
+	}
+	
+	/// Stops recording datagrams and closes the capture file.
+	void stop_capture()
+	{
+		// the capture object stays around, since a background reader thread may still hold it.
+		_capture.close();
+	}
+	
+	/// Restores the state written to a key file by start_capture, so that replaying the capture into this socket reproduces the original host's handshakes.  If recorded_address is set it receives the address the socket was bound to.  Returns false if the file can't be read or isn't a key file.
+	bool load_capture_keys(const char *key_file_name, address *recorded_address = 0)
+	{
+		FILE *key_file = fopen(key_file_name, "rb");
+		if(!key_file)
+			return false;
+		uint8 buffer[udp_socket::max_datagram_size];
+		uint32 size = uint32(fread(buffer, 1, sizeof(buffer), key_file));
+		fclose(key_file);
+		
+		bit_stream s(buffer, size);
+		uint32 version, host, difficulty;
+		uint8 integrity_mode, requires_key_exchange;
+		uint16 port;
+		byte_buffer_ptr private_key;
+		nonce current_nonce, last_nonce;
+		int64 last_update;
+		uint8 seed[capture_seed_size];
+		core::read(s, version);
+		if(version != capture_key_file_version)
+			return false;
+		core::read(s, host);
+		core::read(s, port);
+		core::read(s, private_key);
+		s.read_bytes(_random_hash_data, sizeof(_random_hash_data));
+		core::read(s, current_nonce);
+		core::read(s, last_nonce);
+		core::read(s, last_update);
+		core::read(s, difficulty);
+		core::read(s, integrity_mode);
+		core::read(s, requires_key_exchange);
+		s.read_bytes(seed, sizeof(seed));
+		if(s.was_error_detected() || !private_key || integrity_mode >= torque_integrity_mode_count)
+			return false;
+		
+		_private_key = new asymmetric_key(*private_key);
+		_challenge_template_size = 0;
+		_puzzle_manager.restore(current_nonce, last_nonce, time(last_update));
+		_puzzle_manager.set_current_difficulty(difficulty);
+		_integrity_mode = integrity_mode;
+		_requires_key_exchange = requires_key_exchange != 0;
+		_random_generator.reseed(seed, sizeof(seed));
+		_link_random.seed(_random_generator.random_integer());
+		if(recorded_address)
+		{
+			recorded_address->set_host(host);
+			recorded_address->set_port(port);
+		}
+		return true;
+	}
+	
+	/// Returns the time, in time_source microseconds, at which this socket next has work to do if no more packets arrive: releasing packets held by the link emulator, retrying handshakes or checking connections for timeouts.  Used by simulated_network to schedule sockets.
+	int64 get_next_process_time()
+	{
+		if(_released_packet_list || _event_queue.has_event())
+			return _time_source.get_tick_microseconds();
+		int64 next = (_last_timeout_check_time.get_milliseconds() + timeout_check_interval + 1) * 1000;
+		int64 release = _release_queue.get_next_release_time();
+		if(release != -1 && release < next)
+			next = release;
+		int64 probe = _probe.get_next_time();
+		if(probe != -1 && probe < next)
+			next = probe;
+		if(_bulk_connection_count && _time_source.get_tick_microseconds() + bulk_transfer::process_interval < next)
+			next = _time_source.get_tick_microseconds() + bulk_transfer::process_interval;
+		return next;
+	}
+	
 	~torque_socket()
 	{
 		// gracefully close all the connections on this torque_socket:
@@ -1272,6 +2094,20 @@ public:
 		while(_connection_list)
 			_disconnect(_connection_list->get_connection_index(), reason_self_disconnect, 0, 0);
 		logprintf("Done.");
+		
+		// anything still held by the link emulator is dropped.
+		for(packet_record *walk = _release_queue.remove_all(); walk; )
+		{
+			packet_record *next = walk->next_packet;
+			memory_deallocate(walk);
+			walk = next;
+		}
+		while(_released_packet_list)
+		{
+			packet_record *next = _released_packet_list->next_packet;
+			memory_deallocate(_released_packet_list);
+			_released_packet_list = next;
+		}
 
 	}
 	
@@ -1285,9 +2121,17 @@ public:
 		
 		_last_timeout_check_time = time(0);
 		_allow_connections = true;
-		
-		_send_packet_list = NULL;
-		_process_start_time = time::get_current();
+		_requires_key_exchange = false;
+		_max_connections = 0;
+		_max_pending_connections = 0;
+		_admission_retry_after = 0;
+		_integrity_mode = torque_integrity_cipher;
+		
+		_released_packet_list = 0;
+		_released_packet_tail = 0;
+		_link_random.seed(_random_generator.random_integer());
+		_process_start_time = _time_source.get_tick_time();
+		_packet_arrival_time = 0;
 		
 		_event_ready_notify_fn = socket_notify_fn;
 		_event_ready_user_data = socket_notify_data;
@@ -1297,8 +2141,12 @@ public:
 		// Supply our own (small) unique private key for the time being.
 		_private_key = new asymmetric_key(16, _random_generator);
 		_challenge_response = new byte_buffer();
+		_challenge_template_size = 0;
 		_pending_connections = 0;
 		_connection_list = 0;
+		_bulk_connection_count = 0;
+		_outgoing_connection = invalid_torque_connection;
+		_outgoing_buffer = _outgoing_packet;
 	}
 	
 	socket_event_queue _event_queue;
@@ -1309,6 +2157,7 @@ public:
 	socket_thread _packet_thread; ///< background thread that blocks on socket read and calls the socket_notify_fn whenever it posts something into the packet queue
 	void *_event_ready_user_data;
 	void (*_event_ready_notify_fn)(void *); ///< When the socket operates with a background reader thread, this function is called when each new packet arrives.  This function is called from the background thread, so beware of thread safety issues.  Mostly this is just here for the NPAPI version.
+	packet_capture _capture; ///< Recording of this socket's datagrams, when start_capture has been called.  Declared before _socket so that it outlives the socket's reader thread.
 	udp_socket _socket; ///< Network socket this torque_socket communicates over.
 	random_generator _random_generator;	///< cryptographic random number generator for this socket
 	puzzle_solver _puzzle_solver; ///< helper class for solving client puzzles
@@ -1319,19 +2168,79 @@ public:
 	hash_table_flat<torque_connection_id, torque_connection *> _connection_id_lookup_table; ///< quick lookup table for active connections by id.
 	hash_table_flat<address, torque_connection *> _connection_address_lookup_table; ///< quick lookup table for active connections by address.
 	uint32 _next_connection_index; ///< Next available connection id
+	uint32 _bulk_connection_count; ///< Connections with bulk transfer work to do, which process_connections visits.
 
 	byte_buffer_ptr _challenge_response; ///< Challenge response set by the host as response to all incoming challenge requests on this socket.
 	
 	ref_ptr<asymmetric_key> _private_key; ///< The private key used by this torque_socket for secure key exchange.
 	client_puzzle_manager _puzzle_manager; ///< The ref_object that tracks the current client puzzle difficulty, current puzzle and solutions for this torque_socket.
 
+	time_source _time_source; ///< Clock for this torque_socket, sampled once per processing pass.
 	time _process_start_time; ///< Current time tracked by this torque_socket.
+	int64 _packet_arrival_time; ///< Arrival time in time_source microseconds of the packet currently being processed, 0 outside of packet processing.
+	latency_histogram _latency_histograms[torque_latency_stat_count]; ///< Internal latency measurements, indexed by torque_socket_latency_stat.
 	bool _requires_key_exchange; ///< True if all connections outgoing and incoming require key exchange.
+	uint32 _integrity_mode; ///< torque_socket_integrity_mode requested for and allowed on new connections.
 	time _last_timeout_check_time; ///< Last time all the active connections were checked for timeouts.
-	uint8  _random_hash_data[12]; ///< Data that gets hashed with connect challenge requests to prevent connection spoofing.
+	uint8  _random_hash_data[siphash_key_size]; ///< Key for the identity tokens given out with connect challenge responses, to prevent connection spoofing.
+
+	enum {
+		challenge_template_nonce_offset = 1, ///< Position of the initiator nonce, after the packet type; the identity token follows it.
+	};
+	uint8 _challenge_template[udp_socket::max_datagram_size]; ///< Prebuilt connect challenge response packet.
+	uint32 _challenge_template_size; ///< Size of the challenge response template, or 0 if it needs to be rebuilt.
+	nonce _challenge_template_puzzle_nonce; ///< Client puzzle nonce written into the template.
+	uint32 _challenge_template_difficulty; ///< Client puzzle difficulty written into the template.
 	bool _allow_connections; ///< Set if this torque_socket allows connections from remote instances.
+	uint32 _max_connections; ///< Limit on open connections plus requests awaiting accept, or 0 for none.
+	uint32 _max_pending_connections; ///< Limit on connection requests awaiting accept, or 0 for none.
+	uint32 _admission_retry_after; ///< Milliseconds a client turned away by the admission policy is asked to wait before retrying.
 	
 	hash_table_flat<uint32, torque_connection *> _connection_index_table;
 
-	packet_record *_send_packet_list; ///< List of delayed packets pending to send.
+	link_emulator _link_emulator; ///< Emulated network conditions for all the traffic on this socket.
+	fast_random_generator _link_random; ///< Random source for the link emulators of this socket and its connections.
+	release_queue<packet_record> _release_queue; ///< Packets held by the link emulators until their send or receive time.
+	packet_record *_released_packet_list; ///< Received packets the link emulator has finished delaying, waiting to be processed.
+	packet_record *_released_packet_tail;
+	
+	enum {
+		info_packet_type_count = last_valid_info_packet_id - first_valid_info_packet_id + 1,
+		info_rate_table_size = 1024, ///< Number of source addresses tracked by the info response rate limit; a power of two.
+	};
+	
+	/// Response set by set_info_response for one info packet type.
+	struct info_response
+	{
+		byte_buffer_ptr response;
+		uint32 max_per_second;
+		uint32 hits; ///< Queries answered.
+		uint32 rate_limited; ///< Queries dropped by the rate limit.
+		
+		info_response()
+		{
+			max_per_second = hits = rate_limited = 0;
+		}
+	};
+	
+	/// Number of info responses sent to the source addresses in one slot of the rate table in the current one second window.
+	struct info_rate_slot
+	{
+		int64 window_start;
+		uint32 count;
+		
+		info_rate_slot()
+		{
+			window_start = 0;
+			count = 0;
+		}
+	};
+	
+	info_response _info_responses[info_packet_type_count]; ///< Cached responses, indexed by info packet type - first_valid_info_packet_id.
+	array<info_rate_slot> _info_rate_table; ///< Per source response counts, allocated when the first response is set.
+	server_probe _probe; ///< The round of latency probes started by probe(), if one is in progress.
+	uint8 _outgoing_packet[udp_socket::max_datagram_size]; ///< Buffer of the packet started by begin_packet when zero-copy sends are off; the payload follows torque_connection::max_packet_header_size reserved bytes.
+	uint8 *_outgoing_buffer; ///< Buffer the packet in progress is built in: _outgoing_packet, or a pooled send buffer from _socket.
+	bit_stream _outgoing_stream; ///< Stream over the payload of _outgoing_buffer.
+	torque_connection_id _outgoing_connection; ///< Connection the packet in _outgoing_buffer is for, or invalid_torque_connection if no packet is in progress.
 };
@@ -0,0 +1,644 @@
+// torque_socket_coroutines.h - Optional C++20 coroutine front end for the torque sockets C API.
+// Copyright GarageGames.  torque sockets API and prototype implementation are released under the MIT license.  See /license/info.txt in this distribution for specific details.
+
+// Include after torque_sockets_c_api.h, in a translation unit compiled as C++20.  Nothing else in torque sockets depends on this header.
+//
+// A socket_scheduler owns the event pump of one socket.  Coroutines returning torque::task await its connect, accept, receive and delivered operations, and are resumed from poll() as the events that complete them arrive:
+//
+//	torque::task serve_client(torque::socket_scheduler &s)
+//	{
+//		torque::connect_result connection = co_await s.accept();
+//		while(torque::packet p = co_await s.receive(connection.connection))
+//		{
+//			int sequence = s.get_interface()->send_to_connection(s.get_socket(), connection.connection, p.size(), p.data());
+//			if(!co_await s.delivered(connection.connection, sequence))
+//				break;
+//		}
+//	}
+//
+// Everything runs on the thread that calls poll().  Awaiters live in the coroutine frames, and frames come from a per-thread frame_pool, so awaiting never allocates.
+
+#if !defined(__cpp_impl_coroutine)
+#error "torque_socket_coroutines.h requires a compiler with C++20 coroutine support."
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+namespace torque
+{
+
+/// Recycles coroutine frames in size classes of frame_granularity bytes.  Frames larger than max_pooled_frame_size come from operator new.  Each thread has its own free lists, so no locking is needed; frames are never returned to the system.
+class frame_pool
+{
+public:
+	enum {
+		frame_granularity = 64,
+		max_pooled_frame_size = 2048,
+		size_class_count = max_pooled_frame_size / frame_granularity,
+	};
+
+	static void *allocate(size_t size)
+	{
+		size_t size_class = (size + frame_granularity - 1) / frame_granularity;
+		if(size_class > size_class_count)
+			return ::operator new(size);
+		free_frame *&list = _free_lists[size_class - 1];
+		if(!list)
+			return ::operator new(size_class * frame_granularity);
+		free_frame *frame = list;
+		list = frame->next;
+		return frame;
+	}
+
+	static void deallocate(void *frame, size_t size)
+	{
+		size_t size_class = (size + frame_granularity - 1) / frame_granularity;
+		if(size_class > size_class_count)
+		{
+			::operator delete(frame);
+			return;
+		}
+		free_frame *f = (free_frame *) frame;
+		f->next = _free_lists[size_class - 1];
+		_free_lists[size_class - 1] = f;
+	}
+private:
+	struct free_frame
+	{
+		free_frame *next;
+	};
+	static inline thread_local free_frame *_free_lists[size_class_count];
+};
+
+/// Return type of a coroutine run by a socket_scheduler.  The coroutine starts running when it's called, and its frame goes back to the frame_pool when it returns.  An exception escaping the coroutine terminates the program.
+struct task
+{
+	struct promise_type
+	{
+		task get_return_object()
+		{
+			return task();
+		}
+		std::suspend_never initial_suspend() noexcept
+		{
+			return std::suspend_never();
+		}
+		std::suspend_never final_suspend() noexcept
+		{
+			return std::suspend_never();
+		}
+		void return_void()
+		{
+		}
+		void unhandled_exception()
+		{
+			std::terminate();
+		}
+		static void *operator new(size_t size)
+		{
+			return frame_pool::allocate(size);
+		}
+		static void operator delete(void *frame, size_t size)
+		{
+			frame_pool::deallocate(frame, size);
+		}
+	};
+};
+
+/// The payload of a received data packet.  The packet holds a reference to the socket's event data (see retain_event_data) rather than a copy, and releases it when destroyed.  An empty packet, which tests false, means the connection closed.
+class packet
+{
+public:
+	packet()
+	{
+		_api = 0;
+		_data = 0;
+		_size = 0;
+		_sequence = 0;
+	}
+
+	packet(torque_socket_interface *api, unsigned char *data, unsigned size, unsigned sequence)
+	{
+		_api = api;
+		_data = data;
+		_size = size;
+		_sequence = sequence;
+	}
+
+	packet(packet &&other)
+	{
+		_api = other._api;
+		_data = other._data;
+		_size = other._size;
+		_sequence = other._sequence;
+		other._data = 0;
+	}
+
+	packet &operator=(packet &&other)
+	{
+		if(this != &other)
+		{
+			release();
+			_api = other._api;
+			_data = other._data;
+			_size = other._size;
+			_sequence = other._sequence;
+			other._data = 0;
+		}
+		return *this;
+	}
+
+	packet(const packet &) = delete;
+	packet &operator=(const packet &) = delete;
+
+	~packet()
+	{
+		release();
+	}
+
+	explicit operator bool() const
+	{
+		return _data != 0;
+	}
+
+	unsigned char *data() const
+	{
+		return _data;
+	}
+
+	unsigned size() const
+	{
+		return _size;
+	}
+
+	/// Sequence number the remote host sent the packet with.
+	unsigned sequence() const
+	{
+		return _sequence;
+	}
+
+	/// Drops the reference to the payload, leaving the packet empty.
+	void release()
+	{
+		if(_data)
+		{
+			_api->release_event_data(_data);
+			_data = 0;
+		}
+	}
+private:
+	torque_socket_interface *_api;
+	unsigned char *_data;
+	unsigned _size;
+	unsigned _sequence;
+};
+
+/// Result of awaiting socket_scheduler::connect or accept.
+struct connect_result
+{
+	torque_connection_id connection; ///< The established connection, or invalid_torque_connection if it failed.
+	unsigned reason; ///< torque_connection_disconnect_reason given by the host that refused the connection, or torque_reason_none.
+	unsigned retry_after; ///< Milliseconds the host asked the client to wait before trying again, or 0.
+
+	explicit operator bool() const
+	{
+		return connection != invalid_torque_connection;
+	}
+};
+
+/// Runs coroutines over one torque socket.  The scheduler takes every event from the socket in poll() and resumes the coroutines waiting on them; events no coroutine waits for (unconnected datagrams, probe results, arranged connection requests) go to the handler set with set_event_handler.  A scheduler and its coroutines belong to the thread that calls poll().
+class socket_scheduler
+{
+	struct waiter
+	{
+		std::coroutine_handle<> handle;
+		waiter *next;
+	};
+	
+	/// A connect_awaiter or accept_awaiter, which both wait for a connection to be established.
+	struct establish_waiter : waiter
+	{
+		connect_result result;
+	};
+public:
+	class connect_awaiter;
+	class accept_awaiter;
+	class receive_awaiter;
+	class delivery_awaiter;
+private:
+	/// What the scheduler knows about a connection from the time it's requested until it closes.
+	struct connection_state
+	{
+		establish_waiter *establishing; ///< The connect_awaiter or accept_awaiter waiting for the connection to be established.
+		waiter *receivers; ///< receive_awaiters, oldest first.
+		waiter *deliveries; ///< delivery_awaiters.
+		std::vector<packet> received; ///< Packets no receive_awaiter has taken yet.
+		size_t received_head;
+		bool established;
+
+		connection_state()
+		{
+			establishing = 0;
+			receivers = 0;
+			deliveries = 0;
+			received_head = 0;
+			established = false;
+		}
+	};
+public:
+	class connect_awaiter : establish_waiter
+	{
+		friend class socket_scheduler;
+		socket_scheduler *_scheduler;
+		struct sockaddr *_remote_host;
+		unsigned _connect_data_size;
+		unsigned char *_connect_data;
+	public:
+		connect_awaiter(socket_scheduler *scheduler, struct sockaddr *remote_host, unsigned connect_data_size, unsigned char *connect_data)
+		{
+			_scheduler = scheduler;
+			_remote_host = remote_host;
+			_connect_data_size = connect_data_size;
+			_connect_data = connect_data;
+			result.connection = invalid_torque_connection;
+			result.reason = torque_reason_none;
+			result.retry_after = 0;
+		}
+		bool await_ready()
+		{
+			return false;
+		}
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			torque_connection_id connection = _scheduler->_api->connect(_scheduler->_socket, _remote_host, _connect_data_size, _connect_data);
+			if(connection == invalid_torque_connection)
+				return false;
+			this->handle = handle;
+			this->next = 0;
+			_scheduler->_connections[connection].establishing = this;
+			return true;
+		}
+		connect_result await_resume()
+		{
+			return result;
+		}
+	};
+
+	class accept_awaiter : establish_waiter
+	{
+		friend class socket_scheduler;
+		socket_scheduler *_scheduler;
+	public:
+		accept_awaiter(socket_scheduler *scheduler)
+		{
+			_scheduler = scheduler;
+			result.connection = invalid_torque_connection;
+			result.reason = torque_reason_none;
+			result.retry_after = 0;
+		}
+		bool await_ready()
+		{
+			return false;
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			this->handle = handle;
+			this->next = 0;
+			if(_scheduler->_requests_head < _scheduler->_requests.size())
+				_scheduler->_accept(_scheduler->_requests[_scheduler->_requests_head++], this);
+			else
+				_scheduler->_append(_scheduler->_acceptors, this);
+		}
+		connect_result await_resume()
+		{
+			return result;
+		}
+	};
+
+	class receive_awaiter : waiter
+	{
+		friend class socket_scheduler;
+		socket_scheduler *_scheduler;
+		torque_connection_id _connection;
+		packet _result;
+	public:
+		receive_awaiter(socket_scheduler *scheduler, torque_connection_id connection)
+		{
+			_scheduler = scheduler;
+			_connection = connection;
+		}
+		bool await_ready()
+		{
+			connection_state *state = _scheduler->_find(_connection);
+			if(!state)
+				return true;
+			if(state->received_head == state->received.size())
+				return false;
+			_result = static_cast<packet &&>(state->received[state->received_head++]);
+			if(state->received_head == state->received.size())
+			{
+				state->received.clear();
+				state->received_head = 0;
+			}
+			return true;
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			this->handle = handle;
+			this->next = 0;
+			_scheduler->_append(_scheduler->_find(_connection)->receivers, this);
+		}
+		packet await_resume()
+		{
+			return static_cast<packet &&>(_result);
+		}
+	};
+
+	class delivery_awaiter : waiter
+	{
+		friend class socket_scheduler;
+		socket_scheduler *_scheduler;
+		torque_connection_id _connection;
+		unsigned _sequence;
+		bool _delivered;
+	public:
+		delivery_awaiter(socket_scheduler *scheduler, torque_connection_id connection, int sequence)
+		{
+			_scheduler = scheduler;
+			_connection = connection;
+			_sequence = unsigned(sequence);
+			_delivered = false;
+		}
+		bool await_ready()
+		{
+			connection_state *state = _scheduler->_find(_connection);
+			return !state || !state->established;
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			this->handle = handle;
+			this->next = 0;
+			_scheduler->_append(_scheduler->_find(_connection)->deliveries, this);
+		}
+		bool await_resume()
+		{
+			return _delivered;
+		}
+	};
+
+	socket_scheduler(torque_socket_handle socket, torque_socket_interface *api)
+	{
+		_socket = socket;
+		_api = api;
+		_acceptors = 0;
+		_requests_head = 0;
+		_resuming = false;
+		_event_handler = 0;
+		_event_handler_data = 0;
+	}
+
+	/// Destroys the coroutines still waiting on the scheduler.  Their frames are unwound as if they had returned, so objects they hold are destroyed.
+	~socket_scheduler()
+	{
+		std::vector<std::coroutine_handle<> > handles;
+		for(waiter *walk = _acceptors; walk; walk = walk->next)
+			handles.push_back(walk->handle);
+		for(std::unordered_map<torque_connection_id, connection_state>::iterator i = _connections.begin(); i != _connections.end(); i++)
+		{
+			waiter *lists[3] = { i->second.establishing, i->second.receivers, i->second.deliveries };
+			for(unsigned j = 0; j < 3; j++)
+				for(waiter *walk = lists[j]; walk; walk = walk->next)
+					handles.push_back(walk->handle);
+		}
+		_acceptors = 0;
+		_connections.clear();
+		for(size_t i = 0; i < handles.size(); i++)
+			handles[i].destroy();
+	}
+
+	torque_socket_handle get_socket()
+	{
+		return _socket;
+	}
+
+	torque_socket_interface *get_interface()
+	{
+		return _api;
+	}
+
+	/// Sets a function to receive the events no coroutine waits for.  The event is only valid for the duration of the call.
+	void set_event_handler(void (*handler)(torque_socket_event *event, void *data), void *data)
+	{
+		_event_handler = handler;
+		_event_handler_data = data;
+	}
+
+	/// Opens a connection to remote_host, accepting the host's challenge response, and completes when the connection is established or fails.
+	connect_awaiter connect(struct sockaddr *remote_host, unsigned connect_data_size, unsigned char *connect_data)
+	{
+		return connect_awaiter(this, remote_host, connect_data_size, connect_data);
+	}
+
+	/// Accepts the next incoming connection request and completes when the connection is established, or fails if the request times out first.  The socket must allow incoming connections.
+	accept_awaiter accept()
+	{
+		return accept_awaiter(this);
+	}
+
+	/// Completes with the next data packet received on the connection, or an empty packet once it has closed.  Packets that arrive while no coroutine is receiving are queued.
+	receive_awaiter receive(torque_connection_id connection)
+	{
+		return receive_awaiter(this, connection);
+	}
+
+	/// Completes with whether the packet sent with the given sequence number (as returned by send_to_connection) was delivered.  Completes false at once if the connection isn't established, and false for every packet still in flight when it closes.
+	delivery_awaiter delivered(torque_connection_id connection, int sequence)
+	{
+		return delivery_awaiter(this, connection, sequence);
+	}
+
+	/// Closes a connection and completes the coroutines waiting on it as if the remote host had closed it.
+	void close(torque_connection_id connection, unsigned disconnect_data_size = 0, unsigned char *disconnect_data = 0)
+	{
+		_api->close_connection(_socket, connection, disconnect_data_size, disconnect_data);
+		_closed(connection, torque_reason_disconnect_call, 0);
+		_resume_ready();
+	}
+
+	/// Processes every event waiting on the socket, resuming the coroutines they complete.  Call it from the application's main loop, or whenever the socket's notify function signals.  Returns the number of events processed.
+	unsigned poll()
+	{
+		unsigned count = 0;
+		while(torque_socket_event *event = _api->get_next_event(_socket))
+		{
+			_dispatch(event);
+			_resume_ready();
+			count++;
+		}
+		return count;
+	}
+private:
+	torque_socket_handle _socket;
+	torque_socket_interface *_api;
+	std::unordered_map<torque_connection_id, connection_state> _connections;
+	waiter *_acceptors; ///< accept_awaiters waiting for a connection request, oldest first.
+	std::vector<torque_connection_id> _requests; ///< Connection requests no accept_awaiter has taken yet.
+	size_t _requests_head;
+	std::vector<std::coroutine_handle<> > _ready; ///< Coroutines to resume once the current event has been dispatched.
+	bool _resuming; ///< True while _ready is being worked through.
+	void (*_event_handler)(torque_socket_event *event, void *data);
+	void *_event_handler_data;
+
+	connection_state *_find(torque_connection_id connection)
+	{
+		std::unordered_map<torque_connection_id, connection_state>::iterator i = _connections.find(connection);
+		return i == _connections.end() ? 0 : &i->second;
+	}
+
+	static void _append(waiter *&list, waiter *w)
+	{
+		waiter **walk = &list;
+		while(*walk)
+			walk = &(*walk)->next;
+		*walk = w;
+	}
+
+	static waiter *_pop(waiter *&list)
+	{
+		waiter *w = list;
+		if(w)
+			list = w->next;
+		return w;
+	}
+
+	void _accept(torque_connection_id connection, accept_awaiter *acceptor)
+	{
+		_api->accept_connection(_socket, connection);
+		_connections[connection].establishing = acceptor;
+	}
+
+	/// Completes every coroutine waiting on a connection that has closed or failed to open, and forgets the connection.  Returns false if the scheduler didn't know of the connection.
+	bool _closed(torque_connection_id connection, unsigned reason, unsigned retry_after)
+	{
+		for(size_t i = _requests_head; i < _requests.size(); i++)
+		{
+			if(_requests[i] == connection)
+			{
+				_requests.erase(_requests.begin() + i);
+				return true;
+			}
+		}
+		connection_state *state = _find(connection);
+		if(!state)
+			return false;
+		if(state->establishing)
+		{
+			state->establishing->result.reason = reason;
+			state->establishing->result.retry_after = retry_after;
+			_ready.push_back(state->establishing->handle);
+		}
+		while(waiter *w = _pop(state->receivers))
+			_ready.push_back(w->handle);
+		while(waiter *w = _pop(state->deliveries))
+			_ready.push_back(w->handle);
+		_connections.erase(connection);
+		return true;
+	}
+
+	void _dispatch(torque_socket_event *event)
+	{
+		torque_connection_id connection = event->connection;
+		switch(event->event_type)
+		{
+			case torque_connection_challenge_response_event_type:
+				if(_find(connection))
+				{
+					_api->accept_challenge(_socket, connection);
+					return;
+				}
+				break;
+			case torque_connection_requested_event_type:
+				if(accept_awaiter *acceptor = static_cast<accept_awaiter *>(_pop(_acceptors)))
+					_accept(connection, acceptor);
+				else
+				{
+					if(_requests_head == _requests.size())
+					{
+						_requests.clear();
+						_requests_head = 0;
+					}
+					_requests.push_back(connection);
+				}
+				return;
+			case torque_connection_established_event_type:
+				if(connection_state *state = _find(connection))
+				{
+					state->established = true;
+					if(state->establishing)
+					{
+						state->establishing->result.connection = connection;
+						_ready.push_back(state->establishing->handle);
+						state->establishing = 0;
+					}
+					return;
+				}
+				break;
+			case torque_connection_timed_out_event_type:
+			case torque_connection_disconnected_event_type:
+				if(_closed(connection, event->reason, event->retry_after))
+					return;
+				break;
+			case torque_connection_packet_event_type:
+				if(connection_state *state = _find(connection))
+				{
+					packet p(_api, _api->retain_event_data(_socket, event), event->data_size, event->packet_sequence);
+					if(receive_awaiter *receiver = static_cast<receive_awaiter *>(_pop(state->receivers)))
+					{
+						receiver->_result = static_cast<packet &&>(p);
+						_ready.push_back(receiver->handle);
+					}
+					else
+						state->received.push_back(static_cast<packet &&>(p));
+					return;
+				}
+				break;
+			case torque_connection_packet_notify_event_type:
+				if(connection_state *state = _find(connection))
+				{
+					for(waiter **walk = &state->deliveries; *walk; walk = &(*walk)->next)
+					{
+						delivery_awaiter *delivery = static_cast<delivery_awaiter *>(*walk);
+						if(delivery->_sequence == event->packet_sequence)
+						{
+							delivery->_delivered = event->delivered != 0;
+							*walk = delivery->next;
+							_ready.push_back(delivery->handle);
+							break;
+						}
+					}
+					return;
+				}
+				break;
+		}
+		if(_event_handler)
+			_event_handler(event, _event_handler_data);
+	}
+
+	void _resume_ready()
+	{
+		// resumed coroutines can make more coroutines ready (by calling close), which are appended and resumed by the loop already running.
+		if(_resuming)
+			return;
+		_resuming = true;
+		for(size_t i = 0; i < _ready.size(); i++)
+			_ready[i].resume();
+		_ready.clear();
+		_resuming = false;
+	}
+};
+
+};
@@ -3,15 +3,25 @@
 #include "nonce.h"
 #include "random_generator.h"
 #include "symmetric_cipher.h"
+#include "sha256.h"
+#include "fixed_ecc.h"
 #include "asymmetric_key.h"
 #include "buffer_utils.h"
 #include "time.h"
+#include "time_source.h"
 #include "address.h"
+#include "packet_capture.h"
 #include "udp_socket.h"
 #include "sockets.h"
 #include "packet_stream.h"
 #include "client_puzzle.h"
 #include "pending_connection.h"
 #include "socket_event_queue.h"
+#include "packet_flight_recorder.h"
+#include "latency_histogram.h"
+#include "link_emulator.h"
+#include "server_probe.h"
+#include "bulk_transfer.h"
 #include "torque_socket.h"
 #include "torque_connection.h"
+#include "simulated_network.h"
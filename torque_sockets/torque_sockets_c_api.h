@@ -26,6 +26,22 @@ enum torque_socket_event_type
 	torque_connection_packet_event_type,
 	torque_connection_packet_notify_event_type,
 	torque_socket_packet_event_type,
+	torque_socket_probe_results_event_type, ///< A round of probes started with probe is complete.  data holds a torque_socket_probe_result for each address probed, in the order given.
+	torque_connection_bulk_offer_event_type, ///< The remote host wants to send a file with send_bulk_transfer.  data holds the name it gave and transfer_size the file's size.  Answer with accept_bulk_transfer.
+	torque_connection_bulk_complete_event_type, ///< The bulk transfer in progress on the connection is over, on either side.  delivered is 1 if the whole file arrived, 0 if the receiver refused it or a newer offer replaced it; transfer_size is the file's size.
+};
+
+/// Why a remote host closed or refused a connection, in the reason field of a torque_connection_disconnected_event_type event.
+enum torque_connection_disconnect_reason
+{
+	torque_reason_failed_puzzle, ///< The client puzzle solution was wrong twice.
+	torque_reason_self_disconnect, ///< The host replaced the connection with a new one from the same address.
+	torque_reason_shutdown,
+	torque_reason_reconnecting,
+	torque_reason_disconnect_call, ///< The remote application closed the connection.
+	torque_reason_server_full, ///< Refused by the host's admission policy: it has as many connections as it allows.
+	torque_reason_too_many_pending, ///< Refused by the host's admission policy: too many connection requests are waiting for its application to accept them.
+	torque_reason_none, ///< The event wasn't caused by the remote host closing or refusing the connection.
 };
 
 enum bind_result
@@ -52,6 +68,109 @@ struct torque_socket_event
 	unsigned packet_sequence;
 	int delivered;
 	struct sockaddr source_address;
+	long long arrival_time; ///< Time, in microseconds on the socket's clock (see get_time), that the datagram which caused this event arrived.  Uses the kernel receive timestamp when the platform supports it.  0 for events not caused by a received datagram (timeouts).
+	unsigned reason; ///< For torque_connection_disconnected_event_type, the torque_connection_disconnect_reason given by the remote host; torque_reason_none otherwise.
+	unsigned retry_after; ///< For a connection refused by the host's admission policy, the milliseconds the host asked the client to wait before trying again; 0 if it gave no hint.
+	unsigned long long transfer_size; ///< For the bulk transfer events, the size in bytes of the file being transferred.
+};
+
+/// Internal latency measurements kept by each socket, readable with get_latency_stats.  All are in microseconds.
+enum torque_socket_latency_stat
+{
+	torque_latency_arrival_to_process, ///< Datagram arrival (kernel timestamp where available) to the start of its processing.
+	torque_latency_process_to_dequeue, ///< Start of processing a datagram to each resulting event being returned by get_next_event.
+	torque_latency_arrival_to_dequeue, ///< Datagram arrival to each resulting event being returned by get_next_event.
+	torque_latency_handshake_challenge, ///< Initiator: challenge request sent to challenge response received.
+	torque_latency_handshake_challenge_accept, ///< Initiator: challenge response received to the application calling accept_challenge.
+	torque_latency_handshake_puzzle, ///< Initiator: accept_challenge to the puzzle solution being sent in the connect request.
+	torque_latency_handshake_connect, ///< Initiator: connect request sent to connect accept received.
+	torque_latency_handshake_local_accept, ///< Host: connect request received to the application calling accept_connection.
+	torque_latency_puzzle_solve, ///< Time the puzzle solver thread spent solving a client puzzle.
+	torque_latency_ecdh, ///< Time to compute an ECDH shared secret during the handshake.
+	torque_latency_stat_count,
+};
+
+struct torque_socket_latency_summary
+{
+	unsigned count; ///< Number of samples recorded.
+	unsigned min;
+	unsigned mean;
+	unsigned p50;
+	unsigned p99;
+	unsigned p999;
+	unsigned max;
+};
+
+struct torque_socket_latency
+{
+	unsigned round_trip_time; ///< Smoothed network round trip time of the connection in microseconds, measured from kernel receive timestamps so it doesn't include time packets spent queued in this process.  0 until a sample has been taken.
+	unsigned queueing_delay_count; ///< Number of events measured for the queueing delay figures below.
+	unsigned queueing_delay_p50; ///< Median time, in microseconds, from datagram arrival to the resulting event being returned by get_next_event.
+	unsigned queueing_delay_p99; ///< 99th percentile queueing delay in microseconds.
+	unsigned queueing_delay_max; ///< Largest queueing delay seen in microseconds.
+	int kernel_timestamps; ///< Nonzero if arrival times come from the kernel; otherwise they're taken when the datagram is read, and the queueing delay only covers time spent inside torque sockets.
+};
+
+/// Directions of an emulated link, for set_link_profile and get_link_stats.
+enum torque_socket_link_direction
+{
+	torque_link_outgoing,
+	torque_link_incoming,
+};
+
+enum torque_socket_link_jitter
+{
+	torque_link_jitter_uniform, ///< Delay varies evenly between latency - jitter and latency + jitter.
+	torque_link_jitter_normal, ///< Delay is normally distributed around latency, with jitter as the standard deviation.
+	torque_link_jitter_pareto, ///< Delay is latency plus a heavy tailed extra delay averaging jitter.
+};
+
+/// How the data packets of a connection are protected, for set_integrity_mode.
+enum torque_socket_integrity_mode
+{
+	torque_integrity_cipher, ///< Packets are protected with the keys exchanged in the connection handshake.  The default.
+	torque_integrity_crc32c, ///< Packets only carry a CRC32C to detect corruption, and are neither encrypted nor signed.  For trusted networks.
+	torque_integrity_mode_count,
+};
+
+/// Emulated network conditions for one direction of a socket or connection, for testing over a LAN or a single computer.  Times are in microseconds and probabilities are from 0 to 1.
+struct torque_socket_link_profile
+{
+	unsigned latency; ///< One way delay added to every packet.
+	unsigned jitter; ///< Amount of random variation in the delay.
+	unsigned distribution; ///< torque_socket_link_jitter distribution of the variation.
+	float reorder; ///< Probability that a packet skips the delay and overtakes the packets in flight.
+	float duplicate; ///< Probability that a packet is delivered twice.
+	float loss; ///< Probability of losing a packet (outside of a loss burst).
+	float burst_loss; ///< Probability of losing a packet during a loss burst.
+	float burst_enter; ///< Per packet probability of a loss burst starting.
+	float burst_exit; ///< Per packet probability of a loss burst ending.
+	unsigned bandwidth; ///< Link rate in bytes per second, or 0 for unlimited.
+	unsigned queue_limit; ///< Bytes that can queue for the link before packets are dropped, or 0 for unlimited.
+};
+
+struct torque_socket_link_stats
+{
+	unsigned packets; ///< Packets offered to the link.
+	unsigned lost; ///< Packets dropped by random or burst loss.
+	unsigned queue_dropped; ///< Packets dropped because the bandwidth queue was full.
+	unsigned duplicated; ///< Extra copies delivered.
+	unsigned reordered; ///< Packets that skipped the delay.
+	unsigned burst_count; ///< Number of loss bursts.
+};
+
+/// Round trip time to one address, in the data of a torque_socket_probe_results_event_type event.
+struct torque_socket_probe_result
+{
+	struct sockaddr address;
+	int round_trip_time; ///< Microseconds from the probe being sent to the reply arriving, or -1 if there was no reply.
+};
+
+/// Counters for one info packet type answered from a response set with set_info_response.
+struct torque_socket_info_response_stats
+{
+	unsigned hits; ///< Queries answered.
+	unsigned rate_limited; ///< Queries dropped because their source address was over the rate limit.
 };
 
 struct torque_socket_interface
@@ -86,6 +205,58 @@ struct torque_socket_interface
 	
 	void (*close_connection)(torque_socket_handle, torque_connection_id, unsigned disconnect_data_size, unsigned char *disconnect_data); ///< Close an open connection or rejects a pending connection
 	
-	int (*send_to_connection)(torque_socket_handle, torque_connection_id, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size]); ///< Send a datagram packet to the remote host on the other side of the connection.  Returns the sequence number of the packet sent.
-	struct torque_socket_event *(*get_next_event)(torque_socket_handle); ///< Gets the next event on this socket; returns NULL if there are no events to be read.
+	int (*send_to_connection)(torque_socket_handle, torque_connection_id, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size]); ///< Send a datagram packet to the remote host on the other side of the connection.  Returns the sequence number of the packet sent, or -1 if the connection isn't valid or the datagram doesn't fit with the packet header and the connection's CRC.
+	struct torque_socket_event *(*get_next_event)(torque_socket_handle); ///< Gets the next event on this socket; returns NULL if there are no events to be read.  The event, its key and its data are valid until the next call; use retain_event_data to keep the data longer.
+	
+	int (*set_trace_enabled)(int enabled); ///< Starts or stops recording pipeline tracing spans for all sockets.  Returns 0 if the library was built without TORQUE_SOCKETS_ENABLE_TRACE.
+	
+	int (*write_trace)(const char *file_name); ///< Writes the spans recorded since tracing was enabled to file_name as Chrome trace event JSON, viewable in chrome://tracing or ui.perfetto.dev.  Returns 0 on failure or if tracing is not compiled in.
+	
+	unsigned (*get_flight_record)(torque_socket_handle, torque_connection_id, unsigned buffer_size, unsigned char *buffer); ///< Writes the packet flight recorder dump (the recent packet header history) of the connection into buffer.  Returns the number of bytes written, or the size required if buffer is NULL or too small.  Dumps can be printed as a timeline with the flight_recorder_decode tool.
+	
+	long long (*get_time)(torque_socket_handle); ///< Returns the current time of the socket's clock in microseconds.  The clock is monotonic and starts out at the wall clock time (microseconds since January 1, 1970) when the socket is created.
+	
+	void (*get_latency)(torque_socket_handle, torque_connection_id, struct torque_socket_latency *latency); ///< Reports the network round trip time of the connection separately from this socket's internal queueing delay.  The queueing delay figures cover all events on the socket; round_trip_time is 0 if the connection id isn't valid.
+	
+	int (*get_latency_stats)(torque_socket_handle, unsigned stat, struct torque_socket_latency_summary *summary); ///< Fills in summary with the samples recorded for one of the torque_socket_latency_stat measurements.  Returns 0 if stat isn't valid.
+	
+	void (*reset_latency_stats)(torque_socket_handle); ///< Clears all the latency measurements on the socket.
+	
+	void (*set_puzzle_difficulty)(torque_socket_handle, unsigned difficulty); ///< Sets the number of zero bits the client puzzle solution hash must start with for hosts connecting to this socket.  Each extra bit doubles the average work a connecting host does; 0 disables the puzzle.  Defaults to 17, and is clamped to 26.
+	
+	int (*set_link_profile)(torque_socket_handle, torque_connection_id connection, unsigned direction, struct torque_socket_link_profile *profile); ///< Emulates network conditions for one torque_socket_link_direction of a connection, or of all the socket's traffic (including handshakes) if connection is invalid_torque_connection.  A connection's profile overrides the socket's for that direction.  A NULL profile clears the emulation.  Returns 0 if the connection or direction isn't valid.
+	
+	int (*get_link_stats)(torque_socket_handle, torque_connection_id connection, unsigned direction, struct torque_socket_link_stats *stats); ///< Fills in what the link emulator has done to the packets in one direction of a connection or of the socket.  Returns 0 if the connection or direction isn't valid.
+	
+	int (*start_capture)(torque_socket_handle, const char *capture_file, const char *key_file); ///< Records every datagram the socket sends and receives to a pcap file readable by tcpdump, Wireshark and the replay tool.  If key_file is not NULL, the keys and handshake state needed to replay the socket's side of the capture are written there; anyone holding that file can decrypt the captured sessions.  Returns 0 if either file can't be written.
+	
+	void (*stop_capture)(torque_socket_handle); ///< Stops recording and closes the capture file.
+	
+	int (*set_info_response)(torque_socket_handle, unsigned query_type, unsigned response_size, unsigned char *response, unsigned max_per_second); ///< Sets a response the socket sends, without posting an event, to every info packet (first byte 32 to 127) whose first byte is query_type.  Use it for server browser queries whose answer doesn't depend on the query.  Each source address is sent at most max_per_second responses a second, 0 for no limit.  A NULL response clears the entry.  Returns 0 if query_type isn't an info packet type.
+	
+	int (*get_info_response_stats)(torque_socket_handle, unsigned query_type, struct torque_socket_info_response_stats *stats); ///< Fills in the counters of the response set for query_type.  Returns 0 if query_type isn't an info packet type.
+	
+	int (*probe)(torque_socket_handle, unsigned address_count, struct sockaddr *addresses, unsigned packets_per_second, unsigned timeout); ///< Measures the round trip time to a list of servers, for a server browser.  Probes are paced at packets_per_second (0 sends them all at once) and batched into as few system calls as the platform allows; any torque socket answers them without involving its application.  When every server has replied, or timeout milliseconds after the last probe is sent, one torque_socket_probe_results_event_type event reports all the results.  Returns 0 if a round of probes is already in progress.
+	
+	unsigned (*send_to_connections)(torque_socket_handle, unsigned connection_count, torque_connection_id *connections, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size], int *sequence_numbers); ///< Sends the same datagram packet to every connection in the list, for broadcast traffic.  The datagram is not copied per connection, and the packets are sent with as few system calls as the platform allows.  If sequence_numbers is not NULL it receives the sequence number of each packet sent, or -1 where the connection isn't valid or can't send.  Returns the number of packets sent.
+	
+	unsigned char *(*begin_packet)(torque_socket_handle, torque_connection_id, unsigned *capacity); ///< Starts a datagram packet to the connection that is written directly into the socket's outgoing buffer, saving the copy send_to_connection makes.  Returns a pointer to the payload area and sets capacity to its size, or returns NULL if the connection isn't valid or can't send.  Only one packet can be in progress on a socket.
+	
+	int (*commit_packet)(torque_socket_handle, unsigned datagram_size, unsigned *sequence_number); ///< Sends the packet started by begin_packet, with the first datagram_size bytes of the payload area as its payload.  Returns 0, and sends nothing, if no packet is in progress, datagram_size exceeds the capacity, or the connection can no longer send.
+
+	int (*set_integrity_mode)(torque_socket_handle, unsigned mode); ///< Sets the torque_socket_integrity_mode this socket asks for when it connects and allows when it accepts.  A new connection uses torque_integrity_crc32c only if both ends have set it; otherwise it falls back to torque_integrity_cipher.  Connections already open keep their mode.  Returns 0 if mode isn't valid, or is torque_integrity_crc32c on a socket that requires key exchange.
+
+	void (*set_requires_key_exchange)(torque_socket_handle, int required); ///< Requires every connection on this socket to be protected with the keys exchanged in its handshake.  This sets the integrity mode back to torque_integrity_cipher and refuses torque_integrity_crc32c while it is set.
+
+	void (*set_admission_policy)(torque_socket_handle, unsigned max_connections, unsigned max_pending, unsigned retry_after); ///< Limits the incoming connections this socket takes on.  max_connections caps the open connections plus the requests waiting for accept_connection; max_pending caps just the waiting requests.  0 is no limit.  A host over either limit refuses a challenge request at once, before handing out a puzzle or doing any key exchange, with a reject carrying the reason and retry_after, in milliseconds, as a hint to the client.
+
+	unsigned char *(*retain_event_data)(torque_socket_handle, struct torque_socket_event *event); ///< Keeps the data of an event from get_next_event valid past the next get_next_event call, which otherwise reclaims it, without copying it.  Returns event->data, or NULL if the event has no data; the event's key is not kept.  Each call must be matched by a release_event_data.
+
+	void (*release_event_data)(unsigned char *data); ///< Releases data kept by retain_event_data.  May be called from any thread, and after the socket is destroyed.
+
+	int (*send_bulk_transfer)(torque_socket_handle, torque_connection_id connection, const char *file_path, const char *name, unsigned max_bytes_per_second); ///< Starts sending the file at file_path over the connection, alongside its datagrams, by offering it to the remote host as name (at most 255 bytes).  The file is memory mapped and streamed in sequenced packets that never take the last few slots of the connection's packet window, and lost pieces are sent again until the remote host has every one.  max_bytes_per_second caps the transfer's rate; 0 leaves it limited by the window alone.  A torque_connection_bulk_complete_event_type event reports the end of the transfer.  Returns 0 if the connection is already sending a file, or the file can't be opened or mapped.
+
+	int (*accept_bulk_transfer)(torque_socket_handle, torque_connection_id connection, const char *file_path); ///< Answers the offer of a torque_connection_bulk_offer_event_type event: the file is received into file_path, which is created at its full size and memory mapped, or refused if file_path is NULL.  A torque_connection_bulk_complete_event_type event reports when it has all arrived.  Returns 0, and refuses the offer, if the file can't be created; returns 0 also if no offer is waiting.
+
+	int (*set_zerocopy_threshold)(torque_socket_handle, unsigned min_datagram_size); ///< Sends datagrams of at least min_datagram_size bytes built with begin_packet without the kernel copying them (Linux MSG_ZEROCOPY): begin_packet hands out pinned, pooled buffers, which return to the pool when the kernel reports it has sent from them.  0 turns zero-copy sends off, which is the default.  Zero-copy only pays off for large datagrams on routes that can send straight from user memory; on loopback the kernel copies anyway and it's slower at every size.  Call after bind.  Returns 0 if the platform can't send zero-copy.
 };
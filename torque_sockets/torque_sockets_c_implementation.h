@@ -88,15 +88,169 @@ void torque_socket_close_connection(torque_socket_handle the_socket, torque_conn
 int torque_socket_send_to_connection(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size])
 {
 	unsigned sequence;
-	((core::net::torque_socket *) the_socket)->send_to_connection(connection_id, buffer, datagram_size, &sequence);
+	if(!((core::net::torque_socket *) the_socket)->send_to_connection(connection_id, buffer, datagram_size, &sequence))
+		return -1;
 	return sequence;
 }
 
+unsigned torque_socket_send_to_connections(torque_socket_handle the_socket, unsigned connection_count, torque_connection_id *connections, unsigned datagram_size, unsigned char buffer[torque_sockets_max_datagram_size], int *sequence_numbers)
+{
+	return ((core::net::torque_socket *) the_socket)->send_to_connections(connections, connection_count, buffer, datagram_size, sequence_numbers);
+}
+
+unsigned char *torque_socket_begin_packet(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned *capacity)
+{
+	core::bit_stream *stream = ((core::net::torque_socket *) the_socket)->begin_packet(connection_id);
+	if(!stream)
+		return 0;
+	*capacity = stream->get_stream_byte_size();
+	return stream->get_buffer();
+}
+
+int torque_socket_commit_packet(torque_socket_handle the_socket, unsigned datagram_size, unsigned *sequence_number)
+{
+	core::net::torque_socket *s = (core::net::torque_socket *) the_socket;
+	core::bit_stream *stream = s->get_packet_in_progress();
+	if(stream && datagram_size > stream->get_stream_byte_size())
+		stream->raise_error();
+	else if(stream)
+		stream->set_byte_position(datagram_size);
+	return s->commit_packet(sequence_number);
+}
+
+int torque_socket_set_integrity_mode(torque_socket_handle the_socket, unsigned mode)
+{
+	return ((core::net::torque_socket *) the_socket)->set_integrity_mode(mode);
+}
+
+void torque_socket_set_admission_policy(torque_socket_handle the_socket, unsigned max_connections, unsigned max_pending, unsigned retry_after)
+{
+	((core::net::torque_socket *) the_socket)->set_admission_policy(max_connections, max_pending, retry_after);
+}
+
+void torque_socket_set_requires_key_exchange(torque_socket_handle the_socket, int required)
+{
+	((core::net::torque_socket *) the_socket)->set_requires_key_exchange(required != 0);
+}
+
 struct torque_socket_event *torque_socket_get_next_event(torque_socket_handle the_socket)
 {
 	return ((core::net::torque_socket *) the_socket)->get_next_event();
 }
 
+unsigned char *torque_socket_retain_event_data(torque_socket_handle the_socket, struct torque_socket_event *event)
+{
+	return ((core::net::torque_socket *) the_socket)->retain_event_data(event);
+}
+
+void torque_socket_release_event_data(unsigned char *data)
+{
+	core::net::torque_socket::release_event_data(data);
+}
+
+int torque_socket_send_bulk_transfer(torque_socket_handle the_socket, torque_connection_id connection_id, const char *file_path, const char *name, unsigned max_bytes_per_second)
+{
+	return ((core::net::torque_socket *) the_socket)->send_bulk_transfer(connection_id, file_path, name, max_bytes_per_second);
+}
+
+int torque_socket_accept_bulk_transfer(torque_socket_handle the_socket, torque_connection_id connection_id, const char *file_path)
+{
+	return ((core::net::torque_socket *) the_socket)->accept_bulk_transfer(connection_id, file_path);
+}
+
+int torque_socket_set_zerocopy_threshold(torque_socket_handle the_socket, unsigned min_datagram_size)
+{
+	return ((core::net::torque_socket *) the_socket)->set_zerocopy_threshold(min_datagram_size);
+}
+
+unsigned torque_socket_get_flight_record(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned buffer_size, unsigned char *buffer)
+{
+	return ((core::net::torque_socket *) the_socket)->get_flight_record(connection_id, buffer, buffer_size);
+}
+
+long long torque_socket_get_time(torque_socket_handle the_socket)
+{
+	return ((core::net::torque_socket *) the_socket)->get_time_source().read_microseconds();
+}
+
+void torque_socket_get_latency(torque_socket_handle the_socket, torque_connection_id connection_id, struct torque_socket_latency *latency)
+{
+	((core::net::torque_socket *) the_socket)->get_latency(connection_id, latency);
+}
+
+int torque_socket_get_latency_stats(torque_socket_handle the_socket, unsigned stat, struct torque_socket_latency_summary *summary)
+{
+	return ((core::net::torque_socket *) the_socket)->get_latency_stats(stat, summary);
+}
+
+void torque_socket_reset_latency_stats(torque_socket_handle the_socket)
+{
+	((core::net::torque_socket *) the_socket)->reset_latency_stats();
+}
+
+void torque_socket_set_puzzle_difficulty(torque_socket_handle the_socket, unsigned difficulty)
+{
+	((core::net::torque_socket *) the_socket)->set_puzzle_difficulty(difficulty);
+}
+
+int torque_socket_set_link_profile(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned direction, struct torque_socket_link_profile *profile)
+{
+	return ((core::net::torque_socket *) the_socket)->set_link_profile(connection_id, direction, profile);
+}
+
+int torque_socket_get_link_stats(torque_socket_handle the_socket, torque_connection_id connection_id, unsigned direction, struct torque_socket_link_stats *stats)
+{
+	return ((core::net::torque_socket *) the_socket)->get_link_stats(connection_id, direction, stats);
+}
+
+int torque_socket_start_capture(torque_socket_handle the_socket, const char *capture_file, const char *key_file)
+{
+	return ((core::net::torque_socket *) the_socket)->start_capture(capture_file, key_file);
+}
+
+void torque_socket_stop_capture(torque_socket_handle the_socket)
+{
+	((core::net::torque_socket *) the_socket)->stop_capture();
+}
+
+int torque_socket_set_info_response(torque_socket_handle the_socket, unsigned query_type, unsigned response_size, unsigned char *response, unsigned max_per_second)
+{
+	return ((core::net::torque_socket *) the_socket)->set_info_response(query_type, response, response_size, max_per_second);
+}
+
+int torque_socket_get_info_response_stats(torque_socket_handle the_socket, unsigned query_type, struct torque_socket_info_response_stats *stats)
+{
+	return ((core::net::torque_socket *) the_socket)->get_info_response_stats(query_type, stats);
+}
+
+int torque_socket_probe(torque_socket_handle the_socket, unsigned address_count, struct sockaddr *addresses, unsigned packets_per_second, unsigned timeout)
+{
+	core::array<core::net::address> probe_addresses;
+	probe_addresses.resize(address_count);
+	for(unsigned i = 0; i < address_count; i++)
+		probe_addresses[i].from_sockaddr(addresses[i]);
+	return ((core::net::torque_socket *) the_socket)->probe(probe_addresses.begin(), address_count, packets_per_second, timeout);
+}
+
+int torque_socket_set_trace_enabled(int enabled)
+{
+#if defined(TORQUE_SOCKETS_ENABLE_TRACE)
+	core::trace_set_enabled(enabled != 0);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+int torque_socket_write_trace(const char *file_name)
+{
+#if defined(TORQUE_SOCKETS_ENABLE_TRACE)
+	return core::trace_write_chrome_json(file_name);
+#else
+	return 0;
+#endif
+}
+
 torque_socket_interface g_torque_socket_interface =
 {
 	torque_socket_create,
@@ -116,4 +270,30 @@ torque_socket_interface g_torque_socket_interface =
 	torque_socket_close_connection,
 	torque_socket_send_to_connection,
 	torque_socket_get_next_event,
+	torque_socket_set_trace_enabled,
+	torque_socket_write_trace,
+	torque_socket_get_flight_record,
+	torque_socket_get_time,
+	torque_socket_get_latency,
+	torque_socket_get_latency_stats,
+	torque_socket_reset_latency_stats,
+	torque_socket_set_puzzle_difficulty,
+	torque_socket_set_link_profile,
+	torque_socket_get_link_stats,
+	torque_socket_start_capture,
+	torque_socket_stop_capture,
+	torque_socket_set_info_response,
+	torque_socket_get_info_response_stats,
+	torque_socket_probe,
+	torque_socket_send_to_connections,
+	torque_socket_begin_packet,
+	torque_socket_commit_packet,
+	torque_socket_set_integrity_mode,
+	torque_socket_set_requires_key_exchange,
+	torque_socket_set_admission_policy,
+	torque_socket_retain_event_data,
+	torque_socket_release_event_data,
+	torque_socket_send_bulk_transfer,
+	torque_socket_accept_bulk_transfer,
+	torque_socket_set_zerocopy_threshold,
 };
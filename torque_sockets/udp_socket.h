@@ -1,5 +1,11 @@
 // Copyright Mark Frohnmayer and GarageGames.  See /license/info.txt in this distribution for licensing terms.
 
+class simulated_network;
+
+#if defined(PLATFORM_LINUX) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define UDP_SOCKET_ZEROCOPY
+#endif
+
 class udp_socket
 {
 public:
@@ -9,11 +15,20 @@ public:
 		default_recv_buffer_size = 32768,
 		max_datagram_size = 1536, ///< some routers have issues with packets larger than this
 		recommended_datagram_size = 512,
+		send_buffer_count = 256, ///< Pooled buffers for zero-copy sends.  A power of two, since completion ids index a ring of this size.
 	};
 	
 	udp_socket()
 	{
 		_socket = INVALID_SOCKET;
+		_kernel_timestamps = false;
+		_network = 0;
+		_capture = 0;
+		_zerocopy_threshold = 0;
+		_send_buffers = 0;
+		_free_send_buffer_count = 0;
+		_zerocopy_in_kernel = 0;
+		_next_zerocopy_id = 0;
 	}
 
 	~udp_socket()
@@ -76,6 +91,13 @@ public:
 			unbind();
 			return generic_failure;
 		}
+		// have the kernel timestamp incoming datagrams, so that time a packet spends waiting to be read isn't counted as network latency.
+		int32 enable_timestamps = 1;
+		#if defined(SO_TIMESTAMPNS)
+		_kernel_timestamps = setsockopt(_socket, SOL_SOCKET, SO_TIMESTAMPNS, (char *) &enable_timestamps, sizeof(enable_timestamps)) != SOCKET_ERROR;
+		#elif defined(SO_TIMESTAMP) && !defined(PLATFORM_WIN32)
+		_kernel_timestamps = setsockopt(_socket, SOL_SOCKET, SO_TIMESTAMP, (char *) &enable_timestamps, sizeof(enable_timestamps)) != SOCKET_ERROR;
+		#endif
 		if(recv_timeout != 0)
 		{
 			logprintf("udpsocket set recv timeout to %d", int(recv_timeout.get_milliseconds()));
@@ -94,8 +116,25 @@ public:
 		return bind_success;
 	}
 
+	/// Binds this socket to an address on a simulated_network instead of the host's network stack.  Datagrams sent from it are delivered by the network's scheduler, and received datagrams are stamped with the network's virtual clock.
+	bind_result bind_simulated(simulated_network *network, const address &bind_address)
+	{
+		unbind();
+		if(!network->_attach_socket(bind_address))
+			return address_in_use;
+		_network = network;
+		_simulated_address = bind_address;
+		return bind_success;
+	}
+
 	void unbind()
 	{
+		_release_send_buffers();
+		if(_network)
+		{
+			_network->_detach_socket(_simulated_address);
+			_network = 0;
+		}
 		if(_socket != INVALID_SOCKET)
 		{
 			closesocket(_socket);
@@ -105,6 +144,8 @@ public:
 
 	address get_bound_address()
 	{
+		if(_network)
+			return _simulated_address;
 		SOCKADDR sockaddr;
 		socklen_t address_size = sizeof(sockaddr);
 		getsockname(_socket, &sockaddr, &address_size);
@@ -115,7 +156,25 @@ public:
 
 	bool is_bound()
 	{
-		return _socket != INVALID_SOCKET;
+		return _socket != INVALID_SOCKET || _network;
+	}
+
+	/// Records every datagram sent and received on this socket to capture, or stops recording if capture is NULL.
+	void set_capture(packet_capture *capture)
+	{
+		_capture = capture;
+	}
+
+	/// Returns the simulated_network this socket is bound to, or NULL if it's a real socket.
+	simulated_network *get_simulated_network()
+	{
+		return _network;
+	}
+
+	/// Returns true if the kernel is timestamping received datagrams; otherwise arrival times are taken when recv_from reads the packet.
+	bool has_kernel_timestamps()
+	{
+		return _kernel_timestamps;
 	}
 
 	enum send_to_result
@@ -125,15 +184,290 @@ public:
 	};
 	send_to_result send_to(const address &the_address, const byte *buffer, uint32 buffer_size)
 	{
+		TorqueTraceSpan("udp_socket::send_to");
+		if(_capture)
+			_capture->write(_network ? _network->get_time() : time::get_current_microseconds(), get_bound_address(), the_address, buffer, buffer_size);
+		if(_network)
+		{
+			_network->_send(_simulated_address, the_address, buffer, buffer_size);
+			return send_to_success;
+		}
 		logprintf("udp socket sending to %s: %s.", the_address.to_string().c_str(), string((const char *) buffer_encode_base_16(buffer, buffer_size)->get_buffer()).c_str());
 
 		SOCKADDR dest_address;
 		the_address.to_sockaddr(&dest_address);
+		#if defined(UDP_SOCKET_ZEROCOPY)
+		int32 buffer_index = _find_send_buffer(buffer);
+		if(buffer_index != -1)
+		{
+			int32 result = SOCKET_ERROR;
+			if(_is_zerocopy_size(buffer_size))
+			{
+				result = sendto(_socket, (const char *) buffer, int(buffer_size), MSG_ZEROCOPY, &dest_address, sizeof(dest_address));
+				if(result != SOCKET_ERROR)
+				{
+					_send_buffer_in_kernel(buffer_index);
+					return send_to_success;
+				}
+			}
+			// below the threshold, or out of memory for completion notifications (ENOBUFS): copy it after all.
+			if(result == SOCKET_ERROR)
+				result = sendto(_socket, (const char *) buffer, int(buffer_size), 0, &dest_address, sizeof(dest_address));
+			_free_send_buffer(buffer_index);
+			return result == SOCKET_ERROR ? send_to_failure : send_to_success;
+		}
+		#endif
 		if(sendto(_socket, (const char *) buffer, int(buffer_size), 0, &dest_address, sizeof(dest_address)) == SOCKET_ERROR)
 			return send_to_failure;
 		return send_to_success;
 	}
 
+	/// Turns on zero-copy sends for datagrams of at least threshold bytes, or turns them off if threshold is 0.  Call it after bind.  Datagrams built in buffers from get_send_buffer are handed to the kernel with MSG_ZEROCOPY, which pins the buffer and reads the packet straight out of it as it goes out rather than copying it; the buffer returns to the pool when the kernel reports, on the socket's error queue, that it's done with it.  Pinning pages and reading completions costs more than copying a small datagram, so smaller datagrams from the pool are copied as usual.  Where the route can't send from user memory (loopback, or a device without scatter-gather) the kernel copies anyway and zero-copy is pure overhead: products/bench measures zero-copy slower than a copy at every datagram size on loopback.  Returns false if the platform has no MSG_ZEROCOPY or the socket isn't bound.
+	bool set_zerocopy_threshold(uint32 threshold)
+	{
+		#if defined(UDP_SOCKET_ZEROCOPY)
+		if(_network || _socket == INVALID_SOCKET)
+			return false;
+		if(threshold && !_send_buffers)
+		{
+			int enable = 1;
+			if(setsockopt(_socket, SOL_SOCKET, SO_ZEROCOPY, (char *) &enable, sizeof(enable)) == SOCKET_ERROR)
+				return false;
+			void *buffers = mmap(0, send_buffer_count * max_datagram_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(buffers == MAP_FAILED)
+				return false;
+			// locked so sends never have to fault the pages in; it's fine if the process isn't allowed to.
+			mlock(buffers, send_buffer_count * max_datagram_size);
+			_send_buffers = (byte *) buffers;
+			for(uint32 i = 0; i < send_buffer_count; i++)
+			{
+				_send_buffer_state[i] = send_buffer_free;
+				_free_send_buffers[i] = uint16(send_buffer_count - 1 - i);
+			}
+			_free_send_buffer_count = send_buffer_count;
+		}
+		_zerocopy_threshold = threshold;
+		return true;
+		#else
+		return false;
+		#endif
+	}
+
+	/// Returns a buffer of max_datagram_size bytes to build a datagram in, which send_to and send_to_batch send without a copy if it's at least the zero-copy threshold.  Returns NULL if zero-copy sends are off or every buffer is still in use.  The buffer goes back to the socket when it's passed to send_to, send_to_batch or release_send_buffer.
+	byte *get_send_buffer()
+	{
+		if(!_zerocopy_threshold || _zerocopy_threshold > max_datagram_size)
+			return 0;
+		if(_free_send_buffer_count <= send_buffer_count / 2)
+			process_send_completions();
+		if(!_free_send_buffer_count)
+			return 0;
+		uint32 index = _free_send_buffers[--_free_send_buffer_count];
+		_send_buffer_state[index] = send_buffer_held;
+		return _send_buffers + index * max_datagram_size;
+	}
+
+	/// Returns a buffer from get_send_buffer to the pool without sending it.  Does nothing if buffer isn't a pooled buffer, or has already been sent.
+	void release_send_buffer(const byte *buffer)
+	{
+		int32 index = _find_send_buffer(buffer);
+		if(index != -1 && _send_buffer_state[index] == send_buffer_held)
+			_free_send_buffer(index);
+	}
+
+	/// Reads the kernel's reports of finished zero-copy sends from the socket's error queue and returns their buffers to the pool.  get_send_buffer calls this as the pool runs low.  Returns the number of buffers returned.
+	uint32 process_send_completions()
+	{
+		uint32 completed = 0;
+		#if defined(UDP_SOCKET_ZEROCOPY)
+		while(_zerocopy_in_kernel)
+		{
+			uint8 control[128];
+			msghdr message;
+			memset(&message, 0, sizeof(message));
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+			if(recvmsg(_socket, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == SOCKET_ERROR)
+				break;
+			for(cmsghdr *walk = CMSG_FIRSTHDR(&message); walk; walk = CMSG_NXTHDR(&message, walk))
+			{
+				if(walk->cmsg_level != SOL_IP || walk->cmsg_type != IP_RECVERR)
+					continue;
+				sock_extended_err *report = (sock_extended_err *) CMSG_DATA(walk);
+				if(report->ee_origin != SO_EE_ORIGIN_ZEROCOPY || report->ee_errno)
+					continue;
+				// each report covers the sends with completion ids ee_info through ee_data.
+				for(uint32 id = report->ee_info; id != report->ee_data + 1; id++)
+				{
+					uint32 index = _zerocopy_buffers[id & (send_buffer_count - 1)];
+					if(_send_buffer_state[index] != send_buffer_in_kernel)
+						continue;
+					_free_send_buffer(index);
+					_zerocopy_in_kernel--;
+					completed++;
+				}
+			}
+		}
+		#endif
+		return completed;
+	}
+
+	/// Returns true if a datagram of size bytes from the pool is sent zero-copy.
+	bool _is_zerocopy_size(uint32 size)
+	{
+		return _zerocopy_threshold && size >= _zerocopy_threshold;
+	}
+
+	/// Returns the index of the pooled send buffer that data points into, or -1 if it isn't in one.
+	int32 _find_send_buffer(const byte *data)
+	{
+		if(!_send_buffers || data < _send_buffers || data >= _send_buffers + send_buffer_count * max_datagram_size)
+			return -1;
+		return int32((data - _send_buffers) / max_datagram_size);
+	}
+
+	void _free_send_buffer(uint32 index)
+	{
+		_send_buffer_state[index] = send_buffer_free;
+		_free_send_buffers[_free_send_buffer_count++] = uint16(index);
+	}
+
+	/// Notes that the buffer index was just sent zero-copy, taking the kernel's next completion id.
+	void _send_buffer_in_kernel(uint32 index)
+	{
+		_send_buffer_state[index] = send_buffer_in_kernel;
+		_zerocopy_buffers[_next_zerocopy_id++ & (send_buffer_count - 1)] = uint16(index);
+		_zerocopy_in_kernel++;
+	}
+
+	/// Unmaps the send buffer pool.  Buffers the kernel is still sending from stay valid, since it holds its own references to their pages.
+	void _release_send_buffers()
+	{
+		#if defined(UDP_SOCKET_ZEROCOPY)
+		if(_send_buffers)
+			munmap(_send_buffers, send_buffer_count * max_datagram_size);
+		#endif
+		_send_buffers = 0;
+		_zerocopy_threshold = 0;
+		_free_send_buffer_count = 0;
+		_zerocopy_in_kernel = 0;
+		_next_zerocopy_id = 0;
+	}
+
+	/// One datagram for send_to_batch, made of an optional header followed by data, so that a payload shared by many datagrams isn't copied for each one.
+	struct outgoing_datagram
+	{
+		address destination;
+		const byte *header;
+		uint32 header_size;
+		const byte *data;
+		uint32 data_size;
+	};
+
+	enum {
+		max_send_batch = 64, ///< Datagrams handed to the kernel per system call by send_to_batch.
+	};
+
+	/// Returns true if send_to_batch sends d zero-copy: its data is a pooled buffer of at least the threshold, with no separate header.
+	bool _is_zerocopy_datagram(const outgoing_datagram &d)
+	{
+		return !d.header_size && _is_zerocopy_size(d.data_size) && _find_send_buffer(d.data) != -1;
+	}
+
+	/// Sends a list of datagrams.  Where the platform has sendmmsg, each max_send_batch datagrams go to the kernel in a single system call, with the header and data of each gathered from where they are.  Returns the number of datagrams sent; the rest were refused, normally because the socket's send buffer is full.
+	uint32 send_to_batch(const outgoing_datagram *datagrams, uint32 count)
+	{
+		TorqueTraceSpan("udp_socket::send_to_batch");
+		#if defined(PLATFORM_LINUX)
+		if(!_network)
+		{
+			uint32 sent = 0;
+			while(sent < count)
+			{
+				SOCKADDR addresses[max_send_batch];
+				iovec vectors[max_send_batch][2];
+				mmsghdr messages[max_send_batch];
+				uint32 batch_count = count - sent < max_send_batch ? count - sent : max_send_batch;
+				#if defined(UDP_SOCKET_ZEROCOPY)
+				// a system call's datagrams all go zero-copy or none do, so the batch ends where that changes.
+				bool zerocopy = _is_zerocopy_datagram(datagrams[sent]);
+				for(uint32 i = 1; i < batch_count; i++)
+					if(_is_zerocopy_datagram(datagrams[sent + i]) != zerocopy)
+						batch_count = i;
+				#else
+				bool zerocopy = false;
+				#endif
+				for(uint32 i = 0; i < batch_count; i++)
+				{
+					const outgoing_datagram &d = datagrams[sent + i];
+					d.destination.to_sockaddr(&addresses[i]);
+					vectors[i][0].iov_base = (void *) d.header;
+					vectors[i][0].iov_len = d.header_size;
+					vectors[i][1].iov_base = (void *) d.data;
+					vectors[i][1].iov_len = d.data_size;
+					memset(&messages[i], 0, sizeof(messages[i]));
+					messages[i].msg_hdr.msg_name = &addresses[i];
+					messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+					messages[i].msg_hdr.msg_iov = d.header_size ? vectors[i] : vectors[i] + 1;
+					messages[i].msg_hdr.msg_iovlen = d.header_size ? 2 : 1;
+				}
+				int32 result = sendmmsg(_socket, messages, batch_count, zerocopy ? MSG_ZEROCOPY : 0);
+				if(result <= 0 && zerocopy)
+				{
+					// out of memory for completion notifications (ENOBUFS): copy them after all.
+					zerocopy = false;
+					result = sendmmsg(_socket, messages, batch_count, 0);
+				}
+				if(result <= 0)
+					break;
+				if(_capture)
+				{
+					int64 now = time::get_current_microseconds();
+					for(int32 i = 0; i < result; i++)
+					{
+						const outgoing_datagram &d = datagrams[sent + i];
+						_capture->write(now, get_bound_address(), d.destination, d.header, d.header_size, d.data, d.data_size);
+					}
+				}
+				#if defined(UDP_SOCKET_ZEROCOPY)
+				for(int32 i = 0; i < result && _send_buffers; i++)
+				{
+					int32 buffer_index = _find_send_buffer(datagrams[sent + i].data);
+					if(buffer_index == -1)
+						continue;
+					if(zerocopy)
+						_send_buffer_in_kernel(buffer_index);
+					else
+						_free_send_buffer(buffer_index);
+				}
+				#endif
+				sent += uint32(result);
+			}
+			for(uint32 i = sent; i < count && _send_buffers; i++)
+				release_send_buffer(datagrams[i].data);
+			return sent;
+		}
+		#endif
+		uint32 sent = 0;
+		for(uint32 i = 0; i < count; i++)
+		{
+			const outgoing_datagram &d = datagrams[i];
+			const byte *buffer = d.data;
+			uint8 joined[max_datagram_size];
+			if(d.header_size)
+			{
+				if(d.header_size + d.data_size > max_datagram_size)
+					continue;
+				memcpy(joined, d.header, d.header_size);
+				memcpy(joined + d.header_size, d.data, d.data_size);
+				buffer = joined;
+			}
+			if(send_to(d.destination, buffer, d.header_size + d.data_size) == send_to_success)
+				sent++;
+		}
+		return sent;
+	}
+
 	enum recv_from_result
 	{
 		packet_received,
@@ -142,11 +476,46 @@ public:
 		unknown_error,
 	};
 
-	recv_from_result recv_from(address *sender_address, byte *buffer, uint32 buffer_size, uint32 *incoming_packet_size)
+	/// Reads a datagram from the socket.  If arrival_time is not NULL it is set to the time the datagram arrived, in microseconds on the time::get_current_microseconds() clock.
+	recv_from_result recv_from(address *sender_address, byte *buffer, uint32 buffer_size, uint32 *incoming_packet_size, int64 *arrival_time = 0)
 	{
+		TorqueTraceSpan("udp_socket::recv_from");
+		if(_network)
+		{
+			int64 simulated_arrival_time;
+			address simulated_sender;
+			if(!_network->_receive(_simulated_address, &simulated_sender, buffer, buffer_size, incoming_packet_size, &simulated_arrival_time))
+				return would_block_or_timeout;
+			if(_capture)
+				_capture->write(simulated_arrival_time, simulated_sender, _simulated_address, buffer, *incoming_packet_size);
+			if(sender_address)
+				*sender_address = simulated_sender;
+			if(arrival_time)
+				*arrival_time = simulated_arrival_time;
+			return packet_received;
+		}
 		SOCKADDR sender_sockaddr;
+		#if defined(PLATFORM_WIN32)
 		socklen_t addr_len = sizeof(sender_sockaddr);
 		int32 bytes_read = recvfrom(_socket, (char *) buffer, buffer_size, 0, &sender_sockaddr, &addr_len);
+		#else
+		union {
+			cmsghdr align;
+			uint8 buffer[256];
+		} control;
+		iovec data_vector;
+		data_vector.iov_base = buffer;
+		data_vector.iov_len = buffer_size;
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_name = &sender_sockaddr;
+		message.msg_namelen = sizeof(sender_sockaddr);
+		message.msg_iov = &data_vector;
+		message.msg_iovlen = 1;
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+		int32 bytes_read = recvmsg(_socket, &message, 0);
+		#endif
 		//logprintf("recv_from result = %d", errno);
 		if(bytes_read == SOCKET_ERROR)
 		{
@@ -162,8 +531,39 @@ public:
 		}
 		*incoming_packet_size = uint32(bytes_read);
 
+		if(arrival_time)
+		{
+			*arrival_time = 0;
+			#if !defined(PLATFORM_WIN32)
+			for(cmsghdr *walk = CMSG_FIRSTHDR(&message); walk; walk = CMSG_NXTHDR(&message, walk))
+			{
+				if(walk->cmsg_level != SOL_SOCKET)
+					continue;
+				#if defined(SCM_TIMESTAMPNS)
+				if(walk->cmsg_type == SCM_TIMESTAMPNS)
+				{
+					timespec stamp;
+					memcpy(&stamp, CMSG_DATA(walk), sizeof(stamp));
+					*arrival_time = int64(stamp.tv_sec) * 1000000 + stamp.tv_nsec / 1000;
+				}
+				#elif defined(SCM_TIMESTAMP)
+				if(walk->cmsg_type == SCM_TIMESTAMP)
+				{
+					timeval stamp;
+					memcpy(&stamp, CMSG_DATA(walk), sizeof(stamp));
+					*arrival_time = int64(stamp.tv_sec) * 1000000 + stamp.tv_usec;
+				}
+				#endif
+			}
+			#endif
+			if(!*arrival_time)
+				*arrival_time = time::get_current_microseconds();
+		}
+
 		if(sender_address)
 			sender_address->from_sockaddr(sender_sockaddr);
+		if(_capture)
+			_capture->write(arrival_time ? *arrival_time : time::get_current_microseconds(), address(sender_sockaddr), get_bound_address(), buffer, *incoming_packet_size);
 		
 		if(packet_received == udp_socket::packet_received)
 			logprintf("udp socket received from %s: %s.", sender_address->to_string().c_str(), string((const char *) buffer_encode_base_16(buffer, *incoming_packet_size)->get_buffer()).c_str());
@@ -172,6 +572,24 @@ public:
 	}
 private:
 	SOCKET _socket;
+	bool _kernel_timestamps; ///< True if the kernel timestamps datagrams as they arrive.
+	simulated_network *_network; ///< The simulated_network this socket is bound to, if any.
+	packet_capture *_capture; ///< Capture recording this socket's datagrams, if any.
+	address _simulated_address; ///< Address of this socket on its simulated_network.
+
+	enum send_buffer_state {
+		send_buffer_free,
+		send_buffer_held, ///< Handed out by get_send_buffer and not yet sent.
+		send_buffer_in_kernel, ///< Sent zero-copy, and waiting for the kernel's completion.
+	};
+	uint32 _zerocopy_threshold; ///< Smallest pooled datagram sent zero-copy, or 0 if zero-copy sends are off.
+	byte *_send_buffers; ///< send_buffer_count buffers of max_datagram_size, mapped by set_zerocopy_threshold.
+	uint8 _send_buffer_state[send_buffer_count]; ///< send_buffer_state of each pooled buffer.
+	uint16 _free_send_buffers[send_buffer_count]; ///< Stack of the free buffers.
+	uint32 _free_send_buffer_count;
+	uint16 _zerocopy_buffers[send_buffer_count]; ///< Buffer of each zero-copy send the kernel hasn't completed, by completion id & (send_buffer_count - 1).  Completion ids count the socket's zero-copy sends from 0.
+	uint32 _next_zerocopy_id; ///< Completion id of the next zero-copy send.
+	uint32 _zerocopy_in_kernel; ///< Zero-copy sends not yet completed.
 };
 
 static void udp_socket_unit_test()